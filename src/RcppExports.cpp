@@ -10,6 +10,65 @@ Rcpp::Rostream<true>&  Rcpp::Rcout = Rcpp::Rcpp_cout_get();
 Rcpp::Rostream<false>& Rcpp::Rcerr = Rcpp::Rcpp_cerr_get();
 #endif
 
+// OpenDocumentFromString
+SEXP OpenDocumentFromString(const std::string& file_name, int n_threads, const std::string& sidecar_path);
+RcppExport SEXP _PDFR_OpenDocumentFromString(SEXP file_nameSEXP, SEXP n_threadsSEXP, SEXP sidecar_pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type file_name(file_nameSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< const std::string& >::type sidecar_path(sidecar_pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(OpenDocumentFromString(file_name, n_threads, sidecar_path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// OpenDocumentFromRaw
+SEXP OpenDocumentFromRaw(const std::vector<uint8_t>& raw_file, int n_threads);
+RcppExport SEXP _PDFR_OpenDocumentFromRaw(SEXP raw_fileSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::vector<uint8_t>& >::type raw_file(raw_fileSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(OpenDocumentFromRaw(raw_file, n_threads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// GetPageCount
+int GetPageCount(SEXP document);
+RcppExport SEXP _PDFR_GetPageCount(SEXP documentSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetPageCount(document));
+    return rcpp_result_gen;
+END_RCPP
+}
+// GetStreamCacheStatistics
+Rcpp::NumericVector GetStreamCacheStatistics(SEXP document, double budget);
+RcppExport SEXP _PDFR_GetStreamCacheStatistics(SEXP documentSEXP, SEXP budgetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< double >::type budget(budgetSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetStreamCacheStatistics(document, budget));
+    return rcpp_result_gen;
+END_RCPP
+}
+// GetDocumentInfo
+Rcpp::List GetDocumentInfo(SEXP document);
+RcppExport SEXP _PDFR_GetDocumentInfo(SEXP documentSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetDocumentInfo(document));
+    return rcpp_result_gen;
+END_RCPP
+}
 // GetXrefFromString
 Rcpp::DataFrame GetXrefFromString(const std::string& file_name);
 RcppExport SEXP _PDFR_GetXrefFromString(SEXP file_nameSEXP) {
@@ -56,6 +115,39 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// GetObjectFromHandle
+Rcpp::List GetObjectFromHandle(SEXP document, int object_number);
+RcppExport SEXP _PDFR_GetObjectFromHandle(SEXP documentSEXP, SEXP object_numberSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< int >::type object_number(object_numberSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetObjectFromHandle(document, object_number));
+    return rcpp_result_gen;
+END_RCPP
+}
+// GetDecoderName
+std::string GetDecoderName();
+RcppExport SEXP _PDFR_GetDecoderName() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(GetDecoderName());
+    return rcpp_result_gen;
+END_RCPP
+}
+// CompareDecoders
+Rcpp::DataFrame CompareDecoders(const std::string& file_name);
+RcppExport SEXP _PDFR_CompareDecoders(SEXP file_nameSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const std::string& >::type file_name(file_nameSEXP);
+    rcpp_result_gen = Rcpp::wrap(CompareDecoders(file_name));
+    return rcpp_result_gen;
+END_RCPP
+}
 // GetPdfPageFromString
 Rcpp::List GetPdfPageFromString(const std::string& file_name, int page_number, bool each_glyph);
 RcppExport SEXP _PDFR_GetPdfPageFromString(SEXP file_nameSEXP, SEXP page_numberSEXP, SEXP each_glyphSEXP) {
@@ -82,6 +174,19 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// GetPdfPagesFromHandle
+Rcpp::List GetPdfPagesFromHandle(SEXP document, const std::vector<int>& page_numbers, bool each_glyph);
+RcppExport SEXP _PDFR_GetPdfPagesFromHandle(SEXP documentSEXP, SEXP page_numbersSEXP, SEXP each_glyphSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< const std::vector<int>& >::type page_numbers(page_numbersSEXP);
+    Rcpp::traits::input_parameter< bool >::type each_glyph(each_glyphSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetPdfPagesFromHandle(document, page_numbers, each_glyph));
+    return rcpp_result_gen;
+END_RCPP
+}
 // GetGlyphMap
 Rcpp::DataFrame GetGlyphMap(const std::string& file_name, int page_number);
 RcppExport SEXP _PDFR_GetGlyphMap(SEXP file_nameSEXP, SEXP page_numberSEXP) {
@@ -118,28 +223,53 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// GetPageStringFromHandle
+std::string GetPageStringFromHandle(SEXP document, int page_number);
+RcppExport SEXP _PDFR_GetPageStringFromHandle(SEXP documentSEXP, SEXP page_numberSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< int >::type page_number(page_numberSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetPageStringFromHandle(document, page_number));
+    return rcpp_result_gen;
+END_RCPP
+}
 // GetPdfDocumentFromString
-Rcpp::DataFrame GetPdfDocumentFromString(const std::string& file_name);
-RcppExport SEXP _PDFR_GetPdfDocumentFromString(SEXP file_nameSEXP) {
+Rcpp::DataFrame GetPdfDocumentFromString(const std::string& file_name, int n_threads);
+RcppExport SEXP _PDFR_GetPdfDocumentFromString(SEXP file_nameSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const std::string& >::type file_name(file_nameSEXP);
-    rcpp_result_gen = Rcpp::wrap(GetPdfDocumentFromString(file_name));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetPdfDocumentFromString(file_name, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
 // GetPdfDocumentFromRaw
-Rcpp::DataFrame GetPdfDocumentFromRaw(const std::vector<uint8_t>& file_name);
-RcppExport SEXP _PDFR_GetPdfDocumentFromRaw(SEXP file_nameSEXP) {
+Rcpp::DataFrame GetPdfDocumentFromRaw(const std::vector<uint8_t>& file_name, int n_threads);
+RcppExport SEXP _PDFR_GetPdfDocumentFromRaw(SEXP file_nameSEXP, SEXP n_threadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< const std::vector<uint8_t>& >::type file_name(file_nameSEXP);
-    rcpp_result_gen = Rcpp::wrap(GetPdfDocumentFromRaw(file_name));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetPdfDocumentFromRaw(file_name, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
+// PdfDocStream
+void PdfDocStream(SEXP document, Rcpp::Function callback);
+RcppExport SEXP _PDFR_PdfDocStream(SEXP documentSEXP, SEXP callbackSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< Rcpp::Function >::type callback(callbackSEXP);
+    PdfDocStream(document, callback);
+    return R_NilValue;
+END_RCPP
+}
 // GetPdfBoxesFromString
 Rcpp::DataFrame GetPdfBoxesFromString(const std::string& file_name, int page_number);
 RcppExport SEXP _PDFR_GetPdfBoxesFromString(SEXP file_nameSEXP, SEXP page_numberSEXP) {
@@ -164,6 +294,18 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// GetPdfBoxesFromHandle
+Rcpp::DataFrame GetPdfBoxesFromHandle(SEXP document, int page_number);
+RcppExport SEXP _PDFR_GetPdfBoxesFromHandle(SEXP documentSEXP, SEXP page_numberSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< int >::type page_number(page_numberSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetPdfBoxesFromHandle(document, page_number));
+    return rcpp_result_gen;
+END_RCPP
+}
 // GetPaths
 Rcpp::List GetPaths(const std::string& file_name, int page_number);
 RcppExport SEXP _PDFR_GetPaths(SEXP file_nameSEXP, SEXP page_numberSEXP) {
@@ -176,6 +318,18 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// GetPathsFromHandle
+Rcpp::List GetPathsFromHandle(SEXP document, int page_number);
+RcppExport SEXP _PDFR_GetPathsFromHandle(SEXP documentSEXP, SEXP page_numberSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< int >::type page_number(page_numberSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetPathsFromHandle(document, page_number));
+    return rcpp_result_gen;
+END_RCPP
+}
 // GetGrobs
 Rcpp::List GetGrobs(const std::string& file_name, int page_number);
 RcppExport SEXP _PDFR_GetGrobs(SEXP file_nameSEXP, SEXP page_numberSEXP) {
@@ -188,6 +342,18 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// GetGrobsFromHandle
+Rcpp::List GetGrobsFromHandle(SEXP document, int page_number);
+RcppExport SEXP _PDFR_GetGrobsFromHandle(SEXP documentSEXP, SEXP page_numberSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type document(documentSEXP);
+    Rcpp::traits::input_parameter< int >::type page_number(page_numberSEXP);
+    rcpp_result_gen = Rcpp::wrap(GetGrobsFromHandle(document, page_number));
+    return rcpp_result_gen;
+END_RCPP
+}
 // ReadFontTable
 Rcpp::DataFrame ReadFontTable(Rcpp::RawVector raw);
 RcppExport SEXP _PDFR_ReadFontTable(SEXP rawSEXP) {
@@ -301,21 +467,35 @@ END_RCPP
 RcppExport SEXP run_testthat_tests();
 
 static const R_CallMethodDef CallEntries[] = {
+    {"_PDFR_OpenDocumentFromString", (DL_FUNC) &_PDFR_OpenDocumentFromString, 3},
+    {"_PDFR_OpenDocumentFromRaw", (DL_FUNC) &_PDFR_OpenDocumentFromRaw, 2},
+    {"_PDFR_GetPageCount", (DL_FUNC) &_PDFR_GetPageCount, 1},
+    {"_PDFR_GetStreamCacheStatistics", (DL_FUNC) &_PDFR_GetStreamCacheStatistics, 2},
+    {"_PDFR_GetDocumentInfo", (DL_FUNC) &_PDFR_GetDocumentInfo, 1},
     {"_PDFR_GetXrefFromString", (DL_FUNC) &_PDFR_GetXrefFromString, 1},
     {"_PDFR_GetXrefFromRaw", (DL_FUNC) &_PDFR_GetXrefFromRaw, 1},
     {"_PDFR_GetObjectFromString", (DL_FUNC) &_PDFR_GetObjectFromString, 2},
     {"_PDFR_GetObjectFromRaw", (DL_FUNC) &_PDFR_GetObjectFromRaw, 2},
+    {"_PDFR_GetObjectFromHandle", (DL_FUNC) &_PDFR_GetObjectFromHandle, 2},
+    {"_PDFR_GetDecoderName", (DL_FUNC) &_PDFR_GetDecoderName, 0},
+    {"_PDFR_CompareDecoders", (DL_FUNC) &_PDFR_CompareDecoders, 1},
     {"_PDFR_GetPdfPageFromString", (DL_FUNC) &_PDFR_GetPdfPageFromString, 3},
     {"_PDFR_GetPdfPageFromRaw", (DL_FUNC) &_PDFR_GetPdfPageFromRaw, 3},
+    {"_PDFR_GetPdfPagesFromHandle", (DL_FUNC) &_PDFR_GetPdfPagesFromHandle, 3},
     {"_PDFR_GetGlyphMap", (DL_FUNC) &_PDFR_GetGlyphMap, 2},
     {"_PDFR_GetPageStringFromString", (DL_FUNC) &_PDFR_GetPageStringFromString, 2},
     {"_PDFR_GetPageStringFromRaw", (DL_FUNC) &_PDFR_GetPageStringFromRaw, 2},
-    {"_PDFR_GetPdfDocumentFromString", (DL_FUNC) &_PDFR_GetPdfDocumentFromString, 1},
-    {"_PDFR_GetPdfDocumentFromRaw", (DL_FUNC) &_PDFR_GetPdfDocumentFromRaw, 1},
+    {"_PDFR_GetPageStringFromHandle", (DL_FUNC) &_PDFR_GetPageStringFromHandle, 2},
+    {"_PDFR_GetPdfDocumentFromString", (DL_FUNC) &_PDFR_GetPdfDocumentFromString, 2},
+    {"_PDFR_GetPdfDocumentFromRaw", (DL_FUNC) &_PDFR_GetPdfDocumentFromRaw, 2},
+    {"_PDFR_PdfDocStream", (DL_FUNC) &_PDFR_PdfDocStream, 2},
     {"_PDFR_GetPdfBoxesFromString", (DL_FUNC) &_PDFR_GetPdfBoxesFromString, 2},
     {"_PDFR_GetPdfBoxesFromRaw", (DL_FUNC) &_PDFR_GetPdfBoxesFromRaw, 2},
+    {"_PDFR_GetPdfBoxesFromHandle", (DL_FUNC) &_PDFR_GetPdfBoxesFromHandle, 2},
     {"_PDFR_GetPaths", (DL_FUNC) &_PDFR_GetPaths, 2},
+    {"_PDFR_GetPathsFromHandle", (DL_FUNC) &_PDFR_GetPathsFromHandle, 2},
     {"_PDFR_GetGrobs", (DL_FUNC) &_PDFR_GetGrobs, 2},
+    {"_PDFR_GetGrobsFromHandle", (DL_FUNC) &_PDFR_GetGrobsFromHandle, 2},
     {"_PDFR_ReadFontTable", (DL_FUNC) &_PDFR_ReadFontTable, 1},
     {"_PDFR_GetFontFileHeader", (DL_FUNC) &_PDFR_GetFontFileHeader, 1},
     {"_PDFR_GetFontFileCMap", (DL_FUNC) &_PDFR_GetFontFileCMap, 1},
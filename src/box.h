@@ -97,7 +97,8 @@ private:
   uint8_t flags_; // bits denote delete-void-void-void-NW-NE-SE-SW
   size_t points_to_,
          group_;
-  static std::unordered_map<uint8_t, std::pair<Direction, Direction>> arrows_;
+  static const std::unordered_map<uint8_t, std::pair<Direction, Direction>>
+    arrows_;
 };
 
 //---------------------------------------------------------------------------//
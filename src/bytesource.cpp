@@ -0,0 +1,141 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR ByteSource implementation file                                      //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#include "utilities.h"
+#include<cstring>
+#include<stdexcept>
+
+#ifndef _WIN32
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#endif
+
+//---------------------------------------------------------------------------//
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+// The owned buffer is a std::string, so it is followed by a zero byte
+
+ByteSource::ByteSource(string contents)
+  : owned_(move(contents)),
+    data_(owned_.data()),
+    size_(owned_.size()),
+    is_mapped_(false)
+{}
+
+/*---------------------------------------------------------------------------*/
+
+ByteSource::~ByteSource()
+{
+#ifndef _WIN32
+  if (is_mapped_) munmap((void*) data_, size_);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+// Maps a regular file that isn't empty and doesn't end on a page boundary (see
+// bytesource.h). Other files, or a failed mapping, fall back to reading the
+// whole file with GetFile. The file can be closed once it has been mapped.
+
+shared_ptr<const ByteSource> ByteSource::FromFile(const string& path)
+{
+#ifndef _WIN32
+  int descriptor = open(path.c_str(), O_RDONLY);
+  if (descriptor == -1) throw runtime_error("Couldn't open file.");
+
+  struct stat file_status;
+  if (fstat(descriptor, &file_status) != 0 || !S_ISREG(file_status.st_mode))
+  {
+    close(descriptor);
+    throw runtime_error("Couldn't open file.");
+  }
+
+  void* mapping = MAP_FAILED;
+  size_t size = (size_t) file_status.st_size;
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (size > 0 && page_size > 0 && size % page_size != 0)
+  {
+    mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  }
+  close(descriptor);
+
+  if (mapping != MAP_FAILED)
+  {
+    posix_madvise(mapping, size, POSIX_MADV_RANDOM);
+    shared_ptr<ByteSource> source(new ByteSource());
+    source->data_ = (const char*) mapping;
+    source->size_ = size;
+    source->is_mapped_ = true;
+    return source;
+  }
+#endif
+
+  return make_shared<const ByteSource>(GetFile(path));
+}
+
+/*---------------------------------------------------------------------------*/
+// memchr finds each candidate first byte much faster than a byte-by-byte
+// loop, so this runs close to memory speed when the first byte of the target
+// is uncommon.
+
+size_t ByteSource::find(const char* target, size_t start, size_t limit) const
+{
+  size_t target_length = strlen(target);
+  const char* stop     = data_ + min(limit, size_);
+  const char* position = data_ + min(start, size_);
+
+  while (position + target_length <= stop)
+  {
+    size_t candidates = stop - position - target_length + 1;
+    position = (const char*) memchr(position, target[0], candidates);
+    if (!position) break;
+    if (!memcmp(position, target, target_length)) return position - data_;
+    ++position;
+  }
+  return string::npos;
+}
+
+size_t ByteSource::find(char target, size_t start) const
+{
+  if (start >= size_) return string::npos;
+  const void* found = memchr(data_ + start, target, size_ - start);
+  return found ? (const char*) found - data_ : string::npos;
+}
+
+/*---------------------------------------------------------------------------*/
+// As std::string::substr, but an out-of-range start gives an empty string
+
+string ByteSource::substr(size_t start, size_t length) const
+{
+  if (start >= size_) return string();
+  return string(data_ + start, min(length, size_ - start));
+}
+
+/*---------------------------------------------------------------------------*/
+// The advice has to start on a page boundary, so the range is widened to
+// start at the beginning of its first page. Ranges outside the mapping (such
+// as decrypted copies of a stream) are ignored.
+
+void ByteSource::WillNeed(const CharString& range) const
+{
+#ifndef _WIN32
+  if (!is_mapped_ || range.empty()) return;
+  if (range.begin() < data_ || range.end() > data_ + size_) return;
+
+  size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  size_t start = (range.begin() - data_) / page_size * page_size;
+  size_t end   = range.end() - data_;
+  posix_madvise((void*) (data_ + start), end - start, POSIX_MADV_WILLNEED);
+#endif
+}
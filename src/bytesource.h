@@ -0,0 +1,92 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR ByteSource header file                                              //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#ifndef PDFR_BYTESOURCE
+
+//---------------------------------------------------------------------------//
+
+#define PDFR_BYTESOURCE
+
+/* A ByteSource holds the bytes of a whole pdf file for the classes that parse
+ * it. Every other class reads the file through one of these, usually by way
+ * of the XRef, using byte offsets from the start of the file.
+ *
+ * Where possible, a file opened from a path is memory-mapped (read-only) rather
+ * than read in. Opening a file then costs nothing up front, and the operating
+ * system only reads the pages that are actually looked at, so a large archive
+ * from which only a page or two is wanted is mostly never read from disk at
+ * all. The mapping is marked for random access, since the XRef sends us
+ * jumping about the file, and the pages holding a stream are asked for in
+ * advance just before it is decoded.
+ *
+ * Data that is already in memory, such as an R raw vector, is instead held in
+ * a buffer owned by the ByteSource, as are files on platforms without mmap.
+ *
+ * Much of the parsing code expects to find a zero byte just past the end of
+ * the data, as it would at the end of a std::string. The last page of a
+ * mapping is padded with zeros, so this holds for a mapped file unless its
+ * size is an exact multiple of the page size. Such files are read into an
+ * owned buffer instead.
+ *
+ * Offsets are all size_t, so files larger than 2GB can be read.
+ */
+
+#include "charstring.h"
+#include<string>
+#include<memory>
+
+//---------------------------------------------------------------------------//
+
+class ByteSource
+{
+ public:
+  // Maps the file into memory, or reads it in if it can't be mapped
+  static std::shared_ptr<const ByteSource> FromFile(const std::string& path);
+
+  // Takes ownership of bytes that are already in memory
+  explicit ByteSource(std::string contents);
+
+  ~ByteSource();
+  ByteSource(const ByteSource&) = delete;
+  ByteSource& operator=(const ByteSource&) = delete;
+
+  // Returns the offset of the first match of target at or after start and
+  // before limit, or npos if there is none
+  size_t find(const char* target, size_t start = 0,
+              size_t limit = std::string::npos) const;
+  size_t find(char target, size_t start = 0) const;
+
+  // Copies out up to length bytes from start
+  std::string substr(size_t start, size_t length) const;
+
+  // Tells the operating system that the bytes in range will be read soon
+  void WillNeed(const CharString& range) const;
+
+  // Inlined accessors
+  const char* data()         const {return data_;}
+  size_t size()              const {return size_;}
+  bool empty()               const {return size_ == 0;}
+  bool IsMapped()            const {return is_mapped_;}
+  char operator[](size_t i)  const {return data_[i];}
+  CharString AsCharString()  const {return CharString(data_, size_);}
+
+ private:
+  ByteSource() : data_(nullptr), size_(0), is_mapped_(false) {}
+
+  std::string owned_;   // The bytes, unless the file is mapped
+  const char* data_;    // Start of the file's bytes
+  size_t size_;         // Size of the file
+  bool is_mapped_;      // Set if data_ points at a mapping to be unmapped
+};
+
+//---------------------------------------------------------------------------//
+
+#endif
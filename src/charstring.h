@@ -33,9 +33,9 @@
 // problematic unless care is taken to ensure its lifetime falls strictly
 // within the lifetime of the pointed-to string.
 //
-// It is used in PDFR because the entire pdf file is read into the free store as
-// an std::string and sits there for the duration of the parsing process. It
-// is therefore a safe and efficient tool for this job.
+// It is used in PDFR because the entire pdf file is held in memory (mapped or
+// read in) by a ByteSource and sits there for the duration of the parsing
+// process. It is therefore a safe and efficient tool for this job.
 //
 // This class is a wheel that has been reinvented many times, not least by the
 // C++17 addition of string_view. My guess is that string_view is much more
@@ -14,6 +14,7 @@
 #include "crypto.h"
 #include<iostream>
 #include<iomanip>
+#include<cstring>
 using namespace std;
 
 /*---------------------------------------------------------------------------*/
@@ -24,7 +25,11 @@ using namespace std;
 Crypto::Crypto(const Dictionary& encrypt_dict, const Dictionary& trailer_dict)
   : encryption_dictionary_(encrypt_dict),
     trailer_(trailer_dict),
-    revision_(2)
+    version_(0),
+    revision_(2),
+    encrypt_metadata_(true),
+    stream_method_(RC4),
+    string_method_(RC4)
 {
   // Unless specified, the revision number used for encryption is 2
   if (encryption_dictionary_.ContainsInts("/R"))
@@ -32,6 +37,26 @@ Crypto::Crypto(const Dictionary& encrypt_dict, const Dictionary& trailer_dict)
     revision_ = encryption_dictionary_.GetInts("/R")[0];
   }
 
+  if (encryption_dictionary_.ContainsInts("/V"))
+  {
+    version_ = encryption_dictionary_.GetInts("/V")[0];
+  }
+
+  if (encryption_dictionary_["/EncryptMetadata"].find("false") != string::npos)
+  {
+    encrypt_metadata_ = false;
+  }
+
+  ReadCryptFilters_();
+
+  // Revisions 5 and 6 use a different scheme altogether
+  if (revision_ >= 5)
+  {
+    ReadFileKeyR6_();
+    file_aes_ = make_shared<AES>(filekey_.data(), filekey_.size());
+    return;
+  }
+
   ReadFileKey_();
 
   // if revision 2, check it and we're done. Otherwise use revision 3
@@ -57,7 +82,7 @@ const vector<uint8_t> Crypto::default_user_password_ =
 // with each seperate number 64 times. These numbers come from the function
 // md5_table[i] = abs(sin(i + 1)) * 2^32, but it is quicker to pre-compute them
 
-const vector<FourBytes> Crypto::md5_table =
+const FourBytes Crypto::md5_table[64] =
 {
   0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE,
   0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
@@ -80,7 +105,7 @@ const vector<FourBytes> Crypto::md5_table =
 //---------------------------------------------------------------------------//
 // More pseudorandom numbers for the Md5 hash
 
-const std::vector<std::vector<FourBytes>> Crypto::mixarray =
+const int Crypto::mixarray[4][4] =
 {
   {7, 12, 17, 22},
   {5,  9, 14, 20},
@@ -88,6 +113,78 @@ const std::vector<std::vector<FourBytes>> Crypto::mixarray =
   {6, 10, 15, 21},
 };
 
+//---------------------------------------------------------------------------//
+// The SHA-256 constants are the first 32 bits of the fractional parts of the
+// cube roots of the first 64 primes
+
+const vector<FourBytes> Crypto::sha256_table =
+{
+  0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+  0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+  0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+  0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+  0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+  0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+  0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+  0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+  0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+  0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+  0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+  0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+  0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+  0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+  0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+  0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+//---------------------------------------------------------------------------//
+// The SHA-512 constants are the first 64 bits of the fractional parts of the
+// cube roots of the first 80 primes
+
+const vector<uint64_t> Crypto::sha512_table =
+{
+  0x428A2F98D728AE22, 0x7137449123EF65CD,
+  0xB5C0FBCFEC4D3B2F, 0xE9B5DBA58189DBBC,
+  0x3956C25BF348B538, 0x59F111F1B605D019,
+  0x923F82A4AF194F9B, 0xAB1C5ED5DA6D8118,
+  0xD807AA98A3030242, 0x12835B0145706FBE,
+  0x243185BE4EE4B28C, 0x550C7DC3D5FFB4E2,
+  0x72BE5D74F27B896F, 0x80DEB1FE3B1696B1,
+  0x9BDC06A725C71235, 0xC19BF174CF692694,
+  0xE49B69C19EF14AD2, 0xEFBE4786384F25E3,
+  0x0FC19DC68B8CD5B5, 0x240CA1CC77AC9C65,
+  0x2DE92C6F592B0275, 0x4A7484AA6EA6E483,
+  0x5CB0A9DCBD41FBD4, 0x76F988DA831153B5,
+  0x983E5152EE66DFAB, 0xA831C66D2DB43210,
+  0xB00327C898FB213F, 0xBF597FC7BEEF0EE4,
+  0xC6E00BF33DA88FC2, 0xD5A79147930AA725,
+  0x06CA6351E003826F, 0x142929670A0E6E70,
+  0x27B70A8546D22FFC, 0x2E1B21385C26C926,
+  0x4D2C6DFC5AC42AED, 0x53380D139D95B3DF,
+  0x650A73548BAF63DE, 0x766A0ABB3C77B2A8,
+  0x81C2C92E47EDAEE6, 0x92722C851482353B,
+  0xA2BFE8A14CF10364, 0xA81A664BBC423001,
+  0xC24B8B70D0F89791, 0xC76C51A30654BE30,
+  0xD192E819D6EF5218, 0xD69906245565A910,
+  0xF40E35855771202A, 0x106AA07032BBD1B8,
+  0x19A4C116B8D2D0C8, 0x1E376C085141AB53,
+  0x2748774CDF8EEB99, 0x34B0BCB5E19B48A8,
+  0x391C0CB3C5C95A63, 0x4ED8AA4AE3418ACB,
+  0x5B9CCA4F7763E373, 0x682E6FF3D6B2B8A3,
+  0x748F82EE5DEFB2FC, 0x78A5636F43172F60,
+  0x84C87814A1F0AB72, 0x8CC702081A6439EC,
+  0x90BEFFFA23631E28, 0xA4506CEBDE82BDE9,
+  0xBEF9A3F7B2C67915, 0xC67178F2E372532B,
+  0xCA273ECEEA26619C, 0xD186B8C721C0C207,
+  0xEADA7DD6CDE0EB1E, 0xF57D4F7FEE6ED178,
+  0x06F067AA72176FBA, 0x0A637DC5A2C898A6,
+  0x113F9804BEF90DAE, 0x1B710B35131C471B,
+  0x28DB77F523047D84, 0x32CAAB7B40C72493,
+  0x3C9EBE0A15C9BEBC, 0x431D67C49C100D4C,
+  0x4CC5D4BECB3E42B6, 0x597F299CFC657E2A,
+  0x5FCB6FAB3AD6FAEC, 0x6C44198C4A475817
+};
+
 //---------------------------------------------------------------------------//
 // This simple function "chops" a four-byte int to a vector of four bytes.
 // The bytes are returned lowest-order first as this is the typical use.
@@ -142,138 +239,280 @@ vector<uint8_t> Crypto::ReadPermissions_(const std::string& permission_string)
 // arbitrary, but is completely deterministic so that a given set of bytes
 // always produced the same output.
 //
-// This function is called several times with different parameters as part
-// of the main Md5 algorithm. It can be considered a "shuffler" of bytes
+// The message is split into 64-byte blocks, each of which is read as sixteen
+// four-byte numbers (low-order byte first) and mixed into the four numbers
+// making up the running hash over 64 rounds.
 
-void Crypto::Md5Mix_(int cycle,
-                     deque<FourBytes>& mix_deque,
-                     vector<FourBytes>& fingerprint) const
+void Crypto::Md5Block_(FourBytes* hash, const uint8_t* block) const
 {
-  // Declare and define some pseudorandom numbers
-  FourBytes mixer, e, f = md5_table[cycle], g = mixarray[cycle / 16][cycle % 4];
+  FourBytes fingerprint[16];
+  for (int i = 0; i < 16; ++i)
+  {
+    fingerprint[i] = ((FourBytes) block[4 * i + 3] << 24) |
+                     (block[4 * i + 2] << 16) |
+                     (block[4 * i + 1] <<  8) |
+                     (block[4 * i + 0] <<  0) ;
+  }
+
+  FourBytes a = hash[0], b = hash[1], c = hash[2], d = hash[3];
 
-  // Mangle bytes in various ways as per Md5 algorithm
-  switch (cycle / 16 + 1)
+  for (int cycle = 0; cycle < 64; ++cycle)
   {
-    case 1  : e     = fingerprint[(1 * cycle + 0) % 16];
-              mixer = (mix_deque[0] + ((mix_deque[1] & mix_deque[2]) |
-                      (~mix_deque[1] & mix_deque[3])) + e + f);         break;
+    // Mangle bytes in various ways as per Md5 algorithm
+    FourBytes mixer;
+    int index;
+    switch (cycle / 16)
+    {
+      case 0  : mixer = (b & c) | (~b & d); index = cycle;                break;
+      case 1  : mixer = (b & d) | (c & ~d); index = (5 * cycle + 1) % 16; break;
+      case 2  : mixer = b ^ c ^ d;          index = (3 * cycle + 5) % 16; break;
+      default : mixer = c ^ (b | ~d);       index = (7 * cycle) % 16;     break;
+    }
 
-    case 2  : e     = fingerprint[(5 * cycle + 1) % 16];
-              mixer = (mix_deque[0] + ((mix_deque[1] & mix_deque[3]) |
-                      (mix_deque[2] & ~mix_deque[3])) + e + f);         break;
+    mixer += a + md5_table[cycle] + fingerprint[index];
+    int shift = mixarray[cycle / 16][cycle % 4];
 
-    case 3  : e     = fingerprint[(3 * cycle + 5) % 16];
-              mixer = (mix_deque[0] + (mix_deque[1] ^ mix_deque[2] ^
-                       mix_deque[3]) + e + f);                          break;
+    // Rotate the four numbers along by one
+    a = d;
+    d = c;
+    c = b;
+    b += (mixer << shift) | (mixer >> (32 - shift));
+  }
 
-    case 4  : e     = fingerprint[(7 * cycle + 0) % 16];
-              mixer = (mix_deque[0] + (mix_deque[2] ^
-                      (mix_deque[1] | ~mix_deque[3])) + e + f);         break;
+  hash[0] += a;
+  hash[1] += b;
+  hash[2] += c;
+  hash[3] += d;
+}
 
-    default: throw runtime_error("Md5 error: n > 63");
+/*---------------------------------------------------------------------------*/
+// The main Md5 algorithm. Whole blocks are read straight from the message.
+// The last part of the message is copied to a fixed buffer and padded with a
+// single 1 bit, then zeros, then the message length in bits, which takes one
+// or two more blocks.
+
+void Crypto::Md5_(const uint8_t* message, size_t length, uint8_t* digest) const
+{
+  // Starting pseudorandom numbers
+  FourBytes hash[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+
+  size_t whole_blocks = length - length % 64;
+  for (size_t i = 0; i < whole_blocks; i += 64) Md5Block_(hash, message + i);
+
+  uint8_t last_blocks[128] = {0};
+  size_t remainder = length - whole_blocks;
+  if (remainder) memcpy(last_blocks, message + whole_blocks, remainder);
+  last_blocks[remainder] = 0x80;
+
+  size_t padded_length = remainder < 56 ? 64 : 128;
+  uint64_t message_bits = (uint64_t) length << 3;
+  for (int i = 0; i < 8; ++i)
+  {
+    last_blocks[padded_length - 8 + i] = message_bits >> (8 * i);
   }
 
-  // further bit shuffling:
-  mix_deque[0] = mix_deque[1] + ((mixer << g) | (mixer >> (32 - g)));
+  Md5Block_(hash, last_blocks);
+  if (padded_length == 128) Md5Block_(hash, last_blocks + 64);
 
-  // now push all elements to the left (with aliasing)
-  mix_deque.push_front(mix_deque.back());
-  mix_deque.pop_back();
+  // Split the resultant 4 x FourBytes into 16 bytes, low order first
+  for (int i = 0; i < 16; ++i) digest[i] = hash[i / 4] >> (8 * (i % 4));
 }
 
 /*---------------------------------------------------------------------------*/
-// The main Md5 algorithm. This version of it was modified from various
-// open source online implementations.
+// The md5 hash of a vector of bytes
 
 vector<uint8_t> Crypto::Md5_(const vector<uint8_t>& message) const
 {
-  int message_length = message.size();
+  vector<uint8_t> output(16);
+  Md5_(message.data(), message.size(), output.data());
+  return output;
+}
 
-  // 16 * FourBytes will contain "fingerprint"
-  std::vector<FourBytes> fingerprint(16, 0);
+//----------------------------------------------------------------------------//
+// This allows the Md5 function to be run on a std::string without prior
+// conversion. It simply converts a string to bytes than puts it
+// into the "bytes" version of the function
 
-  // The number of 64-byte blocks to be processed plus extra 8-byte filler
-  int number_of_blocks = (message_length + 72) / 64;
-                                 //
-  // Starting pseudorandom numbers
-  deque<FourBytes> mixvars = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
-
-  // This next block fills the 16-element long "fingerprint" of the message
-  // with up to 64 bytes from each block of the message, mangles them and
-  // turns them into the pseudorandom seed for the next block
-  int block, fourbyte_it, message_it = 0;
-  for (block = 0; block < number_of_blocks; ++block)
-  {
-    // For each 4 bytes of block create a fourbyte from 4 bytes, low-order first
-    for (fourbyte_it = 0;
-         fourbyte_it < 16 && message_it < message_length - 3;
-         fourbyte_it++, message_it += 4)
-    {
-      fingerprint[fourbyte_it] = (message[message_it + 3] << 24) |
-                                 (message[message_it + 2] << 16) |
-                                 (message[message_it + 1] <<  8) |
-                                 (message[message_it + 0] <<  0) ;
-    }
+vector<uint8_t> Crypto::Md5_(const std::string& input) const
+{
+  vector<uint8_t> output(16);
+  Md5_((const uint8_t*) input.data(), input.size(), output.data());
+  return output;
+}
 
-    // If this is the last block...
-    if (block == number_of_blocks - 1)
-    {
-      // create a fourbyte from the remaining bytes (low order first), with a
-      // left-sided padding of (binary) 10000000...
-      if (message_it == message_length - 3)
-      {
-        fingerprint[fourbyte_it++] = 0x80000000                        |
-                                     (message[message_it + 2] << 16) |
-                                     (message[message_it + 1] <<  8) |
-                                     (message[message_it + 0] <<  0) ;
-      }
-      else if (message_it == message_length - 2)
-      {
-        fingerprint[fourbyte_it++] = 0x800000                          |
-                                     (message[message_it + 1] << 8)  |
-                                     (message[message_it + 0] << 0)  ;
-      }
+/*---------------------------------------------------------------------------*/
+// Rotates a four-byte number right by a given number of bits
 
-      else if (message_it == message_length - 1)
-      {
-        fingerprint[fourbyte_it++] = 0x8000 + message[message_it];
-      }
-      else fingerprint[fourbyte_it++] = 0x80;
+static inline FourBytes RotateRight(FourBytes value, int bits)
+{
+  return bits ? (value >> bits) | (value << (32 - bits)) : value;
+}
 
-      // Right pad fingerprint with zeros to total 16 bytes
-      while (fourbyte_it < 16) fingerprint[fourbyte_it++] = 0;
+static inline uint64_t RotateRight64(uint64_t value, int bits)
+{
+  return (value >> bits) | (value << (64 - bits));
+}
 
-      // Store a mangled copy of length in the fingerprint
-      fingerprint[14] = message_length << 3;
-    }
+/*---------------------------------------------------------------------------*/
+// Reads four bytes as a big-endian number, and writes one back
+
+static inline FourBytes ReadWord(const uint8_t* bytes)
+{
+  return ((FourBytes) bytes[0] << 24) | (bytes[1] << 16) |
+         (bytes[2] << 8) | bytes[3];
+}
 
-    // Store a copy of initial random numbers
-    deque<FourBytes> initial_deque = mixvars;
+static inline void WriteWord(FourBytes word, uint8_t* bytes)
+{
+  bytes[0] = word >> 24;
+  bytes[1] = word >> 16;
+  bytes[2] = word >> 8;
+  bytes[3] = word;
+}
 
-    // Shuffle fingerprint 64 times
-    for (int i = 0; i < 64; i++) Md5Mix_(i, mixvars, fingerprint);
+/*---------------------------------------------------------------------------*/
+// The SHA-2 hashes are needed to make the keys for AES-256 encryption. Like
+// Md5, the message is padded with a single 1 bit, then zeros, then its length
+// in bits, to make a whole number of blocks. Each block is expanded into a
+// "message schedule" which is mixed into the running hash over a number of
+// rounds. SHA-256 works on 64-byte blocks of 32-bit words.
 
-    // Add initial random numbers
-    for (int i = 0; i < 4;  i++) mixvars[i] += initial_deque[i];
-  }
+vector<uint8_t> Crypto::Sha256_(const vector<uint8_t>& message) const
+{
+  FourBytes hash[8] =
+  {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+  };
+
+  vector<uint8_t> padded(message);
+  padded.push_back(0x80);
+  while (padded.size() % 64 != 56) padded.push_back(0);
+  uint64_t message_bits = (uint64_t) message.size() * 8;
+  for (int i = 7; i >= 0; --i) padded.push_back(message_bits >> (8 * i));
+
+  FourBytes schedule[64];
+  for (size_t block = 0; block < padded.size(); block += 64)
+  {
+    for (int i = 0; i < 16; ++i) schedule[i] = ReadWord(&padded[block + 4 * i]);
 
-  vector<uint8_t> output; // create empty output vector for output
+    for (int i = 16; i < 64; ++i)
+    {
+      FourBytes a = schedule[i - 15], b = schedule[i - 2];
+      schedule[i] = schedule[i - 16] + schedule[i - 7] +
+                    (RotateRight(a, 7) ^ RotateRight(a, 18) ^ (a >> 3)) +
+                    (RotateRight(b, 17) ^ RotateRight(b, 19) ^ (b >> 10));
+    }
 
-  // Split the resultant 4 x FourBytes into a single 16-byte vector
-  for (auto fourbyte : mixvars) Concatenate(output, ChopLong_(fourbyte));
+    FourBytes v[8];
+    for (int i = 0; i < 8; ++i) v[i] = hash[i];
 
+    for (int i = 0; i < 64; ++i)
+    {
+      FourBytes mix1 = v[7] + sha256_table[i] + schedule[i] +
+                       (RotateRight(v[4], 6) ^ RotateRight(v[4], 11) ^
+                        RotateRight(v[4], 25)) +
+                       ((v[4] & v[5]) ^ (~v[4] & v[6]));
+      FourBytes mix2 = (RotateRight(v[0], 2) ^ RotateRight(v[0], 13) ^
+                        RotateRight(v[0], 22)) +
+                       ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+      for (int j = 7; j > 0; --j) v[j] = v[j - 1];
+      v[4] += mix1;
+      v[0] = mix1 + mix2;
+    }
+
+    for (int i = 0; i < 8; ++i) hash[i] += v[i];
+  }
+
+  vector<uint8_t> output(32);
+  for (int i = 0; i < 8; ++i) WriteWord(hash[i], &output[4 * i]);
   return output;
 }
 
-//----------------------------------------------------------------------------//
-// This allows the Md5 function to be run on a std::string without prior
-// conversion. It simply converts a string to bytes than puts it
-// into the "bytes" version of the function
+/*---------------------------------------------------------------------------*/
+// SHA-512 is the same as SHA-256 but with 128-byte blocks of 64-bit words and
+// more rounds. SHA-384 is SHA-512 with different starting values, cut to 48
+// bytes.
 
-vector<uint8_t> Crypto::Md5_(const std::string& input) const
+vector<uint8_t> Crypto::Sha512_(const vector<uint8_t>& message,
+                                bool is_sha384) const
 {
-  return Md5_(vector<uint8_t>(input.begin(), input.end()));
+  static const uint64_t sha512_start[8] =
+  {
+    0x6A09E667F3BCC908, 0xBB67AE8584CAA73B,
+    0x3C6EF372FE94F82B, 0xA54FF53A5F1D36F1,
+    0x510E527FADE682D1, 0x9B05688C2B3E6C1F,
+    0x1F83D9ABFB41BD6B, 0x5BE0CD19137E2179
+  };
+
+  static const uint64_t sha384_start[8] =
+  {
+    0xCBBB9D5DC1059ED8, 0x629A292A367CD507,
+    0x9159015A3070DD17, 0x152FECD8F70E5939,
+    0x67332667FFC00B31, 0x8EB44A8768581511,
+    0xDB0C2E0D64F98FA7, 0x47B5481DBEFA4FA4
+  };
+
+  uint64_t hash[8];
+  for (int i = 0; i < 8; ++i)
+  {
+    hash[i] = is_sha384 ? sha384_start[i] : sha512_start[i];
+  }
+
+  vector<uint8_t> padded(message);
+  padded.push_back(0x80);
+  while (padded.size() % 128 != 112) padded.push_back(0);
+  uint64_t message_bits = (uint64_t) message.size() * 8;
+  for (int i = 0; i < 8; ++i) padded.push_back(0);
+  for (int i = 7; i >= 0; --i) padded.push_back(message_bits >> (8 * i));
+
+  uint64_t schedule[80];
+  for (size_t block = 0; block < padded.size(); block += 128)
+  {
+    for (int i = 0; i < 16; ++i)
+    {
+      schedule[i] = 0;
+      for (int j = 0; j < 8; ++j)
+      {
+        schedule[i] = (schedule[i] << 8) | padded[block + 8 * i + j];
+      }
+    }
+
+    for (int i = 16; i < 80; ++i)
+    {
+      uint64_t a = schedule[i - 15], b = schedule[i - 2];
+      schedule[i] = schedule[i - 16] + schedule[i - 7] +
+                    (RotateRight64(a, 1) ^ RotateRight64(a, 8) ^ (a >> 7)) +
+                    (RotateRight64(b, 19) ^ RotateRight64(b, 61) ^ (b >> 6));
+    }
+
+    uint64_t v[8];
+    for (int i = 0; i < 8; ++i) v[i] = hash[i];
+
+    for (int i = 0; i < 80; ++i)
+    {
+      uint64_t mix1 = v[7] + sha512_table[i] + schedule[i] +
+                      (RotateRight64(v[4], 14) ^ RotateRight64(v[4], 18) ^
+                       RotateRight64(v[4], 41)) +
+                      ((v[4] & v[5]) ^ (~v[4] & v[6]));
+      uint64_t mix2 = (RotateRight64(v[0], 28) ^ RotateRight64(v[0], 34) ^
+                       RotateRight64(v[0], 39)) +
+                      ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+      for (int j = 7; j > 0; --j) v[j] = v[j - 1];
+      v[4] += mix1;
+      v[0] = mix1 + mix2;
+    }
+
+    for (int i = 0; i < 8; ++i) hash[i] += v[i];
+  }
+
+  vector<uint8_t> output;
+  for (auto word : hash)
+  {
+    for (int i = 56; i >= 0; i -= 8) output.push_back(word >> i);
+  }
+  if (is_sha384) output.resize(48);
+  return output;
 }
 
 //-------------------------------------------------------------------------//
@@ -286,32 +525,43 @@ vector<uint8_t> Crypto::Md5_(const std::string& input) const
 
 void Crypto::Rc4_(vector<uint8_t>& message, const vector<uint8_t>& key) const
 {
-  int key_length = key.size(), message_length = message.size();
-  uint8_t a = 0, b = 0, x = 0, y = 0;
+  Rc4_(message.data(), message.size(), message.data(), key.data(), key.size());
+}
 
-  // Create state and fill with 0 - 0xff
-  vector<uint8_t> state;
-  for (int i = 0; i <= 0xff; ++i) state.push_back(i);
+/*---------------------------------------------------------------------------*/
+// This version of Rc4 reads from one buffer and writes to another, which may
+// be the same one. The state is a fixed array on the stack.
 
+void Crypto::Rc4_(const uint8_t* input, size_t length, uint8_t* output,
+                  const uint8_t* key, size_t key_length) const
+{
   // No key - can't modify message
-  if (key_length == 0) return;
+  if (key_length == 0)
+  {
+    if (output != input) memcpy(output, input, length);
+    return;
+  }
+
+  // Create state and fill with 0 - 0xff
+  uint8_t state[256];
+  for (int i = 0; i < 256; ++i) state[i] = i;
 
   // for each element in state, mix the state around according to the key
-  for (auto& element : state)
+  uint8_t b = 0;
+  for (int i = 0; i < 256; ++i)
   {
-    b = (key[a] + element + b) % 256;
-    swap(element, state[b]);
-    a = (a + 1) % key_length;
+    b += key[i % key_length] + state[i];
+    swap(state[i], state[b]);
   }
 
   // For each character in the message, mix as per Rc4 algorithm
-  for (int k = 0; k < message_length; k++)
+  uint8_t x = 0, y = 0;
+  for (size_t k = 0; k < length; ++k)
   {
-    uint8_t x1, y1;
-    x1 = x = (x + 1) % 256;
-    y1 = y = (state[x] + y) % 256;
-    iter_swap(state.begin() + x1, state.begin() + y1);
-    message[k] = message[k] ^ state[(state[x1] + state[y1]) % 256];
+    x += 1;
+    y += state[x];
+    swap(state[x], state[y]);
+    output[k] = input[k] ^ state[(uint8_t) (state[x] + state[y])];
   }
 }
 
@@ -325,53 +575,138 @@ void Crypto::Rc4_(vector<uint8_t>& message, const vector<uint8_t>& key) const
 // low order bytes to the end of the file key before running the result
 // through an Md5 hash. The first n bytes of the result, where n is the file
 // key length plus 5, is then used as the key with which to decrypt the
-// stream using the Rc4 algorithm.
+// stream using the Rc4 algorithm. AES-128 works the same way, except that
+// the bytes of "sAlT" are added before hashing. AES-256 just uses the file
+// key for everything.
+//
+// Since strings and streams in the same object share a key, and an object may
+// be read more than once, the keys are cached. They are never longer than 16
+// bytes, so each is stored in a fixed array.
 
-string Crypto::DecryptStream(const string& stream,
-                           int object_number,
-                           int object_gen) const
+size_t Crypto::ObjectKeyLength_() const
 {
-  // stream as bytes
-  vector<uint8_t> stream_as_bytes(stream.begin(), stream.end());
+  return min(filekey_.size() + 5, (size_t) 16);
+}
+
+const array<uint8_t, 16>& Crypto::ObjectKey_(CryptMethod method,
+                                             int object_number,
+                                             int object_gen) const
+{
+  uint64_t cache_key = ((uint64_t) (object_number & 0xffffff) << 24) |
+                       ((object_gen & 0xffff) << 8) | method;
+  {
+    lock_guard<mutex> lock(object_keys_mutex_);
+    auto found = object_keys_.find(cache_key);
+    if (found != object_keys_.end()) return found->second;
+  }
 
   // Start building the object key with the file key
-  vector<uint8_t> object_key = filekey_;
+  uint8_t key_material[64];
+  size_t key_length = min(filekey_.size(), (size_t) 32);
+  memcpy(key_material, filekey_.data(), key_length);
 
-  // Append the bytes of the object number
-  Concatenate(object_key, ChopLong_(object_number));
+  // Append the three lowest order bytes of the object number
+  for (int i = 0; i < 3; ++i)
+  {
+    key_material[key_length++] = object_number >> (8 * i);
+  }
 
-  // We only want the three lowest order bytes; pop the last
-  object_key.pop_back();
+  // Then append the two lowest order bytes of the gen number
+  key_material[key_length++] = object_gen & 0xff;
+  key_material[key_length++] = (object_gen >> 8) & 0xff;
 
-  // Append lowest order byte of gen number
-  object_key.push_back( object_gen & 0xff);
+  // AES keys are "salted"
+  if (method == AESV2)
+  {
+    const uint8_t salt[4] = {0x73, 0x41, 0x6C, 0x54};
+    memcpy(key_material + key_length, salt, 4);
+    key_length += 4;
+  }
 
-  // Then append the second lowest byte of gen number
-  object_key.push_back((object_gen >> 8) & 0xff);
+  // Now Md5 hash the object key. Only the first ObjectKeyLength_() bytes of
+  // the hash are used. References to map elements stay valid as it grows.
+  array<uint8_t, 16> object_key;
+  Md5_(key_material, key_length, object_key.data());
+  lock_guard<mutex> lock(object_keys_mutex_);
+  return object_keys_.emplace(cache_key, object_key).first->second;
+}
 
-  // Store the object key's size
-  uint8_t object_key_size = object_key.size();
-  if(object_key_size > 16) object_key_size = 16;
+/*---------------------------------------------------------------------------*/
+// Decrypts length bytes of input into output and returns the decrypted length
+
+size_t Crypto::Decrypt_(const uint8_t* input, size_t length, uint8_t* output,
+                        CryptMethod method, int object_number,
+                        int object_gen) const
+{
+  if (length == 0) return 0;
+
+  if (method == IDENTITY)
+  {
+    if (output != input) memcpy(output, input, length);
+    return length;
+  }
+
+  if (method == AESV3) return file_aes_->DecryptCBC(input, length, output);
+
+  const array<uint8_t, 16>& key = ObjectKey_(method, object_number, object_gen);
+
+  // Now we use this key to decrypt the stream
+  if (method == RC4)
+  {
+    Rc4_(input, length, output, key.data(), ObjectKeyLength_());
+    return length;
+  }
 
-  // Now Md5 hash the object key
-  object_key = Md5_(object_key);
+  AES aes(key.data(), ObjectKeyLength_());
+  return aes.DecryptCBC(input, length, output);
+}
 
-   // Trim the result to match the object key's size
-  object_key.resize(object_key_size);
+/*---------------------------------------------------------------------------*/
+// Streams and strings may use different crypt filters
 
-  // Now we use this key to decrypt the stream using Rc4
-  Rc4_(stream_as_bytes, object_key);
+size_t Crypto::Decrypt(const CharString& stream, uint8_t* output,
+                       int object_number, int gen) const
+{
+  return Decrypt_((const uint8_t*) stream.begin(), stream.size(), output,
+                  stream_method_, object_number, gen);
+}
 
-  // finally we convert the resultant bytes back to a string
-  return string(stream_as_bytes.begin(), stream_as_bytes.end());
+void Crypto::Decrypt(string& stream, int object_number, int gen) const
+{
+  if (stream.empty()) return;
+  uint8_t* bytes = (uint8_t*) &stream[0];
+  stream.resize(Decrypt_(bytes, stream.size(), bytes,
+                         stream_method_, object_number, gen));
 }
 
+void Crypto::DecryptString(string& text, int object_number, int gen) const
+{
+  if (text.empty()) return;
+  uint8_t* bytes = (uint8_t*) &text[0];
+  text.resize(Decrypt_(bytes, text.size(), bytes,
+                       string_method_, object_number, gen));
+}
 
 /*---------------------------------------------------------------------------*/
+// These versions decrypt into a new string and return it
+
+string Crypto::DecryptStream(const string& stream,
+                             int object_number,
+                             int object_gen) const
+{
+  return DecryptStream(CharString(stream), object_number, object_gen);
+}
+
 string Crypto::DecryptStream(const CharString& input, int obj, int gen) const
 {
-  return DecryptStream(input.AsString(), obj, gen);
+  string result(input.size(), '\0');
+  if (!result.empty())
+  {
+    result.resize(Decrypt(input, (uint8_t*) &result[0], obj, gen));
+  }
+  return result;
 }
+
 /*---------------------------------------------------------------------------*/
 // Gets the bytes comprising the hashed owner password from the encryption
 // dictionary
@@ -411,11 +746,17 @@ void Crypto::ReadFileKey_()
 
   Concatenate(filekey_, id_bytes);
 
+  // From revision 4, unencrypted metadata is marked by four more bytes
+  if (revision_ >= 4 && !encrypt_metadata_)
+  {
+    Concatenate(filekey_, vector<uint8_t>(4, 0xff));
+  }
+
   // now Md5 hash the result
   filekey_ = Md5_(filekey_);
 
-  // Set the default filekey size
-  size_t filekey_length = 5;
+  // Set the default filekey size, which is 128 bits from version 4
+  size_t filekey_length = version_ >= 4 ? 16 : 5;
 
   // if the filekey length is not 5, it will be specified as a number of bits
   // so divide by 8 to get the number of bytes.
@@ -505,6 +846,122 @@ void Crypto::CheckKeyR3_()
   }
 }
 
+/*---------------------------------------------------------------------------*/
+// From version 4, the /StmF and /StrF entries name the crypt filters used for
+// streams and strings. These are defined in the /CF dictionary, whose /CFM
+// entry gives the method. The name /Identity means no encryption. Before
+// version 4, everything is encrypted with RC4. AESV3 uses the 256-bit file key
+// of revisions 5 and 6, so it can't be used with an earlier revision.
+
+void Crypto::ReadCryptFilters_()
+{
+  if (version_ < 4) return;
+  stream_method_ = ReadCryptMethod_(encryption_dictionary_["/StmF"]);
+  string_method_ = ReadCryptMethod_(encryption_dictionary_["/StrF"]);
+
+  if (revision_ < 5 && (stream_method_ == AESV3 || string_method_ == AESV3))
+  {
+    throw runtime_error("AESV3 crypt filter needs revision 5 or later");
+  }
+}
+
+Crypto::CryptMethod Crypto::ReadCryptMethod_(const string& filter_name) const
+{
+  if (filter_name.empty() || filter_name == "/Identity") return IDENTITY;
+
+  Dictionary filters = encryption_dictionary_.GetDictionary("/CF");
+  string method = filters.GetDictionary(filter_name)["/CFM"];
+
+  if (method == "/V2")    return RC4;
+  if (method == "/AESV2") return AESV2;
+  if (method == "/AESV3") return AESV3;
+  if (method.empty() || method == "/None") return IDENTITY;
+  throw runtime_error("Unsupported crypt filter " + method);
+}
+
+/*---------------------------------------------------------------------------*/
+// In revisions 5 and 6 the file key is a random 256-bit key, stored in /UE
+// encrypted with a key made from the user password. The /U entry holds a hash
+// of the user password, followed by an 8-byte "validation salt" that was
+// added to the password to make that hash and an 8-byte "key salt" used to
+// make the key for /UE. The user password here is always empty.
+
+void Crypto::ReadFileKeyR6_()
+{
+  vector<uint8_t> user_hash = ReadPassword_("/U"),
+                  user_key  = ReadPassword_("/UE"),
+                  password {};
+
+  if (user_hash.size() < 48 || user_key.size() < 32)
+  {
+    throw runtime_error("Invalid /U or /UE entry");
+  }
+
+  vector<uint8_t> validation_salt(user_hash.begin() + 32,
+                                  user_hash.begin() + 40),
+                  key_salt(user_hash.begin() + 40, user_hash.begin() + 48);
+
+  // Check the empty password matches
+  vector<uint8_t> test_answer = HashR6_(password, validation_salt);
+  if (!equal(test_answer.begin(), test_answer.end(), user_hash.begin()))
+  {
+    throw runtime_error("Incorrect cryptkey");
+  }
+
+  // /UE is encrypted without padding, with an initialization vector of zeros
+  vector<uint8_t> key = HashR6_(password, key_salt);
+  vector<uint8_t> wrapped_key(16, 0);
+  wrapped_key.insert(wrapped_key.end(), user_key.begin(),
+                     user_key.begin() + 32);
+  AES(key.data(), key.size()).DecryptCBC(wrapped_key.data(),
+                                         wrapped_key.size(), false);
+  filekey_.assign(wrapped_key.begin(), wrapped_key.begin() + 32);
+}
+
+/*---------------------------------------------------------------------------*/
+// Revision 5 hashes the password and salt with SHA-256. Revision 6 then goes
+// on to repeatedly AES-encrypt 64 copies of the password and hash, picking
+// SHA-256, 384 or 512 to hash the result depending on its first 16 bytes
+// (taken as a number modulo 3, which is the same as the sum of the bytes
+// modulo 3). This runs for at least 64 rounds, and then until the last byte
+// of the encrypted data is no more than the round number minus 32.
+
+vector<uint8_t> Crypto::HashR6_(const vector<uint8_t>& password,
+                                const vector<uint8_t>& salt) const
+{
+  vector<uint8_t> hash = password;
+  Concatenate(hash, salt);
+  hash = Sha256_(hash);
+  if (revision_ == 5) return hash;
+
+  vector<uint8_t> block;
+  for (int round = 1; ; ++round)
+  {
+    block.clear();
+    for (int i = 0; i < 64; ++i)
+    {
+      Concatenate(block, password);
+      Concatenate(block, hash);
+    }
+
+    AES(hash.data(), 16).EncryptCBC(&hash[16], block.data(), block.size());
+
+    int sum = 0;
+    for (int i = 0; i < 16; ++i) sum += block[i];
+    switch (sum % 3)
+    {
+      case 0 : hash = Sha256_(block);       break;
+      case 1 : hash = Sha512_(block, true); break;
+      default: hash = Sha512_(block);       break;
+    }
+
+    if (round >= 64 && block.back() <= round - 32) break;
+  }
+
+  hash.resize(32);
+  return hash;
+}
+
 /*---------------------------------------------------------------------------*/
 // Usually the ID is given as a hex string, but it can be given as a string
 // of bytes including backslashed escapes etc. This converts either into bytes.
@@ -559,5 +1016,275 @@ vector<uint8_t> Crypto::ParseID_(const string& id_string)
   return result;
 }
 
+/*---------------------------------------------------------------------------*/
+// AES works on bytes as elements of the finite field GF(2^8). Multiplying by
+// 2 in this field is a left shift, reduced by the field's polynomial if the
+// top bit overflows.
+
+static inline uint8_t Times2(uint8_t byte)
+{
+  return (byte << 1) ^ ((byte & 0x80) ? 0x1b : 0x00);
+}
+
+static uint8_t Multiply(uint8_t a, uint8_t b)
+{
+  uint8_t result = 0;
+  for (; b; b >>= 1, a = Times2(a)) if (b & 1) result ^= a;
+  return result;
+}
+
+/*---------------------------------------------------------------------------*/
+// The AES lookup tables. The substitution box maps each byte to its inverse
+// in GF(2^8) followed by a fixed affine transformation. Here it is built by
+// stepping through the field with a generator (3) and its inverse together,
+// so that each byte's inverse is known without any division. The round tables
+// combine the substitution with the column mixing step: each entry is a
+// substituted byte multiplied by the four coefficients of one column of the
+// mixing matrix, rotated for each of the four positions in a column.
+//
+// The tables are built the first time they are needed.
+
+struct AESTables
+{
+  uint8_t substitute[256], inverse_substitute[256];
+  FourBytes encrypt[4][256], decrypt[4][256];
+
+  AESTables()
+  {
+    uint8_t p = 1, q = 1;
+    do
+    {
+      p ^= Times2(p);   // Multiply p by 3
+      q ^= q << 1;      // Divide q by 3
+      q ^= q << 2;
+      q ^= q << 4;
+      if (q & 0x80) q ^= 0x09;
+      uint8_t affine = q ^ ((q << 1) | (q >> 7)) ^ ((q << 2) | (q >> 6)) ^
+                       ((q << 3) | (q >> 5)) ^ ((q << 4) | (q >> 4));
+      substitute[p] = affine ^ 0x63;
+    } while (p != 1);
+    substitute[0] = 0x63;  // Zero has no inverse
+
+    for (int i = 0; i < 256; ++i) inverse_substitute[substitute[i]] = i;
+
+    for (int i = 0; i < 256; ++i)
+    {
+      uint8_t s = substitute[i], t = inverse_substitute[i];
+      uint8_t e[4] = {Times2(s), s, s, (uint8_t) (s ^ Times2(s))};
+      uint8_t d[4] = {Multiply(t, 14), Multiply(t, 9),
+                      Multiply(t, 13), Multiply(t, 11)};
+      for (int j = 0; j < 4; ++j)
+      {
+        encrypt[j][i] = RotateRight(ReadWord(e), 8 * j);
+        decrypt[j][i] = RotateRight(ReadWord(d), 8 * j);
+      }
+    }
+  }
+};
+
+static const AESTables& GetAESTables()
+{
+  static const AESTables tables;
+  return tables;
+}
+
+/*---------------------------------------------------------------------------*/
+// Applies the substitution box to each byte of a word
+
+static inline FourBytes SubstituteWord(FourBytes word)
+{
+  const uint8_t* sbox = GetAESTables().substitute;
+  uint8_t bytes[4];
+  WriteWord(word, bytes);
+  for (auto& byte : bytes) byte = sbox[byte];
+  return ReadWord(bytes);
+}
+
+/*---------------------------------------------------------------------------*/
+// The key is expanded into one four-word round key per round plus one. The
+// inverse cipher uses the same round keys in reverse order, with the column
+// mixing step undone on all but the first and last, which lets decryption
+// use the same structure of table lookups as encryption.
+
+AES::AES(const uint8_t* key, size_t key_length)
+{
+  if (key_length != 16 && key_length != 32)
+  {
+    throw runtime_error("Invalid AES key length");
+  }
+
+  const AESTables& tables = GetAESTables();
+  const uint8_t* sbox = tables.substitute;
+  int key_words = key_length / 4;
+  rounds_ = key_words + 6;
+  int total_words = 4 * (rounds_ + 1);
+
+  for (int i = 0; i < key_words; ++i) encrypt_keys_[i] = ReadWord(key + 4 * i);
+
+  uint8_t round_constant = 1;
+  for (int i = key_words; i < total_words; ++i)
+  {
+    FourBytes word = encrypt_keys_[i - 1];
+    if (i % key_words == 0)
+    {
+      word = SubstituteWord((word << 8) | (word >> 24));
+      word ^= (FourBytes) round_constant << 24;
+      round_constant = Times2(round_constant);
+    }
+    else if (key_words > 6 && i % key_words == 4)
+    {
+      word = SubstituteWord(word);
+    }
+    encrypt_keys_[i] = encrypt_keys_[i - key_words] ^ word;
+  }
+
+  for (int round = 0; round <= rounds_; ++round)
+  {
+    for (int i = 0; i < 4; ++i)
+    {
+      FourBytes word = encrypt_keys_[4 * (rounds_ - round) + i];
+      if (round > 0 && round < rounds_)
+      {
+        word = tables.decrypt[0][sbox[word >> 24]] ^
+               tables.decrypt[1][sbox[(word >> 16) & 0xff]] ^
+               tables.decrypt[2][sbox[(word >> 8) & 0xff]] ^
+               tables.decrypt[3][sbox[word & 0xff]];
+      }
+      decrypt_keys_[4 * round + i] = word;
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Each round replaces every word of the state with four table lookups, one
+// for a byte from each column, xor'd with the round key. The four words are
+// written out in full since this roughly doubles the speed. The last round has
+// no column mixing, so it uses the substitution box directly. Input and
+// output may be the same block.
+
+void AES::EncryptBlock(const uint8_t* input, uint8_t* output) const
+{
+  const AESTables& tables = GetAESTables();
+  const FourBytes* key = encrypt_keys_;
+  FourBytes state[4], next[4];
+
+  for (int i = 0; i < 4; ++i) state[i] = ReadWord(input + 4 * i) ^ key[i];
+
+  const FourBytes* t0 = tables.encrypt[0], * t1 = tables.encrypt[1],
+                  * t2 = tables.encrypt[2], * t3 = tables.encrypt[3];
+
+  for (int round = 1; round < rounds_; ++round)
+  {
+    key += 4;
+    next[0] = t0[state[0] >> 24] ^ t1[(state[1] >> 16) & 0xff] ^
+              t2[(state[2] >> 8) & 0xff] ^ t3[state[3] & 0xff] ^ key[0];
+    next[1] = t0[state[1] >> 24] ^ t1[(state[2] >> 16) & 0xff] ^
+              t2[(state[3] >> 8) & 0xff] ^ t3[state[0] & 0xff] ^ key[1];
+    next[2] = t0[state[2] >> 24] ^ t1[(state[3] >> 16) & 0xff] ^
+              t2[(state[0] >> 8) & 0xff] ^ t3[state[1] & 0xff] ^ key[2];
+    next[3] = t0[state[3] >> 24] ^ t1[(state[0] >> 16) & 0xff] ^
+              t2[(state[1] >> 8) & 0xff] ^ t3[state[2] & 0xff] ^ key[3];
+    for (int i = 0; i < 4; ++i) state[i] = next[i];
+  }
+
+  key += 4;
+  const uint8_t* sbox = tables.substitute;
+  for (int i = 0; i < 4; ++i)
+  {
+    next[i] = (((FourBytes) sbox[state[i] >> 24] << 24) |
+               (sbox[(state[(i + 1) & 3] >> 16) & 0xff] << 16) |
+               (sbox[(state[(i + 2) & 3] >> 8) & 0xff] << 8) |
+               sbox[state[(i + 3) & 3] & 0xff]) ^ key[i];
+  }
+  for (int i = 0; i < 4; ++i) WriteWord(next[i], output + 4 * i);
+}
+
+/*---------------------------------------------------------------------------*/
+// The inverse cipher is the same, except that the rows are shifted the other
+// way, so the bytes come from the columns in the opposite order
 
+void AES::DecryptBlock(const uint8_t* input, uint8_t* output) const
+{
+  const AESTables& tables = GetAESTables();
+  const FourBytes* key = decrypt_keys_;
+  FourBytes state[4], next[4];
+
+  for (int i = 0; i < 4; ++i) state[i] = ReadWord(input + 4 * i) ^ key[i];
+
+  const FourBytes* t0 = tables.decrypt[0], * t1 = tables.decrypt[1],
+                  * t2 = tables.decrypt[2], * t3 = tables.decrypt[3];
 
+  for (int round = 1; round < rounds_; ++round)
+  {
+    key += 4;
+    next[0] = t0[state[0] >> 24] ^ t1[(state[3] >> 16) & 0xff] ^
+              t2[(state[2] >> 8) & 0xff] ^ t3[state[1] & 0xff] ^ key[0];
+    next[1] = t0[state[1] >> 24] ^ t1[(state[0] >> 16) & 0xff] ^
+              t2[(state[3] >> 8) & 0xff] ^ t3[state[2] & 0xff] ^ key[1];
+    next[2] = t0[state[2] >> 24] ^ t1[(state[1] >> 16) & 0xff] ^
+              t2[(state[0] >> 8) & 0xff] ^ t3[state[3] & 0xff] ^ key[2];
+    next[3] = t0[state[3] >> 24] ^ t1[(state[2] >> 16) & 0xff] ^
+              t2[(state[1] >> 8) & 0xff] ^ t3[state[0] & 0xff] ^ key[3];
+    for (int i = 0; i < 4; ++i) state[i] = next[i];
+  }
+
+  key += 4;
+  const uint8_t* sbox = tables.inverse_substitute;
+  for (int i = 0; i < 4; ++i)
+  {
+    next[i] = (((FourBytes) sbox[state[i] >> 24] << 24) |
+               (sbox[(state[(i + 3) & 3] >> 16) & 0xff] << 16) |
+               (sbox[(state[(i + 2) & 3] >> 8) & 0xff] << 8) |
+               sbox[state[(i + 1) & 3] & 0xff]) ^ key[i];
+  }
+  for (int i = 0; i < 4; ++i) WriteWord(next[i], output + 4 * i);
+}
+
+/*---------------------------------------------------------------------------*/
+// In CBC mode each block of plain text is xor'd with the previous block of
+// cipher text (or the initialization vector) before it is encrypted.
+
+void AES::EncryptCBC(const uint8_t* iv, uint8_t* data, size_t length) const
+{
+  const uint8_t* previous = iv;
+  for (size_t i = 0; i + 16 <= length; i += 16)
+  {
+    for (int j = 0; j < 16; ++j) data[i + j] ^= previous[j];
+    EncryptBlock(data + i, data + i);
+    previous = data + i;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// To decrypt, each block is decrypted then xor'd with the previous block of
+// cipher text. The plain text is written one block behind the cipher text,
+// so the initialization vector drops off the front. Each cipher block is
+// copied before it is used, so the output can overwrite the input. The last
+// byte of padded plain text gives the number of padding bytes. Any partial
+// block at the end is ignored.
+
+size_t AES::DecryptCBC(const uint8_t* input, size_t length, uint8_t* output,
+                       bool is_padded) const
+{
+  length -= length % 16;
+  if (length < 32) return 0;
+
+  uint8_t previous[16], current[16];
+  memcpy(previous, input, 16);
+
+  for (size_t i = 16; i < length; i += 16)
+  {
+    memcpy(current, input + i, 16);
+    DecryptBlock(current, output + i - 16);
+    for (int j = 0; j < 16; ++j) output[i - 16 + j] ^= previous[j];
+    memcpy(previous, current, 16);
+  }
+
+  size_t plain_length = length - 16;
+  if (is_padded)
+  {
+    uint8_t padding = output[plain_length - 1];
+    if (padding > 0 && padding <= 16) plain_length -= padding;
+  }
+  return plain_length;
+}
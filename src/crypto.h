@@ -50,12 +50,28 @@
  * is a single function to decrypt a stream given the raw stream, the object
  * number and the generation number of the pdf object in which the stream
  * resides.
+ *
+ * Older pdfs are encrypted with RC4, using a key made from an Md5 hash of the
+ * file key and the object number. From pdf 1.6 (version 4 of the standard
+ * security handler) the encryption dictionary can instead name "crypt
+ * filters" in its /CF entry, with /StmF and /StrF saying which of them is
+ * used for streams and strings. These may use AES-128 (/AESV2), with a key
+ * derived as for RC4. Version 5 (revisions 5 and 6) uses AES-256 (/AESV3)
+ * with the file key itself, which is unwrapped from the /UE entry using a key
+ * made with the SHA-2 hashes.
+ *
+ * Every object has its own RC4 or AES-128 key, so the key made for each object
+ * is kept in a small cache, and the decryption functions can write straight
+ * into a buffer supplied by the caller rather than returning a new string.
  */
 
 #include<string>
 #include<vector>
-#include<deque>         // Needed for md5mix function
 #include<memory>
+#include<array>
+#include<unordered_map>
+#include<cstdint>
+#include<mutex>
 #include "charstring.h"
 class Dictionary;
 
@@ -67,6 +83,46 @@ class Dictionary;
 
 typedef uint32_t FourBytes;
 
+//---------------------------------------------------------------------------//
+// The AES block cipher, with 128 or 256 bit keys. Each round is done with
+// lookups in four tables that combine the byte substitution and column mixing
+// steps, so a block takes 16 table lookups per round. The key schedule is
+// expanded once when the object is made.
+//
+// In pdf, AES is always used in cipher block chaining (CBC) mode. An encrypted
+// stream starts with the 16-byte initialization vector and the plain text is
+// padded to a whole number of blocks. DecryptCBC works in place: the plain
+// text is written from the start of the data, over the initialization vector,
+// and its length without padding is returned.
+
+class AES
+{
+ public:
+  AES(const uint8_t* key, size_t key_length);
+
+  void EncryptBlock(const uint8_t* input, uint8_t* output) const;
+  void DecryptBlock(const uint8_t* input, uint8_t* output) const;
+
+  // Encrypts whole blocks in place with the given initialization vector
+  void EncryptCBC(const uint8_t* iv, uint8_t* data, size_t length) const;
+
+  // Decrypts data that starts with its initialization vector into output,
+  // which needs room for length - 16 bytes and may be the same as input
+  size_t DecryptCBC(const uint8_t* input, size_t length, uint8_t* output,
+                    bool is_padded = true) const;
+
+  // Decrypts data that starts with its initialization vector, in place
+  size_t DecryptCBC(uint8_t* data, size_t length, bool is_padded = true) const
+  {
+    return DecryptCBC(data, length, data, is_padded);
+  }
+
+ private:
+  int rounds_;                       // 10 for 128 bit keys, 14 for 256 bits
+  FourBytes encrypt_keys_[60];       // Expanded key schedule
+  FourBytes decrypt_keys_[60];       // Key schedule for the inverse cipher
+};
+
 //---------------------------------------------------------------------------//
 // Class definition for crypto
 
@@ -86,16 +142,47 @@ class Crypto
 
   std::string DecryptStream(const CharString&, int, int) const;
 
+  // Decrypt a stream or string in place. AES adds an initialization vector
+  // and padding to the plain text, so after AES decryption the string is
+  // shorter than before.
+  void Decrypt(std::string& stream, int object_number, int generation) const;
+  void DecryptString(std::string& text, int object_number,
+                     int generation) const;
+
+  // Decrypts a stream into output, which must have room for at least as many
+  // bytes as the input, and returns the length of the decrypted stream. The
+  // output may be the same memory as the input.
+  size_t Decrypt(const CharString& stream, uint8_t* output,
+                 int object_number, int generation) const;
+
+  // Whether metadata streams are encrypted (/EncryptMetadata)
+  bool EncryptsMetadata() const { return encrypt_metadata_; }
 
 private:
+  // The ways a crypt filter can encrypt data
+  enum CryptMethod {IDENTITY, RC4, AESV2, AESV3};
+
   // private data members
   const Dictionary& encryption_dictionary_;
   const Dictionary& trailer_;
+  int   version_;
   int   revision_;
+  bool  encrypt_metadata_;
+  CryptMethod stream_method_;       // Crypt filter used for streams (/StmF)
+  CryptMethod string_method_;       // Crypt filter used for strings (/StrF)
   std::vector<uint8_t> filekey_;
+  std::shared_ptr<AES> file_aes_;   // AES-256 cipher with the file key
+
+  // Object keys already made, keyed by object number, generation and method.
+  // Pages may be read on several threads at once, so the cache is locked.
+  mutable std::unordered_map<uint64_t, std::array<uint8_t, 16>> object_keys_;
+  mutable std::mutex object_keys_mutex_;
+
   static const std::vector<uint8_t> default_user_password_;
-  static const std::vector<FourBytes> md5_table;
-  static const std::vector<std::vector<FourBytes>> mixarray;
+  static const FourBytes md5_table[64];
+  static const int mixarray[4][4];
+  static const std::vector<FourBytes> sha256_table;
+  static const std::vector<uint64_t> sha512_table;
 
   // Chops FourBytes into 4 bytes
   std::vector<uint8_t> ChopLong_(FourBytes) const;
@@ -103,8 +190,11 @@ private:
   // Return permission flags for file
   std::vector<uint8_t> ReadPermissions_(const std::string&);
 
-  // Helper function for md5
-  void Md5Mix_(int, std::deque<FourBytes>&, std::vector<FourBytes>&) const;
+  // Mixes one 64-byte block into the running md5 hash
+  void Md5Block_(FourBytes* hash, const uint8_t* block) const;
+
+  // Writes the 16-byte md5 hash of length bytes of message to digest
+  void Md5_(const uint8_t* message, size_t length, uint8_t* digest) const;
 
   // Gives md5 hash of a vector of raw bytes
   std::vector<uint8_t> Md5_(const std::vector<uint8_t>&) const;
@@ -112,8 +202,29 @@ private:
   // Gives md5 hash of a string (as bytes)
   std::vector<uint8_t> Md5_(const std::string&) const;
 
+  // Gives SHA-256 hash of a vector of raw bytes
+  std::vector<uint8_t> Sha256_(const std::vector<uint8_t>&) const;
+
+  // Gives SHA-512 hash of a vector of raw bytes, or SHA-384 if requested
+  std::vector<uint8_t> Sha512_(const std::vector<uint8_t>&,
+                               bool is_sha384 = false) const;
+
   // Gives rc4 cipher of message:key pair, given key and message
   void Rc4_(std::vector<uint8_t>&, const std::vector<uint8_t>&) const;
+  void Rc4_(const uint8_t* input, size_t length, uint8_t* output,
+            const uint8_t* key, size_t key_length) const;
+
+  // Gets the key for an object's data, making it if it is not cached
+  const std::array<uint8_t, 16>& ObjectKey_(CryptMethod, int, int) const;
+  size_t ObjectKeyLength_() const;
+
+  // Decrypts data into output with the given crypt filter method
+  size_t Decrypt_(const uint8_t* input, size_t length, uint8_t* output,
+                  CryptMethod, int, int) const;
+
+  // Reads the crypt filters named by /StmF and /StrF
+  void ReadCryptFilters_();
+  CryptMethod ReadCryptMethod_(const std::string& filter_name) const;
 
   // Gets /O and /U cipher
   std::vector<uint8_t> ReadPassword_(const std::string&);
@@ -127,6 +238,13 @@ private:
   // Checks file key (revision 3)
   void CheckKeyR3_();
 
+  // Constructs and checks file key (revisions 5 and 6)
+  void ReadFileKeyR6_();
+
+  // The password hash used in revisions 5 and 6
+  std::vector<uint8_t> HashR6_(const std::vector<uint8_t>& password,
+                               const std::vector<uint8_t>& salt) const;
+
   // Ensure the ID is read correctly whether hex or plain bytes
   std::vector<uint8_t> ParseID_(const std::string&);
 
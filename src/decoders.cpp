@@ -0,0 +1,256 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR Decoders implementation file                                        //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+/* PDFR has its own Deflate implementation so that it can be built without any
+ * external libraries. Where zlib or libdeflate is available, though, they are
+ * faster, so the configure script looks for them and defines PDFR_USE_ZLIB or
+ * PDFR_USE_LIBDEFLATE in src/Makevars if it finds one (libdeflate is preferred
+ * as it is the faster of the two). This file wraps each library in the Decoder
+ * interface declared in deflate.h, and GetFlateDecoder() returns whichever one
+ * the package was built with.
+ *
+ * libdeflate can only inflate a whole stream into a buffer given up front, so
+ * it can't pass its output on a chunk at a time. The chunked interface of the
+ * libdeflate decoder uses zlib instead if it was found too (configure defines
+ * both flags in that case), or the built-in decoder if not. Content streams
+ * are read that way, so they are inflated a little more slowly than with
+ * libdeflate, but never need their whole decoded length in memory.
+ *
+ * The libraries are used to inflate raw Deflate data only. The two-byte zlib
+ * header is checked by the same function the built-in decoder uses, and the
+ * trailing Adler-32 checksum is ignored just as it is by the built-in decoder,
+ * since plenty of pdf writers get it wrong. This keeps the output and the
+ * streams that are rejected the same whichever decoder is in use.
+ */
+
+#include "deflate.h"
+#include<stdexcept>
+
+#ifdef PDFR_USE_LIBDEFLATE
+#include<libdeflate.h>
+#endif
+
+#ifdef PDFR_USE_ZLIB
+#include<cstring>
+#include<zlib.h>
+#endif
+
+using namespace std;
+
+#if defined(PDFR_USE_ZLIB) || defined(PDFR_USE_LIBDEFLATE)
+
+/*---------------------------------------------------------------------------*/
+// Checks the zlib header of message and returns the raw Deflate data after it
+
+static CharString StripZlibHeader(const CharString& message)
+{
+  if (message.size() < 2) CheckZlibHeader(0, 0);
+  CheckZlibHeader(message[0], message[1]);
+  return CharString(message.begin() + 2, message.size() - 2);
+}
+
+#endif
+
+#ifdef PDFR_USE_ZLIB
+
+//---------------------------------------------------------------------------//
+// zlib inflates a stream in pieces into a fixed-size buffer, so it maps
+// naturally onto the chunked interface. The z_stream is held in a small struct
+// whose destructor frees it, since the sink may throw part way through.
+
+class ZlibDecoder : public Decoder
+{
+ public:
+  std::string Inflate(const CharString& message,
+                      size_t expected_size = 0) const
+  {
+    std::string output;
+    output.reserve(expected_size ? expected_size : message.size() * 6);
+    Inflate(message, [&](const char* chunk, size_t length) -> void
+                     {
+                       output.append(chunk, length);
+                     });
+    return output;
+  }
+
+  void Inflate(const CharString& message, const OutputSink& sink) const;
+
+  std::string Name() const {return "zlib";}
+
+ private:
+  struct Inflater
+  {
+    z_stream stream;
+    Inflater()
+    {
+      memset(&stream, 0, sizeof(stream));
+      if (inflateInit2(&stream, -15) != Z_OK)
+      {
+        throw runtime_error("Couldn't initialize zlib");
+      }
+    }
+    ~Inflater() {inflateEnd(&stream);}
+  };
+};
+
+/*---------------------------------------------------------------------------*/
+
+void ZlibDecoder::Inflate(const CharString& message,
+                          const OutputSink& sink) const
+{
+  static const size_t chunk_size = 65536;
+
+  CharString deflated = StripZlibHeader(message);
+  Inflater inflater;
+  z_stream& stream = inflater.stream;
+  stream.next_in  = (Bytef*) deflated.begin();
+  stream.avail_in = (uInt) deflated.size();
+
+  std::string buffer(chunk_size, '\0');
+  int status = Z_OK;
+
+  while (status != Z_STREAM_END)
+  {
+    stream.next_out  = (Bytef*) &buffer[0];
+    stream.avail_out = (uInt) chunk_size;
+    status = inflate(&stream, Z_NO_FLUSH);
+
+    // With room in the output buffer, a buffer error means zlib needs more
+    // input than there is, so the stream has been cut short
+    if (status == Z_BUF_ERROR) throw runtime_error("Unexpected end of stream");
+    if (status != Z_OK && status != Z_STREAM_END)
+    {
+      throw runtime_error("Invalid data in Deflate Stream.");
+    }
+
+    size_t produced = chunk_size - stream.avail_out;
+    if (produced) sink(buffer.data(), produced);
+  }
+}
+
+#endif
+
+#ifdef PDFR_USE_LIBDEFLATE
+
+//---------------------------------------------------------------------------//
+// libdeflate only inflates whole buffers, and has to be told how big the
+// output buffer is (see LibdeflateDecoder::Inflate below). The chunked
+// interface hands the stream to a streaming decoder instead (see above).
+
+class LibdeflateDecoder : public Decoder
+{
+ public:
+  std::string Inflate(const CharString& message,
+                      size_t expected_size = 0) const;
+
+  void Inflate(const CharString& message, const OutputSink& sink) const
+  {
+#ifdef PDFR_USE_ZLIB
+    static const ZlibDecoder streaming_decoder;
+    streaming_decoder.Inflate(message, sink);
+#else
+    GetBuiltInDecoder().Inflate(message, sink);
+#endif
+  }
+
+  std::string Name() const {return "libdeflate";}
+
+ private:
+  struct Decompressor
+  {
+    libdeflate_decompressor* pointer;
+    Decompressor() : pointer(libdeflate_alloc_decompressor())
+    {
+      if (!pointer) throw runtime_error("Couldn't initialize libdeflate");
+    }
+    ~Decompressor() {libdeflate_free_decompressor(pointer);}
+  };
+};
+
+/*---------------------------------------------------------------------------*/
+// A failed attempt to fit the output into the buffer wastes the whole of the
+// decompression, so the first guess matters. The decoded length the stream
+// claims is used if there is one, and six times the input otherwise. Each
+// retry quadruples the buffer rather than doubling it, so that streams which
+// expand a lot are decoded only a few times. No Deflate stream can expand by
+// more than 1032 times (a 258-byte copy in two bits), so the buffer never
+// grows past that, and a stream that still doesn't fit is invalid.
+
+std::string LibdeflateDecoder::Inflate(const CharString& message,
+                                       size_t expected_size) const
+{
+  CharString deflated = StripZlibHeader(message);
+  Decompressor decompressor;
+  size_t largest_output = deflated.size() * 1032 + 1024;
+  size_t first_guess = expected_size ? expected_size : deflated.size() * 6;
+  std::string output(min(max(first_guess, (size_t) 1024), largest_output),
+                     '\0');
+
+  while (true)
+  {
+    size_t output_size = 0;
+    libdeflate_result result = libdeflate_deflate_decompress(
+      decompressor.pointer, deflated.begin(), deflated.size(),
+      &output[0], output.size(), &output_size);
+
+    if (result == LIBDEFLATE_SUCCESS)
+    {
+      output.resize(output_size);
+      return output;
+    }
+
+    if (result != LIBDEFLATE_INSUFFICIENT_SPACE ||
+        output.size() == largest_output)
+    {
+      throw runtime_error("Invalid data in Deflate Stream.");
+    }
+
+    output.resize(min(output.size() * 4, largest_output));
+  }
+}
+
+#endif
+
+/*---------------------------------------------------------------------------*/
+// Chooses the decoder FlateDecode uses according to the build flags
+
+const Decoder& GetFlateDecoder()
+{
+#if defined(PDFR_USE_LIBDEFLATE)
+  static const LibdeflateDecoder flate_decoder;
+  return flate_decoder;
+#elif defined(PDFR_USE_ZLIB)
+  static const ZlibDecoder flate_decoder;
+  return flate_decoder;
+#else
+  return GetBuiltInDecoder();
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+// The flatedecode interface is very simple. Provide it with a compressed
+// string and it will return the uncompressed version, or pass it to a sink
+// piece by piece.
+
+std::string FlateDecode(string* message)
+{
+  return GetFlateDecoder().Inflate(CharString(*message));
+}
+
+std::string FlateDecode(const CharString& message, size_t expected_size)
+{
+  return GetFlateDecoder().Inflate(message, expected_size);
+}
+
+void FlateDecode(const CharString& message, const OutputSink& sink)
+{
+  GetFlateDecoder().Inflate(message, sink);
+}
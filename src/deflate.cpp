@@ -13,7 +13,6 @@
 #include<vector>
 #include<iostream>
 #include<stdexcept>
-#include<map>
 #include<algorithm>
 #include "streams.h"
 #include "deflate.h"
@@ -21,126 +20,82 @@
 
 using namespace std;
 
-// I will define a HuffmanMap for brevity and clarity
-typedef unordered_map<uint32_t, uint32_t> HuffmanMap;
-
 /*---------------------------------------------------------------------------*/
-// The flatedecode interface is very simple. Provide it with a pointer to a
-// compressed string and it will replace it with a pointer to the uncompressed
-// version.
+// The built-in decoder is a thin wrapper around the Deflate class.
+
+class BuiltInDecoder : public Decoder
+{
+ public:
+  std::string Inflate(const CharString& message, size_t = 0) const
+  {
+    return Deflate(message).Output();
+  }
+
+  void Inflate(const CharString& message, const OutputSink& sink) const
+  {
+    Deflate(message, sink);
+  }
 
-std::string FlateDecode(string* message)
+  std::string Name() const {return "builtin";}
+};
+
+const Decoder& GetBuiltInDecoder()
 {
-  return Deflate(message).Output();
+  static const BuiltInDecoder built_in_decoder;
+  return built_in_decoder;
 }
 
-std::string FlateDecode(const CharString& message)
+/*---------------------------------------------------------------------------*/
+// Every deflate stream begins with two header bytes (CMF and FLG). This checks
+// they are valid before attempting to decompress. It will only allow the
+// compression method DEFLATE (CMF & 0x0f == 8), it will halt if the fixed
+// dictionary flag is set, and it will also throw if the checksum fails. It is
+// shared by all the decoders so that they reject the same streams.
+
+void CheckZlibHeader(uint8_t cmf, uint8_t flg)
 {
-  return Deflate(message).Output();
+  // Check compression method
+  if ((cmf & 0x0f) != 8) throw runtime_error("Invalid compression method.");
+
+  // Ensure checksum is modulo 31
+  if ((((cmf << 8) + flg) % 31)) throw runtime_error("Invalid check flag");
+
+  // Throw if FDCIT is set
+  if ((flg & 32) != 0) throw runtime_error("FDICT bit set in stream header");
 }
+
 /*---------------------------------------------------------------------------*/
 // In Deflate, some short messages are encoded with a fixed dictionary, since
 // including a dictionary would make the stream longer instead of shorter.
 // The decompressor needs to know this dictionary.
 //
-// This dictionary takes the form of a lookup table. The difficulty here is
-// representing a variable-length bit sequence with a single key. Each of the
-// 32-bit numbers making up the keys in this lookup table represent a number of
-// bits, and the actual number encoded by those bits. The number of bits is
-// stored in the 16 high order bits, and the value they represent is stored in
-// the 16 low order bits. For example, the bit sequence "1101101" is 109 in
-// binary, and is made of 7 bits. Therefore, it would be represented by
-// 109 | (7 << 16) which is 458861 or 0x7006d. If I have the key 0x800cc, then I
-// know it has 8 bits, since 0x800cc >> 16 == 8, and the value 0xcc or 204,
-// since 0x800cc & 0x0ffff == 0xcc. I can therefore determine that my bit
-// sequence has to be an 8-bit representation of 204, or 11001100. This could be
-// accomplished by having a {bits, value} pair as the key, though you would
-// have to do std::make_pair every time you wanted to look some bits up in
-// the table, and I assume this is more costly than bitwise operations.
-//
-// One final note on this table: the bit sequences in all the code lookup tables
-// in this implementation of Deflate are reversed. This allows direct reading
-// of the codes from the stream in a standard LSB->MSB fashion rather than
-// the reverse ordering employed by the packing of Huffman codes. This could
-// have been done by reversing the bits every time a code was read, but it
-// seemed more sensible to me to reverse the lookup tables, since that would
-// require fewer bit-reversals in total.
-
-const unordered_map<uint32_t, uint32_t> Deflate::fixed_literal_map_ {
-{0x8000c,   0}, {0x8008c,   1}, {0x8004c,   2}, {0x800cc,   3}, {0x8002c,   4},
-{0x800ac,   5}, {0x8006c,   6}, {0x800ec,   7}, {0x8001c,   8}, {0x8009c,   9},
-{0x8005c,  10}, {0x800dc,  11}, {0x8003c,  12}, {0x800bc,  13}, {0x8007c,  14},
-{0x800fc,  15}, {0x80002,  16}, {0x80082,  17}, {0x80042,  18}, {0x800c2,  19},
-{0x80022,  20}, {0x800a2,  21}, {0x80062,  22}, {0x800e2,  23}, {0x80012,  24},
-{0x80092,  25}, {0x80052,  26}, {0x800d2,  27}, {0x80032,  28}, {0x800b2,  29},
-{0x80072,  30}, {0x800f2,  31}, {0x8000a,  32}, {0x8008a,  33}, {0x8004a,  34},
-{0x800ca,  35}, {0x8002a,  36}, {0x800aa,  37}, {0x8006a,  38}, {0x800ea,  39},
-{0x8001a,  40}, {0x8009a,  41}, {0x8005a,  42}, {0x800da,  43}, {0x8003a,  44},
-{0x800ba,  45}, {0x8007a,  46}, {0x800fa,  47}, {0x80006,  48}, {0x80086,  49},
-{0x80046,  50}, {0x800c6,  51}, {0x80026,  52}, {0x800a6,  53}, {0x80066,  54},
-{0x800e6,  55}, {0x80016,  56}, {0x80096,  57}, {0x80056,  58}, {0x800d6,  59},
-{0x80036,  60}, {0x800b6,  61}, {0x80076,  62}, {0x800f6,  63}, {0x8000e,  64},
-{0x8008e,  65}, {0x8004e,  66}, {0x800ce,  67}, {0x8002e,  68}, {0x800ae,  69},
-{0x8006e,  70}, {0x800ee,  71}, {0x8001e,  72}, {0x8009e,  73}, {0x8005e,  74},
-{0x800de,  75}, {0x8003e,  76}, {0x800be,  77}, {0x8007e,  78}, {0x800fe,  79},
-{0x80001,  80}, {0x80081,  81}, {0x80041,  82}, {0x800c1,  83}, {0x80021,  84},
-{0x800a1,  85}, {0x80061,  86}, {0x800e1,  87}, {0x80011,  88}, {0x80091,  89},
-{0x80051,  90}, {0x800d1,  91}, {0x80031,  92}, {0x800b1,  93}, {0x80071,  94},
-{0x800f1,  95}, {0x80009,  96}, {0x80089,  97}, {0x80049,  98}, {0x800c9,  99},
-{0x80029, 100}, {0x800a9, 101}, {0x80069, 102}, {0x800e9, 103}, {0x80019, 104},
-{0x80099, 105}, {0x80059, 106}, {0x800d9, 107}, {0x80039, 108}, {0x800b9, 109},
-{0x80079, 110}, {0x800f9, 111}, {0x80005, 112}, {0x80085, 113}, {0x80045, 114},
-{0x800c5, 115}, {0x80025, 116}, {0x800a5, 117}, {0x80065, 118}, {0x800e5, 119},
-{0x80015, 120}, {0x80095, 121}, {0x80055, 122}, {0x800d5, 123}, {0x80035, 124},
-{0x800b5, 125}, {0x80075, 126}, {0x800f5, 127}, {0x8000d, 128}, {0x8008d, 129},
-{0x8004d, 130}, {0x800cd, 131}, {0x8002d, 132}, {0x800ad, 133}, {0x8006d, 134},
-{0x800ed, 135}, {0x8001d, 136}, {0x8009d, 137}, {0x8005d, 138}, {0x800dd, 139},
-{0x8003d, 140}, {0x800bd, 141}, {0x8007d, 142}, {0x800fd, 143}, {0x90013, 144},
-{0x90113, 145}, {0x90093, 146}, {0x90193, 147}, {0x90053, 148}, {0x90153, 149},
-{0x900d3, 150}, {0x901d3, 151}, {0x90033, 152}, {0x90133, 153}, {0x900b3, 154},
-{0x901b3, 155}, {0x90073, 156}, {0x90173, 157}, {0x900f3, 158}, {0x901f3, 159},
-{0x9000b, 160}, {0x9010b, 161}, {0x9008b, 162}, {0x9018b, 163}, {0x9004b, 164},
-{0x9014b, 165}, {0x900cb, 166}, {0x901cb, 167}, {0x9002b, 168}, {0x9012b, 169},
-{0x900ab, 170}, {0x901ab, 171}, {0x9006b, 172}, {0x9016b, 173}, {0x900eb, 174},
-{0x901eb, 175}, {0x9001b, 176}, {0x9011b, 177}, {0x9009b, 178}, {0x9019b, 179},
-{0x9005b, 180}, {0x9015b, 181}, {0x900db, 182}, {0x901db, 183}, {0x9003b, 184},
-{0x9013b, 185}, {0x900bb, 186}, {0x901bb, 187}, {0x9007b, 188}, {0x9017b, 189},
-{0x900fb, 190}, {0x901fb, 191}, {0x90007, 192}, {0x90107, 193}, {0x90087, 194},
-{0x90187, 195}, {0x90047, 196}, {0x90147, 197}, {0x900c7, 198}, {0x901c7, 199},
-{0x90027, 200}, {0x90127, 201}, {0x900a7, 202}, {0x901a7, 203}, {0x90067, 204},
-{0x90167, 205}, {0x900e7, 206}, {0x901e7, 207}, {0x90017, 208}, {0x90117, 209},
-{0x90097, 210}, {0x90197, 211}, {0x90057, 212}, {0x90157, 213}, {0x900d7, 214},
-{0x901d7, 215}, {0x90037, 216}, {0x90137, 217}, {0x900b7, 218}, {0x901b7, 219},
-{0x90077, 220}, {0x90177, 221}, {0x900f7, 222}, {0x901f7, 223}, {0x9000f, 224},
-{0x9010f, 225}, {0x9008f, 226}, {0x9018f, 227}, {0x9004f, 228}, {0x9014f, 229},
-{0x900cf, 230}, {0x901cf, 231}, {0x9002f, 232}, {0x9012f, 233}, {0x900af, 234},
-{0x901af, 235}, {0x9006f, 236}, {0x9016f, 237}, {0x900ef, 238}, {0x901ef, 239},
-{0x9001f, 240}, {0x9011f, 241}, {0x9009f, 242}, {0x9019f, 243}, {0x9005f, 244},
-{0x9015f, 245}, {0x900df, 246}, {0x901df, 247}, {0x9003f, 248}, {0x9013f, 249},
-{0x900bf, 250}, {0x901bf, 251}, {0x9007f, 252}, {0x9017f, 253}, {0x900ff, 254},
-{0x901ff, 255}, {0x70000, 256}, {0x70040, 257}, {0x70020, 258}, {0x70060, 259},
-{0x70010, 260}, {0x70050, 261}, {0x70030, 262}, {0x70070, 263}, {0x70008, 264},
-{0x70048, 265}, {0x70028, 266}, {0x70068, 267}, {0x70018, 268}, {0x70058, 269},
-{0x70038, 270}, {0x70078, 271}, {0x70004, 272}, {0x70044, 273}, {0x70024, 274},
-{0x70064, 275}, {0x70014, 276}, {0x70054, 277}, {0x70034, 278}, {0x70074, 279},
-{0x80003, 280}, {0x80083, 281}, {0x80043, 282}, {0x800c3, 283}, {0x80023, 284},
-{0x800a3, 285}, {0x80063, 286}, {0x800e3, 287}, {0xfffff,   9}, {0x00000,   7}
-};
+// RFC 1951 defines the fixed dictionary by its code lengths alone: literals
+// 0 - 143 use 8 bits, 144 - 255 use 9 bits, 256 - 279 use 7 bits and 280 - 287
+// use 8 bits, while all 30 distance codes use 5 bits. The tables are built from
+// these lengths by the same Huffmanize_ function used for dynamic blocks. This
+// happens only once, the first time a fixed block is read; the function-local
+// statics are then shared by every subsequent Deflate object.
+
+const HuffmanTable& Deflate::FixedLiteralCodes_()
+{
+  static const HuffmanTable fixed_literal_codes = []()
+  {
+    vector<uint32_t> lengths(288, 8);
+    fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+    fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+    return Huffmanize_(lengths, literal_lookup_bits_);
+  }();
 
-/*---------------------------------------------------------------------------*/
-// The fixed distance table, like the fixed literal table, is only used when
-// a fixed compression dictionary is employed. It uses the same scheme as above
-// to convert from a 32-bit unsigned int to a variable-length bit sequence.
-
-const unordered_map<uint32_t, uint32_t> Deflate::fixed_distance_map_ {
-  {0x50000,  0}, {0x50010,  1}, {0x50008,  2}, {0x50018,  3}, {0x50004,  4},
-  {0x50014,  5}, {0x5000c,  6}, {0x5001c,  7}, {0x50002,  8}, {0x50012,  9},
-  {0x5000a, 10}, {0x5001a, 11}, {0x50006, 12}, {0x50016, 13}, {0x5000e, 14},
-  {0x5001e, 15}, {0x50001, 16}, {0x50011, 17}, {0x50009, 18}, {0x50019, 19},
-  {0x50005, 20}, {0x50015, 21}, {0x5000d, 22}, {0x5001d, 23}, {0x50003, 24},
-  {0x50013, 25}, {0x5000b, 26}, {0x5001b, 27}, {0x50007, 28}, {0x50017, 29},
-  {0x5000f, 30}, {0x5001f, 31}, {0xfffff,  5}, {0x00000,  5}
-  };
+  return fixed_literal_codes;
+}
+
+const HuffmanTable& Deflate::FixedDistanceCodes_()
+{
+  static const HuffmanTable fixed_distance_codes =
+    Huffmanize_(vector<uint32_t>(32, 5), distance_lookup_bits_);
+
+  return fixed_distance_codes;
+}
 
 /*---------------------------------------------------------------------------*/
 // Look up what actual lengths the length codes represent
@@ -162,165 +117,209 @@ const vector<uint32_t> Deflate::distance_table_{
 // decompression without further prompting.
 
 Deflate::Deflate(const string* input) : Stream(input),
-                                          is_last_block_(false)
+                                          is_last_block_(false),
+                                          literal_codes_(nullptr),
+                                          distance_codes_(nullptr)
 {
   SetExpansionRatio(6);
-
-  // This will abort further reading if the two header bytes aren't right.
-  CheckHeader_();
-
-  // Reads each available block sequentially
-  while (!is_last_block_) ReadBlock_();
-
-  ShrinkToFit();
+  Inflate_();
 }
 
 Deflate::Deflate(const CharString& input) : Stream(input),
-                                          is_last_block_(false)
+                                          is_last_block_(false),
+                                          literal_codes_(nullptr),
+                                          distance_codes_(nullptr)
 {
   SetExpansionRatio(6);
+  Inflate_();
+}
+
+// In chunked mode only the last 32K of output is kept, since that is as far
+// back as any length / distance pointer can reach.
 
+Deflate::Deflate(const CharString& input, const OutputSink& sink) :
+  Stream(input),
+  is_last_block_(false),
+  literal_codes_(nullptr),
+  distance_codes_(nullptr)
+{
+  SetOutputSink(sink, window_size_);
+  Inflate_();
+  FlushOutput();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void Deflate::Inflate_()
+{
   // This will abort further reading if the two header bytes aren't right.
   CheckHeader_();
 
   // Reads each available block sequentially
   while (!is_last_block_) ReadBlock_();
-
-  ShrinkToFit();
 }
 
 /*---------------------------------------------------------------------------*/
-// The Huffmanize function reconstructs a Huffman tree from a vector of lengths.
+// The Huffmanize function reconstructs a Huffman code from a vector of lengths.
 // It assumes that the position of each length in the vector is the number to
 // be associated with the Huffman code. This means that symbols which don't
 // need a code have to have a zero associated with them. For example, if
 // the vector (3, 0, 2, 3, 0, 4) is passed, the equivalent mapping would be
 // [ 010 -> 0 ], [ 00 -> 2], [ 011 -> 3], [ 1000 -> 5].
 //
-// Because the bit sequences are variable length, they are stored in such a way
-// as to allow both the number of bits and the bit sequence to be combined into
-// a single key. We reverse the bit sequence for easy lookup and store it in
-// the low order bits, then store the number of bits in the high order bits.
-
-unordered_map<uint32_t, uint32_t>
-Deflate::Huffmanize_(const vector<uint32_t>& lengths)
+// The codes are then written into a lookup table (see deflate.h). Huffman codes
+// are packed into the stream starting from their most significant bit, whereas
+// we read the stream starting from the least significant bit, so each code is
+// bit-reversed before it is used as an index. A code shorter than the index
+// width only fixes the low bits of the index, so it is copied into every entry
+// whose low bits match it, whatever the high bits happen to be.
+//
+// The lengths come from the stream, so they are checked first, as zlib's
+// inflate_table does. If they describe more codes than the bits can hold (an
+// over-subscribed code), codes would overlap and the table couldn't be built.
+// If they leave some bit patterns unused (an incomplete code) the stream is
+// invalid too, except for a literal or distance code with at most one code
+// of one bit, which RFC 1951 allows for blocks with a single distance.
+
+HuffmanTable Deflate::Huffmanize_(const vector<uint32_t>& lengths,
+                                  uint32_t lookup_bits,
+                                  bool is_code_length_code)
 {
-  unordered_map<uint32_t, uint32_t> huffman_table;
-
-  // The maximum length is stored in the main table as it is needed for reading
-  // the table later.
-  uint32_t max_length = *max_element(lengths.begin(), lengths.end());
+  HuffmanTable table;
 
-  // The minimum length needs to be found in the loop.
-  uint32_t min_length = 15, code = 0;
+  // Count the number of codes of each length. Lengths above 15 are invalid.
+  vector<uint32_t> length_counts(16, 0);
+  for (auto length : lengths)
+  {
+    if (length > 15) throw runtime_error("Invalid Huffman code length");
+    ++length_counts[length];
+  }
+  length_counts[0] = 0;
 
-  for(uint32_t i = 1; i <= max_length; ++i) // For each possible length
+  // Count the bit patterns left unused as each length takes its share
+  int32_t unused_patterns = 1;
+  for (uint32_t bits = 1; bits < 16; ++bits)
   {
-    for(size_t j = 0; j < lengths.size(); ++j) // check each acutal length
+    unused_patterns = (unused_patterns << 1) - length_counts[bits];
+    if (unused_patterns < 0)
     {
-      if(lengths[j] == i) // If it matches, add it to the table.
-      {
-        // Creates the lookup value from the code value and number of bits
-        uint32_t&& lookup = (lengths[j] << 16)|BitFlip(code++, lengths[j]);
-
-        // Stores the result
-        huffman_table[lookup] = j;
-
-        // Update min_length if length is smaller the current smallest
-        if (i < min_length) min_length = i;
-      }
+      throw runtime_error("Over-subscribed Huffman code");
     }
-    // Bitshift code to the left so that there won't be any prefix clashes with
-    // higher bit-length sequences
-    code <<= 1;
   }
 
-  // Store the max and min lengths for easy lookup
-  huffman_table[0xfffff] = max_length;
-  huffman_table[0x00000] = min_length;
-
-  return huffman_table;
-}
-
-/*---------------------------------------------------------------------------*/
-// Mostly helpful as a debugger, this takes a representation of a bit-sequence
-// as it is given in the Huffman tree and returns a std::string of ones and
-// zeros to show the bits represented. It is a non-exported function and does
-// not appear in the header file.
-
-std::string PrintBits(uint32_t entry)
-{
-  std::string result = "";
+  // Find the longest code. The primary table never needs to be wider than this.
+  table.max_bits = 15;
+  while (table.max_bits > 0 && length_counts[table.max_bits] == 0)
+  {
+    --table.max_bits;
+  }
+  if (unused_patterns > 0 && (is_code_length_code || table.max_bits > 1))
+  {
+    throw runtime_error("Incomplete Huffman code");
+  }
+  table.primary_bits = min(lookup_bits, max(table.max_bits, (uint32_t) 1));
+  table.entries.assign(1 << table.primary_bits, 0);
+  uint32_t primary_mask = (1 << table.primary_bits) - 1;
+
+  // Canonical Huffman codes of each length start at the code following the
+  // last code of the previous length, shifted left by one bit
+  vector<uint32_t> next_code(16, 0);
+  for (uint32_t code = 0, bits = 1; bits < 16; ++bits)
+  {
+    code = (code + length_counts[bits - 1]) << 1;
+    next_code[bits] = code;
+  }
 
-  // Read the value and number of bits from the uint32
-  uint32_t n_bits = entry >> 16, value = entry & 0xffff;
+  // Assign each symbol its (reversed) code, and work out how many extra bits
+  // the sub-table for each long-code prefix will need
+  vector<uint32_t> codes(lengths.size(), 0);
+  vector<uint32_t> sub_table_bits(table.entries.size(), 0);
+  for (size_t symbol = 0; symbol < lengths.size(); ++symbol)
+  {
+    uint32_t length = lengths[symbol];
+    if (length == 0) continue;
+    codes[symbol] = BitFlip(next_code[length]++, length);
+    if (length > table.primary_bits)
+    {
+      uint32_t& sub_bits = sub_table_bits[codes[symbol] & primary_mask];
+      sub_bits = max(sub_bits, length - table.primary_bits);
+    }
+  }
 
-  // Set an initial mask to give only the number of bits needed for the value
-  uint32_t mask = 1 << (n_bits - 1);
+  // Reserve space for the sub-tables after the primary table, and link to them
+  for (size_t prefix = 0; prefix < sub_table_bits.size(); ++prefix)
+  {
+    if (sub_table_bits[prefix] == 0) continue;
+    uint32_t offset = table.entries.size();
+    table.entries[prefix] = 0x1000000 | (sub_table_bits[prefix] << 16) | offset;
+    table.entries.resize(offset + (1 << sub_table_bits[prefix]), 0);
+  }
 
-  // Now loops through from MSB to LSB to add a 1 or 0 to the string so that
-  // the string is presented in MSB -> LSB order
-  while(n_bits > 0)
+  // Now write the symbols into every table entry that their codes match
+  for (size_t symbol = 0; symbol < lengths.size(); ++symbol)
   {
-    if (mask & value) result = result + '1'; else result = result + '0';
-    mask = mask >> 1;
-    n_bits--;
+    uint32_t length = lengths[symbol], code = codes[symbol];
+    if (length == 0) continue;
+    uint32_t entry = (length << 16) | symbol;
+
+    if (length <= table.primary_bits)
+    {
+      for (uint32_t i = code; i <= primary_mask; i += (1 << length))
+      {
+        table.entries[i] = entry;
+      }
+    }
+    else
+    {
+      uint32_t link = table.entries[code & primary_mask];
+      uint32_t offset = link & 0xffff, sub_bits = (link >> 16) & 0xff;
+      uint32_t sub_length = length - table.primary_bits;
+      for (uint32_t i = code >> table.primary_bits; i < (1u << sub_bits);
+           i += (1 << sub_length))
+      {
+        table.entries[offset + i] = entry;
+      }
+    }
   }
-  return result;
+
+  return table;
 }
 
 /*---------------------------------------------------------------------------*/
 // This is the function that actually reads the bit stream to find the next
-// code, matching it against the appropriate Huffman map. The map is passed
-// by reference.
+// code. It peeks at enough bits to cover the longest code in the table, looks
+// up the primary entry (following a link to a sub-table if needed), and then
+// consumes only as many bits as the matched code actually used.
 
-uint32_t Deflate::ReadCode_(unordered_map<uint32_t, uint32_t>& map_to_read)
+inline uint32_t Deflate::ReadCode_(const HuffmanTable& table)
 {
-  // The maximum and minimum number of bits that may be required for a match
-  // in a given Huffman table is stored in the table itself and retrieved here.
-  uint32_t read_bits = map_to_read[0x00000], maxbits = map_to_read[0xfffff];
+  uint32_t bits = PeekBits(table.max_bits);
+  uint32_t entry = table.entries[bits & ((1 << table.primary_bits) - 1)];
 
-  // Start by reading in the minimum number of bits that could match
-  uint32_t read_value = GetBits(read_bits);
-
-  while(true) // The loop will run until explicitly exited by return or throw
+  // Follow the link to a sub-table for long codes
+  if (entry & 0x1000000)
   {
-    // Create a lookup key from the number of read bits and their value
-    auto lookup = map_to_read.find(read_value | (read_bits << 16));
+    uint32_t sub_bits = (entry >> 16) & 0xff;
+    uint32_t index = (bits >> table.primary_bits) & ((1 << sub_bits) - 1);
+    entry = table.entries[(entry & 0xffff) + index];
+  }
 
-    // If this isn't found, get the next bit and repeat the loop
-    if (lookup == map_to_read.end())
-    {
-      read_value = read_value + (GetBits(1) << read_bits++);
+  // A zero entry means no code matches the bits in the stream
+  uint32_t length = (entry >> 16) & 0xff;
+  if (length == 0) throw runtime_error("Couldn't find code");
 
-      // If we can't find a match in our lookup even with max_bits, something
-      // has gone wrong and we need to throw an error.
-      if (read_bits > maxbits) throw runtime_error("Couldn't find code");
-    }
-    // Otherwise, a match has been found so we return the looked-up value.
-    else return lookup->second;
-  }
+  ConsumeBits(length);
+  return entry & 0xffff;
 }
 
 /*---------------------------------------------------------------------------*/
-// Every deflate stream begins with two header bytes (CMF and FLG). This checks
-// they are valid before attempting to decompress. It will only allow the
-// compression method DEFLATE (CMF & 0x0f == 8), it will halt if the fixed
-// dictionary flag is set, and it will also throw if the checksum fails.
+// Reads the two header bytes and checks them
 
 void Deflate::CheckHeader_()
 {
   uint8_t cmf = GetByte(); // Gets first byte
   uint8_t flg = GetByte(); // Gets second byte
-
-  // Check compression method
-  if ((cmf & 0x0f) != 8) throw runtime_error("Invalid compression method.");
-
-  // Ensure checksum is modulo 31
-  if ((((cmf << 8) + flg) % 31)) throw runtime_error("Invalid check flag");
-
-  // Throw if FDCIT is set
-  if ((flg & 32) != 0) throw runtime_error("FDICT bit set in stream header");
+  CheckZlibHeader(cmf, flg);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -353,30 +352,20 @@ void Deflate::ReadBlock_()
   // the next two
   three_bit_header >>= 1;
 
-  // I'm not sure how often mode 0 is used, since there seems little point in
-  // having uncompressed data in a deflate stream. However, I have implemented
-  // it anyway, albeit in an inefficient manner whereby a Huffman tree is
-  // created for 8-bit numbers to return themselves via a Huffman Map.
-  if ( three_bit_header == 0)
+  // Mode 0 means the block is not compressed at all. Its contents are simply
+  // copied to the output, and there are no codes to read.
+  if (three_bit_header == 0)
   {
-    unordered_map<uint32_t, uint32_t> uncompressed_literal_codes;
-    for(uint32_t i = 0; i < 286; ++i)
-    {
-      auto flipped_bit = BitFlip(i, 8);
-      uncompressed_literal_codes[flipped_bit + 0x80000] = i;
-    }
-    // Remember the maximum and minimum bit lengths will both be 8.
-    uncompressed_literal_codes[0x00000] = 8;
-    uncompressed_literal_codes[0xfffff] = 8;
-    literal_map_ = uncompressed_literal_codes;
+    ReadStoredBlock_();
+    return;
   }
 
   // If the default dictionary is used, this is easy. We have this stored as
-  // a static object, and just use it as our literal and distance maps/
+  // a static object, and just use it as our literal and distance tables.
   if (three_bit_header == 1)
   {
-    literal_map_ = fixed_literal_map_;
-    distance_map_ = fixed_distance_map_;
+    literal_codes_ = &FixedLiteralCodes_();
+    distance_codes_ = &FixedDistanceCodes_();
   }
 
   // Most deflate streams will have their own dictionary. This is complex to
@@ -391,7 +380,31 @@ void Deflate::ReadBlock_()
 
   // Now we should be in a position to read our actual compressed data.
   ReadCodes_();
-};
+}
+
+/*---------------------------------------------------------------------------*/
+// A stored block starts at the next byte boundary with two little-endian
+// 16-bit numbers: the number of bytes in the block (LEN) and its one's
+// complement (NLEN). The bytes themselves follow directly, and once the length
+// has been validated they are copied to the output in one go.
+
+void Deflate::ReadStoredBlock_()
+{
+  AlignToByte();
+
+  uint32_t length = GetByte();
+  length |= GetByte() << 8;
+  uint32_t length_complement = GetByte();
+  length_complement |= GetByte() << 8;
+  if ((length ^ 0xffff) != length_complement)
+  {
+    throw runtime_error("Invalid stored block length in Deflate Stream.");
+  }
+
+  CopyInput(length);
+
+  if (OutputDue()) FlushOutput();
+}
 
 /*---------------------------------------------------------------------------*/
 
@@ -421,8 +434,8 @@ void Deflate::BuildDynamicCodeTable_()
     code_length_lengths[length_code_order[i]] = triplet;
   }
 
-  // Pass these lengths to our Huffman map reconstructor
-  auto code_length_table = Huffmanize_(code_length_lengths);
+  // Pass these lengths to our Huffman table reconstructor
+  auto code_length_table = Huffmanize_(code_length_lengths, 7, true);
 
   // Create an empty array for our literal / distance code lengths
   vector<uint32_t> code_lengths(total_code_count);
@@ -445,8 +458,15 @@ void Deflate::BuildDynamicCodeTable_()
       // Codes 17 and 18 write a sequence of zeros - make this default
       uint32_t repeat_this = 0;
 
-      // Code 16 repeats the last written entry instead
-      if (code == 16) repeat_this = code_lengths[write_head - 1];
+      // Code 16 repeats the last written entry instead, so can't come first
+      if (code == 16)
+      {
+        if (write_head == 0)
+        {
+          throw runtime_error("Repeat code with no previous length");
+        }
+        repeat_this = code_lengths[write_head - 1];
+      }
 
       // The number of repeats is given by a simple formula derived from a table
       // in RFC 1951
@@ -456,7 +476,10 @@ void Deflate::BuildDynamicCodeTable_()
       // Now write the desired element the desired number of times
       for (size_t i = 0; i < num_repeats; ++i)
       {
-        if(write_head > code_lengths.size()) break; // This shouldn't happen
+        if (write_head >= code_lengths.size())
+        {
+          throw runtime_error("Too many code lengths in Deflate stream");
+        }
         code_lengths[write_head++] = repeat_this;
       }
     }
@@ -472,9 +495,13 @@ void Deflate::BuildDynamicCodeTable_()
   auto&& literal_start = code_lengths.begin();
   auto&& literal_end = literal_start + literal_code_count;
 
-  // Now build our Huffman tree from the given length arrays
-  literal_map_ = Huffmanize_(vector<uint32_t>(literal_start, literal_end));
-  distance_map_= Huffmanize_(vector<uint32_t>(literal_end, code_lengths.end()));
+  // Now build our Huffman tables from the given length arrays
+  dynamic_literal_codes_ = Huffmanize_(
+    vector<uint32_t>(literal_start, literal_end), literal_lookup_bits_);
+  dynamic_distance_codes_ = Huffmanize_(
+    vector<uint32_t>(literal_end, code_lengths.end()), distance_lookup_bits_);
+  literal_codes_ = &dynamic_literal_codes_;
+  distance_codes_ = &dynamic_distance_codes_;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -489,9 +516,10 @@ void Deflate::ReadCodes_()
 
   while(code != 256) // continues indefinitely until explicitly exited.
   {
-    code = ReadCode_(literal_map_);               // Read the next code
+    code = ReadCode_(*literal_codes_);            // Read the next code
     if (code < 256) WriteOutput((uint8_t) code);  // If it's a literal, write it
     if (code > 256) HandlePointer_(code);         // If it's a length, handle it
+    if (OutputDue()) FlushOutput();               // Pass on a chunk if ready
   }
 }
 
@@ -511,6 +539,9 @@ void Deflate::HandlePointer_(uint32_t code)
   // length code 285 represents the maximum length of 258
   else if (code == 285) length_value = 258;
 
+  // The fixed Huffman codes include 286 and 287, but they mean nothing
+  else if (code > 285) throw runtime_error("invalid length code");
+
   // The other length codes (265 - 284) are less straightforward. Each of them
   // requires a specific number of extra bits to be read to determine the actual
   // length. The number of bits is easily calculated by (code - 261) / 4,
@@ -527,12 +558,14 @@ void Deflate::HandlePointer_(uint32_t code)
   }
 
   // Now we have our length, we need the distance. The distance codes are stored
-  // in their own table, and we now search for a match in the next few bits in
-  // the stream using the ReadCode() function
-  uint32_t distance_code = ReadCode_(distance_map_);
+  // in their own table, and we now look up the next few bits in the stream
+  // using the ReadCode() function
+  uint32_t distance_code = ReadCode_(*distance_codes_);
 
-  // The first four distance codes are 1-4.
+  // The first four distance codes are 1-4. As with the length codes, the
+  // fixed Huffman codes include two (30 and 31) that mean nothing.
   if(distance_code < 4) distance_value = distance_code + 1;
+  else if (distance_code > 29) throw runtime_error("invalid distance code");
 
   // The other distance codes (up to 31) can represent many thousands of
   // distances. Again, this depends on reading a specified number of extra
@@ -546,6 +579,12 @@ void Deflate::HandlePointer_(uint32_t code)
 
   // Now that we have our distance and length values, we look back in the
   // output at [output_.end() - distance] and start copying characters to the
-  // and of output_ until we have copied [length] characters.
+  // and of output_ until we have copied [length] characters. A distance that
+  // reaches back before the first byte written throws before anything is
+  // copied.
+  if (distance_value > RetainedOutput())
+  {
+    throw runtime_error("invalid distance too far back");
+  }
   AppendPrevious(distance_value, length_value);
 }
@@ -15,16 +15,80 @@
 
 #define PDFR_DEFLATE
 
-#include<map>
+#include<vector>
 #include "streams.h"
 
 std::string FlateDecode(std::string* message);
-std::string FlateDecode(const CharString& message);
+
+// expected_size, if not zero, is the decoded length the stream claims (from
+// its /DL entry). It is only used to size the output buffer.
+std::string FlateDecode(const CharString& message, size_t expected_size = 0);
+
+// Decompresses message, passing the output to sink in chunks as it is produced
+// so that the whole decompressed stream never has to be held in memory at once
+void FlateDecode(const CharString& message, const OutputSink& sink);
+
+//---------------------------------------------------------------------------//
+// FlateDecode doesn't inflate streams itself but hands them to a Decoder. The
+// built-in decoder uses the Deflate class below and is always available. If
+// the package was configured against zlib or libdeflate, a decoder using that
+// library is chosen instead (see decoders.cpp and the configure script). All
+// decoders produce identical output, and all throw a runtime_error if the
+// stream is invalid or truncated. Chunked output is always produced by a
+// streaming decoder (zlib or the built-in one), so that it needs no more than
+// a window of output in memory whichever library inflates whole streams.
+
+class Decoder
+{
+ public:
+  virtual ~Decoder() {}
+
+  // Inflates a zlib-wrapped stream into a string. A non-zero expected_size is
+  // a guess at the size of the output, which may be wrong.
+  virtual std::string Inflate(const CharString&,
+                              size_t expected_size = 0) const = 0;
+
+  // Inflates a zlib-wrapped stream, passing the output to sink in chunks
+  virtual void Inflate(const CharString&, const OutputSink&) const = 0;
+
+  // The name of the library doing the work, e.g. "builtin" or "zlib"
+  virtual std::string Name() const = 0;
+};
+
+// The decoder used by FlateDecode
+const Decoder& GetFlateDecoder();
+
+// The dependency-free decoder, whichever library the package was built with
+const Decoder& GetBuiltInDecoder();
+
+// Throws unless the two zlib header bytes ask for plain Deflate compression
+void CheckZlibHeader(uint8_t cmf, uint8_t flg);
+
+//---------------------------------------------------------------------------//
+// A Huffman code is decoded by direct lookup rather than by searching. The
+// next few bits of the stream (the "primary" bits) are used as an index into
+// the entries vector, and the entry found there gives both the decoded symbol
+// and the number of bits its code actually used. Codes longer than the primary
+// bits are rare, so rather than make the primary table enormous, the primary
+// entry for their prefix points instead to a small sub-table stored further
+// along the same vector, which is indexed by the bits after the prefix.
+//
+// Each entry is packed into a uint32_t: the low 16 bits hold the symbol (or
+// the offset of a sub-table), bits 16 - 23 hold the code length (or the number
+// of bits used to index a sub-table), and bit 24 flags a sub-table link. An
+// entry of zero means no code matches those bits.
+
+struct HuffmanTable
+{
+  uint32_t primary_bits;          // Number of bits used to index the table
+  uint32_t max_bits;              // Length of the longest code in the table
+  std::vector<uint32_t> entries;  // Primary table followed by sub-tables
+};
 
 //---------------------------------------------------------------------------//
 // This class reinvents the wheel in an attempt to free the library from
 // dependencies. It is a full implementation of Deflate decompression. It uses
-// std::map for storing and looking up Huffman trees and inherits from Stream
+// multi-level lookup tables for decoding Huffman codes and inherits from Stream
 // to give it an easy interface to the underlying stream. Only the constructor
 // is public.
 
@@ -35,13 +99,16 @@ class Deflate : public Stream
   Deflate(const std::string*);
   Deflate(const CharString&);
 
+  // Chunked constructor: output goes to the sink rather than being kept
+  Deflate(const CharString&, const OutputSink&);
+
  private:
   bool is_last_block_;    // Flag so decompressor knows when to stop
 
-  // The fixed literal and distance maps are used if compression used a
-  // fixed dictionary. Usually this only happens with short messages.
-  static const std::unordered_map<uint32_t, uint32_t> fixed_literal_map_;
-  static const std::unordered_map<uint32_t, uint32_t> fixed_distance_map_;
+  // The number of bits used to index the primary literal and distance tables.
+  // Nearly all literal / length codes fit in 9 bits and distance codes in 6.
+  static const uint32_t literal_lookup_bits_ = 9;
+  static const uint32_t distance_lookup_bits_ = 6;
 
   // If we come across a length code or a distance code, we need to know
   // how many extra bytes to read. This is looked up in these tables.
@@ -49,22 +116,37 @@ class Deflate : public Stream
   static const std::vector<uint32_t> distance_table_;
 
   // Whether its fixed or dynamic compression, we want to end up with a literal
-  // and distance map that we can look up.
-  std::unordered_map<uint32_t, uint32_t> literal_map_;
-  std::unordered_map<uint32_t, uint32_t> distance_map_;
+  // and distance table that we can look up. These point either to the shared
+  // fixed tables or to the dynamic tables built for the current block.
+  const HuffmanTable* literal_codes_;
+  const HuffmanTable* distance_codes_;
+  HuffmanTable dynamic_literal_codes_;
+  HuffmanTable dynamic_distance_codes_;
 
+  // The largest distance a Deflate back-reference can reach
+  static const size_t window_size_ = 32768;
+
+  void Inflate_();                 // Runs the decompression from the start
   void CheckHeader_();             // Read first two bytes to ensure valid
   void ReadBlock_();               // Co-ordinates reading of a single block
+  void ReadStoredBlock_();         // Copies an uncompressed block to output
   void BuildDynamicCodeTable_();   // Builds lookup tables for each block
   void ReadCodes_();               // Actual reading of compressed data
   void HandlePointer_(uint32_t);   // Deals with length & distance pointers
 
   // Finds the next code in the input stream using given lookup table
-  uint32_t ReadCode_(std::unordered_map<uint32_t, uint32_t>&);
-
-  // Creates a Huffman tree from a vector of bit lengths.
-  std::unordered_map<uint32_t, uint32_t>
-    Huffmanize_(const std::vector<uint32_t>&);
+  inline uint32_t ReadCode_(const HuffmanTable&);
+
+  // Creates a Huffman lookup table from a vector of bit lengths, throwing if
+  // they don't make a valid code. The code length code (used to send the
+  // others in a dynamic block) may not have a single one-bit code.
+  static HuffmanTable Huffmanize_(const std::vector<uint32_t>&, uint32_t,
+                                  bool is_code_length_code = false);
+
+  // The tables used for blocks compressed with the fixed Huffman codes. These
+  // are built once, on first use, and shared by every Deflate object.
+  static const HuffmanTable& FixedLiteralCodes_();
+  static const HuffmanTable& FixedDistanceCodes_();
 };
 
 
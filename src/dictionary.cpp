@@ -69,6 +69,7 @@ class DictionaryBuilder
 
   DictionaryBuilder(StringPointer dictionary_string_ptr);
   DictionaryBuilder(StringPointer dictionary_string_ptr, size_t start_position);
+  DictionaryBuilder(const ByteSource& file, size_t start_position);
   DictionaryBuilder(const CharString& charstring);
   DictionaryBuilder();
   std::unordered_map<std::string, std::string>&& Get();
@@ -141,6 +142,15 @@ DictionaryBuilder::DictionaryBuilder(StringPointer ptr, size_t offset)
   else TokenizeDictionary_();
 }
 
+// The same, reading straight from the file's ByteSource
+DictionaryBuilder::DictionaryBuilder(const ByteSource& file, size_t offset)
+  : bracket_(0), key_pending_(false),
+    buf_(Reader(file, offset)), state_(PREENTRY)
+{
+  if (file.empty()) *this = DictionaryBuilder();
+  else TokenizeDictionary_();
+}
+
 /*---------------------------------------------------------------------------*/
 // This is the main loop which iterates through the string, reads the char,
 // finds its type and then runs the subroutine that deals with the current
@@ -305,7 +315,8 @@ void DictionaryBuilder::HandleValue_()
 /*---------------------------------------------------------------------------*/
 // The lexer is in an array. It will blindly copy the array until it gets
 // to the matching closing bracket unless there is a closing bracket within
-// a string to handle
+// a string to handle. An array cut off by the end of a damaged file stops
+// at the end of the string.
 
 void DictionaryBuilder::HandleArrayValue_()
 {
@@ -313,7 +324,7 @@ void DictionaryBuilder::HandleArrayValue_()
   bool escape_state = false;
   int depth = 1;
 
-  while (depth)
+  while (depth && !buf_.HasOverflowed())
   {
     if (!escape_state && CharIs('('))   in_substring = true;
     if (!escape_state && CharIs(')'))   in_substring = false;
@@ -468,6 +479,11 @@ Dictionary::Dictionary(shared_ptr<const string> string_ptr, size_t offset)
   map_ = move(DictionaryBuilder(string_ptr, offset).Get());
 }
 
+Dictionary::Dictionary(const ByteSource& file, size_t offset)
+{
+  map_ = move(DictionaryBuilder(file, offset).Get());
+}
+
 
 /*---------------------------------------------------------------------------*/
 // Returns a single object number from any reference found in the
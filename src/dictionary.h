@@ -65,6 +65,8 @@ class Dictionary
 
   Dictionary(StringPointer dictionary_string_ptr, size_t start_position);
 
+  Dictionary(const ByteSource& file, size_t start_position);
+
   Dictionary(const CharString&);
 
   Dictionary(std::unordered_map<std::string, std::string> m): map_(m){};
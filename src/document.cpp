@@ -14,9 +14,14 @@
 #include "xref.h"
 #include "object_class.h"
 #include "document.h"
+#include "font.h"
+#include "scheduler.h"
+#include "sidecar.h"
 #include<iostream>
 #include<Rcpp.h>
 #include<iterator>
+#include<algorithm>
+#include<set>
 
 
 //---------------------------------------------------------------------------//
@@ -31,10 +36,15 @@ using namespace std;
 // This is just a helper function to create Document objects. It is the
 // "final common pathway" of both non-default Document constructor functions
 // and is seperated out to make this clear and avoid duplication of code
+//
+// Decoding every object stream up front needs the full XRef, so a first-page
+// XRef is only tried when opening on one thread.
 
-void Document::BuildDocument_()
+void Document::BuildDocument_(int n_threads, bool first_page)
 {
-  xref_ = make_shared<const XRef>(make_shared<string>(file_string_));
+  if (first_page && n_threads == 1) xref_ = XRef::FromFirstPage(file_);
+  if (!xref_) xref_ = make_shared<const XRef>(file_);
+  if (n_threads != 1) DecodeObjectStreams_(n_threads);
 
   // The pointer to the catalog is given under /Root in the trailer dictionary
   int&& root_number = xref_->GetTrailer().GetReference("/Root");
@@ -44,6 +54,24 @@ void Document::BuildDocument_()
 
   // Else get the object number of the /Pages dictionary
   int&& page_object_number = catalog.GetReference("/Pages");
+  page_tree_root_ = page_object_number;
+  is_page_tree_expanded_ = false;
+  first_page_ = -1;
+
+  // A linearized file names its first page and gives its page count, so the
+  // page tree (which is not in the first-page section) needn't be read
+  if (xref_->IsFirstPageOnly())
+  {
+    Dictionary linearization = xref_->GetLinearization();
+    int page = linearization.GetInts("/O")[0];
+    int count = linearization.GetInts("/N")[0];
+    if (count > 0 && GetObject(page)->GetDictionary()["/Type"] == "/Page")
+    {
+      first_page_ = page;
+      page_count_ = count;
+      return;
+    }
+  }
 
   // Now fetch that object and store it
   auto&& directory = Dictionary(GetObject(page_object_number)->GetDictionary());
@@ -52,8 +80,191 @@ void Document::BuildDocument_()
   if (!directory.ContainsReferences("/Kids"))
     throw runtime_error("No Kids entry in /Pages");
 
-  // Populate the page object numbers by expanding the /Kids references
-  page_object_numbers_ = ExpandKids_(directory.GetReferences("/Kids"));
+  // The page count is taken from the root of the page tree. If it doesn't
+  // give one, we have to count the pages by reading the whole tree.
+  vector<int> count = directory.GetInts("/Count");
+  if (!count.empty() && count[0] >= 0) page_count_ = count[0];
+  else ExpandPageTree_();
+}
+
+/*---------------------------------------------------------------------------*/
+// The sidecar holds the saved XRef (see XRef::Save), then the page tree root
+// and the object number of every page. Anything wrong with it just means the
+// Document is built from the file instead. Failing to write a new sidecar
+// doesn't stop the Document being used, and nor does a page tree that can't
+// be read in full, which is left to raise its error when a page is wanted.
+
+void Document::BuildFromSidecar_(const string& file_path,
+                                 const string& sidecar_path, int n_threads)
+{
+  try
+  {
+    SidecarReader sidecar(sidecar_path, file_path, *file_);
+    xref_ = make_shared<const XRef>(file_, sidecar);
+    page_tree_root_ = (int) sidecar.GetInt();
+    page_object_numbers_.resize(sidecar.GetCount(8));
+    for (auto& page : page_object_numbers_) page = (int) sidecar.GetInt();
+    page_count_ = page_object_numbers_.size();
+    is_page_tree_expanded_ = true;
+    first_page_ = -1;
+    return;
+  }
+  catch (runtime_error&)
+  {
+    xref_.reset();
+    page_object_numbers_.clear();
+  }
+
+  BuildDocument_(n_threads, false);
+  try
+  {
+    if (!is_page_tree_expanded_) ExpandPageTree_();
+  }
+  catch (runtime_error&)
+  {
+    return;
+  }
+
+  SidecarWriter sidecar;
+  xref_->Save(sidecar);
+  sidecar.PutInt(page_tree_root_);
+  sidecar.PutInt(page_object_numbers_.size());
+  for (int page : page_object_numbers_) sidecar.PutInt(page);
+  sidecar.WriteTo(sidecar_path, file_path, *file_);
+}
+
+/*---------------------------------------------------------------------------*/
+// Each object stream is fetched through the cache, so it is decoded and
+// indexed once and kept for when its objects are asked for. An object stream
+// that can't be read is left for now: the error is raised again if one of its
+// objects is actually needed.
+
+void Document::DecodeObjectStreams_(int n_threads)
+{
+  vector<int> object_streams = xref_->GetObjectStreamNumbers();
+  if (object_streams.size() < min_object_streams_) return;
+
+  Scheduler scheduler(object_streams.size(), n_threads);
+  if (scheduler.NumberOfThreads() < 2) return;
+
+  scheduler.Run([&](size_t task) -> void
+  {
+    try
+    {
+      GetObject(object_streams[task]);
+    }
+    catch (const exception&) {}
+  });
+}
+
+/*---------------------------------------------------------------------------*/
+// Finds a page by going down the page tree from the root. At each node, we
+// work along its children, skipping over as many pages as each child holds,
+// until we reach the child that holds the page we want. If that child is a
+// page, we are done; otherwise we carry on down from it. Only the children
+// that are passed over or gone into are read, and each is only read once.
+//
+// If we run out of children before finding the page, or a child doesn't give
+// its page count, the /Count entries can't be trusted, so the whole tree is
+// read instead and the page count corrected to match it.
+
+int Document::GetPageObjectNumber(size_t page_number)
+{
+  lock_guard<mutex> lock(page_tree_mutex_);
+  if (page_number >= page_count_) throw runtime_error("Invalid page number");
+  if (is_page_tree_expanded_) return page_object_numbers_[page_number];
+  if (page_number == 0 && first_page_ != -1) return first_page_;
+
+  int node = page_tree_root_;
+  size_t pages_to_skip = page_number;
+  for (int depth = 0; depth < max_page_tree_depth_; depth++)
+  {
+    bool is_found = false;
+    for (auto& kid : ReadPageTreeNode_(node))
+    {
+      if (kid.count < 0 && !ReadPageTreeKid_(kid)) break;
+      if (pages_to_skip >= (size_t) kid.count)
+      {
+        pages_to_skip -= kid.count;
+        continue;
+      }
+      if (kid.is_page) return kid.object_number;
+      node = kid.object_number;
+      is_found = true;
+      break;
+    }
+    if (!is_found) break;
+  }
+
+  ExpandPageTree_();
+  if (page_number >= page_count_) throw runtime_error("Invalid page number");
+  return page_object_numbers_[page_number];
+}
+
+/*---------------------------------------------------------------------------*/
+
+vector<int> Document::GetPageObjectNumbers()
+{
+  lock_guard<mutex> lock(page_tree_mutex_);
+  if (!is_page_tree_expanded_) ExpandPageTree_();
+  return page_object_numbers_;
+}
+
+/*---------------------------------------------------------------------------*/
+
+size_t Document::GetPageCount()
+{
+  lock_guard<mutex> lock(page_tree_mutex_);
+  return page_count_;
+}
+
+/*---------------------------------------------------------------------------*/
+// The children of a node are listed when the node is first read, but each
+// child is only read when it is needed
+
+vector<Document::PageTreeKid>& Document::ReadPageTreeNode_(int object_number)
+{
+  auto found = page_tree_.find(object_number);
+  if (found != page_tree_.end()) return found->second;
+
+  vector<PageTreeKid> kids;
+  auto dictionary = GetObject(object_number)->GetDictionary();
+  for (int kid : dictionary.GetReferences("/Kids"))
+  {
+    kids.push_back({kid, -1, false});
+  }
+  return page_tree_[object_number] = move(kids);
+}
+
+/*---------------------------------------------------------------------------*/
+// As when the whole tree is read (see below), a child is a page if it has no
+// /Kids of its own. Returns false if a node doesn't say how many pages it has.
+
+bool Document::ReadPageTreeKid_(PageTreeKid& kid)
+{
+  auto dictionary = GetObject(kid.object_number)->GetDictionary();
+  if (dictionary.GetReferences("/Kids").empty())
+  {
+    kid.is_page = true;
+    kid.count = 1;
+    return true;
+  }
+
+  vector<int> count = dictionary.GetInts("/Count");
+  if (count.empty() || count[0] < 0) return false;
+  kid.count = count[0];
+  return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// Reads the whole page tree. The caller holds the page tree lock.
+
+void Document::ExpandPageTree_()
+{
+  auto root = GetObject(page_tree_root_)->GetDictionary();
+  page_object_numbers_ = ExpandKids_(root.GetReferences("/Kids"));
+  page_count_ = page_object_numbers_.size();
+  is_page_tree_expanded_ = true;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -66,10 +277,10 @@ void Document::BuildDocument_()
 // model this with a tree structure was actually slower than just implementing
 // it with a std::list.
 //
-// This function takes a lot of the time needed for document creation. It is
-// not that the algorithm is particularly slow; rather, it has to create all the
-// objects it comes across, and there are at least as many of these are there
-// are pages.
+// This function takes a lot of time for a large document. It is not that the
+// algorithm is particularly slow; rather, it has to create all the objects it
+// comes across, and there are at least as many of these are there are pages.
+// That is why it is only used when every page is wanted.
 
 vector<int> Document::ExpandKids_(const vector<int>& object_numbers)
 {
@@ -118,42 +329,347 @@ vector<int> Document::ExpandKids_(const vector<int>& object_numbers)
 // One of two public interface functions after Document object creation. This
 // returns an object of Object class with the requested object number. It first
 // checks to see whether that object has been retrieved before. If so, it
-// returns it from the 'objects' vector. If not, it creates the object then
-// stores a copy in the 'objects' vector before returning the requested object.
+// returns it from the cache, waiting for it if another thread is still
+// building it. If not, it records a promise of the object in the cache so
+// that other threads wait for this one, then builds it outside the lock.
+//
+// If building the object fails, the entry is removed again so that a later
+// request gets a fresh attempt, and any threads already waiting get the
+// same exception as this one.
+//
+// Building an object can mean getting others first (the object stream that
+// holds it, say). If that leads back to the object itself, this thread would
+// wait for its own promise forever, so each thread keeps a note of the
+// objects it is building and throws instead.
 
 shared_ptr<Object> Document::GetObject(int object_number)
 {
-  // Check if object n is already stored
-  if (object_cache_.find(object_number) == object_cache_.end())
+  static thread_local set<pair<const Document*, int>> objects_being_built;
+  auto building = make_pair((const Document*) this, object_number);
+  if (objects_being_built.count(building))
+  {
+    throw runtime_error("Object is needed to build itself");
+  }
+
+  CacheShard& shard = object_cache_[(size_t) object_number % cache_shards_];
+  promise<shared_ptr<Object>> object_promise;
+  CachedObject cached;
+  {
+    lock_guard<mutex> lock(shard.mutex);
+    auto found = shard.objects.find(object_number);
+    if (found != shard.objects.end()) cached = found->second;
+    else shard.objects[object_number] = object_promise.get_future().share();
+  }
+
+  // If it was already cached, get() waits for it and rethrows any failure
+  if (cached.valid()) return cached.get();
+
+  objects_being_built.insert(building);
+  try
+  {
+    auto object_ptr = BuildObject_(object_number);
+    objects_being_built.erase(building);
+    object_promise.set_value(object_ptr);
+    return object_ptr;
+  }
+  catch (...)
   {
-    // If it is not stored, check whether it is in an object stream
-    size_t holder = xref_->GetHoldingNumberOf(object_number);
+    objects_being_built.erase(building);
+    {
+      lock_guard<mutex> lock(shard.mutex);
+      shard.objects.erase(object_number);
+    }
+    object_promise.set_exception(current_exception());
+    throw;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Built in the same way as GetObject: the first thread to ask for a font
+// leaves a future in the cache, builds the Font without holding the lock, and
+// fulfils the future. A Font that can't be built isn't cached.
 
-    // If object is in a stream, create it recursively from the stream object.
-    // Otherwise create & store it directly
-    if (holder)
+shared_ptr<Font> Document::GetFont(const Dictionary& fonts,
+                                   const string& font_name)
+{
+  string descriptor = fonts.GetString(font_name);
+  bool is_direct = descriptor.find("<<") != string::npos;
+  int reference = is_direct ? 0 : fonts.GetReference(font_name);
+  string key = is_direct ? descriptor : to_string(reference);
+
+  promise<shared_ptr<Font>> font_promise;
+  CachedFont cached;
+  {
+    lock_guard<mutex> lock(font_mutex_);
+    auto found = font_cache_.find(key);
+    if (found != font_cache_.end())
     {
-      auto&& obj_ptr = make_shared<Object>(GetObject(holder), object_number);
-      object_cache_[object_number] = obj_ptr;
+      cached = found->second;
+      ++font_statistics_.hits;
     }
     else
     {
-      auto&& object_ptr = make_shared<Object>(xref_, object_number);
-      object_cache_[object_number] = object_ptr;
+      font_cache_[key] = font_promise.get_future().share();
+      ++font_statistics_.misses;
+    }
+  }
+
+  if (cached.valid()) return cached.get();
+
+  try
+  {
+    Dictionary font_dictionary;
+    if (is_direct)
+    {
+      font_dictionary = Dictionary(make_shared<string>(descriptor));
     }
+    else font_dictionary = Dictionary(GetObject(reference)->GetDictionary());
+
+    auto font = make_shared<Font>(shared_from_this(), font_dictionary,
+                                  font_name);
+    font_promise.set_value(font);
+    lock_guard<mutex> lock(font_mutex_);
+    ++font_statistics_.fonts;
+    return font;
+  }
+  catch (...)
+  {
+    {
+      lock_guard<mutex> lock(font_mutex_);
+      font_cache_.erase(key);
+    }
+    font_promise.set_exception(current_exception());
+    throw;
   }
-  return object_cache_[object_number];
 }
 
 /*---------------------------------------------------------------------------*/
-// Public function that gets a specific page header from the pageheader vector
+
+Document::FontStatistics Document::GetFontStatistics()
+{
+  lock_guard<mutex> lock(font_mutex_);
+  return font_statistics_;
+}
+
+/*---------------------------------------------------------------------------*/
+// If the object is in an object stream, it is created from the holding object,
+// which is fetched (and so cached) in turn. The holder is cached like any other
+// object, so however many threads ask for objects in the same object stream,
+// it is only decoded once. Objects not in object streams are read directly.
+//
+// An object in an object stream may be nothing but a reference to another
+// object, in which case that object is built instead. The chain of references
+// is only followed so far, in case it goes round in a loop. Objects read from
+// the file resolve filter entries given by reference through GetObject.
+
+shared_ptr<Object> Document::BuildObject_(int object_number)
+{
+  for (int references = 0; references < 8; references++)
+  {
+    auto xref = GetXRef_(object_number);
+    size_t holder = xref->GetHoldingNumberOf(object_number);
+    if (!holder)
+    {
+      return make_shared<Object>(xref, object_number, stream_cache_,
+                                 [this](int number){return GetObject(number);});
+    }
+
+    auto object = make_shared<Object>(GetObject(holder), object_number);
+    if (!object->GetReferencedObject()) return object;
+    object_number = object->GetReferencedObject();
+  }
+  throw runtime_error("Object references go round in a loop");
+}
+
+/*---------------------------------------------------------------------------*/
+// Objects already made from the first-page XRef keep a pointer to it, which
+// is still right for them, since the first-page section of an unchanged
+// linearized file agrees with the main XRef about where its objects are.
+
+shared_ptr<const XRef> Document::GetXRef_(int object_number)
+{
+  lock_guard<mutex> lock(xref_mutex_);
+  if (xref_->IsFirstPageOnly() && !xref_->ContainsObject(object_number))
+  {
+    xref_ = make_shared<const XRef>(file_);
+  }
+  return xref_;
+}
+
+/*---------------------------------------------------------------------------*/
+// An object still being built by another thread is released as well. That
+// thread will still get its object, but the next request will build it again.
+
+void Document::ReleaseObjects(const vector<int>& object_numbers)
+{
+  for (int object_number : object_numbers)
+  {
+    CacheShard& shard = object_cache_[(size_t) object_number % cache_shards_];
+    lock_guard<mutex> lock(shard.mutex);
+    shard.objects.erase(object_number);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Public function that gets a specific page header from the page tree
 
 Dictionary Document::GetPageHeader(size_t page_number)
 {
-  // Ensure the pagenumber is valid
-  if (page_object_numbers_.size() < page_number)
-    throw runtime_error("Invalid page number");
+  // This throws if the page number is invalid
+  return GetObject(GetPageObjectNumber(page_number))->GetDictionary();
+}
+
+/*---------------------------------------------------------------------------*/
+// A page without a crop box shows the whole of its media box
+
+Document::PageInfo Document::GetPageInfo(size_t page_number)
+{
+  PageInfo info = ReadPageInfo_(GetPageObjectNumber(page_number), 0);
+  if (info.crop_box.empty()) info.crop_box = info.media_box;
+  return info;
+}
+
+/*---------------------------------------------------------------------------*/
+// Reads what a page or /Pages node gives in its own dictionary, then fills in
+// anything missing from its parent. Only dictionaries are read. A /Pages node
+// is usually the parent of many pages, so what it gives (itself or by
+// inheritance) is kept for the next of its children to ask. A box that isn't
+// four numbers (such as one given by reference) is skipped over.
 
-  // All good - return the requested header
-  return object_cache_[page_object_numbers_[page_number]]->GetDictionary();
+Document::PageInfo Document::ReadPageInfo_(int object_number, int depth)
+{
+  PageInfo info {{}, {}, 0, {}};
+  bool has_rotate = false, has_resources = false;
+  auto object = GetObject(object_number);
+  Dictionary& header = object->GetDictionary();
+
+  if (header.HasKey("/MediaBox"))
+  {
+    info.media_box = header.GetFloats("/MediaBox");
+    if (info.media_box.size() != 4) info.media_box.clear();
+  }
+  if (header.HasKey("/CropBox"))
+  {
+    info.crop_box = header.GetFloats("/CropBox");
+    if (info.crop_box.size() != 4) info.crop_box.clear();
+  }
+  if (header.HasKey("/Rotate"))
+  {
+    vector<int> rotate = header.GetInts("/Rotate");
+    if (!rotate.empty()) info.rotate = ((rotate[0] / 90) % 4 + 4) % 4 * 90;
+    has_rotate = true;
+  }
+  if (header.HasKey("/Resources"))
+  {
+    info.fonts = ReadFontNames_(GetSubdictionary_(header, "/Resources"));
+    has_resources = true;
+  }
+
+  bool is_complete = !info.media_box.empty() && !info.crop_box.empty() &&
+                     has_rotate && has_resources;
+  if (is_complete || depth >= max_page_tree_depth_ ||
+      !header.ContainsReferences("/Parent")) return info;
+
+  int parent = header.GetReference("/Parent");
+  PageInfo inherited;
+  bool is_cached = false;
+  {
+    lock_guard<mutex> lock(page_info_mutex_);
+    auto found = page_info_cache_.find(parent);
+    if (found != page_info_cache_.end())
+    {
+      inherited = found->second;
+      is_cached = true;
+    }
+  }
+  if (!is_cached)
+  {
+    inherited = ReadPageInfo_(parent, depth + 1);
+    lock_guard<mutex> lock(page_info_mutex_);
+    page_info_cache_[parent] = inherited;
+  }
+
+  if (info.media_box.empty()) info.media_box = inherited.media_box;
+  if (info.crop_box.empty()) info.crop_box = inherited.crop_box;
+  if (!has_rotate) info.rotate = inherited.rotate;
+  if (!has_resources) info.fonts = inherited.fonts;
+  return info;
+}
+
+/*---------------------------------------------------------------------------*/
+// The fonts in a resource dictionary, sorted by the names the page uses, each
+// with its PostScript name as Font::GetFontName gives it, without any subset
+// tag. Only the font dictionaries are read.
+
+vector<pair<string, string>> Document::ReadFontNames_(
+  const Dictionary& resources)
+{
+  vector<pair<string, string>> result;
+  Dictionary fonts = GetSubdictionary_(resources, "/Font");
+  vector<string> names = fonts.GetAllKeys();
+  sort(names.begin(), names.end());
+
+  for (auto& name : names)
+  {
+    string base_font = GetSubdictionary_(fonts, name).GetString("/BaseFont");
+    if (base_font.size() > 7 && base_font[7] == '+') base_font.erase(0, 8);
+    else if (!base_font.empty()) base_font.erase(0, 1);
+    result.push_back({name, base_font});
+  }
+  return result;
+}
+
+/*---------------------------------------------------------------------------*/
+// Strings in the information dictionary are encrypted with the dictionary's
+// own object number, unless it is in an object stream, whose strings are
+// encrypted along with the rest of the stream. Entries that aren't strings,
+// such as /Trapped, are given as they are written.
+
+vector<pair<string, string>> Document::GetInfo()
+{
+  vector<pair<string, string>> result;
+  Dictionary trailer;
+  {
+    lock_guard<mutex> lock(xref_mutex_);
+    trailer = xref_->GetTrailer();
+  }
+  if (!trailer.ContainsReferences("/Info")) return result;
+
+  int info_number = trailer.GetReference("/Info");
+  auto xref = GetXRef_(info_number);
+  Dictionary info = GetObject(info_number)->GetDictionary();
+  bool is_encrypted = xref->IsEncrypted() &&
+                      !xref->GetHoldingNumberOf(info_number);
+
+  vector<string> keys = info.GetAllKeys();
+  sort(keys.begin(), keys.end());
+  for (auto& key : keys)
+  {
+    string value = info.GetString(key);
+    size_t start = value.find_first_not_of(" \t\r\n");
+    if (start != string::npos && (value[start] == '(' || value[start] == '<'))
+    {
+      value = ReadStringBytes(value);
+      if (is_encrypted) xref->DecryptString(value, info_number, 0);
+      value = TextStringToUtf8(value);
+    }
+    result.push_back({key.substr(1), value});
+  }
+  return result;
+}
+
+/*---------------------------------------------------------------------------*/
+
+Dictionary Document::GetSubdictionary_(const Dictionary& dictionary,
+                                       const string& key)
+{
+  if (dictionary.ContainsDictionary(key))
+  {
+    return dictionary.GetDictionary(key);
+  }
+  if (dictionary.ContainsReferences(key))
+  {
+    return GetObject(dictionary.GetReference(key))->GetDictionary();
+  }
+  return Dictionary();
 }
@@ -31,8 +31,10 @@
  * Each Document will have one and only one xref class. Instead of a pointer to
  * the xref as in other classes, the xref is actually a data member of the
  * Document class. PDF objects are created and stored in a map for easy access.
- * The file string is stored here and any other class that needs to read the
- * file accesses a pointer to the filestring held in the Document class.
+ * The file's contents are held in a ByteSource, which maps the file into
+ * memory rather than reading it in where it can. The Document and its XRef
+ * share a pointer to it, and any other class that needs to read the file
+ * does so through the XRef.
  *
  * The Document class is therefore self-contained, in that after the initial
  * step of reading in the file, it has everything in needs to build up its
@@ -42,70 +44,266 @@
  * objects with key:value dictionaries and uncompressed streams without being
  * concerned about how that is implemented.
  *
+ * Objects stay in the cache for the life of the Document, since fonts and
+ * object streams in particular are shared between pages. Their decoded
+ * streams, which take up most of the memory, are kept within a budget by the
+ * Document's StreamCache (see object_class.h), and decoded again if they are
+ * needed after being dropped. When working through
+ * a very large document a page at a time, the objects that belonged to each
+ * page alone can be released from the cache once the page is done with, so
+ * that memory use doesn't grow with the number of pages.
+ *
+ * Fonts are built by the Document rather than by the pages that use them, and
+ * kept for its life, so a font used on every page of a long document is only
+ * read once. Pages hold their own map of the names they give to the Fonts.
+ *
  * The Document also needs to have an outline of its own logical structure,
- * in terms of the pages it contains and where they are located. Part of the
- * task of Document creation is therefore to count and locate the objects
- * that act as page descriptors. It does this by finding the catalog
- * dictionary and then following pointers to dictionaries that contain
- * individual page headers. There is then a "getter" function for other classes
- * to access the dictionary pertaining to a particular page
+ * in terms of the pages it contains and where they are located. The pages
+ * are the leaves of a tree of /Pages nodes, whose root is named by the
+ * catalog dictionary. Each node gives the number of pages below it in its
+ * /Count entry, so rather than reading the whole tree when the document is
+ * opened, the Document reads only the root's page count, and finds a given
+ * page by going down the tree, choosing at each node the child whose range
+ * of pages holds it. The nodes read on the way are kept for later lookups.
+ * Reading one page of a very large document thus reads only a handful of
+ * nodes. The whole tree is only read if every page's object number is asked
+ * for, or if the /Count entries turn out not to match the tree. There is then
+ * a "getter" function for other classes to access the dictionary pertaining
+ * to a particular page
+ *
+ * Objects in object streams are normally read as they are needed, which means
+ * the object streams are decoded one at a time as the page tree and the first
+ * pages are read. A Document can instead be opened with several threads, in
+ * which case every object stream is decoded in parallel as soon as the XRef
+ * has been read. This isn't worth doing for documents with only a few object
+ * streams, so for them it is skipped.
+ *
+ * A service that only ever shows the first page of a document can open it
+ * from the first-page XRef section of a linearized file (see xref.h). The
+ * page count and first page are then taken from the linearization
+ * dictionary, so neither the main XRef nor the page tree is read. If an
+ * object that isn't in the first-page section is asked for - as it will be
+ * for any later page - the full XRef is read at that point and used from then
+ * on, so the Document behaves just as if it had been opened normally.
+ *
+ * A file that is opened over and over can be given a sidecar (see sidecar.h)
+ * holding its XRef and the object numbers of all its pages. Opening it again
+ * then only needs the sidecar to be mapped and checked.
+ *
+ * Once built, a Document can be read from several threads at once, so that
+ * the pages of a large document can be extracted in parallel. The objects it
+ * hands out are shared between threads, and each Object and the XRef guard
+ * their own lazily filled caches. Logical structures built from the Document,
+ * such as Pages, are not shared: each thread builds its own.
  */
 
 #include<string>
 #include<vector>
 #include<unordered_map>
 #include<memory>
+#include<array>
+#include<future>
+#include<mutex>
+#include<utility>
 
 class Dictionary;
 class XRef;
 class Object;
+class Font;
 
 //---------------------------------------------------------------------------//
 // The public interface of the Document class comprises constructors and two
 // member functions - one to return any object from the pdf and one to retrieve
 // a specific page header.
 
-class Document
+class Document : public std::enable_shared_from_this<Document>
 {
  public:
-  // Constructor to create Document from file path
-  Document(const std::string& file_path)
-   : file_string_(GetFile(file_path))
-   { BuildDocument_(); }
+  // Constructor to create Document from file path. With n_threads other than
+  // 1, object streams are decoded up front on that many threads (or one per
+  // core if n_threads is less than 1). Otherwise, with first_page set, a
+  // linearized file is opened from its first-page XRef section.
+  Document(const std::string& file_path, int n_threads = 1,
+           bool first_page = false)
+   : file_(ByteSource::FromFile(file_path)),
+     stream_cache_(std::make_shared<StreamCache>()),
+     font_statistics_ {0, 0, 0}
+   { BuildDocument_(n_threads, first_page); }
+
+  // As above, but first trying the sidecar file at sidecar_path (see
+  // sidecar.h). If it is there and was made from this file, the XRef and
+  // page list are read back from it. Otherwise the Document is built as
+  // normal, its whole page list is read, and a new sidecar is written.
+  Document(const std::string& file_path, const std::string& sidecar_path,
+           int n_threads = 1)
+   : file_(ByteSource::FromFile(file_path)),
+     stream_cache_(std::make_shared<StreamCache>()),
+     font_statistics_ {0, 0, 0}
+   { BuildFromSidecar_(file_path, sidecar_path, n_threads); }
 
   // Constructor to create Document from raw data
-  Document(const std::vector<uint8_t>& byte_vector)
-   : file_string_(std::string(byte_vector.begin(), byte_vector.end()))
-   { BuildDocument_(); }
+  Document(const std::vector<uint8_t>& byte_vector, int n_threads = 1,
+           bool first_page = false)
+   : file_(std::make_shared<const ByteSource>(
+             std::string(byte_vector.begin(), byte_vector.end()))),
+     stream_cache_(std::make_shared<StreamCache>()),
+     font_statistics_ {0, 0, 0}
+   { BuildDocument_(n_threads, first_page); }
 
 
   // Gets a pointer to the Object specified by object_number. If the object has
   // previously been accessed, it will retrieve a pointer from the Object cache.
   // If it has not been accessed before, it will first create it. If the object
   // is inside an object stream, it will automatically add the holding object to
-  // the cache as well.
+  // the cache as well. Each object is only created once, even if several
+  // threads ask for it at the same time.
   std::shared_ptr<Object> GetObject(int object_number);
 
   // Returns the main header dictionary for page specified by page_number
   Dictionary GetPageHeader(size_t page_number);
 
-  // Accesses the private member containing object numbers of all page headers.
-  std::vector<int> GetPageObjectNumbers() const {return page_object_numbers_;};
+  // Returns the object numbers of all page headers, reading the whole page
+  // tree if it hasn't been read yet
+  std::vector<int> GetPageObjectNumbers();
+
+  // Finds the object number of one page header, reading as little of the
+  // page tree as it can
+  int GetPageObjectNumber(size_t page_number);
+
+  // The number of pages, as given by the root of the page tree
+  size_t GetPageCount();
+
+  // What can be known about a page from its header and the /Pages nodes above
+  // it, without reading its contents or building its fonts. A box, rotation
+  // or resource dictionary missing from the header is inherited from the
+  // nearest node above that has one.
+  struct PageInfo
+  {
+    std::vector<float> media_box;       // Empty if no node gives one
+    std::vector<float> crop_box;        // The media box unless given
+    int rotate;                         // Clockwise: 0, 90, 180 or 270
+    std::vector<std::pair<std::string, std::string>> fonts; // {name, font}
+  };
+  PageInfo GetPageInfo(size_t page_number);
+
+  // The entries of the document information dictionary (/Info) as UTF-8
+  // {key, value} pairs, sorted by key, with the slashes taken off the keys
+  std::vector<std::pair<std::string, std::string>> GetInfo();
+
+  // Drops the given objects from the cache, so that the memory they hold is
+  // freed once nothing else is using them. They are read from the file again
+  // if they are asked for later.
+  void ReleaseObjects(const std::vector<int>& object_numbers);
+
+  // The cache that keeps this Document's decoded streams within budget
+  StreamCache& GetStreamCache() {return *stream_cache_;}
+
+  // Gets the Font given under font_name in a /Font resource dictionary. The
+  // Font is built the first time any page asks for it, and shared with every
+  // other page that uses it, whatever name they give it. Each Font is only
+  // built once, even if several threads ask for it at the same time. The
+  // Document must be owned by a shared_ptr, which its Fonts are given.
+  std::shared_ptr<Font> GetFont(const Dictionary& fonts,
+                                const std::string& font_name);
+
+  // Counts of the Fonts built, and of requests for Fonts already built
+  struct FontStatistics
+  {
+    size_t fonts;        // Number of Fonts built
+    size_t hits;         // Requests for a Font that had already been built
+    size_t misses;       // Requests that built a new Font
+  };
+  FontStatistics GetFontStatistics();
 
  private:
-  const std::string file_string_;         // Full contents of file
+  std::shared_ptr<const ByteSource> file_; // Full contents of file
+  std::shared_ptr<StreamCache> stream_cache_; // Budget for decoded streams
   std::shared_ptr<const XRef> xref_;      // Pointer to creating XRef object
+  std::mutex xref_mutex_;                 // Guards xref_ once built
+
+  // The page tree. Each /Pages node that has been read is stored with its
+  // children, and the number of pages under each child once that child has
+  // been read. The full list of pages is only filled in when it is needed.
+  struct PageTreeKid
+  {
+    int object_number;  // The child's object number
+    int64_t count;      // Pages at or below the child, or -1 if not yet read
+    bool is_page;       // Set if the child is a page rather than a node
+  };
+  int page_tree_root_;                    // Object number of the root node
+  int first_page_;                        // First page if linearized, or -1
+  size_t page_count_;                     // Pages in the document
+  std::unordered_map<int, std::vector<PageTreeKid>> page_tree_;
   std::vector<int> page_object_numbers_;  // The object numbers of page headers
+  bool is_page_tree_expanded_;            // Set once the list is filled in
+  std::mutex page_tree_mutex_;            // Guards the page tree members
+  static const int max_page_tree_depth_ = 64;
 
   // This map holds Object pointers. Since some objects may be read
   // multiple times, it is best to store them when they are first created,
   // then return the stored object on request rather than creating a new
   // instance of the object every time it is requested.
-  std::unordered_map <int, std::shared_ptr<Object>> object_cache_;
+  //
+  // The cache is split into shards by object number, each with its own lock,
+  // so that threads reading different objects rarely wait for each other. An
+  // entry is a future that the first thread to ask for the object fulfils
+  // once it has built it. Other threads that ask in the meantime wait on the
+  // future instead of building the object again. Locks are never held while
+  // an object is built.
+  typedef std::shared_future<std::shared_ptr<Object>> CachedObject;
+  struct CacheShard
+  {
+    std::mutex mutex;
+    std::unordered_map<int, CachedObject> objects;
+  };
+  static const size_t cache_shards_ = 16;
+  std::array<CacheShard, cache_shards_> object_cache_;
+
+  // Fonts are keyed by the object number of their font dictionary. A font
+  // dictionary written directly into a page's resources has no number, and
+  // is keyed by its text instead, which can't be mistaken for a number since
+  // it starts with "<<". Entries are futures, for the same reason as above.
+  typedef std::shared_future<std::shared_ptr<Font>> CachedFont;
+  std::unordered_map<std::string, CachedFont> font_cache_;
+  FontStatistics font_statistics_;
+  std::mutex font_mutex_;                 // Guards the font cache
+
+  // The constructors use this as a common pathway
+  void BuildDocument_(int n_threads, bool first_page);
+  void BuildFromSidecar_(const std::string& file_path,
+                         const std::string& sidecar_path, int n_threads);
+
+  // Decodes all the object streams in parallel, unless there are too few
+  void DecodeObjectStreams_(int n_threads);
+  static const size_t min_object_streams_ = 8;
+
+  // Creates an object that isn't in the cache yet
+  std::shared_ptr<Object> BuildObject_(int object_number);
+
+  // Gets the XRef, first replacing a first-page XRef with the full XRef if
+  // the object isn't listed in it
+  std::shared_ptr<const XRef> GetXRef_(int object_number);
+
+  // Reads a node of the page tree, or one of its children
+  std::vector<PageTreeKid>& ReadPageTreeNode_(int object_number);
+  bool ReadPageTreeKid_(PageTreeKid& kid);
+
+  // The page info of /Pages nodes, once read, for the rest of their children
+  std::unordered_map<int, PageInfo> page_info_cache_;
+  std::mutex page_info_mutex_;            // Guards page_info_cache_
+
+  // Reads the page info of a page or /Pages node (see GetPageInfo)
+  PageInfo ReadPageInfo_(int object_number, int depth);
+  std::vector<std::pair<std::string, std::string>>
+    ReadFontNames_(const Dictionary& resources);
 
-  void BuildDocument_();      // The constructors use this as a common pathway
+  // Gets a dictionary that is either written out under key or referenced
+  // there, or an empty dictionary if it is neither
+  Dictionary GetSubdictionary_(const Dictionary& dictionary,
+                               const std::string& key);
 
-  // This function effectively builds the pages tree.
+  // Reads the whole page tree into page_object_numbers_
+  void ExpandPageTree_();
   std::vector<int> ExpandKids_(const std::vector<int>& object_numbers);
 };
 
@@ -0,0 +1,776 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR Filters implementation file                                         //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#include "filters.h"
+#include "deflate.h"
+#include<cctype>
+#include<cstring>
+#include<cstdlib>
+#include<algorithm>
+#include<stdexcept>
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+// The ASCII filters ignore whitespace wherever it appears
+
+static inline bool IsWhitespace(char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' ||
+         c == '\0';
+}
+
+/*---------------------------------------------------------------------------*/
+
+ASCIIHexFilter::ASCIIHexFilter(const OutputSink& sink)
+  : StreamFilter(sink), high_nibble_(-1), is_finished_(false) {}
+
+/*---------------------------------------------------------------------------*/
+// Anything that is neither a hex digit nor the end marker is skipped
+
+void ASCIIHexFilter::Write(const char* input, size_t length)
+{
+  for (const char* end = input + length; input != end && !is_finished_; ++input)
+  {
+    int value;
+    char c = *input;
+    if (c >= '0' && c <= '9') value = c - '0';
+    else if (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') value = c - 'A' + 10;
+    else
+    {
+      if (c == '>') is_finished_ = true;
+      continue;
+    }
+
+    if (high_nibble_ < 0) high_nibble_ = value;
+    else
+    {
+      Put_((uint8_t) ((high_nibble_ << 4) | value));
+      high_nibble_ = -1;
+    }
+  }
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+// An odd number of digits is completed with a final zero
+
+void ASCIIHexFilter::Finish()
+{
+  if (high_nibble_ >= 0) Put_((uint8_t) (high_nibble_ << 4));
+  high_nibble_ = -1;
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+
+ASCII85Filter::ASCII85Filter(const OutputSink& sink)
+  : StreamFilter(sink), group_(0), group_size_(0), is_finished_(false) {}
+
+/*---------------------------------------------------------------------------*/
+// Each digit is a character from '!' (0) to 'u' (84). Five of them make a
+// 32-bit number written most significant byte first.
+
+void ASCII85Filter::Write(const char* input, size_t length)
+{
+  for (const char* end = input + length; input != end && !is_finished_; ++input)
+  {
+    char c = *input;
+    if (IsWhitespace(c)) continue;
+
+    if (c == '~')
+    {
+      EndGroup_();
+      is_finished_ = true;
+    }
+    else if (c == 'z' && group_size_ == 0)
+    {
+      for (int i = 0; i < 4; ++i) Put_(0);
+    }
+    else if (c >= '!' && c <= 'u')
+    {
+      group_ = group_ * 85 + (c - '!');
+      if (++group_size_ == 5)
+      {
+        for (int shift = 24; shift >= 0; shift -= 8) Put_(group_ >> shift);
+        group_ = 0;
+        group_size_ = 0;
+      }
+    }
+  }
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+// A final group of n digits (2 <= n < 5) is padded out with the highest digit
+// and makes n - 1 bytes
+
+void ASCII85Filter::EndGroup_()
+{
+  if (group_size_ > 1)
+  {
+    int bytes = group_size_ - 1;
+    for (; group_size_ < 5; ++group_size_) group_ = group_ * 85 + 84;
+    for (int i = 0; i < bytes; ++i) Put_(group_ >> (24 - 8 * i));
+  }
+  group_ = 0;
+  group_size_ = 0;
+}
+
+void ASCII85Filter::Finish()
+{
+  if (!is_finished_) EndGroup_();
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+// /EarlyChange defaults to 1, meaning the code width increases one code
+// sooner than strictly necessary, as most encoders do.
+
+LZWFilter::LZWFilter(const OutputSink& sink, const Dictionary& parameters)
+  : StreamFilter(sink),
+    early_change_(1),
+    bit_buffer_(0),
+    bits_in_buffer_(0),
+    code_width_(9),
+    previous_code_(-1),
+    is_finished_(false)
+{
+  auto early_change = parameters.GetInts("/EarlyChange");
+  if (!early_change.empty()) early_change_ = early_change[0];
+  ResetTable_();
+}
+
+/*---------------------------------------------------------------------------*/
+// Codes 0 - 255 stand for single bytes. 256 is the clear-table code and 257
+// the end code; neither has an entry. New entries start at 258.
+
+void LZWFilter::ResetTable_()
+{
+  prefix_.assign(258, -1);
+  last_byte_.resize(258);
+  first_byte_.resize(258);
+  entry_length_.assign(258, 1);
+  for (int i = 0; i < 256; ++i) last_byte_[i] = first_byte_[i] = i;
+  entry_length_[256] = entry_length_[257] = 0;
+  code_width_ = 9;
+  previous_code_ = -1;
+}
+
+/*---------------------------------------------------------------------------*/
+// Adds an entry made of an existing entry plus one byte. Codes are at most 12
+// bits wide, so once there are 4096 entries the table stops growing.
+
+void LZWFilter::AddEntry_(int prefix, uint8_t byte)
+{
+  if (prefix_.size() >= 4096) return;
+  prefix_.push_back(prefix);
+  last_byte_.push_back(byte);
+  first_byte_.push_back(first_byte_[prefix]);
+  entry_length_.push_back(entry_length_[prefix] + 1);
+}
+
+/*---------------------------------------------------------------------------*/
+// Writes the bytes of an entry to the output. Following the prefixes gives
+// the bytes from last to first, so they are written from the end backwards.
+
+void LZWFilter::WriteEntry_(int code)
+{
+  size_t length = entry_length_[code];
+  size_t start = output_.size();
+  output_.resize(start + length);
+  for (size_t i = length; i-- > 0; code = prefix_[code])
+  {
+    output_[start + i] = (char) last_byte_[code];
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Each code after the first adds a table entry: the previous code's entry
+// plus the first byte of this one. A code can refer to the very entry it is
+// about to create, in which case that first byte is the previous entry's.
+
+void LZWFilter::HandleCode_(int code)
+{
+  if (code == 256)
+  {
+    ResetTable_();
+    return;
+  }
+
+  if (code == 257)
+  {
+    is_finished_ = true;
+    return;
+  }
+
+  int next_code = prefix_.size();
+
+  if (previous_code_ < 0)
+  {
+    if (code > 255) throw runtime_error("Invalid code in LZW stream");
+    WriteEntry_(code);
+  }
+  else if (code < next_code)
+  {
+    WriteEntry_(code);
+    AddEntry_(previous_code_, first_byte_[code]);
+  }
+  else if (code == next_code)
+  {
+    AddEntry_(previous_code_, first_byte_[previous_code_]);
+    WriteEntry_(code);
+  }
+  else throw runtime_error("Invalid code in LZW stream");
+
+  previous_code_ = code;
+
+  if (code_width_ < 12 &&
+      prefix_.size() + early_change_ >= (size_t) (1 << code_width_))
+  {
+    ++code_width_;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Codes are packed most significant bit first
+
+void LZWFilter::Write(const char* input, size_t length)
+{
+  for (const char* end = input + length; input != end && !is_finished_; ++input)
+  {
+    bit_buffer_ = (bit_buffer_ << 8) | (uint8_t) *input;
+    bits_in_buffer_ += 8;
+
+    while (bits_in_buffer_ >= code_width_ && !is_finished_)
+    {
+      bits_in_buffer_ -= code_width_;
+      HandleCode_((bit_buffer_ >> bits_in_buffer_) & ((1 << code_width_) - 1));
+    }
+  }
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+
+RunLengthFilter::RunLengthFilter(const OutputSink& sink)
+  : StreamFilter(sink), literals_left_(0), repeat_count_(0),
+    is_finished_(false) {}
+
+/*---------------------------------------------------------------------------*/
+
+void RunLengthFilter::Write(const char* input, size_t length)
+{
+  for (const char* end = input + length; input != end && !is_finished_; ++input)
+  {
+    uint8_t byte = *input;
+
+    if (literals_left_ > 0)
+    {
+      Put_(byte);
+      --literals_left_;
+    }
+    else if (repeat_count_ > 0)
+    {
+      output_.append(repeat_count_, (char) byte);
+      repeat_count_ = 0;
+    }
+    else if (byte < 128) literals_left_ = byte + 1;
+    else if (byte > 128) repeat_count_ = 257 - byte;
+    else is_finished_ = true;
+  }
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void FlateFilter::Finish()
+{
+  FlateDecode(CharString(input_), sink_);
+}
+
+/*---------------------------------------------------------------------------*/
+// /Colors and /Columns default to 1 and /BitsPerComponent to 8. The PNG
+// predictors work on whole bytes, comparing each byte with the one in the
+// same position in the previous pixel, or in the byte before if pixels are
+// smaller than a byte.
+
+PredictorFilter::PredictorFilter(const OutputSink& sink,
+                                 const Dictionary& parameters)
+  : StreamFilter(sink),
+    predictor_(1),
+    colors_(1),
+    bits_per_component_(8),
+    row_position_(0)
+{
+  size_t columns = 1;
+  auto predictor = parameters.GetInts("/Predictor");
+  auto colors    = parameters.GetInts("/Colors");
+  auto bits      = parameters.GetInts("/BitsPerComponent");
+  auto column    = parameters.GetInts("/Columns");
+  if (!predictor.empty()) predictor_ = predictor[0];
+  if (!colors.empty() && colors[0] > 0) colors_ = colors[0];
+  if (!bits.empty() && bits[0] > 0) bits_per_component_ = bits[0];
+  if (!column.empty() && column[0] > 0) columns = column[0];
+
+  size_t bits_per_pixel = colors_ * bits_per_component_;
+  bytes_per_pixel_ = max((size_t) 1, (bits_per_pixel + 7) / 8);
+  row_length_ = (bits_per_pixel * columns + 7) / 8;
+
+  // PNG rows are preceded by their filter type byte
+  row_.resize(row_length_ + (predictor_ >= 10 ? 1 : 0));
+  previous_.assign(row_.size(), 0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool PredictorFilter::IsNeeded(const Dictionary& parameters)
+{
+  auto predictor = parameters.GetInts("/Predictor");
+  return !predictor.empty() && predictor[0] > 1;
+}
+
+/*---------------------------------------------------------------------------*/
+// Input is copied into the row buffer until a row is complete, then the row
+// is decoded and written out
+
+void PredictorFilter::Write(const char* input, size_t length)
+{
+  while (length > 0)
+  {
+    size_t bytes = min(length, row_.size() - row_position_);
+    memcpy(&row_[row_position_], input, bytes);
+    row_position_ += bytes;
+    input += bytes;
+    length -= bytes;
+
+    if (row_position_ == row_.size())
+    {
+      DecodeRow_(row_length_);
+      row_position_ = 0;
+    }
+  }
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+// A short final row is decoded as far as it goes
+
+void PredictorFilter::Finish()
+{
+  size_t filter_bytes = predictor_ >= 10 ? 1 : 0;
+  if (row_position_ > filter_bytes) DecodeRow_(row_position_ - filter_bytes);
+  row_position_ = 0;
+  Flush_();
+}
+
+/*---------------------------------------------------------------------------*/
+// The PNG row kernels. Each undoes one of the PNG filter types on a row in
+// place, given the previous row already decoded. The bytes of the first pixel
+// have no left neighbour, so they are dealt with before the main loop, which
+// leaves the main loops free of branches. The Up kernel has no dependency
+// between bytes, so the compiler can vectorise it; it is also the one that
+// nearly all XRef streams and most images use. In the others each byte
+// depends on the byte one pixel to its left, so they can only run a pixel at
+// a time.
+
+static void UnpredictSub(uint8_t* row, size_t length, size_t bpp)
+{
+  for (size_t i = bpp; i < length; ++i) row[i] += row[i - bpp];
+}
+
+static void UnpredictUp(uint8_t* row, const uint8_t* up, size_t length)
+{
+  for (size_t i = 0; i < length; ++i) row[i] += up[i];
+}
+
+static void UnpredictAverage(uint8_t* row, const uint8_t* up, size_t length,
+                             size_t bpp)
+{
+  size_t first_pixel = min(bpp, length);
+  for (size_t i = 0; i < first_pixel; ++i) row[i] += up[i] >> 1;
+  for (size_t i = bpp; i < length; ++i)
+  {
+    row[i] += (row[i - bpp] + up[i]) >> 1;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// The Paeth predictor picks whichever of the left, upper and upper-left bytes
+// is closest to left + upper - upper left. The three distances simplify to
+// the differences used here. On the first pixel left and upper left are both
+// zero, so the predictor is always the upper byte.
+
+static void UnpredictPaeth(uint8_t* row, const uint8_t* up, size_t length,
+                           size_t bpp)
+{
+  size_t first_pixel = min(bpp, length);
+  for (size_t i = 0; i < first_pixel; ++i) row[i] += up[i];
+  for (size_t i = bpp; i < length; ++i)
+  {
+    int left = row[i - bpp], above = up[i], above_left = up[i - bpp];
+    int distance_left = abs(above - above_left);
+    int distance_above = abs(left - above_left);
+    int distance_above_left = abs(left + above - 2 * above_left);
+    if (distance_left <= distance_above && distance_left <= distance_above_left)
+    {
+      row[i] += left;
+    }
+    else row[i] += distance_above <= distance_above_left ? above : above_left;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// A PNG row is preceded by its filter type byte. Once decoded it becomes the
+// previous row for the next one, so the two buffers are swapped rather than
+// the row being copied.
+
+void PredictorFilter::DecodeRow_(size_t length)
+{
+  if (predictor_ >= 10)
+  {
+    uint8_t* row = &row_[1];
+    const uint8_t* up = &previous_[1];
+
+    switch (row_[0])
+    {
+      case 1:  UnpredictSub(row, length, bytes_per_pixel_);         break;
+      case 2:  UnpredictUp(row, up, length);                        break;
+      case 3:  UnpredictAverage(row, up, length, bytes_per_pixel_); break;
+      case 4:  UnpredictPaeth(row, up, length, bytes_per_pixel_);   break;
+      default: break; // Type 0 means no prediction
+    }
+
+    output_.append((const char*) row, length);
+    row_.swap(previous_);
+    return;
+  }
+
+  // TIFF predictor 2. Each component is added to the same component of the
+  // pixel to its left. For whole-byte components this is done byte by byte,
+  // with a carry between the two bytes of 16-bit components.
+  uint8_t* row = &row_[0];
+  if (predictor_ == 2 && bits_per_component_ == 8)
+  {
+    for (size_t i = colors_; i < length; ++i) row[i] += row[i - colors_];
+  }
+  else if (predictor_ == 2 && bits_per_component_ == 16)
+  {
+    size_t pixel = 2 * colors_;
+    for (size_t i = pixel; i + 1 < length; i += 2)
+    {
+      int sum = ((row[i] << 8) | row[i + 1]) +
+                ((row[i - pixel] << 8) | row[i - pixel + 1]);
+      row[i] = (sum >> 8) & 0xff;
+      row[i + 1] = sum & 0xff;
+    }
+  }
+  else if (predictor_ == 2 && bits_per_component_ < 8)
+  {
+    // Components smaller than a byte are unpacked, added and packed again
+    size_t bits = bits_per_component_, mask = (1 << bits) - 1;
+    size_t components = length * 8 / bits;
+    for (size_t i = colors_; i < components; ++i)
+    {
+      size_t offset = i * bits, left = (i - colors_) * bits;
+      size_t shift = 8 - bits - offset % 8;
+      size_t left_shift = 8 - bits - left % 8;
+      size_t sum = (row[offset / 8] >> shift) + (row[left / 8] >> left_shift);
+      row[offset / 8] &= ~(mask << shift);
+      row[offset / 8] |= (sum & mask) << shift;
+    }
+  }
+  output_.append((const char*) row, length);
+}
+
+/*---------------------------------------------------------------------------*/
+// References are only looked for outside of dictionaries, since a reference
+// inside a parameter dictionary (such as /JBIG2Globals) is a value for the
+// filter to use rather than a parameter dictionary itself. A reference is two
+// integers and an R, each standing on its own. The object text that replaces
+// it stops before any "endobj" keyword.
+
+static const int max_filter_reference_depth = 4;
+
+static string ResolveFilterEntry(const string& entry,
+                                 const function<string(int)>& lookup,
+                                 int depth)
+{
+  auto is_delimiter = [&](size_t i) -> bool
+  {
+    return i >= entry.size() || strchr(" \t\r\n[]<>/()", entry[i]);
+  };
+  auto skip_digits = [&](size_t i) -> size_t
+  {
+    while (i < entry.size() && isdigit((uint8_t) entry[i])) ++i;
+    return i;
+  };
+  auto skip_space = [&](size_t i) -> size_t
+  {
+    while (i < entry.size() && strchr(" \t\r\n", entry[i])) ++i;
+    return i;
+  };
+
+  string result;
+  int dictionary_depth = 0;
+  for (size_t i = 0; i < entry.size();)
+  {
+    if (entry.compare(i, 2, "<<") == 0 || entry.compare(i, 2, ">>") == 0)
+    {
+      dictionary_depth += entry[i] == '<' ? 1 : -1;
+      result.append(entry, i, 2);
+      i += 2;
+      continue;
+    }
+
+    if (dictionary_depth == 0 && isdigit((uint8_t) entry[i]) &&
+        (i == 0 || strchr(" \t\r\n[", entry[i - 1])))
+    {
+      size_t number_end = skip_digits(i);
+      size_t generation = skip_space(number_end);
+      size_t generation_end = skip_digits(generation);
+      size_t r = skip_space(generation_end);
+      if (number_end < generation && generation < generation_end &&
+          generation_end < r && r < entry.size() && entry[r] == 'R' &&
+          is_delimiter(r + 1))
+      {
+        if (depth >= max_filter_reference_depth)
+        {
+          throw runtime_error("Filter entry references are nested too deep");
+        }
+        string object = lookup(atoi(entry.c_str() + i));
+        object = object.substr(0, object.find("endobj"));
+        result += ResolveFilterEntry(object, lookup, depth + 1);
+        i = r + 1;
+        continue;
+      }
+    }
+    result.push_back(entry[i++]);
+  }
+  return result;
+}
+
+string ResolveFilterEntry(const string& entry,
+                          const function<string(int)>& lookup)
+{
+  return ResolveFilterEntry(entry, lookup, 0);
+}
+
+/*---------------------------------------------------------------------------*/
+// Splits a /Filter entry, which may be a name or an array of names, into
+// a vector of names
+
+static vector<string> ReadFilterNames(const string& entry)
+{
+  vector<string> names;
+  size_t start = entry.find('/');
+  while (start != string::npos)
+  {
+    size_t end = entry.find_first_of(" \t\r\n/[]<>()", start + 1);
+    if (end == string::npos) end = entry.size();
+    names.push_back(entry.substr(start, end - start));
+    start = entry.find('/', end);
+  }
+  return names;
+}
+
+/*---------------------------------------------------------------------------*/
+// Splits a /DecodeParms entry into one dictionary per filter. If it is a
+// single dictionary rather than an array, it belongs to the first filter.
+
+static vector<Dictionary> ReadParameters(const string& entry,
+                                         size_t number_of_filters)
+{
+  vector<Dictionary> parameters(number_of_filters);
+  size_t start = entry.find_first_not_of(" \t\r\n");
+  if (start == string::npos || number_of_filters == 0) return parameters;
+
+  if (entry[start] != '[')
+  {
+    if (entry.find("<<") != string::npos)
+    {
+      parameters[0] = Dictionary(make_shared<string>(entry));
+    }
+    return parameters;
+  }
+
+  // Walk through the array, counting nested dictionaries so that only the
+  // outermost ones are split off, and counting nulls as empty dictionaries
+  size_t index = 0, dictionary_start = 0;
+  int depth = 0;
+  for (size_t i = start + 1; i < entry.size() && index < number_of_filters; ++i)
+  {
+    if (entry.compare(i, 2, "<<") == 0)
+    {
+      if (depth++ == 0) dictionary_start = i;
+      ++i;
+    }
+    else if (entry.compare(i, 2, ">>") == 0)
+    {
+      ++i;
+      if (--depth == 0)
+      {
+        string dictionary(entry, dictionary_start, i + 1 - dictionary_start);
+        parameters[index++] = Dictionary(make_shared<string>(dictionary));
+      }
+    }
+    else if (depth == 0 && entry.compare(i, 4, "null") == 0)
+    {
+      ++index;
+      i += 3;
+    }
+  }
+  return parameters;
+}
+
+/*---------------------------------------------------------------------------*/
+// Filter names can be given in full or, in inline images, abbreviated
+
+static bool IsFlate(const string& name)
+{
+  return name == "/FlateDecode" || name == "/Fl";
+}
+
+static bool IsLZW(const string& name)
+{
+  return name == "/LZWDecode" || name == "/LZW";
+}
+
+/*---------------------------------------------------------------------------*/
+
+static bool IsDecodable(const string& name)
+{
+  return IsFlate(name) || IsLZW(name) ||
+         name == "/ASCII85Decode"   || name == "/A85" ||
+         name == "/ASCIIHexDecode"  || name == "/AHx" ||
+         name == "/RunLengthDecode" || name == "/RL";
+}
+
+/*---------------------------------------------------------------------------*/
+// Creates the filter stage for a given name, or returns nullptr if the filter
+// isn't one we can decode
+
+static StreamFilter* MakeFilter(const string& name, const OutputSink& sink,
+                                const Dictionary& parameters)
+{
+  if (IsFlate(name)) return new FlateFilter(sink);
+  if (IsLZW(name)) return new LZWFilter(sink, parameters);
+  if (name == "/ASCII85Decode" || name == "/A85")
+  {
+    return new ASCII85Filter(sink);
+  }
+  if (name == "/ASCIIHexDecode" || name == "/AHx")
+  {
+    return new ASCIIHexFilter(sink);
+  }
+  if (name == "/RunLengthDecode" || name == "/RL")
+  {
+    return new RunLengthFilter(sink);
+  }
+  return nullptr;
+}
+
+/*---------------------------------------------------------------------------*/
+// The chain is built from the last filter backwards, since each stage has to
+// be given the stage after it as its sink. Flate and LZW stages are followed
+// by a predictor stage if their parameters ask for one. When the first filter
+// is FlateDecode, its stage is skipped and the raw stream is inflated straight
+// into the stage after it.
+
+void DecodeStream(const CharString& stream, const Dictionary& dictionary,
+                  const OutputSink& sink)
+{
+  vector<string> all_names = ReadFilterNames(dictionary["/Filter"]);
+  vector<Dictionary> all_parameters = ReadParameters(
+    dictionary["/DecodeParms"], all_names.size());
+
+  // The /Crypt filter is dealt with by decryption, so needs no stage here.
+  // Its parameters go with it, so the other filters keep their own.
+  vector<string> names;
+  vector<Dictionary> parameters;
+  for (size_t i = 0; i < all_names.size(); ++i)
+  {
+    if (all_names[i] == "/Crypt") continue;
+    names.push_back(all_names[i]);
+    parameters.push_back(all_parameters[i]);
+  }
+
+  // Decode only as far as the first filter we can't decode
+  size_t chain_length = 0;
+  while (chain_length < names.size() && IsDecodable(names[chain_length]))
+  {
+    ++chain_length;
+  }
+
+  // Stages are stored last to first
+  vector<unique_ptr<StreamFilter>> stages;
+  OutputSink next_stage = sink;
+
+  auto add_stage = [&](StreamFilter* stage) -> void
+  {
+    stages.emplace_back(stage);
+    next_stage = [stage](const char* input, size_t length) -> void
+    {
+      stage->Write(input, length);
+    };
+  };
+
+  bool inflate_first = chain_length > 0 && IsFlate(names[0]);
+  for (size_t i = chain_length; i-- > 0;)
+  {
+    bool has_predictor = PredictorFilter::IsNeeded(parameters[i]) &&
+                         (IsFlate(names[i]) || IsLZW(names[i]));
+    if (has_predictor)
+    {
+      add_stage(new PredictorFilter(next_stage, parameters[i]));
+    }
+    if (i > 0 || !inflate_first)
+    {
+      add_stage(MakeFilter(names[i], next_stage, parameters[i]));
+    }
+  }
+
+  if (inflate_first) FlateDecode(stream, next_stage);
+  else next_stage(stream.begin(), stream.size());
+
+  // Finish the stages from first to last, so that anything a stage writes as
+  // it finishes reaches the later stages before they finish in turn
+  for (size_t i = stages.size(); i-- > 0;) stages[i]->Finish();
+}
+
+/*---------------------------------------------------------------------------*/
+// A lone FlateDecode filter, which is by far the most common case, is
+// inflated straight into a string without going through the chain. The
+// decoded length in /DL, if the stream gives one, sizes the output.
+
+string DecodeStream(const CharString& stream, const Dictionary& dictionary)
+{
+  vector<string> names = ReadFilterNames(dictionary["/Filter"]);
+  if (names.size() == 1 && IsFlate(names[0]) &&
+      !PredictorFilter::IsNeeded(dictionary.GetDictionary("/DecodeParms")))
+  {
+    vector<int> decoded_length = dictionary.GetInts("/DL");
+    size_t expected_size = 0;
+    if (!decoded_length.empty() && decoded_length[0] > 0)
+    {
+      expected_size = (size_t) decoded_length[0];
+    }
+    return FlateDecode(stream, expected_size);
+  }
+
+  string result;
+  DecodeStream(stream, dictionary, [&](const char* chunk, size_t length)
+                                   {
+                                     result.append(chunk, length);
+                                   });
+  return result;
+}
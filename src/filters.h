@@ -0,0 +1,218 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR Filters header file                                                 //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#ifndef PDFR_FILTERS
+
+//---------------------------------------------------------------------------//
+
+#define PDFR_FILTERS
+
+/* A pdf stream's dictionary names the filters that were used to encode it in
+ * its /Filter entry. This is either a single name or an array of names, in
+ * which case the stream has to be passed through each filter in turn. Some
+ * filters take parameters, which are given in a /DecodeParms dictionary (or
+ * an array of dictionaries, one per filter, with null for filters that have
+ * none).
+ *
+ * Each filter is implemented here as a stage that is written to a chunk at a
+ * time and passes its decoded output on to the next stage as it goes, using
+ * the same OutputSink interface that the Deflate class uses for chunked
+ * output. A chain such as [/ASCII85Decode /FlateDecode] is therefore run in a
+ * single pass without the output of each stage being stored in between.
+ *
+ * The one exception is FlateDecode, since the decoders need their whole input
+ * at once. When it is the first filter, which it nearly always is, it simply
+ * reads the raw stream; when it comes later in the chain its (compressed)
+ * input is gathered first and inflated when the previous stage finishes.
+ *
+ * Filters that decode image data (DCTDecode, JPXDecode, CCITTFaxDecode and
+ * JBIG2Decode) are not implemented. Decoding stops at the first such filter,
+ * and the data is passed on still encoded by it and any filters after it.
+ */
+
+#include "streams.h"
+#include "dictionary.h"
+#include<memory>
+
+//---------------------------------------------------------------------------//
+// The base class for a filter stage. Input is passed with Write, and Finish is
+// called when there is no more input. Decoded bytes are collected with Put_
+// and passed to the sink in one go at the end of each call to Write, rather
+// than through a function call per byte.
+
+class StreamFilter
+{
+ public:
+  StreamFilter(const OutputSink& sink) : sink_(sink) {}
+  virtual ~StreamFilter() {}
+
+  virtual void Write(const char* input, size_t length) = 0;
+  virtual void Finish() {Flush_();}
+
+ protected:
+  OutputSink sink_;      // The next stage of the chain
+  std::string output_;   // Output waiting to be passed on
+
+  void Put_(uint8_t byte) {output_.push_back((char) byte);}
+  void Flush_()
+  {
+    if (!output_.empty()) sink_(output_.data(), output_.size());
+    output_.clear();
+  }
+};
+
+//---------------------------------------------------------------------------//
+// Pairs of hexadecimal digits, with whitespace ignored and '>' marking the end
+
+class ASCIIHexFilter : public StreamFilter
+{
+ public:
+  ASCIIHexFilter(const OutputSink& sink);
+  void Write(const char* input, size_t length);
+  void Finish();
+
+ private:
+  int high_nibble_;      // First digit of a pair, or -1 if none waiting
+  bool is_finished_;     // Set when the end marker has been read
+};
+
+//---------------------------------------------------------------------------//
+// Groups of five base-85 digits make four bytes. 'z' stands for four zero
+// bytes and '~>' marks the end. A final partial group makes fewer bytes.
+
+class ASCII85Filter : public StreamFilter
+{
+ public:
+  ASCII85Filter(const OutputSink& sink);
+  void Write(const char* input, size_t length);
+  void Finish();
+
+ private:
+  uint64_t group_;       // Value of the digits read so far in this group
+  int group_size_;       // Number of digits read so far in this group
+  bool is_finished_;     // Set when the end marker has been read
+  void EndGroup_();      // Writes out a partial final group
+};
+
+//---------------------------------------------------------------------------//
+// Lempel-Ziv-Welch compression with variable-width codes of 9 to 12 bits.
+
+class LZWFilter : public StreamFilter
+{
+ public:
+  LZWFilter(const OutputSink& sink, const Dictionary& parameters);
+  void Write(const char* input, size_t length);
+
+ private:
+  int early_change_;                // Widen codes one code early (default 1)
+  uint32_t bit_buffer_;             // Input bits not yet used
+  int bits_in_buffer_;              // Number of bits in bit_buffer_
+  int code_width_;                  // Current code width in bits
+  int previous_code_;               // Last code read, or -1 after a reset
+  bool is_finished_;                // Set when the end code has been read
+
+  // The code table. Each entry is the entry for a shorter code (its prefix)
+  // plus one byte, so entries are stored as a prefix code and a final byte,
+  // with the first byte and length kept so entries can be expanded quickly.
+  std::vector<int> prefix_;
+  std::vector<uint8_t> last_byte_, first_byte_;
+  std::vector<uint16_t> entry_length_;
+
+  void ResetTable_();
+  void AddEntry_(int prefix, uint8_t byte);
+  void WriteEntry_(int code);
+  void HandleCode_(int code);
+};
+
+//---------------------------------------------------------------------------//
+// A length byte n of 0-127 is followed by n + 1 literal bytes, one of 129-255
+// by a single byte to be repeated 257 - n times, and 128 marks the end.
+
+class RunLengthFilter : public StreamFilter
+{
+ public:
+  RunLengthFilter(const OutputSink& sink);
+  void Write(const char* input, size_t length);
+
+ private:
+  int literals_left_;    // Literal bytes still to copy from the current run
+  int repeat_count_;     // Repeats of the next byte, or 0 if not waiting
+  bool is_finished_;     // Set when the end marker has been read
+};
+
+//---------------------------------------------------------------------------//
+// Gathers compressed input and inflates it once it is all present
+
+class FlateFilter : public StreamFilter
+{
+ public:
+  FlateFilter(const OutputSink& sink) : StreamFilter(sink) {}
+  void Write(const char* input, size_t length) {input_.append(input, length);}
+  void Finish();
+
+ private:
+  std::string input_;
+};
+
+//---------------------------------------------------------------------------//
+// Undoes the predictor functions that /FlateDecode and /LZWDecode streams may
+// apply to their data before compression (see /DecodeParms). The data is laid
+// out in rows of /Columns samples, each of /Colors components of
+// /BitsPerComponent bits. Predictor 2 is the TIFF predictor, which stores each
+// component as its difference from the same component of the previous pixel.
+// Predictors 10 - 15 are the PNG predictors, where each row starts with a
+// byte saying which of the five PNG filter types was used for that row.
+
+class PredictorFilter : public StreamFilter
+{
+ public:
+  PredictorFilter(const OutputSink& sink, const Dictionary& parameters);
+  void Write(const char* input, size_t length);
+  void Finish();
+
+  // True if the parameters ask for a predictor that needs undoing
+  static bool IsNeeded(const Dictionary& parameters);
+
+ private:
+  int predictor_;                   // 2 for TIFF, 10 or more for PNG
+  size_t colors_;                   // Components per sample
+  size_t bits_per_component_;       // Bits per component
+  size_t bytes_per_pixel_;          // Whole bytes per sample (at least 1)
+  size_t row_length_;               // Bytes per row, excluding filter byte
+  std::vector<uint8_t> row_;        // The row being read
+  std::vector<uint8_t> previous_;   // The previous row (PNG only)
+  size_t row_position_;             // Bytes of the current row read so far
+
+  void DecodeRow_(size_t length);   // Undoes the predictor on one row
+};
+
+//---------------------------------------------------------------------------//
+// A /Filter or /DecodeParms entry may be an indirect reference, or an array
+// with references among its members. This replaces each such reference with
+// the text of the object it refers to, as given by lookup, so that the entry
+// can be split into filters and parameters. References in the objects looked
+// up are replaced in turn, up to a few levels deep.
+
+std::string ResolveFilterEntry(const std::string& entry,
+                               const std::function<std::string(int)>& lookup);
+
+//---------------------------------------------------------------------------//
+// Runs stream through the filters named in the /Filter entry of dictionary,
+// with the parameters from its /DecodeParms entry, passing the result to sink.
+// The second version returns the result as a string.
+
+void DecodeStream(const CharString& stream, const Dictionary& dictionary,
+                  const OutputSink& sink);
+
+std::string DecodeStream(const CharString& stream,
+                         const Dictionary& dictionary);
+
+#endif
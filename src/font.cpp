@@ -24,39 +24,62 @@ using namespace std;
 /*---------------------------------------------------------------------------*/
 // The Font constructor simply initializes the private data members, calls
 // getFontName() to get the postscript font title, and then makeGlyphTable()
-// to create the main data member
+// to create the main data member. The document is only kept as a weak
+// pointer, since the Document keeps its Fonts (see Document::GetFont) and
+// each would otherwise keep the other alive. Only the number of the font
+// descriptor is noted, for reading the font file later if it is needed.
 
 Font::Font(shared_ptr<Document> document_ptr,
            Dictionary& font_dictionary,
            const string& font_id)
-  : document_(document_ptr),
-    font_dictionary_(font_dictionary),
-    font_id_(font_id)
+  : font_dictionary_(font_dictionary),
+    font_id_(font_id),
+    document_(document_ptr),
+    font_descriptor_(0),
+    is_font_data_read_(false)
 {
   ReadFontName_();
-  MakeGlyphTable_();
-  GetFontFile_();
-  if(fontfile_.size() > 0) font_data_ = std::make_shared<TTFont>(fontfile_);
+  MakeGlyphTable_(document_ptr);
+  if (font_dictionary_.ContainsReferences("/FontDescriptor"))
+  {
+    font_descriptor_ = font_dictionary_.GetReference("/FontDescriptor");
+  }
 }
 
 /*---------------------------------------------------------------------------*/
-// Obtains the font's relevant TrueType file
+// Obtains the font's relevant TrueType file. Its decoded stream is shared
+// with the Object it belongs to rather than copied. The caller holds the
+// lock.
 
 void Font::GetFontFile_()
 {
-  if(font_dictionary_.ContainsReferences("/FontDescriptor"))
+  is_font_data_read_ = true;
+  auto document = document_.lock();
+  if (!document || !font_descriptor_) return;
+
+  Dictionary& descriptor = document->GetObject(font_descriptor_)
+                                   ->GetDictionary();
+  if (descriptor.ContainsReferences("/FontFile2"))
   {
-    int descriptor_ref = font_dictionary_.GetReference("/FontDescriptor");
-    std::shared_ptr<Object> descriptor = document_->GetObject(descriptor_ref);
-    if(descriptor->GetDictionary().ContainsReferences("/FontFile2"))
-    {
-      int fontfile_ref = descriptor->GetDictionary().GetReference("/FontFile2");
-      std::shared_ptr<Object> font_obj = document_->GetObject(fontfile_ref);
-      fontfile_ = font_obj->GetStream();
-    }
+    int fontfile_ref = descriptor.GetReference("/FontFile2");
+    auto fontfile = document->GetObject(fontfile_ref)->GetSharedStream();
+    if (!fontfile->empty()) font_data_ = make_shared<TTFont>(fontfile);
   }
 }
 
+/*---------------------------------------------------------------------------*/
+// Reading a glyph moves the TTFont's position in the font file, so it is done
+// under the same lock as building the TTFont. A font without an embedded
+// TrueType font file has no outlines to give.
+
+Glyf Font::ReadGlyf_(RawChar raw_char)
+{
+  lock_guard<mutex> lock(font_data_mutex_);
+  if (!is_font_data_read_) GetFontFile_();
+  if (!font_data_) throw runtime_error("Font has no TrueType font file");
+  return font_data_->ReadGlyf(raw_char);
+}
+
 /*---------------------------------------------------------------------------*/
 // Obtains the font's PostScript name from the font dictionary
 
@@ -105,13 +128,13 @@ vector<pair<Unicode, float>> Font::MapRawChar(const vector<RawChar>& raw_vector)
 // the encoding and glyphwidth classes. This private method co-ordinates the
 // building of the glyphmap using these two component classes
 
-void Font::MakeGlyphTable_()
+void Font::MakeGlyphTable_(shared_ptr<Document> document)
 {
   // Create Encoding object
-  Encoding encodings(font_dictionary_, document_);
+  Encoding encodings(font_dictionary_, document);
 
   // Create glyphwidth object
-  GlyphWidths widths(font_dictionary_, document_);
+  GlyphWidths widths(font_dictionary_, document);
 
   // get all the mapped RawChars from the Encoding object
   auto encoding_map = encodings.GetEncodingKeys();
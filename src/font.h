@@ -45,6 +45,7 @@
 #include<vector>
 #include<unordered_map>
 #include<memory>
+#include<mutex>
 #include "truetype.h"
 
 class Dictionary;
@@ -84,33 +85,40 @@ class Font
 
 private:
   // private data members
-  std::shared_ptr<Document> document_;  // - Pointer to the containing document
   Dictionary& font_dictionary_;         // - The main font dictionary
   std::string font_id_,                 // - The name the font as used in PDF
-              font_name_,               // - The actual name of the font
-              fontfile_;                // - The bytes making up the font
+              font_name_;               // - The actual name of the font
   GlyphMap glyph_map_;                  // - Main data member, mapping RawChar
                                         //   to a {Unicode, width} pair.
-  std::shared_ptr<TTFont> font_data_;
+
+  // The embedded TrueType font program is only needed for glyph outlines, so
+  // it isn't decoded or parsed until they are first asked for. The Font only
+  // holds a weak pointer to its Document (see Document::GetFont), so if the
+  // Document has gone by then, there are no outlines.
+  std::weak_ptr<Document> document_;    // - The Document, to read the font file
+  int font_descriptor_;                 // - Font descriptor object, or 0
+  bool is_font_data_read_;              // - Set once font_data_ is filled in
+  std::shared_ptr<TTFont> font_data_;   // - The parsed font file, if any
+  std::mutex font_data_mutex_;          // - Guards font_data_
 
   std::vector<Path> GetGlyphPath(RawChar ch, float x_scale, float y_scale,
                                  float x_offset, float y_offset) {
-    return font_data_->ReadGlyf(ch).AsPath(x_scale, y_scale,
-                                           x_offset, y_offset);
+    return ReadGlyf_(ch).AsPath(x_scale, y_scale, x_offset, y_offset);
   }
 
   std::vector<Path> GetGlyphPath(RawChar ch, float x_scale, float y_scale) {
-    return font_data_->ReadGlyf(ch).AsPath(x_scale, y_scale);
+    return ReadGlyf_(ch).AsPath(x_scale, y_scale);
   }
 
   std::vector<Path> GetGlyphPath(RawChar ch, float scale) {
-    return font_data_->ReadGlyf(ch).AsPath(scale, scale);
+    return ReadGlyf_(ch).AsPath(scale, scale);
   }
 
   // private methods
   void ReadFontName_();                  // Finds the postscript font name
-  void MakeGlyphTable_();                // Co-ordinates font construction
-  void GetFontFile_();                   // Gets TTF data
+  void MakeGlyphTable_(std::shared_ptr<Document>); // Co-ordinates font creation
+  void GetFontFile_();                   // Gets TTF data, under the lock
+  Glyf ReadGlyf_(RawChar);               // Reads a glyph's outline
 };
 
 //---------------------------------------------------------------------------//
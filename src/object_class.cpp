@@ -13,6 +13,7 @@
 #include "dictionary.h"
 #include "streams.h"
 #include "deflate.h"
+#include "filters.h"
 #include "xref.h"
 #include "object_class.h"
 #include<iostream>
@@ -25,10 +26,16 @@ using namespace std;
 // The main object creator class. It needs a pointer to the xref and a number
 // representing the object's number as set out in the xref table.
 
-Object::Object(shared_ptr<const XRef> xref, int object_number) :
+Object::Object(shared_ptr<const XRef> xref, int object_number,
+               shared_ptr<StreamCache> stream_cache, const Lookup& lookup) :
   xref_(xref),
   object_number_(object_number),
   raw_stream_(),
+  stream_mutex_(make_shared<mutex>()),
+  is_decoded_(false),
+  is_evictable_(true),
+  stream_cache_(stream_cache),
+  referenced_object_(0),
   stream_index_(make_shared<unordered_map<int, pair<int, int>>>())
 {
   // Find start and end of object
@@ -48,20 +55,25 @@ Object::Object(shared_ptr<const XRef> xref, int object_number) :
 
     // Finds start and length of contents
     size_t c_start = xref_->File()->find(" obj", start) + 4;
-    raw_stream_ = {xref_->File()->c_str() + c_start, stop - c_start};
+    raw_stream_ = {xref_->File()->data() + c_start, stop - c_start};
   }
 
   else // Else the object has a header dictionary
   {
-    header_ = Dictionary(xref_->File(), start);
+    header_ = Dictionary(*xref_->File(), start);
+    ResolveFilterEntries_(lookup);
+
     // Find the stream (if any)
     raw_stream_ = xref_->GetStreamLocation(start);
 
-    // The object may contain an object stream that needs unpacked
+    // The object may contain an object stream that needs unpacked. The
+    // objects taken from it point into its decoded stream, so it is kept.
     if (header_["/Type"] == "/ObjStm")
     {
       // Get the object stream
       ReadStream_();
+      is_decoded_ = true;
+      is_evictable_ = false;
 
       // Index the objects in the stream
       IndexObjectStream_();
@@ -77,17 +89,19 @@ Object::Object(shared_ptr<const XRef> xref, int object_number) :
 
 void Object::IndexObjectStream_()
 {
-  // Get the first character that is not a digit or space
-  int startbyte = stream_.find_first_not_of("\n\r\t 0123456789");
+  const string& stream = *stream_;
 
-  // Now get the substring with the objects proper...
-  string stream_string(stream_.begin() + startbyte, stream_.end());
-
-  // ...and the substring with the registration numbers...
-  string index_string(stream_.begin(), stream_.begin() + startbyte - 1);
+  // Get the first character that is not a digit or space
+  size_t startbyte = stream.find_first_not_of("\n\r\t 0123456789");
+  if (startbyte == string::npos || startbyte == 0)
+  {
+    throw runtime_error("Couldn't parse object stream");
+  }
 
-  // extract these numbers to a vector
-  vector<int> index = ParseInts(index_string);
+  // The objects proper follow the registration numbers, which we read in
+  // place into a vector
+  size_t objects_length = stream.size() - startbyte;
+  vector<int> index = ParseInts(CharString(stream.data(), startbyte - 1));
 
   // If this is empty, something has gone wrong.
   if (index.empty()) throw runtime_error("Couldn't parse object stream");
@@ -96,7 +110,7 @@ void Object::IndexObjectStream_()
   // which are byte offsets
   for (size_t byte_length, i = 1; i < index.size(); i += 2)
   {
-    if (i == (index.size() - 1)) byte_length = stream_string.size() - index[i];
+    if (i == (index.size() - 1)) byte_length = objects_length - index[i];
     else byte_length = index[i + 2] - index[i];
     auto&& index_pair = make_pair(index[i] + startbyte, byte_length);
     (*stream_index_)[index[i - 1]] = index_pair;
@@ -104,14 +118,24 @@ void Object::IndexObjectStream_()
 }
 
 /*---------------------------------------------------------------------------*/
-// The constructor for in-stream objects. This is called automatically by the
-// main object constructor if the main object constructor determines that the
-// requested object lies inside the stream of another object
+// The constructor for in-stream objects. This is called by the Document when
+// it finds that the requested object lies inside the stream of another object.
+//
+// Nothing is copied out of the holding object's stream. A dictionary is read
+// straight from it, and any other contents (an array or a number, say) are
+// kept as a view into it, along with a share in it to keep it alive. If the
+// index puts the object outside the stream, the stream is damaged, and this
+// throws rather than giving an empty object.
 
 Object::Object(shared_ptr<Object> holder, int object_number):
   xref_(holder->xref_),
   object_number_(object_number),
-  raw_stream_()
+  raw_stream_(),
+  stream_mutex_(make_shared<mutex>()),
+  is_decoded_(true),
+  is_evictable_(false),
+  stream_cache_(holder->stream_cache_),
+  referenced_object_(0)
 {
   auto finder = holder->stream_index_->find(object_number_);
   if (finder == holder->stream_index_->end())
@@ -121,33 +145,44 @@ Object::Object(shared_ptr<Object> holder, int object_number):
 
   auto index_position = finder->second.first;
   auto index_length   = finder->second.second;
-  auto stream_string  = holder->stream_.substr(index_position, index_length);
-
-  // Most stream objects consist of just a dictionary
-  if (stream_string[0] == '<')
+  shared_ptr<const string> holder_stream;
+  CharString holder_contents = holder->GetDecodedStream_(holder_stream);
+  if (index_position < 0 || index_length <= 0 ||
+      (size_t) index_position >= holder_contents.size())
   {
-    header_ = Dictionary(make_shared<string>(stream_string));
-    stream_ = "";             // stream objects don't have their own stream
+    throw runtime_error("Object lies outside its object stream");
   }
-  else // The object is not a dictionary - maybe just an array or int etc
+  CharString contents = holder_contents.substr(index_position, index_length);
+
+  // Most stream objects consist of just a dictionary, and have no stream of
+  // their own
+  if (contents[0] == '<')
   {
-    header_ = Dictionary();// empty header
-    stream_ = stream_string;  // Call the contents a stream for ease
+    header_ = Dictionary(contents);
+    return;
+  }
 
-    // Annoyingly, some "objects" in an object stream are just pointers
-    // to other objects. This is pointless but does happen and needs to
-    // be handled by recursively calling the constructor
-    if (stream_.size() < 15 && stream_.find(" R", 0) < 15)
-    {
-      size_t new_number = ParseReferences(stream_)[0];
-      size_t holder = xref_->GetHoldingNumberOf(new_number);
-      if (holder == 0) *this = Object(xref_, new_number);
-      else *this = Object(make_shared<Object>(xref_, holder), new_number);
-      this->object_number_ = object_number;
-    }
+  // The object is not a dictionary - maybe just an array or int etc. We call
+  // the contents a stream for ease.
+  stream_   = move(holder_stream);
+  contents_ = contents;
+
+  // Annoyingly, some "objects" in an object stream are just pointers to other
+  // objects. This is pointless but does happen, so we note the object pointed
+  // to for the Document to fetch instead.
+  if (contents_.size() < 15 && contents_.contains(" R"))
+  {
+    referenced_object_ = ParseReferences(contents_.AsString())[0];
   }
 }
 
+/*---------------------------------------------------------------------------*/
+
+Object::~Object()
+{
+  if (stream_cache_) stream_cache_->Remove(this);
+}
+
 /*---------------------------------------------------------------------------*/
 // Simple public getter for the header dictionary
 
@@ -158,13 +193,75 @@ Dictionary& Object::GetDictionary()
 
 /*---------------------------------------------------------------------------*/
 // We have to create the stream on the fly when it is needed rather than
-// calculating and storing all the streams upon document creation
+// calculating and storing all the streams upon document creation. The stream
+// is returned as a copy, since the cache may drop the stored one at any time.
+
+string Object::GetStream()
+{
+  shared_ptr<const string> owner;
+  CharString contents = GetDecodedStream_(owner);
+  return string(contents.begin(), contents.end());
+}
+
+/*---------------------------------------------------------------------------*/
+// A stream object's contents are the whole of the string it owns, so that
+// string can be handed out as it is. Objects from an object stream only view
+// part of their holder's stream, so they have to be copied.
+
+shared_ptr<const string> Object::GetSharedStream()
+{
+  shared_ptr<const string> owner;
+  CharString contents = GetDecodedStream_(owner);
+  if (owner && contents.begin() == owner->data() &&
+      contents.size() == owner->size()) return owner;
+  return make_shared<const string>(contents.begin(), contents.end());
+}
+
+/*---------------------------------------------------------------------------*/
+// Decodes the stream if it hasn't been decoded yet, or has been evicted since,
+// and returns a view of it. Owner is given a share in the bytes viewed, which
+// keeps them alive for the caller even if the stream is evicted. The cache is
+// told about the use after the lock is released, since the cache takes
+// objects' locks while holding its own when it evicts their streams.
+
+CharString Object::GetDecodedStream_(shared_ptr<const string>& owner)
+{
+  CharString contents;
+  {
+    lock_guard<mutex> lock(*stream_mutex_);
+    if (!is_decoded_)
+    {
+      ReadStream_();
+      is_decoded_ = true;
+    }
+    owner = stream_;
+    contents = contents_;
+  }
+  RecordUse_(contents.size());
+  return contents;
+}
+
+/*---------------------------------------------------------------------------*/
+// Empty streams cost nothing to keep, so they are left out of the cache
 
-string& Object::GetStream()
+void Object::RecordUse_(size_t bytes)
 {
-  // If the stream has not already been processed, do it now
-  if (stream_.empty()) ReadStream_();
-  return stream_;
+  if (stream_cache_ && is_evictable_ && bytes > 0)
+  {
+    stream_cache_->Record(shared_from_this(), bytes);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Called by the cache to drop the decoded stream
+
+void Object::EvictStream_()
+{
+  lock_guard<mutex> lock(*stream_mutex_);
+  if (!is_evictable_) return;
+  stream_.reset();
+  contents_ = CharString();
+  is_decoded_ = false;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -173,19 +270,219 @@ string& Object::GetStream()
 
 void Object::ReadStream_()
 {
+  xref_->File()->WillNeed(raw_stream_);
+
+  // Decrypt if necessary, then undo the filters named in the header
+  if (NeedsDecryption_())
+  {
+    string decrypted = DecryptStream_();
+    if (header_.HasKey("/Filter"))
+    {
+      decrypted = DecodeStream(CharString(decrypted), header_);
+    }
+    stream_ = make_shared<const string>(move(decrypted));
+  }
+  else stream_ = make_shared<const string>(DecodeStream(raw_stream_, header_));
+  contents_ = CharString(*stream_);
+}
+
+/*---------------------------------------------------------------------------*/
+// /Filter and /DecodeParms may be given by reference (see ResolveFilterEntry),
+// and are replaced in the header by what they refer to as soon as it is read,
+// so that decoding and decryption both see the direct values. The objects
+// referred to are got through the lookup, which is the Document's GetObject,
+// so they come from its cache and a chain of references that loops back on
+// itself is caught there. Without a lookup the references are left as they are.
+
+void Object::ResolveFilterEntries_(const Lookup& lookup)
+{
+  if (!lookup) return;
+
+  unordered_map<string, string> entries;
+  for (const char* key : {"/Filter", "/DecodeParms"})
+  {
+    if (!header_.HasKey(key) || !header_.ContainsReferences(key)) continue;
+    auto read = [&](int number) {return FilterEntryText_(*lookup(number));};
+    entries[key] = ResolveFilterEntry(header_[key], read);
+  }
+
+  if (entries.empty()) return;
+  unordered_map<string, string> map = header_.GetMap();
+  for (auto& entry : entries) map[entry.first] = entry.second;
+  header_ = Dictionary(map);
+}
+
+/*---------------------------------------------------------------------------*/
+// The text of an object referred to from a filter entry. A dictionary is
+// written back out as pdf, and anything else is given as the text between
+// "obj" and "endobj", or as its view into an object stream. The object's own
+// stream is never read, so nothing here is decoded or decrypted.
+
+string Object::FilterEntryText_(const Object& object)
+{
+  if (object.header_.begin() == object.header_.end())
+  {
+    if (!object.raw_stream_.empty()) return object.raw_stream_.AsString();
+    return object.contents_.AsString();
+  }
+
+  string text = "<<";
+  for (auto& entry : object.header_)
+  {
+    text += " " + entry.first + " " + entry.second;
+  }
+  return text + " >>";
+}
+
+/*---------------------------------------------------------------------------*/
+// Not every stream in an encrypted file is encrypted. XRef streams never are,
+// nor are metadata streams if /EncryptMetadata is false, and a stream can opt
+// out by naming the /Crypt filter, whose default (/Identity) does nothing.
+
+bool Object::NeedsDecryption_() const
+{
+  if (!xref_->IsEncrypted()) return false;
+  string type = header_["/Type"];
+  if (type == "/XRef") return false;
+  if (type == "/Metadata" && !xref_->EncryptsMetadata()) return false;
+  return header_["/Filter"].find("/Crypt") == string::npos;
+}
+
+/*---------------------------------------------------------------------------*/
+// The raw stream is decrypted straight from the file into a new buffer, which
+// the filters then read from
+
+string Object::DecryptStream_() const
+{
+  string decrypted(raw_stream_.size(), '\0');
+  if (decrypted.empty()) return decrypted;
+  decrypted.resize(xref_->Decrypt(raw_stream_, (uint8_t*) &decrypted[0],
+                                  object_number_, 0));
+  return decrypted;
+}
+
+/*---------------------------------------------------------------------------*/
+// A page description program only needs to be read once, from start to finish,
+// so there is no need to hold the whole decompressed stream in memory. This
+// decodes the stream a chunk at a time and hands each chunk to the sink. If
+// the stream has already been decoded and stored, it is passed on as it is.
+
+void Object::StreamTo(const OutputSink& sink)
+{
+  bool is_decoded;
+  shared_ptr<const string> owner;
+  CharString contents;
+  {
+    lock_guard<mutex> lock(*stream_mutex_);
+    is_decoded = is_decoded_;
+    owner = stream_;
+    contents = contents_;
+  }
+
+  if (is_decoded)
+  {
+    RecordUse_(contents.size());
+    if (!contents.empty()) sink(contents.begin(), contents.size());
+    return;
+  }
+
+  xref_->File()->WillNeed(raw_stream_);
+
+  // Encrypted streams have to be decrypted in full before decoding
+  if (NeedsDecryption_())
+  {
+    string decrypted = DecryptStream_();
+    DecodeStream(CharString(decrypted), header_, sink);
+  }
+  else DecodeStream(raw_stream_, header_, sink);
+}
+
+
+/*---------------------------------------------------------------------------*/
+// The cache starts empty, with all its counters at zero
 
-  string filters = header_["/Filter"];
-  bool is_flatedecode = filters.find("/FlateDecode") != string::npos;
+StreamCache::StreamCache(size_t budget) : statistics_({budget, 0, 0, 0, 0, 0})
+{}
 
-  // Decrypt if necessary
-  if (xref_->IsEncrypted())
+/*---------------------------------------------------------------------------*/
+// Moves the object's entry to the front of the list, adding one if it isn't
+// there yet. The evicted objects are only let go of once the lock is released.
+
+void StreamCache::Record(const shared_ptr<Object>& object, size_t bytes)
+{
+  vector<shared_ptr<Object>> evicted;
   {
-    stream_ = xref_->Decrypt(raw_stream_, object_number_, 0);
-    if (is_flatedecode) stream_ = FlateDecode(&stream_);
+    lock_guard<mutex> lock(mutex_);
+    auto found = index_.find(object.get());
+    if (found != index_.end())
+    {
+      statistics_.hits++;
+      entries_.splice(entries_.begin(), entries_, found->second.first);
+      return;
+    }
+
+    statistics_.misses++;
+    entries_.emplace_front(object.get(), object);
+    index_[object.get()] = make_pair(entries_.begin(), bytes);
+    statistics_.bytes += bytes;
+    statistics_.entries++;
+    evicted = Evict_();
   }
-  else
+}
+
+/*---------------------------------------------------------------------------*/
+
+void StreamCache::Remove(const Object* object)
+{
+  lock_guard<mutex> lock(mutex_);
+  auto found = index_.find(object);
+  if (found == index_.end()) return;
+  entries_.erase(found->second.first);
+  statistics_.bytes -= found->second.second;
+  statistics_.entries--;
+  index_.erase(found);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void StreamCache::SetBudget(size_t budget)
+{
+  vector<shared_ptr<Object>> evicted;
   {
-    if (is_flatedecode) stream_ = FlateDecode(raw_stream_);
+    lock_guard<mutex> lock(mutex_);
+    statistics_.budget = budget;
+    evicted = Evict_();
   }
 }
 
+/*---------------------------------------------------------------------------*/
+
+StreamCache::Statistics StreamCache::GetStatistics() const
+{
+  lock_guard<mutex> lock(mutex_);
+  return statistics_;
+}
+
+/*---------------------------------------------------------------------------*/
+// An entry whose object is already being destroyed is just removed, since the
+// object's destructor will be waiting on the lock to do the same.
+
+vector<shared_ptr<Object>> StreamCache::Evict_()
+{
+  vector<shared_ptr<Object>> evicted;
+  while (statistics_.bytes > statistics_.budget && !entries_.empty())
+  {
+    auto found = index_.find(entries_.back().first);
+    auto object = entries_.back().second.lock();
+    statistics_.bytes -= found->second.second;
+    statistics_.entries--;
+    index_.erase(found);
+    entries_.pop_back();
+
+    if (!object) continue;
+    object->EvictStream_();
+    statistics_.evictions++;
+    evicted.push_back(move(object));
+  }
+  return evicted;
+}
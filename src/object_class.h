@@ -33,44 +33,146 @@
  * a vector of retrieved objects in the document class, which persists through
  * the lifetime of the program.
  *
+ * Decoded streams can be far larger than the rest of an object, so a
+ * document's objects share a StreamCache that counts the bytes their decoded
+ * streams hold and keeps the total within a budget. When it goes over, the
+ * least recently used streams are dropped, leaving the objects themselves
+ * (and their dictionaries) in place. A dropped stream is simply decoded again
+ * from the file the next time it is asked for.
+ *
+ * Object streams are the exception. In newer files nearly every dictionary is
+ * kept in one, so rather than copy each object out of it, an object taken
+ * from an object stream is read in place: its dictionary is parsed straight
+ * from the decoded object stream, and any other contents are kept as a view
+ * into it, sharing ownership of its bytes. The decoded object stream is
+ * therefore never evicted, and each one is decoded only once.
+ *
  * The job of finding the object, parsing its dictionary and decoding its stream
  * is abstracted away using this class, so that pdf objects can be directly
  * interrogated for key:value pairs and their streams can be parsed as plain
  * text where appropriate. This means that logical structures such as pages,
  * fonts and form objects can be built by interfacing directly with pdf objects
  * rather than indirectly through byte offsets and binary streams
+ *
+ * Pages may be read on several threads at once, and an Object such as a font
+ * file or a form XObject can be shared between pages, so the decoding of its
+ * stream is done under a lock, and only once.
  */
 
+#include "streams.h"
 #include "xref.h"
+#include<functional>
+#include<mutex>
+#include<list>
+
+class Object;
+
+//---------------------------------------------------------------------------//
+// Keeps the decoded streams of a document's objects within a memory budget,
+// evicting the least recently used ones first. Objects report each use of
+// their decoded stream with Record; a stream not already in the cache counts
+// as a miss, since it has just been decoded. The counters are there so that
+// the budget can be sized to the memory available.
+
+class StreamCache
+{
+ public:
+  struct Statistics
+  {
+    size_t budget;       // Most bytes of decoded stream to keep
+    size_t bytes;        // Bytes of decoded stream currently kept
+    size_t entries;      // Number of decoded streams currently kept
+    size_t hits;         // Uses of a stream that was already decoded
+    size_t misses;       // Uses of a stream that had to be decoded
+    size_t evictions;    // Streams dropped to keep within the budget
+  };
+
+  StreamCache(size_t budget = default_budget_);
+
+  // Marks object's stream of the given size as the most recently used,
+  // evicting others if this takes the cache over its budget
+  void Record(const std::shared_ptr<Object>& object, size_t bytes);
+
+  // Forgets an object that is being destroyed
+  void Remove(const Object* object);
+
+  // Changes the budget, evicting streams at once if it has been reduced
+  void SetBudget(size_t budget);
+
+  Statistics GetStatistics() const;
+
+  static const size_t default_budget_ = 256 << 20;
+
+ private:
+  typedef std::pair<const Object*, std::weak_ptr<Object>> Entry;
+
+  mutable std::mutex mutex_;
+  std::list<Entry> entries_;    // Most recently used at the front
+  std::unordered_map<const Object*,
+                     std::pair<std::list<Entry>::iterator, size_t>> index_;
+  Statistics statistics_;
+
+  // Drops least recently used streams until the cache is within budget.
+  // The caller holds the lock, and must keep the returned pointers until
+  // after it has been released, in case one of them is the last owner of
+  // its object, whose destructor calls Remove.
+  std::vector<std::shared_ptr<Object>> Evict_();
+};
 
 //---------------------------------------------------------------------------//
 
-class Object
+class Object : public std::enable_shared_from_this<Object>
 {
  public:
-  // Get pdf object from a given object number
-  Object(std::shared_ptr<const XRef> xref_ptr, int object_number);
+  // Gets other objects by number, as Document::GetObject does
+  typedef std::function<std::shared_ptr<Object>(int)> Lookup;
+
+  // Get pdf object from a given object number. If a cache is given, the
+  // decoded stream is kept within its budget. If a lookup is given, it is
+  // used to resolve /Filter and /DecodeParms entries given by reference.
+  Object(std::shared_ptr<const XRef> xref_ptr, int object_number,
+         std::shared_ptr<StreamCache> stream_cache = nullptr,
+         const Lookup& lookup = nullptr);
 
   // Get stream object from inside the holding object, given object number
   Object(std::shared_ptr<Object> holding_object_ptr, int object_number);
 
   // Default constructor
   Object() = delete;
+  ~Object();
 
   // Returns an Object's stream as a string
-  std::string& GetStream();
+  std::string GetStream();
+
+  // Returns an Object's decoded stream without copying it. The pointer keeps
+  // the stream alive even if the cache evicts it.
+  std::shared_ptr<const std::string> GetSharedStream();
+
+  // Passes an Object's decoded stream to sink in chunks without storing it
+  void StreamTo(const OutputSink& sink);
 
   // Returns an Object's Dictionary
   Dictionary& GetDictionary();
 
+  // If this object (from an object stream) is only a reference to another
+  // object, returns the other object's number. Otherwise returns 0.
+  int GetReferencedObject() const {return referenced_object_;}
+
   friend std::ostream& operator<<(std::ostream& os, const Object& obj);
+  friend class StreamCache;
 
  private:
   std::shared_ptr<const XRef> xref_;      // Pointer to creating xref
   int object_number_;                     // The object knows its own number
   Dictionary header_;                     // The object's dictionary
-  std::string stream_;                    // The object's stream or contents
+  std::shared_ptr<const std::string> stream_; // Owns the bytes of contents_
+  CharString contents_;                   // The decoded stream or contents
   CharString raw_stream_;                 // Start position and length of stream
+  std::shared_ptr<std::mutex> stream_mutex_; // Guards decoding of stream_
+  bool is_decoded_;                       // Set while stream_ holds the stream
+  bool is_evictable_;                     // Set if stream_ can be decoded again
+  std::shared_ptr<StreamCache> stream_cache_; // Budget for decoded streams
+  int referenced_object_;                 // Object this one only points to
 
   // A lookup of start / stop positions of the objects within an object stream
   std::shared_ptr<std::unordered_map<int, std::pair<int, int>>> stream_index_;
@@ -78,6 +180,13 @@ class Object
   // private methods
   void IndexObjectStream_();
   void ReadStream_();
+  CharString GetDecodedStream_(std::shared_ptr<const std::string>& owner);
+  void RecordUse_(size_t bytes);
+  void EvictStream_();
+  void ResolveFilterEntries_(const Lookup& lookup);
+  static std::string FilterEntryText_(const Object& object);
+  bool NeedsDecryption_() const;
+  std::string DecryptStream_() const;
 };
 
 //---------------------------------------------------------------------------//
@@ -16,6 +16,7 @@
 #include "box.h"
 #include "page.h"
 #include<list>
+#include<unordered_set>
 #include<iterator>
 #include<iostream>
 
@@ -23,20 +24,18 @@
 
 using namespace std;
 
-unordered_map<string, shared_ptr<Font>> Page::fontmap_;
-
 /*--------------------------------------------------------------------------*/
 // The Page constructor calls private methods to build its data members after
 // its initializer list
 
 Page::Page(shared_ptr<Document> document_ptr, int page_number) :
-  document_(document_ptr), page_number_(page_number), rotate_(0)
+  document_(document_ptr), page_number_(page_number), rotate_(0),
+  has_read_xobjects_(false), has_read_nested_xobjects_(false)
 {
   ReadHeader_();      // find the page header
   ReadResources_();   // find the resource header
-  ReadXObjects_();    // identify, parse and store XObjects
   ReadFonts_();       // find the fonts dictionaries and build the fontmap
-  ReadContents_();    // Find the contents entries and build the content string
+  ReadContents_();    // Find the contents entries
   ReadBoxes_();       // Find the bounding box of the page
 }
 
@@ -130,38 +129,14 @@ void Page::ReadFonts_()
   fonts_ = FollowToDictionary(resources_, "/Font");
 
   // We can now iterate through the font dictionary, which will be a sequence
-  // of key:value pairs of fontname : font descriptor, where the font descriptor
-  // is almost always a reference but can also be a direct dictionary
+  // of key:value pairs of fontname : font descriptor. Each name goes into
+  // the fontmap unresolved, and its Font is only fetched from the Document
+  // (which builds and keeps it) when the page first selects it. Many pages
+  // share a resource dictionary naming far more fonts than any one of them
+  // uses, and the others never need to be built.
   for (auto name_descriptor_pair : fonts_)
   {
-    auto& font_name = name_descriptor_pair.first;
-    auto& font_descriptor = name_descriptor_pair.second;
-    auto found_font = fontmap_.find(font_name);
-
-    // If the font is not in the fontmap, inserts it
-    if (found_font == fontmap_.end())
-    {
-      Dictionary font_dict;
-
-      // Handle the font descriptor being a direct dictionary
-      if (font_descriptor.find("<<") != string::npos)
-      {
-        font_dict = Dictionary(make_shared<string>(font_descriptor));
-      }
-
-      // If it's not a direct dictionary, it must be a reference
-      else
-      {
-        auto font_reference = fonts_.GetReference(font_name);
-        font_dict = Dictionary(
-          document_->GetObject(font_reference)->GetDictionary());
-      }
-
-
-      // We should now have a font dictionary from which to create a Font object
-      auto font_ptr = make_shared<Font>(document_, font_dict, font_name);
-      fontmap_[font_name] = font_ptr;
-    }
+    fontmap_[name_descriptor_pair.first] = nullptr;
   }
 }
 
@@ -169,132 +144,138 @@ void Page::ReadFonts_()
 // The contents contain the page description program, sometimes split across
 // several objects. Occasionally the contents for a page can be nested such
 // that one reference contains a bunch of other references rather than the
-// content stream itself.
+// content stream itself. Only the object numbers are stored here; the streams
+// themselves are not decompressed until the program is actually read.
 
 void Page::ReadContents_()
 {
   // Call ExpandContents() to get page header object numbers
-  auto contents = ExpandContents_(header_.GetReferences("/Contents"));
+  contents_ = ExpandContents_(header_.GetReferences("/Contents"));
+}
 
-  // Get the contents from each object stream and paste them at the bottom
-  // of the pagestring with a line break after each one
-  for (auto element : contents)
+/*--------------------------------------------------------------------------*/
+// Sends the contents of each content object to the sink in turn, with a line
+// break after each one. Since the streams are inflated a chunk at a time, the
+// full page description program never needs to exist as a single string.
+
+void Page::StreamContents(const OutputSink& sink)
+{
+  for (auto element : contents_)
   {
-    content_string_.append(document_->GetObject(element)->GetStream());
-    content_string_.append(string("\n"));
+    document_->GetObject(element)->StreamTo(sink);
+    sink("\n", 1);
   }
 }
 
 /*---------------------------------------------------------------------------*/
 // XObjects are components that can be called from a page description program.
 // Most often, these are images, but they can be of many different types. Some
-// contain textual components and form an integral part of the page. Any
-// xobjects in the resources dictionary therefore needs to be examined for
-// textual components and its uncompressed contents stored for later use
+// contain textual components and form an integral part of the page. Nothing
+// is read about them until the page description program draws one with "Do",
+// and then only the XObject named is built. Its /Subtype is in its dictionary,
+// so images and the like can be passed over without decoding their streams.
 
-void Page::ReadXObjects_()
+shared_ptr<const string> Page::GetXObject(const string& t_object_id)
 {
-  string xobject_string {};
-
-  std::list<std::pair<std::string, int>> xobject_list;
-
-  // first find any xobject entries in the resource dictionary
-  if (resources_.HasKey("/XObject"))
-  {
-    xobject_string = resources_.GetString("/XObject");
-  }
-
-  // Sanity check - the entry shouldn't be empty
-  if (xobject_string.empty()) return;
+  int object_number = FindXObject_(t_object_id);
+  if (object_number == 0 || !IsForm_(object_number)) return nullptr;
+  return document_->GetObject(object_number)->GetSharedStream();
+}
 
-  // If /xobject entry is a dictionary, create a dictionary object
-  Dictionary xobject_dictionary;
-  if (xobject_string.find("<<") != string::npos)
-  {
-    xobject_dictionary = Dictionary(make_shared<string>(xobject_string));
-  }
+/*---------------------------------------------------------------------------*/
+// Names are looked up in the page's own /XObject dictionary first. A form can
+// draw XObjects from its own resources, so if the name isn't found there, the
+// resources of the page's forms (and of their forms in turn) are added, with
+// names the page already uses keeping their objects.
 
-  // If the /XObject string is a reference, follow the reference to dictionary
-  else if (resources_.ContainsReferences("/XObject"))
+int Page::FindXObject_(const string& name)
+{
+  if (!has_read_xobjects_)
   {
-    auto xobject_number = resources_.GetReference("/XObject");
-    xobject_dictionary = document_->GetObject(xobject_number)->GetDictionary();
+    for (auto& entry : ReadXObjectNames_(resources_)) xobjects_.insert(entry);
+    has_read_xobjects_ = true;
   }
 
-  // We now have a dictionary of {xobject name: ref} from which to get xobjects
-  for (auto& entry : xobject_dictionary)
+  auto found = xobjects_.find(name);
+  if (found == xobjects_.end() && !has_read_nested_xobjects_)
   {
-    vector<int> xobjects = xobject_dictionary.GetReferences(entry.first);
-
-  // map xobject numbers to the xobject names in a list of pairs
-    if (!xobjects.empty())
-    {
-      xobject_list.push_back({entry.first, xobjects[0]});
-    }
+    ReadNestedXObjects_();
+    found = xobjects_.find(name);
   }
 
-  // iterate through the xobject <name, object_number> list, adding newly
-  // discovered nested xobjects to the end of the list as we find them
-
-  for(auto i = xobject_list.begin(); i != xobject_list.end(); ++i)
-  {
-    xobjects_[i->first] = document_->GetObject(i->second)->GetStream();
-    std::list<std::pair<std::string, int>> subobjects = SubXobjects(i->second);
-    for(auto j : subobjects) xobject_list.push_back(j);
-  }
+  if (found == xobjects_.end()) return 0;
+  return found->second;
 }
 
-std::list<std::pair<std::string, int>>
-  Page::SubXobjects(int xobj_num)
-{
-  std::list<std::pair<std::string, int>> result;
-
-  std::shared_ptr<Object> xobj_ptr = document_->GetObject(xobj_num);
+/*---------------------------------------------------------------------------*/
+// A breadth-first walk through the forms used on the page, adding newly
+// discovered nested xobjects to the end of the list as we find them. Only
+// dictionaries are read. Forms already visited are skipped, so a form that
+// names itself in its own resources can't send this round in circles.
 
-  Dictionary xobject_dict = xobj_ptr->GetDictionary();
+void Page::ReadNestedXObjects_()
+{
+  has_read_nested_xobjects_ = true;
+  list<pair<string, int>> xobject_list = ReadXObjectNames_(resources_);
+  unordered_set<int> visited;
 
-  if (!xobject_dict.HasKey("/Resources"))
+  for (auto i = xobject_list.begin(); i != xobject_list.end(); ++i)
   {
-    return result;
+    if (!visited.insert(i->second).second || !IsForm_(i->second)) continue;
+    for (auto& subobject : SubXobjects(i->second))
+    {
+      xobjects_.insert(subobject);
+      xobject_list.push_back(subobject);
+    }
   }
+}
 
-  Dictionary resources = FollowToDictionary(xobject_dict, "/Resources");
-
-  if (!resources.HasKey("/XObject"))
-  {
-    return result;
-  }
+/*---------------------------------------------------------------------------*/
+// Reads an XObject's dictionary to find whether it is a form. The answer is
+// kept, since the same XObject is often drawn many times on a page.
 
-  string xobject_string = resources.GetString("/XObject");
+bool Page::IsForm_(int object_number)
+{
+  auto found = is_form_.find(object_number);
+  if (found != is_form_.end()) return found->second;
 
+  auto& dictionary = document_->GetObject(object_number)->GetDictionary();
+  bool is_form = dictionary.GetString("/Subtype") == "/Form";
+  is_form_[object_number] = is_form;
+  return is_form;
+}
 
-  Dictionary xobject_dictionary;
-  if (xobject_string.find("<<") != string::npos)
-  {
-    xobject_dictionary = Dictionary(make_shared<string>(xobject_string));
-  }
+/*---------------------------------------------------------------------------*/
+// Reads the {xobject name: reference} pairs from the /XObject entry of a
+// resource dictionary, which may be a direct dictionary or a reference to one
 
-  else if (resources.ContainsReferences("/XObject"))
-  {
-    auto xobject_number = resources.GetReference("/XObject");
-    xobject_dictionary = document_->GetObject(xobject_number)->GetDictionary();
-  }
+list<pair<string, int>> Page::ReadXObjectNames_(Dictionary& resources)
+{
+  list<pair<string, int>> result;
+  if (!resources.ContainsDictionary("/XObject") &&
+      !resources.ContainsReferences("/XObject")) return result;
 
+  Dictionary xobject_dictionary = FollowToDictionary(resources, "/XObject");
   for (auto& entry : xobject_dictionary)
   {
-
     vector<int> xobjects = xobject_dictionary.GetReferences(entry.first);
-
-    // map xobject strings to the xobject names
-    if (!xobjects.empty())
-    {
-      result.push_back({entry.first, xobjects[0]});
-    }
+    if (!xobjects.empty()) result.push_back({entry.first, xobjects[0]});
   }
-
   return result;
 }
 
+/*---------------------------------------------------------------------------*/
+// The XObjects named in the resources of the given XObject
+
+list<pair<string, int>> Page::SubXobjects(int xobj_num)
+{
+  Dictionary xobject_dict = document_->GetObject(xobj_num)->GetDictionary();
+  if (!xobject_dict.HasKey("/Resources")) return {};
+
+  Dictionary resources = FollowToDictionary(xobject_dict, "/Resources");
+  return ReadXObjectNames_(resources);
+}
+
 /*---------------------------------------------------------------------------*/
 // This is similar to the ExpandKids() method in document class, in that it
 // starts with a vector of references to objects which act as nodes of a tree
@@ -350,34 +331,42 @@ vector<int> Page::ExpandContents_(vector<int> object_numbers)
 }
 
 /*--------------------------------------------------------------------------*/
-// Simple getter for the PDF-style font names used in a page
+// See page.h. Only the dictionaries of images and other XObjects that aren't
+// forms have been read, and they aren't needed once the page has been built.
 
-vector<string> Page::GetFontNames()
+vector<int> Page::GetLocalObjectNumbers() const
 {
-  return this->fonts_.GetAllKeys();
+  vector<int> result {document_->GetPageObjectNumber(page_number_)};
+  Concatenate(result, contents_);
+  for (auto& entry : is_form_)
+  {
+    if (!entry.second) result.push_back(entry.first);
+  }
+  return result;
 }
 
 /*--------------------------------------------------------------------------*/
-// Simple getter for the content string of a Page
+// Simple getter for the PDF-style font names used in a page
 
-const string& Page::GetPageContents()
+vector<string> Page::GetFontNames()
 {
-  return this->content_string_;
+  return this->fonts_.GetAllKeys();
 }
 
 /*--------------------------------------------------------------------------*/
-// Finds and returns a particular XObject used on the page
+// Getter for the content string of a Page. The string is only assembled the
+// first time it is asked for, since the tokenizer reads the contents directly.
 
-shared_ptr<string> Page::GetXObject(const string& t_object_id)
+const string& Page::GetPageContents()
 {
-  // Use a non-inserting finder. If object not found return empty string
-  if (xobjects_.find(t_object_id) == xobjects_.end())
+  if (content_string_.empty())
   {
-    return make_shared<string>(string(""));
+    StreamContents([&](const char* chunk, size_t length) -> void
+                   {
+                     content_string_.append(chunk, length);
+                   });
   }
-
-  // Else return the Xobject
-  return make_shared<string>(xobjects_[t_object_id]);
+  return this->content_string_;
 }
 
 /*--------------------------------------------------------------------------*/
@@ -389,11 +378,15 @@ shared_ptr<Font> Page::GetFont(const string& font_id)
   // If no fonts on the page, throw an error
   if (fontmap_.empty()) throw runtime_error("No fonts available for page");
 
-  // If we can't find a specified font, return the first font in the map
+  // If we can't find a specified font, use the first font in the map
   auto font_finder = fontmap_.find(font_id);
-  if (font_finder == fontmap_.end()) return fontmap_.begin()->second;
+  if (font_finder == fontmap_.end()) font_finder = fontmap_.begin();
 
-  // Otherwise we're all good and return the requested font
+  // Build the font (or fetch it from the Document) on its first use
+  if (!font_finder->second)
+  {
+    font_finder->second = document_->GetFont(fonts_, font_finder->first);
+  }
   return font_finder->second;
 }
 
@@ -79,24 +79,33 @@ class Page
   // Returns page description program
   const std::string& GetPageContents();
 
-  // Returns a pointer to the contents of an XObject used by the page
-  std::shared_ptr<std::string> GetXObject(const std::string& x_object_name);
+  // Passes the page description program to sink as it is decompressed
+  void StreamContents(const OutputSink& sink);
 
-  // Returns a pointer to the Font object from a given font name
+  // Returns a pointer to the decoded contents of a form XObject used by the
+  // page, or nullptr if there is no such form. Images and other XObjects
+  // without text are never decoded, so give nullptr too.
+  std::shared_ptr<const std::string>
+    GetXObject(const std::string& x_object_name);
+
+  // Returns a pointer to the Font object from a given font name, building
+  // the Font if this is the first time it has been asked for
   std::shared_ptr<Font> GetFont(const std::string& font_name);
 
   // Returns a Box object describing the page's bounding box.
   std::shared_ptr<Box> GetMinbox() const { return minbox_;}
 
-  // Since the font map is a static object, it should be cleared at the end
-  // of processing any particular document. Important!
-  void ClearFontMap() { fontmap_.clear(); };
-
   // Allows a dictionary to be returned either directly or via reference
   Dictionary FollowToDictionary(Dictionary&,  const std::string&);
 
   std::list<std::pair<std::string, int>> SubXobjects(int xobj_num);
 
+  // Returns the numbers of the objects that belong to this page alone: its
+  // header, its content streams and the images it uses. Shared resources
+  // such as fonts and form XObjects aren't included. These can be released
+  // from the Document's cache once the page has been read.
+  std::vector<int> GetLocalObjectNumbers() const;
+
  private:
   std::shared_ptr<Document>   document_;        // Pointer to main document
   int                         page_number_;     // [Zero-indexed] page number
@@ -105,21 +114,33 @@ class Page
                               fonts_;           // Font sub-dictionary
   std::shared_ptr<Box>        minbox_;          // Page bounding Box
   std::string                 content_string_;  // The page PostScript program
+  std::vector<int>            contents_;        // Content object numbers
   float                       rotate_;          // Page rotation in degrees
+  bool                        has_read_xobjects_,        // Set once the names
+                              has_read_nested_xobjects_; // are looked up
 
-  // A map of Xobject strings, which are fragments of page description programs
-  std::unordered_map<std::string, std::string> xobjects_;
+  // XObject names mapped to their object numbers, and whether each XObject
+  // looked at so far is a form. Forms are fragments of page description
+  // programs, and are decoded by the Document, which keeps them for any other
+  // pages that use them.
+  std::unordered_map<std::string, int> xobjects_;
+  std::unordered_map<int, bool> is_form_;
 
-  // The actual storage container for fonts, mapped to their pdf names
-  static std::unordered_map<std::string, std::shared_ptr<Font>> fontmap_;
+  // The page's fonts mapped to their pdf names, each left empty until the
+  // font is first used. The Fonts belong to the Document, which shares them
+  // between pages.
+  std::unordered_map<std::string, std::shared_ptr<Font>> fontmap_;
 
   // private methods
-  void ReadXObjects_();     // Write form XObjects to the xobject map
   void ReadBoxes_();        // Store bounding boxes and calculate the smallest
   void ReadHeader_();       // Find the correct header dictionary in document
   void ReadResources_();    // Obtain the resource dictionary
   void ReadFonts_();        // Get font dictionary and build fontmap
-  void ReadContents_();     // find content objects to Write contentstring
+  void ReadContents_();     // Find the object numbers of the contents
+  int FindXObject_(const std::string&); // Object number of a named XObject
+  void ReadNestedXObjects_();           // Add names from forms' resources
+  bool IsForm_(int);                    // Is object a form XObject?
+  std::list<std::pair<std::string, int>> ReadXObjectNames_(Dictionary&);
 
   // Gets the leaf nodes of a content tree
   std::vector<int> ExpandContents_(std::vector<int>);
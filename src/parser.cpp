@@ -30,7 +30,7 @@ typedef void (Parser::*FunctionPointer)();
 // This statically-declared map allows functions to be called based on strings
 // passed to it from the tokenizer
 
-std::unordered_map<std::string, FunctionPointer> Parser::function_map_ =
+const std::unordered_map<std::string, FunctionPointer> Parser::function_map_ =
 {
   {"Q",   &Parser::Q_  }, {"q",  &Parser::q_ }, {"BT",  &Parser::BT_ },
   {"ET",  &Parser::ET_ }, {"cm", &Parser::cm_}, {"Tm",  &Parser::Tm_ },
@@ -691,7 +691,7 @@ void Parser::Reader(const string& token, TokenState state)
 
     // Pass any stored operands on the stack
     auto finder = function_map_.find(token);
-    if (finder != function_map_.end()) (this->*function_map_[token])();
+    if (finder != function_map_.end()) (this->*finder->second)();
 
     // Clear the stack since an operator has been called
     operand_types_.clear();
@@ -707,7 +707,7 @@ void Parser::Reader(const string& token, TokenState state)
 
 /*---------------------------------------------------------------------------*/
 // Can't inline this without including page.h in header
-shared_ptr<string> Parser::GetXObject(const string& inloop) const
+shared_ptr<const string> Parser::GetXObject(const string& inloop) const
 {
   return page_->GetXObject(inloop);
 };
@@ -117,8 +117,9 @@ class Parser
     else return this->operands_[0];
   }
 
-  // This allows us to process an xObject
-  std::shared_ptr<std::string> GetXObject(const std::string& inloop) const;
+  // This allows us to process a form xObject. Gives nullptr for anything else
+  std::shared_ptr<const std::string>
+    GetXObject(const std::string& inloop) const;
 
   std::shared_ptr<Page> PagePointer() {return this->page_;}
 
@@ -139,7 +140,7 @@ class Parser
   typedef void (Parser::*FunctionPointer)();
 
   // A map that can look up which function to call based on the instruction sent
-  static std::unordered_map<std::string, FunctionPointer> function_map_;
+  static const std::unordered_map<std::string, FunctionPointer> function_map_;
 
   // The reader method takes the compiled instructions and writes operands
   // to a "stack", or calls an operator method depending on the label given
@@ -21,8 +21,10 @@
 #include "whitespace.h"
 #include "line_grouper.h"
 #include "truetype.h"
+#include "scheduler.h"
 #include "pdfr.h"
 #include <iomanip>
+#include <limits>
 
 //---------------------------------------------------------------------------//
 
@@ -30,37 +32,180 @@ using namespace std;
 using namespace Rcpp;
 
 //---------------------------------------------------------------------------//
-// The two GetPage functions are helpers to take either a string representing
-// the path to a valid pdf file, or the pdf file itself as a vector of bytes,
-// as well as an integer page number, and returning a pointer to a newly created
-// page object. This is a common task in the exported functions, so we need to
-// seperate these functions out to reduce replication
+// The GetPage functions are helpers to take either a string representing
+// the path to a valid pdf file, the pdf file itself as a vector of bytes, or
+// an open Document, as well as an integer page number, and returning a pointer
+// to a newly created page object. This is a common task in the exported
+// functions, so we need to seperate these functions out to reduce replication
 
-shared_ptr<Page> GetPage(string file_name, int page_number)
+shared_ptr<Page> GetPage(shared_ptr<Document> document_ptr, int page_number)
 {
   // Pages are numbered from 1. Any less than this should throw an error
   if (page_number < 1) stop("Invalid page number");
 
-  // Create the Document object
-  auto document_ptr = make_shared<Document>(file_name);
-
   // Create the page object and return it
   return make_shared<Page>(document_ptr, page_number - 1);
 }
 
+//---------------------------------------------------------------------------//
+// File path version. The Document is only used for one page, so a linearized
+// file is opened from its first-page XRef section (see document.h). Reading
+// the first page then doesn't need the rest of the file, and other pages are
+// read just as before.
+
+shared_ptr<Page> GetPage(string file_name, int page_number)
+{
+  return GetPage(make_shared<Document>(file_name, 1, true), page_number);
+}
+
 //---------------------------------------------------------------------------//
 // Raw version
 
 shared_ptr<Page> GetPage(vector<uint8_t> raw_file, int page_number)
 {
-  // Pages are numbered from 1. Any less than this should throw an error
-  if (page_number < 1) stop("Invalid page number");
+  return GetPage(make_shared<Document>(raw_file, 1, true), page_number);
+}
 
-  // Create the Document object
-  auto document_ptr = make_shared<Document>(raw_file);
+//---------------------------------------------------------------------------//
+// A document handle is an R external pointer to a heap-allocated shared_ptr
+// to a Document. R deletes the shared_ptr when the handle is garbage
+// collected, and the Document (with its object cache) goes with it unless a
+// Page somewhere still holds a pointer to it. The handle's class is checked
+// before it is used, since R code could pass any external pointer here.
 
-  // Create the page object and return it
-  return make_shared<Page>(document_ptr, page_number - 1);
+SEXP MakeDocumentHandle(shared_ptr<Document> document_ptr)
+{
+  XPtr<shared_ptr<Document>> handle(new shared_ptr<Document>(document_ptr));
+  handle.attr("class") = "pdf_document";
+  return handle;
+}
+
+shared_ptr<Document> GetDocument(SEXP handle)
+{
+  if (TYPEOF(handle) != EXTPTRSXP || !Rf_inherits(handle, "pdf_document"))
+  {
+    stop("Invalid pdf document handle");
+  }
+
+  // An external pointer that has been saved and reloaded is null
+  XPtr<shared_ptr<Document>> pointer(handle);
+  if (!pointer.get()) stop("The pdf document is no longer open");
+  return *pointer;
+}
+
+//---------------------------------------------------------------------------//
+// Exported functions to open a document from a file path or raw data
+
+SEXP OpenDocumentFromString(const string& file_name, int n_threads,
+                            const string& sidecar_path)
+{
+  if (sidecar_path.empty())
+  {
+    return MakeDocumentHandle(make_shared<Document>(file_name, n_threads));
+  }
+  return MakeDocumentHandle(
+    make_shared<Document>(file_name, sidecar_path, n_threads));
+}
+
+SEXP OpenDocumentFromRaw(const vector<uint8_t>& raw_file, int n_threads)
+{
+  return MakeDocumentHandle(make_shared<Document>(raw_file, n_threads));
+}
+
+//---------------------------------------------------------------------------//
+
+int GetPageCount(SEXP document)
+{
+  return GetDocument(document)->GetPageCount();
+}
+
+//---------------------------------------------------------------------------//
+// The counts are returned as doubles, since they may not fit in an R integer.
+// An infinite budget turns eviction off. The Document's font cache is reported
+// alongside, since fonts are the other thing pages share.
+
+NumericVector GetStreamCacheStatistics(SEXP document, double budget)
+{
+  StreamCache& cache = GetDocument(document)->GetStreamCache();
+  size_t no_limit = numeric_limits<size_t>::max();
+  if (budget >= (double) no_limit) cache.SetBudget(no_limit);
+  else if (budget >= 0) cache.SetBudget((size_t) budget);
+
+  StreamCache::Statistics statistics = cache.GetStatistics();
+  Document::FontStatistics fonts = GetDocument(document)->GetFontStatistics();
+  return NumericVector::create(
+    Named("budget")      = (double) statistics.budget,
+    Named("bytes")       = (double) statistics.bytes,
+    Named("entries")     = (double) statistics.entries,
+    Named("hits")        = (double) statistics.hits,
+    Named("misses")      = (double) statistics.misses,
+    Named("evictions")   = (double) statistics.evictions,
+    Named("fonts")       = (double) fonts.fonts,
+    Named("font_hits")   = (double) fonts.hits,
+    Named("font_misses") = (double) fonts.misses);
+}
+
+//---------------------------------------------------------------------------//
+// The whole page list is read first, so that each page's header is found
+// directly rather than by going down the page tree. Missing boxes are NA. The
+// information strings are UTF-8, which the R function marks them as.
+
+List GetDocumentInfo(SEXP document)
+{
+  auto document_ptr = GetDocument(document);
+  size_t page_count = document_ptr->GetPageObjectNumbers().size();
+
+  vector<string> info_keys, info_values;
+  for (auto& entry : document_ptr->GetInfo())
+  {
+    info_keys.push_back(entry.first);
+    info_values.push_back(entry.second);
+  }
+  CharacterVector info = wrap(info_values);
+  info.attr("names") = info_keys;
+
+  vector<vector<double>> boxes(8, vector<double>(page_count, NA_REAL));
+  vector<int> pages(page_count), rotate(page_count), font_pages;
+  vector<string> font_names, base_fonts;
+  for (size_t i = 0; i < page_count; ++i)
+  {
+    Document::PageInfo page_info = document_ptr->GetPageInfo(i);
+    pages[i] = (int) i + 1;
+    rotate[i] = page_info.rotate;
+    for (size_t j = 0; j < 4 && !page_info.media_box.empty(); ++j)
+    {
+      boxes[j][i]     = page_info.media_box[j];
+      boxes[j + 4][i] = page_info.crop_box[j];
+    }
+    for (auto& font : page_info.fonts)
+    {
+      font_pages.push_back((int) i + 1);
+      font_names.push_back(font.first);
+      base_fonts.push_back(font.second);
+    }
+  }
+
+  DataFrame page_table = DataFrame::create(
+    Named("page")         = pages,
+    Named("media_left")   = boxes[0],
+    Named("media_bottom") = boxes[1],
+    Named("media_right")  = boxes[2],
+    Named("media_top")    = boxes[3],
+    Named("crop_left")    = boxes[4],
+    Named("crop_bottom")  = boxes[5],
+    Named("crop_right")   = boxes[6],
+    Named("crop_top")     = boxes[7],
+    Named("rotate")       = rotate);
+
+  DataFrame font_table = DataFrame::create(
+    Named("page")             = font_pages,
+    Named("name")             = font_names,
+    Named("font")             = base_fonts,
+    Named("stringsAsFactors") = false);
+
+  return List::create(Named("info")  = info,
+                      Named("pages") = page_table,
+                      Named("fonts") = font_table);
 }
 
 //---------------------------------------------------------------------------//
@@ -96,9 +241,6 @@ DataFrame GetGlyphMap(const string& file_name, int page_number)
     }
   }
 
-  // Clear the static font map
-  page_ptr->ClearFontMap();
-
   // put all the glyphs in a single dataframe and return
   return  DataFrame::create(Named("Font")      = font_names,
                             Named("Codepoint") = codepoint,
@@ -111,13 +253,16 @@ DataFrame GetGlyphMap(const string& file_name, int page_number)
 // get_xref. It acts as a helper function and common final pathway for the
 // raw and filepath versions of get_xref
 
-DataFrame XrefCreator(shared_ptr<const string> file_string)
+DataFrame XrefCreator(shared_ptr<const ByteSource> file)
 {
-  // Create the xref from the given string pointer
-  XRef Xref(file_string);
+  // Create the xref from the given file
+  XRef Xref(file);
 
-  // Declare containers used to fill dataframe
-  vector<int> object {}, start_byte {}, holding_object {};
+  // Declare containers used to fill dataframe. Start bytes are doubles, as
+  // offsets in files over 2GB don't fit in an R integer
+  vector<int> object {}, holding_object {};
+  vector<double> start_byte {};
+  vector<bool> recovered {};
 
   // If the xref has entries
   if (!Xref.GetAllObjectNumbers().empty())
@@ -131,54 +276,50 @@ DataFrame XrefCreator(shared_ptr<const string> file_string)
       object.push_back(object_num);
       start_byte.push_back(Xref.GetObjectStartByte(object_num));
       holding_object.push_back(Xref.GetHoldingNumberOf(object_num));
+      recovered.push_back(Xref.IsRecovered(object_num));
     }
   }
 
   // Use the containers to fill the dataframe and return it to caller
   return DataFrame::create(Named("Object")    = object,
                            Named("StartByte") = start_byte,
-                           Named("InObject")  = holding_object);
+                           Named("InObject")  = holding_object,
+                           Named("Recovered") = recovered);
 }
 
 /*---------------------------------------------------------------------------*/
-// Exported filepath version of get_xref. Gets the file string by loading
-// the file path into a single large string, a pointer to which is used to
-// call the XrefCreator
+// Exported filepath version of get_xref. Maps the file into memory (or loads
+// it where it can't be mapped) and passes it to the XrefCreator
 
 DataFrame GetXrefFromString(const string& filename)
 {
-  // This one-liner gets the file string, builds the xref and turns it into an
+  // This one-liner opens the file, builds the xref and turns it into an
   // R data frame
-  return XrefCreator(make_shared<string>(GetFile(filename)));
+  return XrefCreator(ByteSource::FromFile(filename));
 }
 
 //---------------------------------------------------------------------------//
-// Exported raw data version of get_xref. Gets the file string by casting the
-// raw data vector as a single large string, a pointer to which is used to
-// call the XrefCreator
+// Exported raw data version of get_xref. Copies the raw data vector into a
+// ByteSource, which is used to call the XrefCreator
 
 DataFrame GetXrefFromRaw(const vector<uint8_t>& raw_file)
 {
-  // Cast raw vector to string
+  // Copy raw vector into a ByteSource
   string file_string(raw_file.begin(), raw_file.end());
 
   // Create a dataframe representing the xref entry
-  return XrefCreator(make_shared<string>(file_string));
+  return XrefCreator(make_shared<const ByteSource>(move(file_string)));
 }
 
 //---------------------------------------------------------------------------//
-// The file string version of get_object. It takes a file path as a parameter,
-// from which it loads the entire file into a string to create a Document.
-// The second parameter is the actual pdf object number, which is found by
+// The common pathway of the get_object functions. The object is found by
 // the public GetObject() method from Document class. It returns a list
 // of two named values - the dictionary, as a named character vector, and the
-// decrypted / decompressed stream as a single string
+// decrypted / decompressed stream, as a single string if it is text or as a
+// raw vector otherwise
 
-List GetObjectFromString(const string& file_name, int object)
+List ObjectAsList(shared_ptr<Document> doc_ptr, int object)
 {
-  // Create the Document
-  auto doc_ptr = make_shared<Document>(file_name);
-
   auto as_string = doc_ptr->GetObject(object)->GetStream();
   std::vector<uint8_t> as_raw(as_string.begin(), as_string.end());
   // Fill an List with the requested object and return
@@ -194,31 +335,101 @@ List GetObjectFromString(const string& file_name, int object)
   }
 }
 
+//---------------------------------------------------------------------------//
+// The file string version of get_object. It takes a file path as a parameter,
+// from which it creates a Document. The second parameter is the actual pdf
+// object number.
+
+List GetObjectFromString(const string& file_name, int object)
+{
+  return ObjectAsList(make_shared<Document>(file_name), object);
+}
+
 //---------------------------------------------------------------------------//
 // The raw data version of get_object(). It takes a raw vector as a parameter,
 // which it recasts as a single large string to create a Document.
-// The second parameter is the actual pdf object number, which is found by
-// the public GetObject() method from Document class. It returns a list
-// of two named values - the dictionary, as a named character vector, and the
-// decrypted / decompressed stream as a single string
 
 List GetObjectFromRaw(const vector<uint8_t>& raw_file, int object)
 {
-  // Create the Document
-  auto doc_ptr = make_shared<Document>(raw_file);
-  auto as_string = doc_ptr->GetObject(object)->GetStream();
-  std::vector<uint8_t> as_raw(as_string.begin(), as_string.end());
-  // Fill an List with the requested object and return
-  if(!IsAscii(as_string) && !as_raw.empty())
+  return ObjectAsList(make_shared<Document>(raw_file), object);
+}
+
+//---------------------------------------------------------------------------//
+// The document handle version of get_object()
+
+List GetObjectFromHandle(SEXP document, int object)
+{
+  return ObjectAsList(GetDocument(document), object);
+}
+
+//---------------------------------------------------------------------------//
+// Inflates every FlateDecode stream in the file with both the built-in decoder
+// and the one FlateDecode is using, and records whether the two agree. A
+// stream that makes one decoder throw must make the other throw as well. When
+// the package is built without zlib or libdeflate, both decoders are the same
+// and every stream trivially agrees.
+
+DataFrame CompareDecoders(const string& file_name)
+{
+  XRef xref(ByteSource::FromFile(file_name));
+
+  vector<int> object {}, builtin_size {}, backend_size {};
+  vector<bool> identical {};
+
+  for (int object_number : xref.GetAllObjectNumbers())
   {
-  return List::create(
-    Named("header") = doc_ptr->GetObject(object)->GetDictionary().GetMap(),
-    Named("stream") = as_raw);
-  } else {
-  return List::create(
-    Named("header") = doc_ptr->GetObject(object)->GetDictionary().GetMap(),
-    Named("stream") = as_string);
+    // Objects inside object streams don't have streams of their own
+    if (xref.GetHoldingNumberOf(object_number) != 0) continue;
+
+    size_t start = xref.GetObjectStartByte(object_number);
+    if (xref.File()->substr(start, 20).find("<<") == string::npos) continue;
+
+    Dictionary dictionary(*xref.File(), start);
+    if (dictionary["/Filter"].find("/FlateDecode") == string::npos) continue;
+
+    CharString raw_stream = xref.GetStreamLocation(start);
+    string decrypted;
+    if (xref.IsEncrypted())
+    {
+      decrypted = xref.Decrypt(raw_stream, object_number, 0);
+      raw_stream = CharString(decrypted);
+    }
+
+    // A size of -1 records that the decoder threw
+    string builtin_output, backend_output;
+    int builtin_length = -1, backend_length = -1;
+    try
+    {
+      builtin_output = GetBuiltInDecoder().Inflate(raw_stream);
+      builtin_length = builtin_output.size();
+    }
+    catch (...) {}
+    try
+    {
+      backend_output = GetFlateDecoder().Inflate(raw_stream);
+      backend_length = backend_output.size();
+    }
+    catch (...) {}
+
+    object.push_back(object_number);
+    builtin_size.push_back(builtin_length);
+    backend_size.push_back(backend_length);
+    identical.push_back(builtin_length == backend_length &&
+                        builtin_output == backend_output);
   }
+
+  return DataFrame::create(Named("object")       = object,
+                           Named("builtin_size") = builtin_size,
+                           Named("backend_size") = backend_size,
+                           Named("identical")    = identical);
+}
+
+//---------------------------------------------------------------------------//
+// Returns the name of the library FlateDecode is using
+
+string GetDecoderName()
+{
+  return GetFlateDecoder().Name();
 }
 
 //---------------------------------------------------------------------------//
@@ -232,15 +443,12 @@ List GetSingleTextElements(shared_ptr<Page> page_ptr)
   Parser parser_object = Parser(page_ptr);
 
   // Read page contents to Parser
-  Tokenizer(page_ptr->GetPageContents(), &parser_object);
+  Tokenizer(page_ptr, &parser_object);
 
   // Obtain output from Parser and transpose into a text table
   auto text_box = parser_object.Output();
   TextTable table(*text_box);
 
-  // Ensure the static fontmap is cleared after use
-  page_ptr->ClearFontMap();
-
   // Now create the data frame
   DataFrame db =  DataFrame::create(Named("text")   = table.GetText(),
                                     Named("left")   = table.GetLefts(),
@@ -264,7 +472,7 @@ List GetTextBoxes(shared_ptr<Page> page_ptr)
   auto parser_object = new Parser(page_ptr);
 
   // Read page contents to Parser
-  Tokenizer(page_ptr->GetPageContents(), parser_object);
+  Tokenizer(page_ptr, parser_object);
 
   // Group letters and words
   auto grouped_letters = new LetterGrouper(parser_object->Output());
@@ -277,7 +485,6 @@ List GetTextBoxes(shared_ptr<Page> page_ptr)
   delete WS;
   auto text_table = TextTable(linegrouper->Output());
   delete linegrouper;
-  page_ptr->ClearFontMap();
   DataFrame db =  DataFrame::create(
                     Named("text")             = move(text_table.GetText()),
                     Named("left")             = move(text_table.GetLefts()),
@@ -325,34 +532,74 @@ List GetPdfPageFromRaw(const vector<uint8_t>& raw_file,
 }
 
 //---------------------------------------------------------------------------//
+// The vectorised document handle version of pdfpage. Returns a list with the
+// result for each of the requested pages, all read from the same Document.
 
-DataFrame PdfDocCommon(shared_ptr<Document> document_ptr)
+List GetPdfPagesFromHandle(SEXP document,
+                           const vector<int>& page_numbers,
+                           bool each_glyph)
 {
-  auto number_of_pages = document_ptr->GetPageObjectNumbers().size();
-  vector<float> left, right, size, bottom;
-  vector<string> glyph, font;
-  vector<int> page_number_of_element;
+  auto document_ptr = GetDocument(document);
+  List result(page_numbers.size());
 
-  // Loop through each page, get its contents and add it to the output list
-  for (size_t page_number = 0; page_number < number_of_pages; page_number++)
+  for (size_t i = 0; i < page_numbers.size(); ++i)
   {
-    // Create a new page object
-    auto page_ptr = make_shared<Page>(document_ptr, page_number);
+    auto page_ptr = GetPage(document_ptr, page_numbers[i]);
+    if (!each_glyph) result[i] = GetTextBoxes(page_ptr);
+    else result[i] = GetSingleTextElements(page_ptr);
+  }
+  return result;
+}
+
+//---------------------------------------------------------------------------//
+// Extracts the text from a page as a TextTable of words and word clusters.
+// This is the common page task of pdfdoc and pdfdoc_stream.
+
+TextTable ExtractPageText(shared_ptr<Page> page_ptr)
+{
+  // Create a new Parser object
+  Parser parser_object(page_ptr);
 
-    // Create a new Parser object
-    Parser parser_object(page_ptr);
+  // Read page contents to Parser object
+  Tokenizer(page_ptr, &parser_object);
 
-    // Read page contents to Parser object
-    Tokenizer(page_ptr->GetPageContents(), &parser_object);
+  // Join individual letters into words
+  LetterGrouper grouped_letters(move(parser_object.Output()));
 
-    // Join individual letters into words
-    LetterGrouper grouped_letters(move(parser_object.Output()));
+  // Join individual words into lines or word clusters
+  WordGrouper grouped_words(grouped_letters.Output());
 
-    // Join individual words into lines or word clusters
-    WordGrouper grouped_words(grouped_letters.Output());
+  // Get a text table from the output
+  return grouped_words.Out();
+}
 
-    // Get a text table from the output
-    TextTable table = grouped_words.Out();;
+//---------------------------------------------------------------------------//
+// Extracts the text from every page of a document on number_of_threads
+// threads (see scheduler.h). Each page is processed independently into its own
+// TextTable, and the tables are joined in page order once all the pages are
+// done, so the result is the same whatever the number of threads. Nothing in
+// the page task touches R.
+
+DataFrame PdfDocCommon(shared_ptr<Document> document_ptr, int number_of_threads)
+{
+  auto number_of_pages = document_ptr->GetPageObjectNumbers().size();
+  vector<shared_ptr<TextTable>> page_tables(number_of_pages);
+
+  Scheduler scheduler(number_of_pages, number_of_threads);
+  scheduler.Run([&](size_t page_number) -> void
+  {
+    auto page_ptr = make_shared<Page>(document_ptr, page_number);
+    auto table = ExtractPageText(page_ptr);
+    page_tables[page_number] = make_shared<TextTable>(move(table));
+  });
+
+  vector<float> left, right, size, bottom;
+  vector<string> glyph, font;
+  vector<int> page_number_of_element;
+
+  for (size_t page_number = 0; page_number < number_of_pages; page_number++)
+  {
+    TextTable& table = *page_tables[page_number];
 
     // Join current page's output to final data frame columns
     Concatenate(left,   table.GetLefts());
@@ -367,9 +614,6 @@ DataFrame PdfDocCommon(shared_ptr<Document> document_ptr)
     {
       page_number_of_element.push_back(page_number + 1);
     }
-
-    // Clear the static font map if we are on the last page.
-    if (page_number == (number_of_pages - 1)) page_ptr->ClearFontMap();
   }
 
   // Build and return an R data frame
@@ -383,20 +627,68 @@ DataFrame PdfDocCommon(shared_ptr<Document> document_ptr)
                             Named("stringsAsFactors") = false);
 }
 
+//---------------------------------------------------------------------------//
+// Passes the text of each page of a document to callback in turn, without
+// keeping anything from one page to the next. Once a page has been read, the
+// objects that belong to it alone are released from the Document's cache (see
+// page.h) before the callback is called, so that only shared resources such as
+// fonts and object streams stay in memory. A document of any length can
+// therefore be read in roughly constant memory.
+
+void ForEachPageText(shared_ptr<Document> document_ptr,
+                     const function<void(size_t, TextTable&)>& callback)
+{
+  auto number_of_pages = document_ptr->GetPageObjectNumbers().size();
+
+  for (size_t page_number = 0; page_number < number_of_pages; page_number++)
+  {
+    auto page_ptr = make_shared<Page>(document_ptr, page_number);
+    TextTable table = ExtractPageText(page_ptr);
+    vector<int> local_objects = page_ptr->GetLocalObjectNumbers();
+    page_ptr.reset();
+    document_ptr->ReleaseObjects(local_objects);
+
+    callback(page_number, table);
+  }
+}
+
+//---------------------------------------------------------------------------//
+// The exported streaming version of pdfdoc. Each page's text is passed to the
+// R function callback as a data frame with the same columns as pdfdoc gives,
+// along with the (one-indexed) page number.
+
+void PdfDocStream(SEXP document, Function callback)
+{
+  ForEachPageText(GetDocument(document),
+                  [&](size_t page_number, TextTable& table) -> void
+  {
+    vector<int> page(table.GetText().size(), page_number + 1);
+    callback(DataFrame::create(Named("text")             = table.GetText(),
+                               Named("left")             = table.GetLefts(),
+                               Named("right")            = table.GetRights(),
+                               Named("bottom")           = table.GetBottoms(),
+                               Named("font")             = table.GetFontNames(),
+                               Named("size")             = table.GetSizes(),
+                               Named("page")             = page,
+                               Named("stringsAsFactors") = false),
+             (int) page_number + 1);
+  });
+}
+
 //---------------------------------------------------------------------------//
 // This exported function takes a string representing a file path, creates a
 // new Document object and sends it to PdfDocCommon to create an R data frame
 // containing all of the text elements in a Document, including their location
-// and page number
+// and page number, using n_threads threads (for opening it as well)
 
-DataFrame GetPdfDocumentFromString(const string& file_name)
+DataFrame GetPdfDocumentFromString(const string& file_name, int n_threads)
 {
   // Simply create a new Document pointer from the file name
-  auto document_ptr = make_shared<Document>(file_name);
+  auto document_ptr = make_shared<Document>(file_name, n_threads);
 
   // Feed the Document pointer to PdfDocCommon to get the whole Document as
   // an R data frame
-  return PdfDocCommon(document_ptr);
+  return PdfDocCommon(document_ptr, n_threads);
 }
 
 //---------------------------------------------------------------------------//
@@ -405,14 +697,14 @@ DataFrame GetPdfDocumentFromString(const string& file_name)
 // data frame containing all of the text elements in a document, including their
 // location and page number.
 
-DataFrame GetPdfDocumentFromRaw(const vector<uint8_t>& raw_data)
+DataFrame GetPdfDocumentFromRaw(const vector<uint8_t>& raw_data, int n_threads)
 {
   // Simply create a new Document pointer from the raw data
-  auto document_ptr = make_shared<Document>(raw_data);
+  auto document_ptr = make_shared<Document>(raw_data, n_threads);
 
   // Feed the Document pointer to PdfDocCommon to get the whole document as
   // an R data frame
-  return PdfDocCommon(document_ptr);
+  return PdfDocCommon(document_ptr, n_threads);
 }
 
 //---------------------------------------------------------------------------//
@@ -424,9 +716,6 @@ string GetPageStringFromString(const string& file_name, int page_number)
   // Create the page object
   auto page_ptr = GetPage(file_name, page_number);
 
-  // Clear the static font map
-  page_ptr->ClearFontMap();
-
   // Return a dereferenced pointer to the page contents
   return (page_ptr->GetPageContents());
 }
@@ -441,13 +730,18 @@ string GetPageStringFromRaw(const vector<uint8_t>& raw_file,
   // Create the page object
   auto page_ptr = GetPage(raw_file, page_number);
 
-  // Clear the static font map
-  page_ptr->ClearFontMap();
-
   // Return a dereferenced pointer to the page contents
   return (page_ptr->GetPageContents());
 }
 
+//---------------------------------------------------------------------------//
+// As above, given an open document handle
+
+string GetPageStringFromHandle(SEXP document, int page_number)
+{
+  return GetPage(GetDocument(document), page_number)->GetPageContents();
+}
+
 //---------------------------------------------------------------------------//
 
 DataFrame PdfBoxes(shared_ptr<Page> page_ptr)
@@ -456,7 +750,7 @@ DataFrame PdfBoxes(shared_ptr<Page> page_ptr)
   Parser parser_object(page_ptr);
 
   // Read the page contents into the Parser
-  Tokenizer(page_ptr->GetPageContents(), &parser_object);
+  Tokenizer(page_ptr, &parser_object);
 
   // Group individual letters into words
   LetterGrouper grouped_letters(move(parser_object.Output()));
@@ -485,9 +779,6 @@ DataFrame PdfBoxes(shared_ptr<Page> page_ptr)
     groups.push_back(group++);
   }
 
-  // Clear the static font map
-  page_ptr->ClearFontMap();
-
   // Build and return an R dataframe
   return DataFrame::create( Named("xmin")             = xmin,
                             Named("ymin")             = ymin,
@@ -500,16 +791,15 @@ DataFrame PdfBoxes(shared_ptr<Page> page_ptr)
 
 //---------------------------------------------------------------------------//
 
-List GetPaths(const string& file_name, int page_number)
-{
-  // Create the page object
-  auto page_ptr = GetPage(file_name, page_number);
+// Returns the paths drawn on a page as a list of lists
 
+List PathsFromPage(shared_ptr<Page> page_ptr)
+{
   // Create an empty Parser object
   Parser parser_object(page_ptr);
 
   // Read the page contents into the Parser
-  Tokenizer(page_ptr->GetPageContents(), &parser_object);
+  Tokenizer(page_ptr, &parser_object);
 
   std::vector<std::shared_ptr<GraphicObject>> boxes = parser_object.GetGraphics();
 
@@ -533,6 +823,18 @@ List GetPaths(const string& file_name, int page_number)
 
 //---------------------------------------------------------------------------//
 
+List GetPaths(const string& file_name, int page_number)
+{
+  return PathsFromPage(GetPage(file_name, page_number));
+}
+
+List GetPathsFromHandle(SEXP document, int page_number)
+{
+  return PathsFromPage(GetPage(GetDocument(document), page_number));
+}
+
+//---------------------------------------------------------------------------//
+
 DataFrame GetPdfBoxesFromString(const string& file_name,
                                           int page_number)
 {
@@ -555,6 +857,13 @@ DataFrame GetPdfBoxesFromRaw(const vector<uint8_t>& raw_data,
   return PdfBoxes(page_ptr);
 }
 
+//---------------------------------------------------------------------------//
+
+DataFrame GetPdfBoxesFromHandle(SEXP document, int page_number)
+{
+  return PdfBoxes(GetPage(GetDocument(document), page_number));
+}
+
 //---------------------------------------------------------------------------//
 // A helper function to create npc units for drawing grobs
 
@@ -678,16 +987,13 @@ List MakeGrobFromGraphics(std::shared_ptr<Page> page,
 //---------------------------------------------------------------------------//
 // Outputs a page's graphical content as grobs
 
-List GetGrobs(const string& file_name, int page_number)
+List GrobsFromPage(shared_ptr<Page> page_ptr)
 {
-  // Create the page object
-  auto page_ptr = GetPage(file_name, page_number);
-
   // Create an empty Parser object
   Parser parser_object(page_ptr);
 
   // Read the page contents into the Parser
-  Tokenizer(page_ptr->GetPageContents(), &parser_object);
+  Tokenizer(page_ptr, &parser_object);
 
   std::vector<std::shared_ptr<GraphicObject>> go_s = parser_object.GetGraphics();
 
@@ -699,12 +1005,23 @@ List GetGrobs(const string& file_name, int page_number)
     result.push_back(MakeGrobFromGraphics(page_ptr, go_s[i], n));
   }
 
-  page_ptr->ClearFontMap();
 
   // Build and return an R dataframe
   return result;
 }
 
+//---------------------------------------------------------------------------//
+
+List GetGrobs(const string& file_name, int page_number)
+{
+  return GrobsFromPage(GetPage(file_name, page_number));
+}
+
+List GetGrobsFromHandle(SEXP document, int page_number)
+{
+  return GrobsFromPage(GetPage(GetDocument(document), page_number));
+}
+
 /*---------------------------------------------------------------------------*/
 
 DataFrame ReadFontTable(RawVector raw)
@@ -60,6 +60,39 @@
 #include "streams.h"
 #include "line_grouper.h"
 
+//---------------------------------------------------------------------------//
+// Opening a document reads its xref table and page tree, which for a large
+// file can take much longer than reading any one page. These functions open a
+// document once and return a handle to it (an R external pointer) that the
+// "Handle" versions of the functions below take in place of a file, so that
+// R can read many pages or objects from a document without reopening it.
+// Objects that have been read are cached in the open document as well. With
+// n_threads other than 1, the document's object streams are decoded in
+// parallel when it is opened. A file can also be given a sidecar, which is
+// used to reopen it quickly (see sidecar.h); an empty path means none.
+
+// [[Rcpp::export(.open_pdf)]]
+SEXP OpenDocumentFromString(const std::string& file_name, int n_threads,
+                            const std::string& sidecar_path);
+
+// [[Rcpp::export(.open_pdfraw)]]
+SEXP OpenDocumentFromRaw(const std::vector<uint8_t>& raw_file, int n_threads);
+
+// [[Rcpp::export(.page_count)]]
+int GetPageCount(SEXP document);
+
+// Reports on (and optionally sets the budget of) an open document's cache of
+// decoded streams, and on its font cache. A negative budget leaves it
+// unchanged.
+// [[Rcpp::export(.stream_cache)]]
+Rcpp::NumericVector GetStreamCacheStatistics(SEXP document, double budget);
+
+// Summarises an open document without reading any page's contents or fonts:
+// its information dictionary, each page's boxes and rotation, and the fonts
+// named in each page's resources
+// [[Rcpp::export(.pdfinfo)]]
+Rcpp::List GetDocumentInfo(SEXP document);
+
 //---------------------------------------------------------------------------//
 // Get xref. Returns a dataframe representing all of the cross-reference tables
 // in a pdf stuck together. Each row represents an object, and gives the object
@@ -95,6 +128,24 @@ GetObjectFromString(const std::string& file_name, int object_number);
 Rcpp::List
 GetObjectFromRaw(const std::vector<uint8_t>& raw_file, int object_number);
 
+// [[Rcpp::export(.get_objHandle)]]
+Rcpp::List
+GetObjectFromHandle(SEXP document, int object_number);
+
+//---------------------------------------------------------------------------//
+// The package inflates FlateDecode streams with its own Deflate implementation
+// unless it was built against zlib or libdeflate. These two functions give the
+// name of the library in use, and compare its output on every FlateDecode
+// stream in a file with the built-in decoder's. The result is a dataframe
+// with a row per stream giving the object number, the size of each output
+// (-1 if the decoder threw), and whether the outputs are identical.
+
+// [[Rcpp::export(.get_decoder_name)]]
+std::string GetDecoderName();
+
+// [[Rcpp::export(.compare_decoders)]]
+Rcpp::DataFrame CompareDecoders(const std::string& file_name);
+
 //---------------------------------------------------------------------------//
 // The main output of the program is a dataframe of each glyph with its
 // position, size and font name. This is produced by the pdfpage function and
@@ -113,6 +164,14 @@ Rcpp::List GetPdfPageFromRaw(const std::vector<uint8_t>& raw_file,
                              int page_number,
                              bool atoms);
 
+// The handle version takes a vector of page numbers and returns a list with
+// the result for each page
+
+// [[Rcpp::export(.pdfpagesHandle)]]
+Rcpp::List GetPdfPagesFromHandle(SEXP document,
+                                 const std::vector<int>& page_numbers,
+                                 bool each_glyph);
+
 //---------------------------------------------------------------------------//
 // This function takes a file path and page number as parameters (note there is
 // no raw version, as it is mostly used for debugging rather than a user tool).
@@ -137,17 +196,30 @@ GetPageStringFromString(const std::string& file_name, int page_number);
 std::string
 GetPageStringFromRaw(const std::vector<uint8_t>& raw_file, int page_number);
 
+// [[Rcpp::export(.pagestringHandle)]]
+std::string
+GetPageStringFromHandle(SEXP document, int page_number);
+
 //---------------------------------------------------------------------------//
 // These two versions of the pdfdoc function return R dataframes with all of
-// the extracted text from an entire document.
+// the extracted text from an entire document. The pages are processed on
+// n_threads threads, or one per core if n_threads is less than one.
 
 // [[Rcpp::export(.pdfdoc)]]
 Rcpp::DataFrame
-GetPdfDocumentFromString(const std::string& file_name);
+GetPdfDocumentFromString(const std::string& file_name, int n_threads);
 
 // [[Rcpp::export(.pdfdocraw)]]
 Rcpp::DataFrame
-GetPdfDocumentFromRaw(const std::vector<uint8_t>& file_name);
+GetPdfDocumentFromRaw(const std::vector<uint8_t>& file_name, int n_threads);
+
+// Reads an open document a page at a time, calling the R function callback
+// with a dataframe of each page's text and the page number. Nothing is kept
+// from one page to the next, so memory use doesn't grow with the length of
+// the document.
+
+// [[Rcpp::export(.pdfdoc_stream)]]
+void PdfDocStream(SEXP document, Rcpp::Function callback);
 
 // [[Rcpp::export(.pdfboxesString)]]
 Rcpp::DataFrame
@@ -157,12 +229,22 @@ GetPdfBoxesFromString(const std::string& file_name, int page_number);
 Rcpp::DataFrame
 GetPdfBoxesFromRaw(const std::vector<uint8_t>& file_name, int page_number);
 
+// [[Rcpp::export(.pdfboxesHandle)]]
+Rcpp::DataFrame
+GetPdfBoxesFromHandle(SEXP document, int page_number);
+
 // [[Rcpp::export(.GetPaths)]]
 Rcpp::List GetPaths(const std::string& file_name, int page_number);
 
+// [[Rcpp::export(.GetPathsHandle)]]
+Rcpp::List GetPathsFromHandle(SEXP document, int page_number);
+
 // [[Rcpp::export(.GetGrobs)]]
 Rcpp::List GetGrobs(const std::string& file_name, int page_number);
 
+// [[Rcpp::export(.GetGrobsHandle)]]
+Rcpp::List GetGrobsFromHandle(SEXP document, int page_number);
+
 // [[Rcpp::export]]
 Rcpp::DataFrame ReadFontTable(Rcpp::RawVector raw);
 
@@ -0,0 +1,152 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR Scheduler implementation file                                       //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#include "scheduler.h"
+#include<string>
+#include<system_error>
+#include<thread>
+
+//---------------------------------------------------------------------------//
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+// The tasks are dealt out as evenly as possible in contiguous ranges
+
+Scheduler::Scheduler(size_t number_of_tasks, int number_of_threads)
+  : number_of_tasks_(number_of_tasks),
+    errors_(number_of_tasks),
+    first_error_(string::npos)
+{
+  if (number_of_threads < 1)
+  {
+    number_of_threads = max((int) thread::hardware_concurrency(), 1);
+  }
+  size_t threads = max(min((size_t) number_of_threads, number_of_tasks),
+                       (size_t) 1);
+  queues_ = vector<Queue>(threads);
+
+  for (size_t i = 0; i < threads; ++i)
+  {
+    queues_[i].next = number_of_tasks * i / threads;
+    queues_[i].end  = number_of_tasks * (i + 1) / threads;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// The calling thread does its share of the work rather than waiting idle, so
+// with a single thread no new threads are started at all. If a thread can't
+// be started, its queue is simply left for the others to steal from.
+
+void Scheduler::Run(const function<void(size_t)>& task)
+{
+  vector<thread> threads;
+  for (size_t i = 1; i < queues_.size(); ++i)
+  {
+    try
+    {
+      threads.emplace_back(&Scheduler::Work_, this, i, cref(task));
+    }
+    catch (const system_error&)
+    {
+      break;
+    }
+  }
+  Work_(0, task);
+  for (auto& worker : threads) worker.join();
+
+  if (first_error_ != string::npos) rethrow_exception(errors_[first_error_]);
+}
+
+/*---------------------------------------------------------------------------*/
+// A worker takes tasks from its own queue, then steals from others until
+// there is nothing left to steal
+
+void Scheduler::Work_(size_t worker, const function<void(size_t)>& task)
+{
+  size_t task_number;
+  do
+  {
+    while (Pop_(worker, task_number)) RunTask_(task_number, task);
+  }
+  while (Steal_(worker));
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool Scheduler::Pop_(size_t worker, size_t& task_number)
+{
+  Queue& queue = queues_[worker];
+  lock_guard<mutex> lock(queue.mutex);
+  if (queue.next == queue.end) return false;
+  task_number = queue.next++;
+  return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// Finds the queue with the most tasks left and moves the back half of them
+// (rounded up) to the worker's own, empty queue. The victim is only locked
+// while its range is split, and the two queues are never locked together.
+
+bool Scheduler::Steal_(size_t worker)
+{
+  while (true)
+  {
+    size_t victim = worker, most_left = 0;
+    for (size_t i = 0; i < queues_.size(); ++i)
+    {
+      if (i == worker) continue;
+      lock_guard<mutex> lock(queues_[i].mutex);
+      if (queues_[i].end - queues_[i].next > most_left)
+      {
+        victim = i;
+        most_left = queues_[i].end - queues_[i].next;
+      }
+    }
+    if (most_left == 0) return false;
+
+    size_t start, end;
+    {
+      lock_guard<mutex> lock(queues_[victim].mutex);
+      Queue& queue = queues_[victim];
+      if (queue.next == queue.end) continue; // Emptied since we looked
+      start = queue.next + (queue.end - queue.next) / 2;
+      end = queue.end;
+      queue.end = start;
+    }
+
+    lock_guard<mutex> lock(queues_[worker].mutex);
+    queues_[worker].next = start;
+    queues_[worker].end  = end;
+    return true;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Tasks numbered after one that has failed are skipped. A failure is recorded
+// against its task number, and first_error_ is lowered to it if need be.
+
+void Scheduler::RunTask_(size_t task_number,
+                         const function<void(size_t)>& task)
+{
+  if (task_number > first_error_) return;
+  try
+  {
+    task(task_number);
+  }
+  catch (...)
+  {
+    errors_[task_number] = current_exception();
+    size_t lowest = first_error_;
+    while (task_number < lowest &&
+           !first_error_.compare_exchange_weak(lowest, task_number)) {}
+  }
+}
@@ -0,0 +1,80 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR Scheduler header file                                               //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#ifndef PDFR_SCHEDULER
+
+//---------------------------------------------------------------------------//
+
+#define PDFR_SCHEDULER
+
+/* The Scheduler runs a numbered set of independent tasks, such as extracting
+ * each page of a document, on a number of threads.
+ *
+ * Pages vary a great deal in how long they take to process, so handing each
+ * thread a fixed share of the pages up front would leave threads idle while
+ * one works through a run of heavy pages. Instead, each thread starts with an
+ * equal contiguous range of task numbers and works through it from the front.
+ * A thread that runs out of work steals the back half of whichever other
+ * range has the most left. Ranges stay contiguous, so neighbouring pages,
+ * which tend to share objects, are mostly processed by the same thread.
+ *
+ * The tasks must not call into R, since only the main thread may do that.
+ * Results should be written to a slot reserved for each task number, so that
+ * they can be put together in order afterwards.
+ *
+ * If any task throws, no tasks numbered after it are started, and the
+ * exception from the lowest-numbered failing task is rethrown on the calling
+ * thread once all the threads have stopped. This is the exception that running
+ * the tasks in order on one thread would have given.
+ */
+
+#include<atomic>
+#include<exception>
+#include<functional>
+#include<mutex>
+#include<vector>
+
+//---------------------------------------------------------------------------//
+
+class Scheduler
+{
+ public:
+  // Threads are limited to the number of tasks. A number of threads less than
+  // one means one per available core.
+  Scheduler(size_t number_of_tasks, int number_of_threads);
+
+  // Calls task(i) for each task number i, returning when all are done
+  void Run(const std::function<void(size_t)>& task);
+
+  size_t NumberOfThreads() const {return queues_.size();}
+
+ private:
+  // The task numbers from next up to (but not including) end are waiting
+  struct Queue
+  {
+    std::mutex mutex;
+    size_t next, end;
+  };
+
+  size_t number_of_tasks_;
+  std::vector<Queue> queues_;                // One per thread
+  std::vector<std::exception_ptr> errors_;   // One per task
+  std::atomic<size_t> first_error_;          // Lowest task number that threw
+
+  void Work_(size_t worker, const std::function<void(size_t)>& task);
+  bool Pop_(size_t worker, size_t& task_number);
+  bool Steal_(size_t worker);
+  void RunTask_(size_t task_number, const std::function<void(size_t)>& task);
+};
+
+//---------------------------------------------------------------------------//
+
+#endif
@@ -0,0 +1,204 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR Sidecar implementation file                                         //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#include "sidecar.h"
+#include<algorithm>
+#include<cstdio>
+#include<fstream>
+#include<stdexcept>
+#include<sys/stat.h>
+
+//---------------------------------------------------------------------------//
+
+using namespace std;
+
+/*---------------------------------------------------------------------------*/
+// The header is the magic bytes followed by these fields, each stored as an
+// integer. The version is increased whenever the layout of the body changes,
+// so that sidecars written by an older version are simply ignored.
+
+static const char sidecar_magic[8] = {'P', 'D', 'F', 'R', 'S', 'C', 'A', 'R'};
+static const int64_t sidecar_version = 1;
+static const size_t hashed_bytes = 1 << 16;
+
+struct SidecarHeader
+{
+  int64_t version, file_size, modified, file_hash, body_size, body_hash;
+};
+
+/*---------------------------------------------------------------------------*/
+// 64-bit FNV-1a. It is fast and needs no tables, and it only has to tell a
+// changed file or a damaged sidecar from the real thing.
+
+static uint64_t Hash(const char* data, size_t size, uint64_t hash)
+{
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash = (hash ^ (uint8_t) data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static const uint64_t hash_seed = 0xcbf29ce484222325ULL;
+
+/*---------------------------------------------------------------------------*/
+// The header fields that identify the pdf. If the file can't be looked at,
+// its modification time is left as zero.
+
+static SidecarHeader Identify(const string& file_path, const ByteSource& file)
+{
+  SidecarHeader header {sidecar_version, (int64_t) file.size(), 0, 0, 0, 0};
+
+  struct stat file_status;
+  if (stat(file_path.c_str(), &file_status) == 0)
+  {
+    header.modified = (int64_t) file_status.st_mtime;
+  }
+
+  size_t head = min(file.size(), hashed_bytes);
+  size_t tail = min(file.size() - head, hashed_bytes);
+  uint64_t hash = Hash(file.data(), head, hash_seed);
+  hash = Hash(file.data() + file.size() - tail, tail, hash);
+  header.file_hash = (int64_t) hash;
+  return header;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void AppendInt(string& output, int64_t value)
+{
+  for (int i = 0; i < 8; ++i) output.push_back((char) (value >> (8 * i)));
+}
+
+static int64_t ReadInt(const char* input)
+{
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) value = (value << 8) | (uint8_t) input[i];
+  return (int64_t) value;
+}
+
+/*---------------------------------------------------------------------------*/
+
+void SidecarWriter::PutInt(int64_t value)
+{
+  AppendInt(body_, value);
+}
+
+void SidecarWriter::PutString(const string& value)
+{
+  AppendInt(body_, (int64_t) value.size());
+  body_.append(value);
+}
+
+/*---------------------------------------------------------------------------*/
+// The temporary file is named after the sidecar, so it is in the same
+// directory and can be renamed over it. Removing the old sidecar first is
+// needed on Windows, where rename won't replace an existing file.
+
+bool SidecarWriter::WriteTo(const string& sidecar_path, const string& file_path,
+                            const ByteSource& file) const
+{
+  SidecarHeader header = Identify(file_path, file);
+  header.body_size = (int64_t) body_.size();
+  header.body_hash = (int64_t) Hash(body_.data(), body_.size(), hash_seed);
+
+  string output(sidecar_magic, sizeof(sidecar_magic));
+  for (int64_t field : {header.version, header.file_size, header.modified,
+                        header.file_hash, header.body_size, header.body_hash})
+  {
+    AppendInt(output, field);
+  }
+
+  string temporary_path = sidecar_path + ".tmp";
+  {
+    ofstream stream(temporary_path.c_str(), ios::out | ios::binary);
+    if (!stream) return false;
+    stream.write(output.data(), output.size());
+    stream.write(body_.data(), body_.size());
+    if (!stream) return false;
+  }
+
+  if (rename(temporary_path.c_str(), sidecar_path.c_str()) != 0)
+  {
+    remove(sidecar_path.c_str());
+    if (rename(temporary_path.c_str(), sidecar_path.c_str()) != 0)
+    {
+      remove(temporary_path.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// Every header field has to match what the pdf looks like now, and the body
+// has to be all there and unchanged, before any of it is read
+
+SidecarReader::SidecarReader(const string& sidecar_path,
+                             const string& file_path, const ByteSource& file)
+  : sidecar_(ByteSource::FromFile(sidecar_path)),
+    position_(sizeof(sidecar_magic) + 6 * 8),
+    end_(position_)
+{
+  const char* data = sidecar_->data();
+  if (sidecar_->size() < position_ ||
+      !equal(sidecar_magic, sidecar_magic + sizeof(sidecar_magic), data))
+  {
+    throw runtime_error("Not a sidecar file");
+  }
+
+  SidecarHeader expected = Identify(file_path, file);
+  const char* field = data + sizeof(sidecar_magic);
+  if (ReadInt(field)      != expected.version   ||
+      ReadInt(field + 8)  != expected.file_size ||
+      ReadInt(field + 16) != expected.modified  ||
+      ReadInt(field + 24) != expected.file_hash)
+  {
+    throw runtime_error("Sidecar is out of date");
+  }
+
+  int64_t body_size = ReadInt(field + 32);
+  if (body_size < 0 || (size_t) body_size != sidecar_->size() - position_ ||
+      (int64_t) Hash(data + position_, body_size, hash_seed) !=
+        ReadInt(field + 40))
+  {
+    throw runtime_error("Sidecar is damaged");
+  }
+  end_ = sidecar_->size();
+}
+
+/*---------------------------------------------------------------------------*/
+
+int64_t SidecarReader::GetInt()
+{
+  if (end_ - position_ < 8) throw runtime_error("Sidecar is too short");
+  int64_t value = ReadInt(sidecar_->data() + position_);
+  position_ += 8;
+  return value;
+}
+
+string SidecarReader::GetString()
+{
+  size_t length = GetCount();
+  string value(sidecar_->data() + position_, length);
+  position_ += length;
+  return value;
+}
+
+size_t SidecarReader::GetCount(size_t item_size)
+{
+  int64_t count = GetInt();
+  if (count < 0 || (uint64_t) count > (end_ - position_) / item_size)
+  {
+    throw runtime_error("Sidecar is damaged");
+  }
+  return (size_t) count;
+}
@@ -0,0 +1,92 @@
+//---------------------------------------------------------------------------//
+//                                                                           //
+//  PDFR Sidecar header file                                                 //
+//                                                                           //
+//  Copyright (C) 2018 - 2019 by Allan Cameron                               //
+//                                                                           //
+//  Licensed under the MIT license - see https://mit-license.org             //
+//  or the LICENSE file in the project root directory                        //
+//                                                                           //
+//---------------------------------------------------------------------------//
+
+#ifndef PDFR_SIDECAR
+
+//---------------------------------------------------------------------------//
+
+#define PDFR_SIDECAR
+
+/* Opening a large document means reading its XRef, and getting at all of its
+ * pages means reading its whole page tree. When the same file is opened again
+ * and again, as it is when it is read from several R sessions, this work is
+ * the same every time. A sidecar is a small binary file kept alongside the pdf
+ * that stores the results, so that later opens can read them back instead.
+ *
+ * A sidecar starts with a header giving a format version and the identity of
+ * the pdf it was made from: its size, its modification time and a hash of its
+ * first and last 64kB, which is where the header, linearization dictionary,
+ * trailer and (usually) the XRef are found. Hashing the whole file would mean
+ * reading all of it, which is what the sidecar is there to avoid. The header
+ * also gives the length and a checksum of the body that follows, so that a
+ * sidecar that has been cut short or damaged is never used.
+ *
+ * The body is a sequence of integers and strings written by the classes that
+ * own the data (see XRef::Save), and read back in the same order. Integers
+ * are always stored as 8 little-endian bytes and strings as their length
+ * followed by their bytes, so a sidecar can be moved between machines. The
+ * sidecar is mapped rather than read in, like the pdf itself.
+ *
+ * Reading a sidecar that is missing, from another version of the format or
+ * for a different file throws a runtime_error, and so does reading past the
+ * end of its body. Writing goes to a temporary file that is renamed into
+ * place, so a reader never sees a half-written sidecar.
+ */
+
+#include "bytesource.h"
+#include<cstdint>
+#include<string>
+
+//---------------------------------------------------------------------------//
+// Collects the body of a sidecar and writes it out with its header
+
+class SidecarWriter
+{
+ public:
+  void PutInt(int64_t value);
+  void PutString(const std::string& value);
+
+  // Writes the sidecar for the pdf at file_path, whose contents are file.
+  // Returns false if it couldn't be written.
+  bool WriteTo(const std::string& sidecar_path, const std::string& file_path,
+               const ByteSource& file) const;
+
+ private:
+  std::string body_;
+};
+
+//---------------------------------------------------------------------------//
+// Maps a sidecar and reads its body back from the start
+
+class SidecarReader
+{
+ public:
+  // Throws unless the sidecar exists, is intact and belongs to file
+  SidecarReader(const std::string& sidecar_path, const std::string& file_path,
+                const ByteSource& file);
+
+  int64_t GetInt();
+  std::string GetString();
+
+  // Reads a count of items to follow. Each item takes up at least item_size
+  // bytes, so a count too big for the bytes left is caught before anything
+  // is allocated for it.
+  size_t GetCount(size_t item_size = 1);
+
+ private:
+  std::shared_ptr<const ByteSource> sidecar_;
+  size_t position_;      // Next byte of the body to read
+  size_t end_;           // End of the body
+};
+
+//---------------------------------------------------------------------------//
+
+#endif
@@ -25,6 +25,7 @@
 #include<stdexcept>
 #include<map>
 #include<algorithm>
+#include<cstring>
 #include "streams.h"
 
 using namespace std;
@@ -33,16 +34,22 @@ using namespace std;
 Stream::Stream(const string* input) : input_(*input),
                                         output_(std::string()),
                                         input_position_(input_.begin()),
-                                        output_position_(output_.begin()),
-                                        unconsumed_bits_(0),
-                                        unconsumed_bit_value_(0) {}
+                                        output_position_(0),
+                                        bit_buffer_(0),
+                                        bits_in_buffer_(0),
+                                        window_size_(0),
+                                        flush_size_(0),
+                                        delivered_(0) {}
 
 Stream::Stream(const CharString& input) : input_(input),
                                         output_(std::string()),
                                         input_position_(input_.begin()),
-                                        output_position_(output_.begin()),
-                                        unconsumed_bits_(0),
-                                        unconsumed_bit_value_(0) {}
+                                        output_position_(0),
+                                        bit_buffer_(0),
+                                        bits_in_buffer_(0),
+                                        window_size_(0),
+                                        flush_size_(0),
+                                        delivered_(0) {}
 
 /*---------------------------------------------------------------------------*/
 
@@ -67,32 +74,29 @@ uint32_t Stream::PeekByte()
 void Stream::Reset()
 {
   input_position_ = input_.begin();
-  output_.clear();
-  output_position_ = output_.begin();
-  unconsumed_bit_value_ = 0;
-  unconsumed_bits_ = 0;
+  output_position_ = 0;
+  bit_buffer_ = 0;
+  bits_in_buffer_ = 0;
+  delivered_ = 0;
 }
 
 /*---------------------------------------------------------------------------*/
 
 uint32_t Stream::GetBits(uint32_t n_bits)
 {
-  uint32_t value_read = unconsumed_bit_value_;
-  uint8_t bits_read = unconsumed_bits_;
+  uint32_t result = PeekBits(n_bits);
+  ConsumeBits(n_bits);
+  return result;
+}
 
-  while (bits_read < n_bits)
-  {
-    uint32_t new_byte = GetByte();
-    if (new_byte == 256) throw runtime_error("Unexpected end of stream");
-    value_read |= new_byte << bits_read;
-    bits_read += 8;
-  }
+/*---------------------------------------------------------------------------*/
 
-  uint32_t result = value_read & ((1 << n_bits) - 1);
-  unconsumed_bit_value_ = value_read >> n_bits;
-  bits_read -= n_bits;
-  unconsumed_bits_ = bits_read;
-  return result;
+void Stream::AlignToByte()
+{
+  ConsumeBits(bits_in_buffer_ % 8);
+  input_position_ -= bits_in_buffer_ / 8;
+  bit_buffer_ = 0;
+  bits_in_buffer_ = 0;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -107,3 +111,139 @@ uint32_t Stream::BitFlip(uint32_t value, uint32_t n_bits)
   }
   return result;
 }
+
+/*---------------------------------------------------------------------------*/
+// In chunked mode the output buffer never grows much beyond the retained
+// window plus one chunk, so it is sized up front and reused. The chunk size
+// is a trade-off: larger chunks mean fewer calls to the sink and less copying
+// of the window to the front of the buffer, smaller chunks less memory.
+
+void Stream::SetOutputSink(const OutputSink& sink, size_t window_size)
+{
+  static const size_t chunk_size = 65536;
+  sink_ = sink;
+  window_size_ = window_size;
+  flush_size_ = window_size + chunk_size;
+  output_.resize(flush_size_ + 512);
+}
+
+/*---------------------------------------------------------------------------*/
+
+void Stream::FlushOutput()
+{
+  if (!sink_) return;
+
+  if (output_position_ > delivered_)
+  {
+    sink_(&output_[delivered_], output_position_ - delivered_);
+  }
+
+  if (output_position_ > window_size_)
+  {
+    memmove(&output_[0], &output_[output_position_ - window_size_],
+            window_size_);
+    output_position_ = window_size_;
+  }
+
+  delivered_ = output_position_;
+}
+
+/*---------------------------------------------------------------------------*/
+// The output buffer is at least doubled each time it is grown, so that writing
+// n bytes one at a time takes amortized constant time per byte.
+
+void Stream::GrowOutput_(size_t n)
+{
+  output_.resize(max(output_.size() * 2, output_position_ + n));
+}
+
+/*---------------------------------------------------------------------------*/
+// Stored data is copied in a single memcpy rather than byte by byte. The
+// length comes from the stream itself, so it is checked against what is left
+// of the input first.
+
+void Stream::CopyInput(size_t length)
+{
+  if ((size_t) (input_.end() - input_position_) < length)
+  {
+    throw runtime_error("Unexpected end of stream");
+  }
+
+  if (output_position_ + length > output_.size()) GrowOutput_(length);
+  memcpy(&output_[output_position_], input_position_, length);
+  output_position_ += length;
+  input_position_ += length;
+}
+
+/*---------------------------------------------------------------------------*/
+// A back-reference copies length bytes starting distance bytes back from the
+// cursor. Where distance is less than length the source and destination
+// overlap, and the copy has to repeat the bytes it has just written, so a
+// single memcpy can't be used.
+//
+// Instead, as long as the source stays at least a whole word behind the
+// destination, each word-sized memcpy reads only bytes that are already final,
+// so the copy can go eight or sixteen bytes at a time. The last word may write
+// up to 15 bytes past the end of the match; this is harmless, since the buffer
+// has room for them and they are overwritten by whatever comes next.
+//
+// Short distances are first widened: the bytes between source and cursor form
+// a repeating pattern, so copying all of them doubles the length of the
+// pattern, and after a couple of doublings the gap is wide enough for word
+// copies. A distance of one is just a run of a single byte, so uses memset.
+
+void Stream::AppendPrevious(uint32_t distance, uint32_t length)
+{
+  if (distance == 0 || distance > output_position_)
+  {
+    throw runtime_error("Invalid back-reference in stream");
+  }
+
+  if (output_position_ + length + 16 > output_.size())
+  {
+    GrowOutput_(length + 16);
+  }
+
+  char* destination = &output_[output_position_];
+  const char* source = destination - distance;
+  output_position_ += length;
+
+  if (distance == 1)
+  {
+    memset(destination, *source, length);
+    return;
+  }
+
+  // Widen the gap between source and destination by doubling the pattern
+  while (length > 0 && destination - source < 8)
+  {
+    size_t gap = destination - source;
+    size_t pattern_length = min(gap, (size_t) length);
+    memcpy(destination, source, pattern_length);
+    destination += pattern_length;
+    length -= pattern_length;
+  }
+
+  // The word size is fixed in each loop so that memcpy compiles to a single
+  // load and store rather than a library call
+  if (destination - source >= 16)
+  {
+    while (length > 0)
+    {
+      memcpy(destination, source, 16);
+      destination += 16;
+      source += 16;
+      length = (length > 16) ? length - 16 : 0;
+    }
+  }
+  else
+  {
+    while (length > 0)
+    {
+      memcpy(destination, source, 8);
+      destination += 8;
+      source += 8;
+      length = (length > 8) ? length - 8 : 0;
+    }
+  }
+}
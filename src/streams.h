@@ -29,28 +29,28 @@
  * The raw data in the stream is almost always compressed, so needs to be
  * decompressed before being processed. That is the purpose of the stream class.
  *
- * At present, only the flatedecode decompression algorithm is implemented.
- * I have yet to find a pdf file that uses anything else for page description
- * to allow testing.
- *
- * The possible stream types are:
- *
- *  Ascii85Stream,
- *  AsciiHexStream,
- *  DecodeStream,
- *  FlateStream,
- *  NullStream,
- *  PredictorStream,
- *  RunLengthStream,
- *  StreamsSequenceStream,
- *  StringStream,
- *  LZWStream
+ * The filters that can be decoded are ASCIIHexDecode, ASCII85Decode,
+ * LZWDecode, RunLengthDecode and FlateDecode, along with the PNG and TIFF
+ * predictors that LZW and Flate streams may use. Each of these is a stage in
+ * a chain of filters (see filters.h) that passes its output on to the next
+ * stage a chunk at a time. The Stream class below is the bit-level reader and
+ * output buffer that the Deflate decompressor (see deflate.h) is built on.
+ * Image filters such as DCTDecode are left encoded by the chain.
  *
  * This header is required by the xref class, as it needs to be able to deflate
  * xrefstreams.
  */
 
 #include "utilities.h"
+#include<stdexcept>
+#include<functional>
+
+//---------------------------------------------------------------------------//
+// Decoded output can be passed on in pieces rather than collected into one
+// large string. An OutputSink is called with a pointer to each new piece and
+// its length; the pointer is only valid for the duration of the call.
+
+typedef std::function<void(const char*, size_t)> OutputSink;
 
 //---------------------------------------------------------------------------//
 // The Stream class is the base class for the different streams used in pdfs.
@@ -67,41 +67,104 @@ class Stream
   Stream(const CharString&);
 
  public:
-  std::string Output(){return output_;}        // Getter for output
+  std::string Output() const                   // Getter for output
+  {
+    return output_.substr(0, output_position_);
+  }
   uint32_t GetByte();                          // Consumes next byte
   uint32_t PeekByte();                         // Looks but doesn't consume
   void Reset();                                // Returns stream to start
   uint32_t GetBits(uint32_t n);                // Get next n bits
-  uint32_t BitFlip(uint32_t value, uint32_t);  // Reverses bit order
+  static uint32_t BitFlip(uint32_t value, uint32_t); // Reverses bit order
+
+  // Returns the next n bits (n <= 32) without consuming them. Bits are read
+  // into a 64-bit buffer several bytes at a time, so most calls are just a
+  // mask of the buffer. If the input runs out, the missing high bits are
+  // returned as zeros; it is the call to ConsumeBits that detects the overrun.
+  uint32_t PeekBits(uint32_t n)
+  {
+    if (bits_in_buffer_ < n) RefillBits_();
+    return (uint32_t) (bit_buffer_ & ((((uint64_t) 1) << n) - 1));
+  }
+
+  // Discards n bits that have already been examined with PeekBits
+  void ConsumeBits(uint32_t n)
+  {
+    if (n > bits_in_buffer_)
+    {
+      throw std::runtime_error("Unexpected end of stream");
+    }
+    bit_buffer_ >>= n;
+    bits_in_buffer_ -= n;
+  }
 
-  // Appends byte to output and advances iterator
+  // Throws away any bits left over from a partially read byte and returns
+  // the whole bytes still held in the bit buffer to the input, so that the
+  // next call to GetByte reads the byte after the last one used for bits.
+  void AlignToByte();
+
+  // Writes byte at the output cursor and advances the cursor
   void WriteOutput(uint8_t byte)
   {
-    output_.append(1, (char) byte);
-    output_position_ = output_.end();
+    if (output_position_ == output_.size()) GrowOutput_(1);
+    output_[output_position_++] = (char) byte;
   }
 
+  // Copies the next length bytes of the input directly to the output. Used
+  // for data that is stored without compression.
+  void CopyInput(size_t length);
+
+  // The number of bytes of output a back-reference can reach: all of it, or
+  // in chunked mode just the retained window
+  size_t RetainedOutput() const {return output_position_;}
+
   // Writes a repeat sequence from earlier in the ouput to the end of the
   // output. Used in Deflate and LZW.
-  void AppendPrevious(uint32_t distance, uint32_t len)
-  {
-    for (unsigned i = 0; i < len; ++i)
-      WriteOutput(*(output_position_ - distance));
-  }
+  void AppendPrevious(uint32_t distance, uint32_t length);
 
-  void SetExpansionRatio(uint8_t r) {output_.reserve(input_.size() * r);}
-  void ShrinkToFit() { output_.shrink_to_fit();}
-  char GetOutput(){return *output_position_++;}
+  // Sizes the output buffer as a multiple of the input size, as a guess at
+  // how much output there will be; it grows if the guess is too small
+  void SetExpansionRatio(uint8_t r) {output_.resize(input_.size() * r);}
 
   uint64_t GetEightBytes();
 
+  // Makes the stream hand its output to the sink in chunks rather than keep
+  // all of it. Only the most recent window_size bytes are retained, which is
+  // enough for any back-reference a decompressor can make.
+  void SetOutputSink(const OutputSink& sink, size_t window_size);
+
+  // True when enough output has built up that it should be flushed
+  bool OutputDue() const {return sink_ && output_position_ >= flush_size_;}
+
+  // Hands all output not yet seen by the sink to it, then discards everything
+  // except the retained window. Does nothing if there is no sink.
+  void FlushOutput();
+
  private:
   CharString input_;                            // The input string
-  std::string output_;                          // The output string
+  std::string output_;                          // The output buffer
   const char* input_position_;                  // Input iterator
-  std::string::const_iterator output_position_; // Output iterator
-  uint8_t unconsumed_bits_;                     // Bit iterator
-  uint32_t unconsumed_bit_value_;               // Keeps track of unused bits
+  size_t output_position_;                      // Output write cursor
+  uint64_t bit_buffer_;                         // Bits read but not consumed
+  uint32_t bits_in_buffer_;                     // Number of bits in buffer
+  OutputSink sink_;                             // Receives chunked output
+  size_t window_size_;                          // Output kept after flush
+  size_t flush_size_;                           // Output size to flush at
+  size_t delivered_;                            // Output already flushed
+
+  // Enlarges the output buffer so that at least n more bytes can be written
+  void GrowOutput_(size_t n);
+
+  // Tops up the bit buffer with whole bytes from the input
+  void RefillBits_()
+  {
+    while (bits_in_buffer_ <= 56 && input_position_ != input_.end())
+    {
+      uint64_t next_byte = (uint8_t) *input_position_++;
+      bit_buffer_ |= next_byte << bits_in_buffer_;
+      bits_in_buffer_ += 8;
+    }
+  }
 };
 
 #endif
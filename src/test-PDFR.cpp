@@ -12,6 +12,13 @@
 #include <testthat.h>
 #include "utilities.h"
 #include "dictionary.h"
+#include "deflate.h"
+#include "filters.h"
+#include "crypto.h"
+#include "object_class.h"
+#include "document.h"
+#include "tokenizer.h"
+#include "scheduler.h"
 #include "pdfr.h"
 
 //---------------------------------------------------------------------------//
@@ -80,6 +87,129 @@ Dictionary test_dictionary = Dictionary(make_shared<string>(test_dict_string));
 
 vector<char> test_chars = {'c', 'e', 'b', 'a', 'd'},
              test_alpha = {'a', 'b', 'c', 'd', 'e'};
+
+// Deflate streams of "Hello world" compressed with fixed Huffman codes and
+// stored uncompressed, plus longer messages with repeats to test pointers
+vector<uint8_t> fixed_deflate_bytes {
+  0x78, 0x9c, 0xf3, 0x48, 0xcd, 0xc9, 0xc9, 0x57, 0x28, 0xcf,
+  0x2f, 0xca, 0x49, 0x01, 0x00, 0x18, 0xab, 0x04, 0x3d};
+vector<uint8_t> stored_deflate_bytes {
+  0x78, 0x01, 0x01, 0x0b, 0x00, 0xf4, 0xff, 0x48, 0x65, 0x6c, 0x6c,
+  0x6f, 0x20, 0x77, 0x6f, 0x72, 0x6c, 0x64, 0x18, 0xab, 0x04, 0x3d};
+vector<uint8_t> pointer_deflate_bytes {
+  0x78, 0xda, 0x4b, 0x4c, 0x4a, 0xa4, 0x2a, 0xf4, 0x48, 0xcd, 0xc9, 0xc9, 0x57,
+  0x28, 0xcf, 0x2f, 0xca, 0x49, 0x21, 0x85, 0x09, 0x00, 0xab, 0xe2, 0x33, 0xa5};
+vector<uint8_t> run_deflate_bytes {
+  0x78, 0x9c, 0x4b, 0x4c, 0x1c, 0x05, 0xc4, 0x82, 0x8a,
+  0xca, 0xaa, 0x41, 0x88, 0x00, 0x61, 0x9f, 0xb8, 0x93};
+string fixed_deflate(fixed_deflate_bytes.begin(), fixed_deflate_bytes.end());
+string stored_deflate(stored_deflate_bytes.begin(), stored_deflate_bytes.end());
+string pointer_deflate(pointer_deflate_bytes.begin(),
+                       pointer_deflate_bytes.end());
+string run_deflate(run_deflate_bytes.begin(), run_deflate_bytes.end());
+string truncated_deflate = fixed_deflate.substr(0, 8);
+
+// Malformed Deflate streams: a dynamic block whose code length code is
+// over-subscribed, fixed blocks using the unused length code 286, the unused
+// distance code 30 and a distance reaching back before the start, and dynamic
+// blocks that repeat a code length before any is given or give too many
+vector<vector<uint8_t>> malformed_deflate_bytes {
+  {0x78, 0x9c, 0x05, 0xe0, 0x93, 0x24, 0x49, 0x92, 0x24, 0x49, 0x92, 0x00},
+  {0x78, 0x9c, 0x1b, 0x03, 0x00},
+  {0x78, 0x9c, 0x4b, 0x04, 0x3e, 0x00},
+  {0x78, 0x9c, 0x4b, 0x04, 0x12, 0x00},
+  {0x78, 0x9c, 0x05, 0x00, 0x02, 0x24, 0x00, 0x00, 0x00, 0x00},
+  {0x78, 0x9c, 0x05, 0x00, 0x80, 0xe4, 0xff, 0x1f, 0x00, 0x00, 0x00, 0x00}};
+string inflated_message = "Hello world";
+
+// Encoded streams for the filters, each with a dictionary naming its filters.
+// The LZW example is the one given in the pdf reference. The predicted data
+// is three rows of three bytes using the Up, Up and Sub PNG predictors.
+auto filter_dictionary = [](const string& filters) -> Dictionary
+{
+  return Dictionary(make_shared<string>("<<" + filters + ">>"));
+};
+string hex_encoded = "48 65 6C 6c 6F2 >";
+string ascii85_encoded = "87cURD]j7BEbo7~>";
+vector<uint8_t> lzw_bytes {
+  0x80, 0x0b, 0x60, 0x50, 0x22, 0x0c, 0x0c, 0x85, 0x01};
+string lzw_encoded(lzw_bytes.begin(), lzw_bytes.end());
+vector<uint8_t> run_length_bytes {0x02, 'a', 'b', 'c', 0xfe, 'x', 0x80, 'y'};
+string run_length_encoded(run_length_bytes.begin(), run_length_bytes.end());
+vector<uint8_t> predicted_bytes {2, 1, 2, 3, 2, 1, 1, 1, 1, 5, 1, 1};
+vector<uint8_t> unpredicted_bytes {1, 2, 3, 2, 3, 4, 5, 6, 7};
+string hex_flate_predicted = "78DA63626462666204025646460000960016>";
+vector<uint8_t> average_paeth_bytes {
+  0, 10, 20, 30, 40, 3, 4, 6, 200, 1, 4, 7, 1, 9, 90, 4, 250, 3, 3, 128};
+vector<uint8_t> average_paeth_result {
+  10, 20, 30, 40, 9, 16, 219, 29, 16, 17, 228, 119, 10, 20, 231, 247};
+
+// The FIPS-197 example block, with the keys 00 01 02 ... for AES-128 and
+// AES-256 and the cipher text each gives
+vector<uint8_t> aes_plain {
+  0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+  0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+vector<uint8_t> aes128_cipher {
+  0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+  0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+vector<uint8_t> aes256_cipher {
+  0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+  0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89};
+
+// Two minimal files with no pages, each with a stream of "Hello world",
+// encrypted with AES-128 (revision 4) and AES-256 (revision 6) respectively
+const char aes128_pdf[] =
+"%PDF-1.7\n"
+"1 0 obj\n"
+"<</Length 32>>\n"
+"stream\n"
+"\xa0\xa1\xa2\xa3\xa4\xa5\xa6\xa7\xa8\xa9\xaa\xab\xac\xad\xae\xaf\x22\x1a@%"
+"x\x3f\xc9\xe3\xfd>\x94\xf8\x91\xec\x65K\n"
+"endstream\n"
+"endobj\n"
+"2 0 obj\n"
+"<</Filter/Standard/V 4/R 4/Length 128/CF<</StdCF<</CFM/AESV2>>>>/StmF/StdC"
+"F/StrF/StdCF/P -1028/O<030a11181f262d343b424950575e656c737a81888f969da4abb"
+"2b9c0c7ced5dc>/U<1ec4eb7abcc8c258d5e4a96d3a012d870000000000000000000000000"
+"0000000>>>\n"
+"endobj\n"
+"xref\n"
+"0 3\n"
+"0000000000 65535 f \n"
+"0000000009 00000 n \n"
+"0000000089 00000 n \n"
+"trailer\n"
+"<</Size 3/Encrypt 2 0 R/ID[<000102030405060708090a0b0c0d0e0f><000102030405"
+"060708090a0b0c0d0e0f>]>>\n"
+"startxref\n"
+"337\n"
+"%%EOF";
+const char aes256_pdf[] =
+"%PDF-1.7\n"
+"1 0 obj\n"
+"<</Length 32>>\n"
+"stream\n"
+"\xa0\xa1\xa2\xa3\xa4\xa5\xa6\xa7\xa8\xa9\xaa\xab\xac\xad\xae\xaf\x16\x32"
+"\x97\xc9\xd1>93w\x87\x92\x85q\xf5\x1d\xec\n"
+"endstream\n"
+"endobj\n"
+"2 0 obj\n"
+"<</Filter/Standard/V 5/R 6/Length 256/CF<</StdCF<</CFM/AESV3>>>>/StmF/StdC"
+"F/StrF/StdCF/P -1028/U<8d1efb4f1bdbb651341704c2139de4f6be05d6d4609af56916b"
+"21646ed74825c01020304050607081112131415161718>/UE<18f1e66b33dd4ea7d7d03256"
+"68383e8178c6ff73c929b2e952dde69661ff0628>>>\n"
+"endobj\n"
+"xref\n"
+"0 3\n"
+"0000000000 65535 f \n"
+"0000000009 00000 n \n"
+"0000000089 00000 n \n"
+"trailer\n"
+"<</Size 3/Encrypt 2 0 R/ID[<000102030405060708090a0b0c0d0e0f><000102030405"
+"060708090a0b0c0d0e0f>]>>\n"
+"startxref\n"
+"370\n"
+"%%EOF";
 }
 
 //---------------------------------------------------------------------------//
@@ -126,6 +256,17 @@ context("utilities.h")
     expect_true(ConvertHexToBytes(test_broken_hexstring) == test_bytes);
   }
 
+  test_that("Pdf strings are read as bytes and text.")
+  {
+    expect_true(ReadStringBytes("(A \\(B\\) (C)\\101\\n)") == "A (B) (C)A\n");
+    expect_true(ReadStringBytes("(split \\\nline) trailing") == "split line");
+    expect_true(ReadStringBytes(" <48 65 6C6C 6F>") == "Hello");
+    expect_true(ReadStringBytes("/Name") == "/Name");
+    expect_true(TextStringToUtf8("caf\xE9") == "caf\xC3\xA9");
+    string utf16("\xFE\xFF\x00\x41\xD8\x3D\xDE\x00", 8);
+    expect_true(TextStringToUtf8(utf16) == "A\xF0\x9F\x98\x80");
+  }
+
   test_that("Ints are converted to hex appropriately.")
   {
     expect_true(ConvertIntToHex(161) == string("00A1"));
@@ -166,9 +307,27 @@ context("utilities.h")
       test_floats);
   }
 
+  test_that("Offsets beyond 2GB are parsed.")
+  {
+    expect_true(ParseOffsets("0 3000000000 12") ==
+                vector<int64_t>({0, 3000000000LL, 12}));
+  }
+
   test_that("Read file throws if file not found.")
   {
     expect_error(GetFile("not_a_real_file.nrf"));
+    expect_error(ByteSource::FromFile("not_a_real_file.nrf"));
+  }
+
+  test_that("A ByteSource finds and copies out bytes.")
+  {
+    ByteSource source(string("1 0 obj\n<< >>\nendobj\n", 21));
+    expect_true(source.find("obj") == 4);
+    expect_true(source.find("obj", 5) == 17);
+    expect_true(source.find("obj", 5, 19) == string::npos);
+    expect_true(source.find('\n') == 7);
+    expect_true(source.substr(8, 5) == "<< >>");
+    expect_true(source.substr(30, 5).empty());
   }
 }
 
@@ -195,3 +354,678 @@ context("dictionary.h")
     expect_true(get_font_name == string("/Times-Roman"));
   }
 }
+
+//---------------------------------------------------------------------------//
+// Tests the Deflate decompressor with short streams made by zlib, covering
+// each of the three block types.
+
+context("deflate.h")
+{
+  test_that("Blocks with fixed Huffman codes are inflated correctly.")
+  {
+    expect_true(FlateDecode(&fixed_deflate) == inflated_message);
+  }
+
+  test_that("Stored blocks are copied correctly.")
+  {
+    expect_true(FlateDecode(&stored_deflate) == inflated_message);
+  }
+
+  test_that("Length and distance pointers are expanded correctly.")
+  {
+    string expected;
+    for (int i = 0; i < 40; ++i) expected += "ab";
+    for (int i = 0; i < 5; ++i) expected += inflated_message;
+    expect_true(FlateDecode(&pointer_deflate) == expected);
+  }
+
+  test_that("Runs and short repeating patterns are expanded correctly.")
+  {
+    string expected(300, 'a');
+    for (int i = 0; i < 50; ++i) expected += "xyz";
+    expect_true(FlateDecode(&run_deflate) == expected);
+  }
+
+  test_that("Chunked inflation gives the same output as whole inflation.")
+  {
+    string chunked;
+    FlateDecode(CharString(pointer_deflate),
+                [&](const char* chunk, size_t length) -> void
+                {
+                  chunked.append(chunk, length);
+                });
+    expect_true(chunked == FlateDecode(&pointer_deflate));
+  }
+
+  test_that("Truncated streams throw.")
+  {
+    expect_error(FlateDecode(&truncated_deflate));
+  }
+
+  test_that("Malformed Huffman codes and pointers throw.")
+  {
+    for (auto& bytes : malformed_deflate_bytes)
+    {
+      string malformed(bytes.begin(), bytes.end());
+      expect_error(FlateDecode(&malformed));
+      expect_error(GetBuiltInDecoder().Inflate(CharString(malformed)));
+    }
+  }
+
+  test_that("The expected size is only a guess at the output size.")
+  {
+    string expected = FlateDecode(&pointer_deflate);
+    for (size_t guess : {(size_t) 1, expected.size(), (size_t) 1 << 20})
+    {
+      expect_true(FlateDecode(CharString(pointer_deflate), guess) == expected);
+    }
+  }
+
+  test_that("The configured decoder agrees with the built-in decoder.")
+  {
+    const Decoder& decoder = GetFlateDecoder();
+    expect_true(decoder.Inflate(CharString(pointer_deflate)) ==
+                GetBuiltInDecoder().Inflate(CharString(pointer_deflate)));
+    expect_true(decoder.Inflate(CharString(stored_deflate)) ==
+                inflated_message);
+    expect_error(decoder.Inflate(CharString(truncated_deflate)));
+  }
+}
+
+context("crypto.h")
+{
+  test_that("AES encrypts and decrypts the standard test block.")
+  {
+    vector<uint8_t> key(32), block(16);
+    for (int i = 0; i < 32; ++i) key[i] = i;
+
+    AES aes128(key.data(), 16);
+    aes128.EncryptBlock(aes_plain.data(), block.data());
+    expect_true(block == aes128_cipher);
+    aes128.DecryptBlock(block.data(), block.data());
+    expect_true(block == aes_plain);
+
+    AES aes256(key.data(), 32);
+    aes256.EncryptBlock(aes_plain.data(), block.data());
+    expect_true(block == aes256_cipher);
+    aes256.DecryptBlock(block.data(), block.data());
+    expect_true(block == aes_plain);
+  }
+
+  test_that("AES-128 and AES-256 encrypted streams are decrypted.")
+  {
+    auto aes128_xref = make_shared<XRef>(make_shared<ByteSource>(
+      string(aes128_pdf, sizeof(aes128_pdf) - 1)));
+    expect_true(Object(aes128_xref, 1).GetStream() == inflated_message);
+
+    auto aes256_xref = make_shared<XRef>(make_shared<ByteSource>(
+      string(aes256_pdf, sizeof(aes256_pdf) - 1)));
+    expect_true(Object(aes256_xref, 1).GetStream() == inflated_message);
+  }
+
+  test_that("An AESV3 crypt filter is refused before revision 5.")
+  {
+    // The AES-128 file with its crypt filter changed to AESV3
+    string pdf(aes128_pdf, sizeof(aes128_pdf) - 1);
+    pdf.replace(pdf.find("/AESV2"), 6, "/AESV3");
+    expect_error(make_shared<XRef>(make_shared<ByteSource>(pdf)));
+  }
+}
+
+context("xref.h")
+{
+  test_that("XRef lists objects in order and finds where they end.")
+  {
+    auto file = make_shared<ByteSource>(
+      string(aes128_pdf, sizeof(aes128_pdf) - 1));
+    XRef xref(file);
+    expect_true(xref.GetAllObjectNumbers() == vector<int>({1, 2}));
+    for (int object_number : {1, 2})
+    {
+      size_t end = xref.GetObjectEndByte(object_number);
+      expect_true(end > xref.GetObjectStartByte(object_number));
+      expect_true(file->substr(end, 6) == "endobj");
+    }
+    expect_error(xref.GetObjectStartByte(3));
+  }
+
+  test_that("A damaged XRef is rebuilt from the objects in the file.")
+  {
+    string objects = "%PDF-1.4\n"
+                     "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+                     "2 0 obj\n<< /Type /Pages /Kids [] /Count 0 >>\nendobj\n"
+                     "3 0 obj\n(Hello world)\nendobj\n";
+    string xref_table = "xref\n0 4\n0000000000 65535 f \n"
+                        "0000000009 00000 n \n0000000058 00000 n \n"
+                        "0000000110 00000 n \n";
+    string trailer = "trailer\n<< /Size 4 /Root 1 0 R >>\nstartxref\n";
+    string good_pdf = objects + xref_table + trailer +
+                      to_string(objects.size()) + "\n%%EOF\n";
+
+    XRef good_xref(make_shared<ByteSource>(good_pdf));
+    expect_false(good_xref.IsRepaired());
+    expect_false(good_xref.IsRecovered(3));
+
+    // Junk at the start of the file moves every object away from its offset
+    auto shifted = make_shared<ByteSource>("JUNK\n" + good_pdf);
+    XRef shifted_xref(shifted);
+    expect_true(shifted_xref.IsRepaired());
+    expect_true(shifted_xref.GetAllObjectNumbers() == vector<int>({1, 2, 3}));
+    expect_true(shifted_xref.IsRecovered(3));
+    expect_true(shifted_xref.GetObjectStartByte(3) == shifted->find("3 0 obj"));
+    expect_true(shifted_xref.GetTrailer().GetReference("/Root") == 1);
+
+    // A file cut off before its XRef
+    XRef cut_xref(make_shared<ByteSource>(objects));
+    expect_true(cut_xref.IsRepaired());
+    expect_true(cut_xref.GetTrailer().GetReference("/Root") == 1);
+  }
+}
+
+context("filters.h")
+{
+  test_that("ASCIIHex streams are decoded, ignoring whitespace.")
+  {
+    Dictionary dictionary = filter_dictionary("/Filter /ASCIIHexDecode");
+    expect_true(DecodeStream(CharString(hex_encoded), dictionary) ==
+                "Hello ");
+  }
+
+  test_that("ASCII85 streams are decoded, including partial groups.")
+  {
+    Dictionary dictionary = filter_dictionary("/Filter /ASCII85Decode");
+    expect_true(DecodeStream(CharString(ascii85_encoded), dictionary) ==
+                inflated_message);
+    expect_true(DecodeStream(CharString("z~>"), dictionary) ==
+                string(4, '\0'));
+  }
+
+  test_that("LZW streams are decoded.")
+  {
+    Dictionary dictionary = filter_dictionary("/Filter /LZWDecode");
+    expect_true(DecodeStream(CharString(lzw_encoded), dictionary) ==
+                "-----A---B");
+  }
+
+  test_that("RunLength streams are decoded up to the end marker.")
+  {
+    Dictionary dictionary = filter_dictionary("/Filter /RunLengthDecode");
+    expect_true(DecodeStream(CharString(run_length_encoded), dictionary) ==
+                "abcxxx");
+  }
+
+  test_that("PNG predictors are undone across chunk boundaries.")
+  {
+    string output;
+    Dictionary parameters = filter_dictionary("/Predictor 12 /Columns 3");
+    PredictorFilter predictor([&](const char* chunk, size_t length) -> void
+                              {
+                                output.append(chunk, length);
+                              }, parameters);
+    for (uint8_t byte : predicted_bytes) predictor.Write((char*) &byte, 1);
+    predictor.Finish();
+    expect_true(output == string(unpredicted_bytes.begin(),
+                                 unpredicted_bytes.end()));
+  }
+
+  test_that("Average and Paeth predictors are undone on multi-byte pixels.")
+  {
+    string output;
+    Dictionary parameters = filter_dictionary(
+      "/Predictor 15 /Colors 2 /Columns 2");
+    PredictorFilter predictor([&](const char* chunk, size_t length) -> void
+                              {
+                                output.append(chunk, length);
+                              }, parameters);
+    predictor.Write((char*) average_paeth_bytes.data(),
+                    average_paeth_bytes.size());
+    predictor.Finish();
+    expect_true(output == string(average_paeth_result.begin(),
+                                 average_paeth_result.end()));
+  }
+
+  test_that("Filter arrays are applied in order with their parameters.")
+  {
+    Dictionary dictionary = filter_dictionary(
+      "/Filter [/ASCIIHexDecode /FlateDecode]"
+      "/DecodeParms [null <</Predictor 12 /Columns 3>>]");
+    expect_true(DecodeStream(CharString(hex_flate_predicted), dictionary) ==
+                string(unpredicted_bytes.begin(), unpredicted_bytes.end()));
+  }
+
+  test_that("A /Crypt filter's parameters aren't given to the next filter.")
+  {
+    Dictionary dictionary = filter_dictionary(
+      "/Filter [/Crypt /ASCIIHexDecode /FlateDecode]"
+      "/DecodeParms [<</Name /Identity>> null <</Predictor 12 /Columns 3>>]");
+    expect_true(DecodeStream(CharString(hex_flate_predicted), dictionary) ==
+                string(unpredicted_bytes.begin(), unpredicted_bytes.end()));
+  }
+
+  test_that("Unsupported filters leave the stream undecoded from there on.")
+  {
+    Dictionary dictionary = filter_dictionary(
+      "/Filter [/ASCIIHexDecode /DCTDecode]");
+    expect_true(DecodeStream(CharString(hex_encoded), dictionary) ==
+                "Hello ");
+    dictionary = filter_dictionary("/Filter /JBIG2Decode");
+    expect_true(DecodeStream(CharString(hex_encoded), dictionary) ==
+                hex_encoded);
+  }
+}
+
+context("object_class.h")
+{
+  test_that("Decoded streams are evicted to keep within budget.")
+  {
+    string pdf = "%PDF-1.4\n"
+                 "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+                 "2 0 obj\n<< /Length 10 >>\nstream\n0123456789\n"
+                 "endstream\nendobj\n"
+                 "3 0 obj\n<< /Length 10 >>\nstream\nabcdefghij\n"
+                 "endstream\nendobj\n";
+    auto xref = make_shared<XRef>(make_shared<ByteSource>(pdf));
+    auto cache = make_shared<StreamCache>(15);
+    auto digits = make_shared<Object>(xref, 2, cache);
+    auto letters = make_shared<Object>(xref, 3, cache);
+
+    expect_true(digits->GetStream() == "0123456789");
+    expect_true(digits->GetStream() == "0123456789");
+    expect_true(letters->GetStream() == "abcdefghij");
+    StreamCache::Statistics statistics = cache->GetStatistics();
+    expect_true(statistics.hits == 1 && statistics.misses == 2);
+    expect_true(statistics.evictions == 1 && statistics.bytes == 10);
+
+    // The evicted stream is decoded again when it is next needed
+    expect_true(digits->GetStream() == "0123456789");
+    expect_true(cache->GetStatistics().misses == 3);
+
+    letters.reset();
+    cache->SetBudget(0);
+    statistics = cache->GetStatistics();
+    expect_true(statistics.entries == 0 && statistics.bytes == 0);
+  }
+
+  test_that("Filters and parameters given by reference are resolved.")
+  {
+    // The parameters are an array object whose second member is a reference
+    // to a dictionary in an object stream. Object 9's filter is itself.
+    string pdf = "%PDF-1.5\n"
+                 "1 0 obj\n<< /Type /Catalog /Pages 7 0 R >>\nendobj\n"
+                 "2 0 obj\n<< /Filter 3 0 R /DecodeParms 4 0 R /Length " +
+                 to_string(hex_flate_predicted.size()) + " >>\nstream\n" +
+                 hex_flate_predicted + "\nendstream\nendobj\n"
+                 "3 0 obj\n[/ASCIIHexDecode /FlateDecode]\nendobj\n"
+                 "4 0 obj\n[null 6 0 R]\nendobj\n"
+                 "5 0 obj\n<< /Type /ObjStm /N 1 /First 4 /Length 32 >>\n"
+                 "stream\n6 0 <</Predictor 12 /Columns 3>>\n"
+                 "endstream\nendobj\n"
+                 "7 0 obj\n<< /Type /Pages /Kids [8 0 R] /Count 1 >>\nendobj\n"
+                 "8 0 obj\n<< /Type /Page /Parent 7 0 R >>\nendobj\n"
+                 "9 0 obj\n<< /Filter 9 0 R /Length 2 >>\nstream\nab\n"
+                 "endstream\nendobj\n"
+                 "trailer\n<< /Root 1 0 R >>\n";
+    Document document(vector<uint8_t>(pdf.begin(), pdf.end()));
+    expect_true(document.GetObject(2)->GetStream() ==
+                string(unpredicted_bytes.begin(), unpredicted_bytes.end()));
+    expect_true(document.GetObject(2)->GetDictionary()["/Filter"]
+                .find("[/ASCIIHexDecode /FlateDecode]") != string::npos);
+
+    // A reference that leads back to itself fails rather than looping
+    expect_error(document.GetObject(9));
+  }
+
+  test_that("Objects are read from inside object streams.")
+  {
+    string pdf = "%PDF-1.5\n"
+                 "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+                 "3 0 obj\n<< /Type /ObjStm /N 3 /First 14 /Length 38 >>\n"
+                 "stream\n4 0 5 11 6 19 << /A 1 >> [1 2 3] 4 0 R\n"
+                 "endstream\nendobj\n";
+    auto xref = make_shared<XRef>(make_shared<ByteSource>(pdf));
+    expect_true(xref->GetObjectStreamNumbers() == vector<int>{3});
+    auto holder = make_shared<Object>(xref, 3);
+
+    Object dictionary(holder, 4), array(holder, 5), reference(holder, 6);
+    expect_true(dictionary.GetDictionary().GetInts("/A") == vector<int>{1});
+    expect_true(dictionary.GetStream().empty());
+    expect_true(array.GetStream() == "[1 2 3] ");
+    expect_true(array.GetReferencedObject() == 0);
+    expect_true(reference.GetReferencedObject() == 4);
+    expect_error(Object(holder, 7));
+  }
+
+  test_that("Objects placed outside a damaged object stream throw.")
+  {
+    // Object 5 is indexed past the end of the stream, and object 6 before
+    // object 5, which would give object 5 a negative length
+    string pdf = "%PDF-1.5\n"
+                 "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+                 "3 0 obj\n<< /Type /ObjStm /N 3 /First 14 /Length 28 >>\n"
+                 "stream\n4 0 5 90 6 40 << /A 1 >>\n"
+                 "endstream\nendobj\n";
+    auto xref = make_shared<XRef>(make_shared<ByteSource>(pdf));
+    auto holder = make_shared<Object>(xref, 3);
+    Object dictionary(holder, 4);
+    expect_true(dictionary.GetDictionary().GetInts("/A") == vector<int>{1});
+    expect_error(Object(holder, 5));
+    expect_error(Object(holder, 6));
+  }
+}
+
+context("document.h")
+{
+  test_that("Pages are found through the page tree's /Count entries.")
+  {
+    auto page_tree = [](int node_count) -> vector<uint8_t>
+    {
+      string pdf = "%PDF-1.4\n"
+                   "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+                   "2 0 obj\n<< /Type /Pages /Kids [3 0 R 4 0 R] /Count 3 >>"
+                   "\nendobj\n"
+                   "3 0 obj\n<< /Type /Pages /Kids [5 0 R 6 0 R] /Count " +
+                   to_string(node_count) + " >>\nendobj\n"
+                   "4 0 obj\n<< /Type /Page >>\nendobj\n"
+                   "5 0 obj\n<< /Type /Page >>\nendobj\n"
+                   "6 0 obj\n<< /Type /Page >>\nendobj\n";
+      return vector<uint8_t>(pdf.begin(), pdf.end());
+    };
+
+    Document document(page_tree(2));
+    expect_true(document.GetPageCount() == 3);
+    expect_true(document.GetPageObjectNumber(2) == 4);
+    expect_true(document.GetPageObjectNumber(1) == 6);
+    expect_error(document.GetPageObjectNumber(3));
+    expect_true(document.GetPageObjectNumbers() == vector<int>({5, 6, 4}));
+
+    // A wrong /Count means the whole tree has to be read
+    Document miscounted(page_tree(1));
+    expect_true(miscounted.GetPageObjectNumber(2) == 4);
+    expect_true(miscounted.GetPageObjectNumber(0) == 5);
+    expect_true(miscounted.GetPageCount() == 3);
+  }
+
+  test_that("Objects held in a loop of object streams fail without waiting.")
+  {
+    // An XRef stream with one-byte types, two-byte offsets and one-byte
+    // generations. Object 2 claims to be held in its own object stream, and
+    // objects 3 and 4 each claim to be held in the other's.
+    auto row = [](int type, size_t field, int generation) -> string
+    {
+      return string {(char) type, (char) (field >> 8), (char) (field & 0xff),
+                     (char) generation};
+    };
+    string pdf = "%PDF-1.5\n";
+    size_t catalog_start = pdf.size();
+    pdf += "1 0 obj\n<< /Type /Catalog /Pages 6 0 R >>\nendobj\n";
+    size_t pages_start = pdf.size();
+    pdf += "6 0 obj\n<< /Type /Pages /Kids [7 0 R] /Count 1 >>\nendobj\n";
+    size_t page_start = pdf.size();
+    pdf += "7 0 obj\n<< /Type /Page /Parent 6 0 R >>\nendobj\n";
+    size_t xref_start = pdf.size();
+    string rows = row(0, 0, 0) + row(1, catalog_start, 0) + row(2, 2, 0) +
+                  row(2, 4, 0) + row(2, 3, 0) + row(1, xref_start, 0) +
+                  row(1, pages_start, 0) + row(1, page_start, 0);
+    pdf += "5 0 obj\n<< /Type /XRef /Size 8 /W [1 2 1] /Root 1 0 R /Length " +
+           to_string(rows.size()) + " >>\nstream\n" + rows +
+           "\nendstream\nendobj\nstartxref\n" + to_string(xref_start) +
+           "\n%%EOF\n";
+
+    Document document(vector<uint8_t>(pdf.begin(), pdf.end()));
+    expect_true(document.GetObject(1)->GetDictionary()["/Type"] ==
+                "/Catalog");
+    expect_error(document.GetObject(2));
+    expect_error(document.GetObject(3));
+    expect_error(document.GetObject(4));
+  }
+
+  test_that("A linearized file's first page is read from its first section.")
+  {
+    // Objects 4 - 6 are listed in the first-page XRef section, and objects
+    // 1 - 3 (the page tree and second page) only in the main XRef at the end
+    auto linearized = [](const string& page_tree, bool is_changed)
+    {
+      auto offset = [](size_t position) -> string
+      {
+        string digits = to_string(position);
+        return string(10 - digits.size(), '0') + digits;
+      };
+      vector<string> objects = {
+        "4 0 obj\n<< /Linearized 1 /L ########## /O 6 /N 2 >>\nendobj\n",
+        "5 0 obj\n<< /Type /Catalog /Pages 1 0 R >>\nendobj\n",
+        "6 0 obj\n<< /Type /Page /Parent 1 0 R >>\nendobj\n",
+        "1 0 obj\n" + page_tree + "\nendobj\n",
+        "2 0 obj\n<< /Type /Page /Parent 1 0 R >>\nendobj\n",
+        "3 0 obj\n<< /Type /Page /Parent 1 0 R >>\nendobj\n"};
+      auto xref = [&](const vector<size_t>& starts, int first) -> string
+      {
+        string table = "xref\n" + to_string(first) + " 3\n";
+        for (auto start : starts) table += offset(start) + " 00000 n\r\n";
+        return table;
+      };
+
+      // The first-page section is written once its objects' offsets are known
+      string first_trailer = "trailer\n<< /Size 7 /Root 5 0 R >>\n"
+                             "startxref\n0\n%%EOF\n";
+      size_t first_length = xref({0, 0, 0}, 4).size() + first_trailer.size();
+      string pdf = "%PDF-1.4\n";
+      vector<size_t> starts;
+      for (auto& object : objects)
+      {
+        if (starts.size() == 1) pdf += string(first_length, ' ');
+        starts.push_back(pdf.size());
+        pdf += object;
+      }
+      pdf.replace(starts[1] - first_length, first_length,
+                  xref({starts[0], starts[1], starts[2]}, 4) + first_trailer);
+
+      size_t main_start = pdf.size();
+      pdf += xref({starts[3], starts[4], starts[5]}, 1) +
+             "trailer\n<< /Size 4 >>\nstartxref\n" +
+             to_string(main_start) + "\n%%EOF\n";
+      pdf.replace(pdf.find("##########"), 10,
+                  offset(pdf.size() + (is_changed ? 1 : 0)));
+      return vector<uint8_t>(pdf.begin(), pdf.end());
+    };
+
+    string page_tree = "<< /Type /Pages /Kids [6 0 R 2 0 R] /Count 2 >>";
+    Document document(linearized(page_tree, false), 1, true);
+    expect_true(document.GetPageCount() == 2);
+    expect_true(document.GetPageObjectNumber(0) == 6);
+    expect_true(document.GetPageObjectNumber(1) == 2);
+    expect_true(document.GetObject(3)->GetDictionary()["/Type"] == "/Page");
+
+    // The page tree isn't needed for the first page
+    auto broken = linearized("<< /Type /Pages >>", false);
+    expect_true(Document(broken, 1, true).GetPageObjectNumber(0) == 6);
+    expect_error(Document(broken, 1, false));
+
+    // Nor is the first section used once the file has changed
+    expect_error(Document(linearized("<< /Type /Pages >>", true), 1, true));
+  }
+
+  test_that("Only form XObjects are decoded, and each only once.")
+  {
+    auto stream = [](const string& number, const string& entries,
+                     const string& contents) -> string
+    {
+      return number + " 0 obj\n<< " + entries + " /Length " +
+             to_string(contents.size()) + " >>\nstream\n" + contents +
+             "\nendstream\nendobj\n";
+    };
+
+    // Both pages draw the same form and image. The image isn't valid flate
+    // data, so reading the pages would fail if it were ever decoded.
+    string page = "<< /Type /Page /Parent 2 0 R /Contents 5 0 R "
+                  "/Resources 6 0 R /MediaBox [0 0 200 200] >>";
+    string pdf = "%PDF-1.4\n"
+      "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R 4 0 R] /Count 2 >>\nendobj\n"
+      "3 0 obj\n" + page + "\nendobj\n4 0 obj\n" + page + "\nendobj\n" +
+      stream("5", "", "/Im1 Do /Fm1 Do") +
+      "6 0 obj\n<< /XObject << /Fm1 7 0 R /Im1 8 0 R >> "
+      "/Font << /F1 9 0 R >> >>\nendobj\n" +
+      stream("7", "/Type /XObject /Subtype /Form",
+             "BT /F1 10 Tf (Shared) Tj ET") +
+      stream("8", "/Type /XObject /Subtype /Image /Filter /FlateDecode",
+             "notflate") +
+      "9 0 obj\n<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>\n"
+      "endobj\n";
+
+    auto document = make_shared<Document>(vector<uint8_t>(pdf.begin(),
+                                                          pdf.end()));
+    for (int page_number : {0, 1})
+    {
+      auto page_ptr = make_shared<Page>(document, page_number);
+      Parser parser(page_ptr);
+      Tokenizer(page_ptr, &parser);
+      expect_true(page_ptr->GetXObject("/Im1") == nullptr);
+      expect_true(page_ptr->GetLocalObjectNumbers().back() == 8);
+    }
+
+    StreamCache::Statistics statistics = document->GetStreamCache()
+                                                  .GetStatistics();
+    expect_true(statistics.misses == 1 && statistics.hits == 1);
+  }
+
+  test_that("Pages share their Document's Fonts, whatever they call them.")
+  {
+    // Both pages use font 5, under different names, and the same font
+    // dictionary written out in full
+    string inline_font = "<< /Type /Font /Subtype /Type1 /BaseFont /Courier >>";
+    auto page = [&](const string& name) -> string
+    {
+      return "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 200 200] "
+             "/Resources << /Font << " + name + " 5 0 R /F9 " + inline_font +
+             " >> >> >>";
+    };
+    string pdf = "%PDF-1.4\n"
+      "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R 4 0 R] /Count 2 >>\nendobj\n"
+      "3 0 obj\n" + page("/F1") + "\nendobj\n"
+      "4 0 obj\n" + page("/F2") + "\nendobj\n"
+      "5 0 obj\n<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>\n"
+      "endobj\n";
+
+    auto document = make_shared<Document>(vector<uint8_t>(pdf.begin(),
+                                                          pdf.end()));
+    Page first(document, 0), second(document, 1);
+    expect_true(first.GetFont("/F1") == second.GetFont("/F2"));
+    expect_true(first.GetFont("/F9") == second.GetFont("/F9"));
+    expect_true(first.GetFont("/F1") != first.GetFont("/F9"));
+
+    Document::FontStatistics statistics = document->GetFontStatistics();
+    expect_true(statistics.fonts == 2);
+    expect_true(statistics.misses == 2 && statistics.hits == 2);
+  }
+
+  test_that("A page only builds the fonts it uses.")
+  {
+    // Font /F2 is missing, so it would fail if it were built
+    string pdf = "%PDF-1.4\n"
+      "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n"
+      "3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 200 200] "
+      "/Resources << /Font << /F1 4 0 R /F2 9 0 R >> >> >>\nendobj\n"
+      "4 0 obj\n<< /Type /Font /Subtype /Type1 /BaseFont /Helvetica >>\n"
+      "endobj\n";
+
+    auto document = make_shared<Document>(vector<uint8_t>(pdf.begin(),
+                                                          pdf.end()));
+    Page page(document, 0);
+    expect_true(document->GetFontStatistics().fonts == 0);
+    expect_true(page.GetFont("/F1")->GetFontName() == "Helvetica");
+    expect_true(document->GetFontStatistics().fonts == 1);
+    expect_error(page.GetFont("/F2"));
+  }
+
+  test_that("Page boxes, rotation and fonts are inherited from the tree.")
+  {
+    string pdf = "%PDF-1.4\n"
+      "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R 4 0 R] /Count 2 /Rotate -90 "
+      "/MediaBox [0 0 612 792] /Resources 5 0 R >>\nendobj\n"
+      "3 0 obj\n<< /Type /Page /Parent 2 0 R /CropBox [10 10 600 780] "
+      "/Contents 9 0 R >>\nendobj\n"
+      "4 0 obj\n<< /Type /Page /Parent 2 0 R /Rotate 180 "
+      "/Resources << /Font << >> >> >>\nendobj\n"
+      "5 0 obj\n<< /Font << /F2 6 0 R /F1 << /BaseFont /ABCDEF+Arial >> >> >>"
+      "\nendobj\n"
+      "6 0 obj\n<< /Type /Font /BaseFont /Helvetica >>\nendobj\n"
+      "7 0 obj\n<< /Title (Caf\\351) /Author <FEFF00410042> /Trapped /False >>"
+      "\nendobj\ntrailer\n<< /Root 1 0 R /Info 7 0 R >>\n";
+
+    // The page's contents (object 9) don't exist, and are never looked for
+    Document document(vector<uint8_t>(pdf.begin(), pdf.end()));
+    Document::PageInfo first = document.GetPageInfo(0);
+    expect_true(first.media_box == vector<float>({0, 0, 612, 792}));
+    expect_true(first.crop_box == vector<float>({10, 10, 600, 780}));
+    expect_true(first.rotate == 270);
+    expect_true(first.fonts.size() == 2);
+    expect_true(first.fonts[0].first == "/F1");
+    expect_true(first.fonts[0].second == "Arial");
+    expect_true(first.fonts[1].second == "Helvetica");
+
+    Document::PageInfo second = document.GetPageInfo(1);
+    expect_true(second.crop_box == second.media_box);
+    expect_true(second.rotate == 180);
+    expect_true(second.fonts.empty());
+
+    auto info = document.GetInfo();
+    expect_true(info.size() == 3);
+    expect_true(info[0] == make_pair(string("Author"), string("AB")));
+    expect_true(info[1].second == "Caf\xC3\xA9");
+    expect_true(info[2].second == "/False");
+  }
+
+  test_that("Embedded font files aren't read to build a Font.")
+  {
+    // The font file isn't valid flate data, so it would fail if decoded
+    string pdf = "%PDF-1.4\n"
+      "1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n"
+      "2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n"
+      "3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 200 200] "
+      "/Resources << /Font << /F1 4 0 R >> >> >>\nendobj\n"
+      "4 0 obj\n<< /Type /Font /Subtype /TrueType /BaseFont /ABCDEF+Arial "
+      "/FontDescriptor 5 0 R >>\nendobj\n"
+      "5 0 obj\n<< /Type /FontDescriptor /FontFile2 6 0 R >>\nendobj\n"
+      "6 0 obj\n<< /Filter /FlateDecode /Length 8 >>\nstream\nnotflate\n"
+      "endstream\nendobj\n";
+
+    auto document = make_shared<Document>(vector<uint8_t>(pdf.begin(),
+                                                          pdf.end()));
+    Page page(document, 0);
+    expect_true(page.GetFont("/F1")->GetFontName() == "Arial");
+    expect_true(document->GetStreamCache().GetStatistics().misses == 0);
+  }
+}
+
+context("scheduler.h")
+{
+  test_that("Every task is run exactly once.")
+  {
+    vector<int> runs(100, 0);
+    Scheduler scheduler(runs.size(), 4);
+    scheduler.Run([&](size_t task) -> void {++runs[task];});
+    expect_true(scheduler.NumberOfThreads() == 4);
+    expect_true(count(runs.begin(), runs.end(), 1) == 100);
+    expect_true(Scheduler(2, 8).NumberOfThreads() == 2);
+  }
+
+  test_that("The exception from the first failing task is rethrown.")
+  {
+    string message;
+    try
+    {
+      Scheduler(50, 3).Run([](size_t task) -> void
+      {
+        if (task == 7 || task == 31) throw runtime_error(to_string(task));
+      });
+    }
+    catch (const runtime_error& error)
+    {
+      message = error.what();
+    }
+    expect_true(message == "7");
+  }
+}
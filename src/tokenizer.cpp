@@ -16,20 +16,75 @@
 using namespace std;
 using namespace Token;
 
-std::string Tokenizer::in_loop_ = "none";
-
-
 /*---------------------------------------------------------------------------*/
 // constructor of Tokenizer - initializes members and starts tokenizing
 
 Tokenizer::Tokenizer(const string& input, Parser* interpreter)
   : it_(input),
     state_(NEWSYMBOL),
-    interpreter_(interpreter)
+    interpreter_(interpreter),
+    in_loop_("none")
+{
+  Tokenize_(true);
+}
+
+/*---------------------------------------------------------------------------*/
+// As above, for the contents of the XObject named in_loop
+
+Tokenizer::Tokenizer(const string& input, Parser* interpreter,
+                     const string& in_loop)
+  : it_(input),
+    state_(NEWSYMBOL),
+    interpreter_(interpreter),
+    in_loop_(in_loop)
+{
+  Tokenize_(true);
+}
+
+/*---------------------------------------------------------------------------*/
+// The chunked constructor asks the page to stream its contents into the
+// buffer, tokenizing each chunk as it arrives, then finishes off whatever is
+// left once the last chunk has been received.
+
+Tokenizer::Tokenizer(shared_ptr<Page> page, Parser* interpreter)
+  : it_(buffer_),
+    state_(NEWSYMBOL),
+    interpreter_(interpreter),
+    in_loop_("none")
+{
+  page->StreamContents([this](const char* chunk, size_t length) -> void
+                       {
+                         Feed_(chunk, length);
+                       });
+  Tokenize_(true);
+}
+
+/*---------------------------------------------------------------------------*/
+// Before a new chunk is appended, the characters that have already been
+// tokenized are dropped from the front of the buffer. Any token that is still
+// being read (from it_.first() to it_.last()) is kept, so a token split
+// across two chunks is read exactly as if the input had been one string.
+
+void Tokenizer::Feed_(const char* chunk, size_t length)
 {
-  // Now cycle through each character, switching state as needed and writing
-  // to the interpreter when a parsed symbol has been obtained.
-  while (!it_.HasOverflowed())
+  size_t consumed = it_.first();
+  size_t token_length = it_.last() - consumed;
+  buffer_.erase(0, consumed);
+  buffer_.append(chunk, length);
+  it_ = Reader(buffer_, 0, token_length);
+  Tokenize_(false);
+}
+
+/*---------------------------------------------------------------------------*/
+// Cycle through each character, switching state as needed and writing to the
+// interpreter when a parsed symbol has been obtained. Unless this is the end
+// of the input, stop short of the end of the buffer so that no handler looks
+// past the characters received so far.
+
+void Tokenizer::Tokenize_(bool is_end_of_input)
+{
+  while (is_end_of_input ? !it_.HasOverflowed() :
+                           it_.last() + lookahead_ < it_.size())
   {
     switch (state_)
     {
@@ -54,21 +109,17 @@ Tokenizer::Tokenizer(const string& input, Parser* interpreter)
 // (i.e in a different pdf object). This needs to be fetched and parsed by the
 // same Parser instance we are using, but we call up a new Tokenizer to read
 // the symbols into the Parser. In theory, these XObjects can be nested so we
-// need to keep track of which XObject we're in using the in_loop_ member.
+// need to keep track of which XObject we're in using the in_loop_ member,
+// which is passed on to the new Tokenizer.
 
 void Tokenizer::HandleXObject_()
 {
   string loop_name = interpreter_->GetOperand();
   if (loop_name != in_loop_)
   {
-    std::string last_loop = in_loop_;
-    in_loop_ = loop_name;
-
-    shared_ptr<string> xobject = interpreter_->GetXObject(in_loop_);
-
-    // Don't try to parse binary objects like images etc
-    if (IsAscii(*xobject)) Tokenizer(*xobject, interpreter_);
-    in_loop_ = last_loop;
+    // Images and other binary objects are never decoded (see Page::GetXObject)
+    shared_ptr<const string> xobject = interpreter_->GetXObject(loop_name);
+    if (xobject) Tokenizer(*xobject, interpreter_, loop_name);
   }
 }
 
@@ -286,19 +337,24 @@ void Tokenizer::EscapeState_()
 
 /*---------------------------------------------------------------------------*/
 // The lexer has reached an inline image, which indicates it should ignore the
-// string until it reaches the keyword "EI" at the end of the image
+// string until it reaches the keyword "EI" at the end of the image. This looks
+// at one character at a time, so that the image data can span several chunks.
 
 void Tokenizer::WaitState_()
 {
-  // Moves through the string until it finds an 'E'
-  while (GetChar() != 'E') Skip_();
-
-  ++it_;
-
-  // If the following character is not an 'I', keeps looking for an 'E'
-  if(GetChar() != 'I') WaitState_();
-
   // After an 'EI' is found we are out of the inline image and ready for the
   // next token
-  NewToken_(NEWSYMBOL);
+  if (GetChar() == 'E')
+  {
+    ++it_;
+    if (GetChar() == 'I')
+    {
+      NewToken_(NEWSYMBOL);
+      return;
+    }
+    --it_;
+  }
+
+  // Otherwise discard this character and keep looking
+  it_.Clear();
 }
@@ -33,7 +33,9 @@
  *
  * Its interface is very simple - create the object by feeding it a string and
  * a pointer to the graphics state. It will tokenize the string and send it
- * to the parser for parsing
+ * to the parser for parsing. Alternatively, the program can be fed to it in
+ * pieces as it is decompressed, so that a page's contents are tokenized
+ * without ever being held in memory as one string.
  *
  * It has a number of private members because it is a fairly complex lexer and
  * is easier to maintain as a collection of functions that pass private members
@@ -54,13 +56,25 @@ class Tokenizer
   // and a fresh Parser object
   Tokenizer(const std::string& input_string, Parser* parser);
 
+  // Constructor that reads a page's content streams chunk by chunk as they
+  // are decompressed
+  Tokenizer(std::shared_ptr<Page> page, Parser* parser);
+
  private:
-  // Enumerates the types of characters that can alter state differently
+  // The handlers for some states look a few characters beyond the current
+  // one. When reading in chunks, this many characters are held back from the
+  // end of each chunk until the next chunk arrives.
+  static const size_t lookahead_ = 16;
 
+  std::string buffer_;                    // Unread part of chunked input
   Reader it_;
   Token::TokenState state_;               // Current Tokenizer state
   Parser* interpreter_;                   // The Parser instructions are sent to
-  static std::string in_loop_;            // Prevents an infinite loop
+  std::string in_loop_;                   // Prevents an infinite loop
+
+  // Constructor for the contents of the XObject named in_loop
+  Tokenizer(const std::string& input_string, Parser* parser,
+            const std::string& in_loop);
 
   // const member functions
   char GetChar()         const {return it_.GetChar();}
@@ -79,6 +93,9 @@ class Tokenizer
   void DictionaryState_();             //
   void WaitState_();         //--------//---------------------------------------
 
+  void Tokenize_(bool);      // Runs the lexer over the available input
+  void Feed_(const char*, size_t); // Appends a chunk to the buffer and lexes
+
   // Frequently used helper functions to update buffer and state
   void PushBuffer_(const Token::TokenState, const Token::TokenState);
   void HandleXObject_();
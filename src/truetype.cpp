@@ -19,7 +19,7 @@
 
 uint8_t TTFont::GetUint8()
 {
-  if (it_ == stream_.end())
+  if (it_ == stream_->end())
     throw std::runtime_error("Insufficient bytes for GetUint8()");
   return (uint8_t) *it_++;
 }
@@ -28,7 +28,7 @@ uint8_t TTFont::GetUint8()
 
 uint16_t TTFont::GetUint16()
 {
-  if (stream_.end() - it_ < 2)
+  if (stream_->end() - it_ < 2)
     throw std::runtime_error("Insufficient bytes for GetUint16()");
   uint16_t res = 0;
   res += 256 * ((uint16_t) (uint8_t) *it_++);
@@ -40,7 +40,7 @@ uint16_t TTFont::GetUint16()
 
 int16_t TTFont::GetInt16()
 {
-  if (stream_.end() - it_ < 2)
+  if (stream_->end() - it_ < 2)
     throw std::runtime_error("Insufficient bytes for GetInt16()");
 
   return (int16_t) GetUint16();
@@ -83,7 +83,7 @@ Date_type TTFont::GetDate()
 
 int32_t TTFont::GetInt32()
 {
-  if (stream_.end() - it_ < 4)
+  if (stream_->end() - it_ < 4)
     throw std::runtime_error("Insufficient bytes for GetInt32()");
   int32_t res = 0;
   res = res | *it_++ << 24;
@@ -97,7 +97,7 @@ int32_t TTFont::GetInt32()
 
 uint32_t TTFont::GetUint32()
 {
-  if (stream_.end() - it_ < 4)
+  if (stream_->end() - it_ < 4)
     throw std::runtime_error("Insufficient bytes for GetUint32()");
   uint32_t res = GetUint16() << 16;
   res += GetUint16();
@@ -512,8 +512,16 @@ void Contour::transform(double a, double b, double c, double d, double e,
 /*---------------------------------------------------------------------------*/
 
 TTFont::TTFont(const std::string& input_stream) :
+  TTFont(std::make_shared<const std::string>(input_stream))
+{}
+
+/*---------------------------------------------------------------------------*/
+// The font file is shared rather than copied, so a font file decoded from a
+// pdf stream isn't held in memory twice
+
+TTFont::TTFont(std::shared_ptr<const std::string> input_stream) :
   stream_(input_stream),
-  it_(stream_.begin())
+  it_(stream_->begin())
 {
   ReadTables();
 
@@ -751,7 +759,7 @@ void TTFont::GoToTable(std::string table_name) {
   if(index == -1)
     throw std::runtime_error("Could not find table \"" + table_name +
                              "\" in font directory.");
-  it_ = stream_.begin() + index;
+  it_ = stream_->begin() + index;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -791,7 +799,7 @@ void TTFont::ReadTables()
     {
       uint32_t sum = 0;
   	  uint32_t nLongs = (this_table.length_ + 3) / 4;
-  	  it_ = stream_.begin() + this_table.offset_;
+  	  it_ = stream_->begin() + this_table.offset_;
   	  while (nLongs-- > 0) sum += GetUint32();
   	  if (sum != this_table.checksum_)
   	  {
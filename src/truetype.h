@@ -324,6 +324,7 @@ class TTFont
 
  public:
   TTFont(const std::string& input_stream);
+  TTFont(std::shared_ptr<const std::string> input_stream);
 
   std::vector<TTFRow>        GetTable() { return this->table_of_tables_;}
   HeadTable                  GetHead()  { return this->head_;}
@@ -391,7 +392,7 @@ class TTFont
 
     // Reading the file:
 
-    std::string stream_;                    // The actual font file being read
+    std::shared_ptr<const std::string> stream_; // The font file being read
     std::string::const_iterator it_;        // Iterator reading the font file
 
     // Font header information:
@@ -21,7 +21,7 @@ using namespace std;
 // value in an unordered map. This can be done arithmetically, but that is
 // probably less efficient and definitely less transparent
 
-static unordered_map<char, uint8_t> s_hexmap =
+static const unordered_map<char, uint8_t> s_hexmap =
 {
   {'0',  0}, {'1',  1}, {'2',  2}, {'3',  3}, {'4',  4}, {'5',  5}, {'6',  6},
   {'7',  7}, {'8',  8}, {'9',  9}, {'a', 10}, {'A', 10}, {'b', 11}, {'B', 11},
@@ -198,6 +198,137 @@ vector<uint8_t> ConvertHexToBytes(const string& hexstring)
   return byte_vector;
 }
 
+/*---------------------------------------------------------------------------*/
+// A backslash in a literal string is followed by one of "nrtbf", by up to
+// three octal digits, or by a line break, which is dropped so that a long
+// string can be split across lines. Before anything else, it just stands for
+// the character after it, as in "\(" and "\\". Unescaped parentheses have to
+// be balanced, so only the one matching the opening parenthesis ends the
+// string. e.g.
+//
+// ReadStringBytes("(A \\(B\\)\\101)") == string("A (B)A");
+// ReadStringBytes("<48 65 6C6C 6F>") == string("Hello");
+
+string ReadStringBytes(const string& pdf_string)
+{
+  size_t start = pdf_string.find_first_not_of(" \t\r\n");
+  if (start == string::npos) return pdf_string;
+
+  if (pdf_string[start] == '<')
+  {
+    size_t end = pdf_string.find('>', start);
+    if (end == string::npos) end = pdf_string.size();
+    auto bytes = ConvertHexToBytes(pdf_string.substr(start + 1,
+                                                     end - start - 1));
+    return string(bytes.begin(), bytes.end());
+  }
+
+  if (pdf_string[start] != '(') return pdf_string;
+
+  string result;
+  int depth = 0;
+  size_t size = pdf_string.size();
+  auto is_octal = [&](size_t i) {return pdf_string[i] >= '0' &&
+                                        pdf_string[i] <= '7';};
+
+  for (size_t i = start + 1; i < size; ++i)
+  {
+    char next = pdf_string[i];
+    if (next == '(') ++depth;
+    else if (next == ')' && depth-- == 0) break;
+    else if (next == '\\' && i + 1 < size)
+    {
+      next = pdf_string[++i];
+      switch (next)
+      {
+        case 'n':  result.push_back('\n'); continue;
+        case 'r':  result.push_back('\r'); continue;
+        case 't':  result.push_back('\t'); continue;
+        case 'b':  result.push_back('\b'); continue;
+        case 'f':  result.push_back('\f'); continue;
+        case '\n': continue;
+        case '\r': if (i + 1 < size && pdf_string[i + 1] == '\n') ++i;
+                   continue;
+        default:   break;
+      }
+      if (is_octal(i))
+      {
+        int value = next - '0';
+        for (int digits = 1; digits < 3 && i + 1 < size && is_octal(i + 1);
+             ++digits)
+        {
+          value = value * 8 + (pdf_string[++i] - '0');
+        }
+        next = (char) value;
+      }
+    }
+    result.push_back(next);
+  }
+  return result;
+}
+
+/*---------------------------------------------------------------------------*/
+// UTF-16 code units from D800 to DBFF start a surrogate pair, which together
+// with the unit after it gives a code point above FFFF. e.g.
+//
+// TextStringToUtf8("\xFE\xFF\x00\x41\x00\xE9") == string("A\xC3\xA9");
+
+string TextStringToUtf8(const string& text_string)
+{
+  string result;
+  auto append = [&](uint32_t point) -> void
+  {
+    if (point < 0x80) result.push_back((char) point);
+    else if (point < 0x800)
+    {
+      result.push_back((char) (0xC0 | (point >> 6)));
+      result.push_back((char) (0x80 | (point & 0x3F)));
+    }
+    else if (point < 0x10000)
+    {
+      result.push_back((char) (0xE0 | (point >> 12)));
+      result.push_back((char) (0x80 | ((point >> 6) & 0x3F)));
+      result.push_back((char) (0x80 | (point & 0x3F)));
+    }
+    else
+    {
+      result.push_back((char) (0xF0 | (point >> 18)));
+      result.push_back((char) (0x80 | ((point >> 12) & 0x3F)));
+      result.push_back((char) (0x80 | ((point >> 6) & 0x3F)));
+      result.push_back((char) (0x80 | (point & 0x3F)));
+    }
+  };
+  auto byte = [&](size_t i) -> uint32_t {return (uint8_t) text_string[i];};
+  size_t size = text_string.size();
+
+  if (size >= 3 && byte(0) == 0xEF && byte(1) == 0xBB && byte(2) == 0xBF)
+  {
+    return text_string.substr(3);
+  }
+
+  if (size < 2 || byte(0) != 0xFE || byte(1) != 0xFF)
+  {
+    for (size_t i = 0; i < size; ++i) append(byte(i));
+    return result;
+  }
+
+  for (size_t i = 2; i + 1 < size; i += 2)
+  {
+    uint32_t unit = (byte(i) << 8) | byte(i + 1);
+    if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < size)
+    {
+      uint32_t low = (byte(i + 2) << 8) | byte(i + 3);
+      if (low >= 0xDC00 && low < 0xE000)
+      {
+        unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+        i += 2;
+      }
+    }
+    append(unit);
+  }
+  return result;
+}
+
 /*---------------------------------------------------------------------------*/
 // Converts an int to the relevant 2-byte ASCII hex string (4 characters long)
 // e.g.
@@ -234,12 +365,17 @@ vector<RawChar> ConvertHexToRawChar(string& hexstring)
   // Note this loop reads 4 chars at a time and stops incrementing at size - 3.
   // It looks up each character in the hexmap and places it in the correct
   // 4-bit section of the 16-bit result using the bit shift operator.
+  // Characters that aren't hex digits count as zero.
+  auto hex = [&](size_t j) -> RawChar
+  {
+    auto found = s_hexmap.find(hexstring[j]);
+    return found == s_hexmap.end() ? 0 : found->second;
+  };
+
   for (size_t i = 0; i < (hexstring.size() - 3); i += 4)
   {
-    raw_vector.emplace_back(((s_hexmap[hexstring[i + 0]] & 0x000f) << 12)  |
-                            ((s_hexmap[hexstring[i + 1]] & 0x000f) <<  8)  |
-                            ((s_hexmap[hexstring[i + 2]] & 0x000f) <<  4)  |
-                            ((s_hexmap[hexstring[i + 3]] & 0x000f) <<  0)  );
+    raw_vector.emplace_back((hex(i + 0) << 12) | (hex(i + 1) << 8) |
+                            (hex(i + 2) <<  4) | (hex(i + 3) << 0));
   }
   return raw_vector;
 }
@@ -359,7 +495,11 @@ vector<int> ParseReferences(const string& ref_string)
 //
 // ParseInts("<</Refs 1 0 R 2 0 R 31 5 R>>") == vector<int> {1, 0, 2, 0, 31, 5};
 
-vector<int> ParseInts(const CharString& int_string)
+// The lexer is a template so that it can also produce the 64-bit integers
+// needed for byte offsets.
+
+template <typename T>
+static vector<T> ParseIntegers(const CharString& int_string)
 {
   // Define the possible states of the lexer
   enum IntState
@@ -370,9 +510,9 @@ vector<int> ParseInts(const CharString& int_string)
     IGNORE  // Ignoring any digits between decimal point and next non-number
   };
 
-  vector<int> result;       // Vector to store results
-  int buffer = 0;            // String buffer to hold chars which may be ints
-  int neg = 1;
+  vector<T> result;         // Vector to store results
+  T buffer = 0;              // String buffer to hold chars which may be ints
+  T neg = 1;
   IntState state = WAITING; // Current state of the finite state machine.
 
   // The main loop cycles through each char in the string to write the result
@@ -419,10 +559,20 @@ vector<int> ParseInts(const CharString& int_string)
   return result;
 }
 
+vector<int> ParseInts(const CharString& int_string)
+{
+  return ParseIntegers<int>(int_string);
+}
+
 vector<int> ParseInts(const string& int_string)
 {
   return ParseInts(CharString(int_string));
 }
+
+vector<int64_t> ParseOffsets(const CharString& int_string)
+{
+  return ParseIntegers<int64_t>(int_string);
+}
 /*--------------------------------------------------------------------------*/
 // This lexer retrieves floats from a string. It searches through the entire
 // given string character by character and returns all instances where the
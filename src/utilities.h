@@ -29,6 +29,7 @@
  */
 
 #include "charstring.h"
+#include "bytesource.h"
 #include<numeric>
 #include<string>
 #include<vector>
@@ -245,12 +246,25 @@ public:
 
   Reader(std::shared_ptr<const std::string> ptr) {*this = Reader(ptr, 0);}
 
+  Reader(const ByteSource& input, size_t start) :
+    start_(input.data()),
+    first_(start),
+    last_(start),
+    size_(input.size()) {}
+
   Reader(const std::string& input) :
     start_(input.c_str()),
     first_(0),
     last_(0),
     size_(input.size()) {}
 
+  // Reads input with the current token already running from first to last
+  Reader(const std::string& input, size_t first, size_t last) :
+    start_(input.c_str()),
+    first_(first),
+    last_(last),
+    size_(input.size()) {}
+
   Reader(const CharString& input) :
     start_(input.begin()),
     first_(0),
@@ -268,8 +282,8 @@ public:
 
   bool StartsString(const std::string& input_string) const
   {
-    std::string test_string(start_ + first_, input_string.size());
     if (input_string.size() > (size_ - last_)) return false;
+    std::string test_string(start_ + first_, input_string.size());
     return input_string == test_string;
   }
 
@@ -342,6 +356,23 @@ bool IsAscii(const std::string& string_to_be_tested);
 
 std::vector<uint8_t> ConvertHexToBytes(const std::string& hex_encoded_string);
 
+//---------------------------------------------------------------------------//
+// Gets the bytes of a pdf string as it is written in a dictionary: a literal
+// string in parentheses with its escapes undone, or a hex string in angle
+// brackets. Anything else is returned unchanged.
+// eg "(A \(B\)\101)" -> "A (B)A"
+
+std::string ReadStringBytes(const std::string& pdf_string);
+
+//---------------------------------------------------------------------------//
+// Converts the bytes of a pdf text string, such as an entry in the document
+// information dictionary, to UTF-8. A text string is UTF-16BE if it starts
+// with the byte order mark FE FF, UTF-8 if it starts with EF BB BF, and
+// PDFDocEncoding otherwise, which is read here as Latin-1 (the two only
+// differ in a few rarely used characters).
+
+std::string TextStringToUtf8(const std::string& text_string);
+
 //---------------------------------------------------------------------------//
 //Converts an int to the relevant 2-byte ASCII hex (4 characters long)
 // eg 161 -> "00A1"
@@ -397,6 +428,12 @@ std::vector<int> ParseInts(const std::string& string_to_be_parsed);
 
 std::vector<int> ParseInts(const CharString& string_to_be_parsed);
 
+//---------------------------------------------------------------------------//
+// As ParseInts, but with 64-bit results, for reading byte offsets in files
+// that may be larger than 2GB
+
+std::vector<int64_t> ParseOffsets(const CharString& string_to_be_parsed);
+
 //---------------------------------------------------------------------------//
 // This lexer retrieves floats from a string. It searches through the entire
 // given string character by character and returns all instances where the
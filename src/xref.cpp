@@ -12,8 +12,12 @@
 #include "utilities.h"
 #include "dictionary.h"
 #include "deflate.h"
+#include "filters.h"
 #include "crypto.h"
 #include "xref.h"
+#include "sidecar.h"
+#include<cstring>
+#include<climits>
 
 //---------------------------------------------------------------------------//
 
@@ -33,35 +37,44 @@ class XRefStream
   friend class XRef;  // This class is only constructible via XRef
 
   XRef&   xref_;         // Pointer to creating XRef
-  vector<uint8_t> byte_stream_;
-  vector<vector<int>> final_array_,  // Transposed, modulo 256 table
-                      result_;       // The main results table for export
-  vector<int> array_widths_,         // Bytes per column from /w entry
+  vector<uint8_t> row_buffer_;       // Decoded bytes not yet read as a row
+  vector<vector<int64_t>> result_;   // The main results table for export
+  vector<int> array_widths_,         // Bytes per field from /W entry
               object_numbers_;       // vector of object numbers inside stream.
-  int         number_of_columns_,    // Number of Columns in table
-              predictor_,            // Specifies decoding algorithm
-              object_start_;         // Byte offset of XRefStream's container
+  size_t      row_width_;            // Bytes per row of the table
+  size_t      object_start_;         // Byte offset of XRefStream's container
   Dictionary  dictionary_;           // Dictionary of object containing stream
 
-  XRefStream(XRef&, int); // Private constructor
-  void ReadStream_();            // Reads the PNG decoding parameters
-  void ProcessStream_();              // Reads the stream into data table
-  void ToColumns_(int, int);  // Transposes table and makes it modulo 256
-  void ExpandBytes_();               // Multiply bytes by correct powers of 256
-  void MergeColumns_();              // Adds adjacent columns as per parameters
+  XRefStream(XRef&, size_t);         // Private constructor
+  void ReadStream_();                // Decodes the stream into the table
+  void ReadRows_(const char*, size_t); // Reads decoded bytes into the table
   void NumberRows_();                // Merges object numbers with data table
-  vector<vector<int>> Table_();      // Getter for final result
+  vector<vector<int64_t>> Table_();  // Getter for final result
 };
 
 /*---------------------------------------------------------------------------*/
-// The XRef constructor. It takes the entire file contents as a string
+// The XRef constructor. It takes the entire file contents as a ByteSource
 // then sequentially runs the steps in creation of an XRef master map
 
-XRef::XRef(shared_ptr<const string> file_string_ptr)
-  : file_string_(file_string_ptr)
+XRef::XRef(shared_ptr<const ByteSource> file)
+  : file_(file),
+    is_repaired_(false),
+    is_first_page_only_(false)
 {
-  LocateXRefs_();             // Find all xrefs
+  // Find all xrefs. If they can't be read, the table is rebuilt instead
+  try
+  {
+    LocateXRefs_();
+  }
+  catch (runtime_error&)
+  {
+    xref_table_.clear();
+  }
+
+  if (!IsValidTable_()) Repair_(); // Rebuild a damaged table
+  FindObjectLimits_();        // Find where each object's end can be
   CreateCrypto_();            // Get file key, needed for decryption of streams
+  if (is_repaired_) ReadObjectStreams_();
 }
 
 /*---------------------------------------------------------------------------*/
@@ -79,45 +92,69 @@ XRef::XRef(shared_ptr<const string> file_string_ptr)
 void XRef::LocateXRefs_()
 {
   // Get last 50 chars of the file
-  CharString file_tail(*file_string_, file_string_->size() - 50);
+  size_t tail_size = min(file_->size(), (size_t) 50);
+  CharString file_tail(file_->data(), file_->size() - tail_size, file_->size());
   auto xref_charstring = file_tail.CarveOut("startxref", "%%EOF");
 
-  // Convert the number string to an int
-  vector<int> xref_locations {atoi(xref_charstring.begin())};
+  // Convert the number string to a (64-bit) offset
+  vector<int64_t> xref_locations = ParseOffsets(xref_charstring);
+  if (xref_locations.size() > 1) xref_locations.resize(1);
 
   // If no XRef location is found, then we're stuck. Throw an error.
-  if (xref_locations.empty()) throw runtime_error("No XRef entry found");
+  if (xref_locations.empty() || xref_locations[0] <= 0 ||
+      (size_t) xref_locations[0] >= file_->size())
+  {
+    throw runtime_error("No XRef entry found");
+  }
 
   // The first dictionary found after any XRef offset is always a trailer
   // dictionary, though sometimes it doubles as an XRefStream dictionary.
   // We make this first one found the canonical trailer dictionary
-  trailer_dictionary_ = Dictionary(file_string_, xref_locations[0]);
+  trailer_dictionary_ = ReadTrailer_(xref_locations[0]);
   // Now we follow the pointers to all xrefs sequentially.
   Dictionary temp_dictionary = trailer_dictionary_;
   while (temp_dictionary.ContainsInts("/Prev"))
   {
-    xref_locations.emplace_back(temp_dictionary.GetInts("/Prev")[0]);
-    temp_dictionary = Dictionary(file_string_, xref_locations.back());
+    xref_locations.emplace_back(ParseOffsets(temp_dictionary["/Prev"])[0]);
+    temp_dictionary = ReadTrailer_(xref_locations.back());
   }
 
   // Get a string from each XRef location or throw exception
   for (auto& start : xref_locations) ReadXRefStrings_(start);
 }
 
+/*---------------------------------------------------------------------------*/
+// Reads the dictionary following an XRef location. A plain XRef table can be
+// longer than the dictionary reader will look ahead, so its trailer is read
+// from the "trailer" keyword after the table.
+
+Dictionary XRef::ReadTrailer_(size_t location) const
+{
+  if (file_->substr(location, 4) == "xref")
+  {
+    size_t trailer = file_->find("trailer", location);
+    if (trailer != string::npos) location = trailer;
+  }
+  return Dictionary(*file_, location);
+}
+
 /*---------------------------------------------------------------------------*/
 // Whatever form the xrefs take (plain or XRefStream), we first get their
 // raw contents as strings from the XRef locations
 
-void XRef::ReadXRefStrings_(int start)
+void XRef::ReadXRefStrings_(size_t start)
 {
   // Find the length of XRef in chars
-  int end = file_string_->find("startxref", start);
+  size_t end = file_->find("startxref", start);
 
   // Throw error if no XRef found
-  if (end <= 0) throw runtime_error("No object found at location");
+  if (end == string::npos || end == 0)
+  {
+    throw runtime_error("No object found at location");
+  }
 
   // Extract the XRef string
-  CharString fullxref(file_string_->c_str(), start, end);
+  CharString fullxref(file_->data(), start, end);
 
   // Carve out the actual string
   CharString xref_string = fullxref.CarveOut("xref", "trailer");
@@ -130,10 +167,10 @@ void XRef::ReadXRefStrings_(int start)
 
 /*---------------------------------------------------------------------------*/
 // Takes an XRef location and if it is a stream, creates an XRefStream object.
-// The output of this object is a "table" (vec<vec<int>>) which is parsed
+// The output of this object is a "table" (vec<vec<int64_t>>) which is parsed
 // and added to the main combined XRef table
 
-void XRef::ReadXRefFromStream_(int location)
+void XRef::ReadXRefFromStream_(size_t location)
 {
   // Calls XRefStream constructor to make the data table from the stream
   auto&& xref_table = XRefStream(*this, location).Table_();
@@ -141,13 +178,13 @@ void XRef::ReadXRefFromStream_(int location)
   // Throws if XRefStream returns an empty table
   if (xref_table.empty()) throw runtime_error("XRef table empty");
 
-  // Fill the XRef data map from the table -------------------//
+  // Fill the XRef data table from the table -----------------//
   for (size_t j = 0; j < xref_table[0].size(); j++)
   {
-    int& object_number = xref_table[3][j], position = xref_table[1][j];
-    xref_table_[object_number] = XRefRow {position, 0, position};
-    if (xref_table[0][j] != 2) xref_table_[object_number].in_object = 0;
-    else xref_table_[object_number].startbyte = 0;
+    int object_number = (int) xref_table[3][j];
+    int64_t position = xref_table[1][j];
+    if (xref_table[0][j] != 2) StoreRow_(object_number, {position, 0, 0});
+    else StoreRow_(object_number, {0, 0, (int) position});
   }
 }
 
@@ -162,7 +199,7 @@ void XRef::ReadXRefFromStream_(int location)
 
 void XRef::ReadXRefFromString_(const CharString& xref_string)
 {
-  auto all_ints = ParseInts(xref_string);
+  auto all_ints = ParseOffsets(xref_string);
 
   // A valid XRef has >= 4 ints in it and must have an even number of ints
   auto xref_size = all_ints.size();
@@ -170,13 +207,14 @@ void XRef::ReadXRefFromString_(const CharString& xref_string)
 
   // This loop starts on the second row of the table. Even numbers are the
   // byte offsets and odd numbers are the in_use numbers
-  for (int bytestore = 0, i = 2; i < (int) all_ints.size(); ++i)
+  int64_t bytestore = 0;
+  for (int i = 2; i < (int) all_ints.size(); ++i)
   {
     // If an odd number index and the integer is in use, store to map
     if (i % 2 && all_ints[i] < 0xffff)
     {
       // Numbers each row by counting pairs of numbers past initial object
-      xref_table_[all_ints[0] + (i / 2) - 1] = XRefRow {bytestore, 0, 0};
+      StoreRow_((int) all_ints[0] + (i / 2) - 1, XRefRow {bytestore, 0, 0});
     }
 
     // If odd-numbered index, the number gives the byte offset of the object
@@ -184,17 +222,505 @@ void XRef::ReadXRefFromString_(const CharString& xref_string)
   }
 }
 
+/*---------------------------------------------------------------------------*/
+// Stores a row in the table, making the table bigger if needed. Each object
+// takes up at least one byte of the file, so an object number larger than the
+// file can only come from a corrupt XRef and is ignored rather than making a
+// huge table.
+
+void XRef::StoreRow_(int object_number, const XRefRow& row)
+{
+  // An object can't be held in its own object stream
+  if (object_number < 0 || (size_t) object_number > file_->size() ||
+      (row.in_object && row.in_object == object_number))
+  {
+    return;
+  }
+
+  if ((size_t) object_number >= xref_table_.size())
+  {
+    xref_table_.resize(object_number + 1, XRefRow {-1, 0, 0});
+  }
+
+  xref_table_[object_number] = row;
+}
+
+/*---------------------------------------------------------------------------*/
+
+bool XRef::HasRow_(int object_number) const
+{
+  return object_number >= 0 && (size_t) object_number < xref_table_.size() &&
+         xref_table_[object_number].startbyte != -1;
+}
+
 const XRefRow& XRef::GetRow_(int object_number) const
 {
-  auto found = xref_table_.find(object_number);
-  if (found == xref_table_.end()) throw runtime_error("Object does not exist");
-  return found->second;
+  if (!HasRow_(object_number)) throw runtime_error("Object does not exist");
+  return xref_table_[object_number];
+}
+
+/*---------------------------------------------------------------------------*/
+// Finds where the next object starts for each object not held in an object
+// stream, by sorting the objects by starting offset. This only needs the
+// table, so the objects themselves are not read.
+
+void XRef::FindObjectLimits_()
+{
+  vector<pair<int64_t, int>> starts; // start byte, object number
+  for (size_t i = 0; i < xref_table_.size(); ++i)
+  {
+    const XRefRow& row = xref_table_[i];
+    if (row.startbyte != -1 && row.in_object == 0)
+    {
+      starts.emplace_back(row.startbyte, i);
+    }
+  }
+  sort(starts.begin(), starts.end());
+
+  for (size_t i = 0, next = 0; i < starts.size(); ++i)
+  {
+    int64_t start = starts[i].first;
+    while (next < starts.size() && starts[next].first <= start) ++next;
+    int64_t limit = next < starts.size() ? starts[next].first : -1;
+    xref_table_[starts[i].second].limit = limit;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// Characters that end a number or keyword in pdf
+
+static bool IsWhitespace(char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' ||
+         c == '\f' || c == '\0';
+}
+
+static bool IsDelimiter(char c)
+{
+  return IsWhitespace(c) || c == '<' || c == '>' || c == '[' || c == ']' ||
+         c == '(' || c == ')' || c == '/' || c == '%' || c == '{' || c == '}';
+}
+
+static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+/*---------------------------------------------------------------------------*/
+// Checks that an object's "n g obj" header is at the given offset. Leading
+// whitespace and a comment line are allowed, as the Object class skips them.
+
+static bool IsObjectHeader(const ByteSource& file, size_t position,
+                           int number)
+{
+  size_t size = file.size();
+  while (position < size && IsWhitespace(file[position])) ++position;
+  if (position < size && file[position] == '%')
+  {
+    position = file.find('\n', position);
+    if (position == string::npos) return false;
+    while (position < size && IsWhitespace(file[position])) ++position;
+  }
+
+  long long found_number = 0;
+  size_t digits = 0;
+  while (position < size && IsDigit(file[position]) && digits++ < 10)
+  {
+    found_number = 10 * found_number + file[position++] - '0';
+  }
+  if (digits == 0 || found_number != number) return false;
+
+  // The generation number, then "obj"
+  size_t gap = 0;
+  while (position < size && IsWhitespace(file[position])) ++position, ++gap;
+  if (gap == 0 || position >= size || !IsDigit(file[position])) return false;
+  while (position < size && IsDigit(file[position])) ++position;
+  while (position < size && IsWhitespace(file[position])) ++position;
+  return file.substr(position, 3) == "obj";
+}
+
+/*---------------------------------------------------------------------------*/
+// Given the position of an "obj" keyword, reads back over the generation and
+// object numbers before it. Returns the offset of the object number and sets
+// object_number, or returns npos if the keyword is not an object header.
+
+static size_t ReadHeaderBackwards(const ByteSource& file, size_t position,
+                                  int& object_number)
+{
+  // The keyword must stand alone, so "endobj" and "objects" don't count
+  if (position + 3 < file.size() && !IsDelimiter(file[position + 3]))
+  {
+    return string::npos;
+  }
+
+  size_t start = position;
+  while (start > 0 && IsWhitespace(file[start - 1])) --start;
+  size_t generation_end = start;
+  while (start > 0 && IsDigit(file[start - 1])) --start;
+  if (start == generation_end || start == 0) return string::npos;
+
+  size_t gap_end = start;
+  while (start > 0 && IsWhitespace(file[start - 1])) --start;
+  if (start == gap_end) return string::npos;
+
+  size_t number_end = start;
+  while (start > 0 && IsDigit(file[start - 1]) && number_end - start < 10)
+  {
+    --start;
+  }
+  if (start == number_end) return string::npos;
+  if (start > 0 && !IsDelimiter(file[start - 1])) return string::npos;
+
+  long long number = atoll(file.data() + start);
+  if (number > INT_MAX) return string::npos;
+  object_number = (int) number;
+  return start;
+}
+
+/*---------------------------------------------------------------------------*/
+// The linearization dictionary belongs to the first object in the file, which
+// has to start within the first 1024 bytes. Its /L entry is the length of the
+// file when it was linearized: an incremental update since then appends to
+// the file, and its objects are only listed in the XRefs at the end.
+//
+// The first-page XRef section comes straight after the linearization object,
+// as either a plain table with its own trailer or an XRef stream whose
+// dictionary serves as the trailer. Its /Prev entry points to the main XRef,
+// which is not followed. The section is only used if it reads cleanly, lists
+// the first page and passes the same checks as a full table; otherwise the
+// caller reads the whole XRef as normal.
+
+shared_ptr<const XRef> XRef::FromFirstPage(shared_ptr<const ByteSource> file)
+{
+  size_t header = file->find("obj", 0, 1024);
+  if (header == string::npos) return nullptr;
+  Dictionary linearization(*file, header);
+  if (!linearization.HasKey("/Linearized")) return nullptr;
+
+  vector<int64_t> length = ParseOffsets(linearization["/L"]);
+  if (length.empty() || (size_t) length[0] != file->size()) return nullptr;
+  if (!linearization.ContainsInts("/O") || !linearization.ContainsInts("/N"))
+  {
+    return nullptr;
+  }
+
+  size_t start = file->find("endobj", header, 1024);
+  if (start == string::npos) return nullptr;
+  start += 6;
+  while (start < file->size() && IsWhitespace((*file)[start])) ++start;
+
+  auto xref = make_shared<XRef>();
+  xref->file_ = file;
+  xref->is_first_page_only_ = true;
+  xref->linearization_ = linearization;
+  try
+  {
+    xref->trailer_dictionary_ = xref->ReadTrailer_(start);
+    xref->ReadXRefStrings_(start);
+    if (!xref->IsValidTable_()) return nullptr;
+    if (!xref->HasRow_(linearization.GetInts("/O")[0])) return nullptr;
+    xref->FindObjectLimits_();
+    xref->CreateCrypto_();
+  }
+  catch (runtime_error&)
+  {
+    return nullptr;
+  }
+  return xref;
+}
+
+/*---------------------------------------------------------------------------*/
+// A saved table is only read back for the same file it was made from (see
+// sidecar.h), but its entries are still checked to be within the file, so a
+// sidecar that is somehow wrong can't send us reading outside it. Only the
+// decryption key has to be worked out again, as it is never saved.
+
+XRef::XRef(shared_ptr<const ByteSource> file, SidecarReader& sidecar)
+  : file_(file),
+    is_repaired_(false),
+    is_first_page_only_(false)
+{
+  is_repaired_ = sidecar.GetInt() != 0;
+  int64_t file_size = (int64_t) file_->size();
+  xref_table_.resize(sidecar.GetCount(24));
+  for (auto& row : xref_table_)
+  {
+    row.startbyte = sidecar.GetInt();
+    row.limit     = sidecar.GetInt();
+    int64_t in_object = sidecar.GetInt();
+    if (row.startbyte < -1 || row.startbyte > file_size ||
+        row.limit < -1 || row.limit > file_size ||
+        in_object < 0 || in_object >= (int64_t) xref_table_.size())
+    {
+      throw runtime_error("Sidecar is damaged");
+    }
+    row.in_object = (int) in_object;
+  }
+
+  unordered_map<string, string> trailer;
+  for (size_t i = sidecar.GetCount(16); i > 0; --i)
+  {
+    string key = sidecar.GetString();
+    trailer[key] = sidecar.GetString();
+  }
+  trailer_dictionary_ = Dictionary(move(trailer));
+
+  recovered_objects_.resize(sidecar.GetCount(8));
+  for (auto& object : recovered_objects_) object = (int) sidecar.GetInt();
+
+  CreateCrypto_();
+}
+
+/*---------------------------------------------------------------------------*/
+
+void XRef::Save(SidecarWriter& sidecar) const
+{
+  sidecar.PutInt(is_repaired_);
+  sidecar.PutInt(xref_table_.size());
+  for (const auto& row : xref_table_)
+  {
+    sidecar.PutInt(row.startbyte);
+    sidecar.PutInt(row.limit);
+    sidecar.PutInt(row.in_object);
+  }
+
+  sidecar.PutInt(distance(trailer_dictionary_.begin(),
+                          trailer_dictionary_.end()));
+  for (const auto& entry : trailer_dictionary_)
+  {
+    sidecar.PutString(entry.first);
+    sidecar.PutString(entry.second);
+  }
+
+  sidecar.PutInt(recovered_objects_.size());
+  for (int object : recovered_objects_) sidecar.PutInt(object);
+}
+
+/*---------------------------------------------------------------------------*/
+// The XRef is taken to be damaged if it has no entries or no /Root, or if
+// an object it places in the file doesn't start with its header there.
+// Object 0 and free entries, which have an offset of 0, are not checked.
+//
+// Checking every object would mean reading a page of the file for each one,
+// which for a large mapped file is most of the cost of opening it. Damage
+// nearly always moves every object (junk before the header, or a file edited
+// without updating its XRef), so only an evenly spaced sample of at most
+// 64 objects, including the last, is checked.
+
+bool XRef::IsValidTable_() const
+{
+  if (xref_table_.empty() || !trailer_dictionary_.HasKey("/Root"))
+  {
+    return false;
+  }
+
+  vector<int> in_file;
+  for (size_t i = 1; i < xref_table_.size(); ++i)
+  {
+    const XRefRow& row = xref_table_[i];
+    if (row.startbyte > 0 && !row.in_object) in_file.push_back(i);
+  }
+  if (in_file.empty()) return true;
+
+  size_t step = max((size_t) 1, in_file.size() / 64);
+  for (size_t i = 0; i < in_file.size(); i += step)
+  {
+    int number = in_file[i];
+    if (!IsObjectHeader(*file_, xref_table_[number].startbyte, number))
+    {
+      return false;
+    }
+  }
+  int last = in_file.back();
+  return IsObjectHeader(*file_, xref_table_[last].startbyte, last);
+}
+
+/*---------------------------------------------------------------------------*/
+// Rebuilds the table by scanning the file for "obj" keywords and reading the
+// object headers before them. Where an object appears more than once, as
+// happens with incremental updates, the last one in the file is the current
+// version. Entries from the original XRef that pointed at the right place (or
+// into an object stream) are kept and the rest dropped; everything else found
+// is recovered.
+
+void XRef::Repair_()
+{
+  is_repaired_ = true;
+  const ByteSource& file = *file_;
+  vector<XRefRow> original_table;
+  original_table.swap(xref_table_);
+
+  // All object headers in file order, as start offset and object number
+  vector<pair<size_t, int>> headers;
+  for (size_t position = file.find("obj", 0);
+       position != string::npos;
+       position = file.find("obj", position + 3))
+  {
+    int object_number = 0;
+    size_t start = ReadHeaderBackwards(file, position, object_number);
+    if (start == string::npos) continue;
+    headers.emplace_back(start, object_number);
+    StoreRow_(object_number, XRefRow {(int64_t) start, 0, 0});
+  }
+
+  vector<bool> is_scanned(xref_table_.size());
+  for (size_t i = 0; i < xref_table_.size(); ++i)
+  {
+    is_scanned[i] = xref_table_[i].startbyte != -1;
+  }
+
+  // Keep the original entries that were right. An entry for an object in an
+  // object stream is right if the holding object is an object stream.
+  unordered_map<int, bool> is_object_stream;
+  auto check_holder = [&](int holder) -> bool
+  {
+    auto found = is_object_stream.find(holder);
+    if (found != is_object_stream.end()) return found->second;
+    bool result = HasRow_(holder) && !xref_table_[holder].in_object &&
+                  Dictionary(*file_, xref_table_[holder].startbyte)
+                    ["/Type"] == "/ObjStm";
+    is_object_stream[holder] = result;
+    return result;
+  };
+
+  for (size_t i = 0; i < original_table.size(); ++i)
+  {
+    const XRefRow& row = original_table[i];
+    if (row.startbyte == -1) continue;
+    bool is_correct = row.in_object ? check_holder(row.in_object) :
+                      (row.startbyte > 0 &&
+                       IsObjectHeader(file, row.startbyte, i));
+    if (!is_correct) continue;
+    StoreRow_(i, row);
+    if (i < is_scanned.size()) is_scanned[i] = false;
+  }
+
+  for (size_t i = 0; i < is_scanned.size(); ++i)
+  {
+    if (is_scanned[i]) recovered_objects_.push_back(i);
+  }
+
+  FindRepairTrailer_(headers);
+
+  // Object streams are read once the decryption key is known
+  for (size_t position = file.find("/ObjStm", 0);
+       position != string::npos;
+       position = file.find("/ObjStm", position + 7))
+  {
+    auto holder = upper_bound(headers.begin(), headers.end(),
+                              make_pair(position, INT_MAX));
+    if (holder == headers.begin()) continue;
+    object_streams_.push_back((--holder)->second);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// A repaired file still needs a trailer dictionary. If the one found at the
+// startxref offset (if any) has no /Root, the last trailer in the file that
+// does is used, or failing that the last XRef stream dictionary with a /Root.
+// If the trailer itself is damaged, a new one is made pointing to the last
+// /Catalog in the file. If there is no catalog either, the document can't be
+// read, but its objects still can.
+
+void XRef::FindRepairTrailer_(const vector<pair<size_t, int>>& headers)
+{
+  if (trailer_dictionary_.HasKey("/Root")) return;
+  const ByteSource& file = *file_;
+
+  // Finds the dictionary of the object holding the given offset
+  auto holding_dictionary = [&](size_t position) -> Dictionary
+  {
+    auto holder = upper_bound(headers.begin(), headers.end(),
+                              make_pair(position, INT_MAX));
+    if (holder == headers.begin()) return Dictionary();
+    return Dictionary(*file_, (--holder)->first);
+  };
+
+  for (size_t position = file.find("trailer", 0);
+       position != string::npos;
+       position = file.find("trailer", position + 7))
+  {
+    Dictionary dictionary(*file_, position);
+    if (dictionary.HasKey("/Root")) trailer_dictionary_ = move(dictionary);
+  }
+  if (trailer_dictionary_.HasKey("/Root")) return;
+
+  for (size_t position = file.find("/XRef", 0);
+       position != string::npos;
+       position = file.find("/XRef", position + 5))
+  {
+    Dictionary dictionary = holding_dictionary(position);
+    if (dictionary["/Type"] == "/XRef" && dictionary.HasKey("/Root"))
+    {
+      trailer_dictionary_ = move(dictionary);
+    }
+  }
+  if (trailer_dictionary_.HasKey("/Root")) return;
+
+  for (size_t position = file.find("/Catalog", 0);
+       position != string::npos;
+       position = file.find("/Catalog", position + 8))
+  {
+    auto holder = upper_bound(headers.begin(), headers.end(),
+                              make_pair(position, INT_MAX));
+    if (holder == headers.begin()) continue;
+    if (holding_dictionary(position)["/Type"] != "/Catalog") continue;
+    string root = to_string((--holder)->second) + " 0 R";
+    trailer_dictionary_ = Dictionary({{"/Root", root}});
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+// The objects held in the object streams found during a repair are added to
+// the table, unless they were also found directly in the file. A damaged
+// object stream is skipped.
+
+void XRef::ReadObjectStreams_()
+{
+  for (int holder : object_streams_)
+  {
+    try
+    {
+      size_t start = GetObjectStartByte(holder);
+      Dictionary dictionary(*file_, start);
+      if (dictionary["/Type"] != "/ObjStm") continue;
+      if (!dictionary.ContainsInts("/First")) continue;
+
+      string stream = GetStreamLocation(start).AsString();
+      if (encryption_ && dictionary["/Filter"].find("/Crypt") == string::npos)
+      {
+        Decrypt(stream, holder, 0);
+      }
+      stream = DecodeStream(CharString(stream), dictionary);
+
+      // The stream starts with pairs of object numbers and offsets
+      size_t first = min((size_t) dictionary.GetInts("/First")[0],
+                         stream.size());
+      vector<int> numbers = ParseInts(CharString(stream.c_str(), first));
+      for (size_t i = 0; i + 1 < numbers.size(); i += 2)
+      {
+        if (HasRow_(numbers[i])) continue;
+        StoreRow_(numbers[i], XRefRow {0, 0, holder});
+        if (HasRow_(numbers[i])) recovered_objects_.push_back(numbers[i]);
+      }
+    }
+    catch (runtime_error&) {}
+  }
+
+  object_streams_.clear();
+  sort(recovered_objects_.begin(), recovered_objects_.end());
 }
 
+/*---------------------------------------------------------------------------*/
+// Whether an object was found by rebuilding the table rather than read from
+// the file's XRef
+
+bool XRef::IsRecovered(int object_number) const
+{
+  return binary_search(recovered_objects_.begin(), recovered_objects_.end(),
+                       object_number);
+}
 
 /*---------------------------------------------------------------------------*/
-// Returns the end byte of an object by finding the first example of the
-// word "endobj" after the start of the object
+// Returns the end byte of an object, which is the position of the word
+// "endobj" after the start of the object
 
 size_t XRef::GetObjectEndByte(int object_number) const
 {
@@ -203,52 +729,95 @@ size_t XRef::GetObjectEndByte(int object_number) const
   // If the object is in an object stream, return 0;
   if (row.in_object) return 0;
 
-  // else find the first match of "endobj" and return
-  return file_string_->find("endobj", row.startbyte);
+  // Search up to the next object first. If "endobj" isn't found, return npos
+  size_t start = row.startbyte;
+  size_t limit = row.limit == -1 ? string::npos : (size_t) row.limit;
+  size_t end = file_->find("endobj", start, limit);
+  if (end == string::npos) end = file_->find("endobj", start);
+  return end;
 }
 
-
 /*---------------------------------------------------------------------------*/
-// Returns vector of all objects listed in the xrefs
+// Returns vector of all objects listed in the xrefs, in ascending order
 
 vector<int> XRef::GetAllObjectNumbers() const
 {
-  return GetKeys(this->xref_table_);
+  vector<int> result;
+  for (size_t i = 0; i < xref_table_.size(); ++i)
+  {
+    if (xref_table_[i].startbyte != -1) result.push_back(i);
+  }
+  return result;
 }
 
 /*---------------------------------------------------------------------------*/
+// Returns the numbers of the object streams that hold other objects, in
+// ascending order, by collecting the holding object of every row
 
-int XRef::GetStreamLength_(const Dictionary& dictionary) const
+vector<int> XRef::GetObjectStreamNumbers() const
+{
+  vector<int> result;
+  for (const auto& row : xref_table_)
+  {
+    if (row.in_object && HasRow_(row.in_object))
+    {
+      result.push_back(row.in_object);
+    }
+  }
+  sort(result.begin(), result.end());
+  result.erase(unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+/*---------------------------------------------------------------------------*/
+// Stream lengths are usually direct ints, but may be references to another
+// object containing the length. Each such object is only read once.
+
+size_t XRef::GetStreamLength_(const Dictionary& dictionary) const
 {
   if (dictionary.ContainsReferences("/Length"))
   {
     int length_object_number = dictionary.GetReference("/Length");
-    size_t first_position = GetObjectStartByte(length_object_number);
-    size_t len = file_string_->find("endobj", first_position) - first_position;
-    CharString object_string(file_string_->c_str() + first_position, len);
-    return ParseInts(object_string).back();
+    lock_guard<mutex> lock(stream_lengths_mutex_);
+    auto found = stream_lengths_.find(length_object_number);
+    if (found != stream_lengths_.end()) return found->second;
+
+    const XRefRow& row = GetRow_(length_object_number);
+    size_t first_position = row.startbyte;
+    size_t end = row.in_object ? file_->find("endobj", first_position)
+                               : GetObjectEndByte(length_object_number);
+    CharString object_string(file_->data() + first_position,
+                             end - first_position);
+    vector<int64_t> lengths = ParseOffsets(object_string);
+    size_t length = lengths.empty() ? 0 : (size_t) max(lengths.back(),
+                                                       (int64_t) 0);
+    stream_lengths_[length_object_number] = length;
+    return length;
   }
 
   // Thankfully though most lengths are just direct ints
-  else return dictionary.GetInts("/Length")[0];
+  vector<int64_t> lengths = ParseOffsets(dictionary["/Length"]);
+  return lengths.empty() ? 0 : (size_t) max(lengths[0], (int64_t) 0);
 }
 
 /*---------------------------------------------------------------------------*/
 // Returns the offset of the start location relative to the file start, and the
-// length, of the stream belonging to the given object
+// length, of the stream belonging to the given object. A /Length that runs
+// past the end of the file is cut short there.
 
-CharString XRef::GetStreamLocation(int object_start) const
+CharString XRef::GetStreamLocation(size_t object_start) const
 {
   // Get the object dictionary
-  Dictionary dictionary = Dictionary(file_string_, object_start);
+  Dictionary dictionary = Dictionary(*file_, object_start);
 
   // If the stream exists, get its start / stop positions as a CharString
   if (dictionary.HasKey("stream") && dictionary.HasKey("/Length"))
   {
-    size_t stream_length = (size_t) GetStreamLength_(dictionary);
-    size_t stream_start  = (size_t) dictionary.GetInts("stream")[0];
-    stream_length += stream_start;
-    return CharString(file_string_->c_str(), stream_start, stream_length);
+    size_t stream_start = (size_t) ParseOffsets(dictionary["stream"])[0];
+    size_t stream_end   = stream_start + GetStreamLength_(dictionary);
+    stream_start = min(stream_start, file_->size());
+    stream_end   = max(stream_start, min(stream_end, file_->size()));
+    return CharString(file_->data(), stream_start, stream_end);
   }
   return CharString(); // if no length, return empty length-2 array
 }
@@ -261,6 +830,27 @@ string XRef::Decrypt(const CharString& str, int obj, int gen)const
   return encryption_->DecryptStream(str, obj, gen);
 }
 
+size_t XRef::Decrypt(const CharString& str, uint8_t* output,
+                     int obj, int gen) const
+{
+  return encryption_->Decrypt(str, output, obj, gen);
+}
+
+void XRef::Decrypt(string& stream, int obj, int gen) const
+{
+  encryption_->Decrypt(stream, obj, gen);
+}
+
+void XRef::DecryptString(string& text, int obj, int gen) const
+{
+  encryption_->DecryptString(text, obj, gen);
+}
+
+bool XRef::EncryptsMetadata() const
+{
+  return !encryption_ || encryption_->EncryptsMetadata();
+}
+
 /*---------------------------------------------------------------------------*/
 // getter function to access the trailer dictionary - a private data member
 
@@ -278,40 +868,45 @@ void XRef::CreateCrypto_()
    // if there's no encryption dictionary, there's nothing else to do
   if (!trailer_dictionary_.HasKey("/Encrypt")) return;
 
+  // The encryption dictionary is occasionally written directly in the trailer
+  if (trailer_dictionary_.ContainsDictionary("/Encrypt"))
+  {
+    Dictionary dictionary = trailer_dictionary_.GetDictionary("/Encrypt");
+    encryption_ = make_shared<Crypto>(dictionary, trailer_dictionary_);
+    return;
+  }
+
   int encryption_number = trailer_dictionary_.GetReference("/Encrypt");
 
   // No encryption dict - exception?
-  if (xref_table_.find(encryption_number) == xref_table_.end()) return;
+  if (!HasRow_(encryption_number)) return;
 
   // mark file as encrypted and read the encryption dictionary
   size_t starts_at = GetObjectStartByte(encryption_number);
-  Dictionary&& dictionary = Dictionary(file_string_, starts_at);
+  Dictionary&& dictionary = Dictionary(*file_, starts_at);
   encryption_ = make_shared<Crypto>(move(dictionary), trailer_dictionary_);
 }
 
 /*---------------------------------------------------------------------------*/
 // simple getter for the output of an XRefStream
 
-vector<vector<int>> XRefStream::Table_()
+vector<vector<int64_t>> XRefStream::Table_()
 {
   return result_;
 }
 
 /*---------------------------------------------------------------------------*/
 // XRefStream constructor. Note that encryption does not apply to XRefStreams.
-// The constructor calls several functions which together comprise the
-// PNG decompression algorithm. They are seperated out to prevent one large
-// hairball function being created that is difficult to debug.
 
-XRefStream::XRefStream(XRef& xref, int starts_at)
+XRefStream::XRefStream(XRef& xref, size_t starts_at)
   : xref_(xref),
-    number_of_columns_(0),
-    predictor_(0),
+    result_(3),
+    row_width_(0),
     object_start_(starts_at),
-    dictionary_(Dictionary(xref_.File(), object_start_))
+    dictionary_(Dictionary(*xref_.File(), object_start_))
 {
-  ReadStream_();    // Reads the PNG decoding parameters
-  ProcessStream_(); // Arranges the raw data in stream into correct table form
+  ReadStream_();    // Decodes the stream into the table
+  NumberRows_();    // Adds the object numbers to the table
 }
 
 /*---------------------------------------------------------------------------*/
@@ -330,9 +925,11 @@ XRefStream::XRefStream(XRef& xref, int starts_at)
 // The expanded sequence is stored as a private data member of type integer
 // vector: objectNumbers
 //
-// We next read two parameters we need from the /DecodeParms entry of the
-// stream dictionary: the number of columns in the table and the predictor
-// number, which gives the method used to decode the stream
+// The table itself is a series of rows, each made of up to three fields whose
+// widths in bytes are given by the /W entry. The stream is nearly always
+// compressed with its rows passed through the PNG "Up" predictor, which is
+// undone by the filter chain as for any other stream, so the decoded rows can
+// be read straight into the table as they arrive.
 
 void XRefStream::ReadStream_()
 {
@@ -353,133 +950,62 @@ void XRefStream::ReadStream_()
     }
   }
 
-  Dictionary sub_dictionary(dictionary_.GetDictionary("/DecodeParms"));
-  number_of_columns_ = sub_dictionary.GetInts("/Columns").at(0);
-  predictor_ = sub_dictionary.GetInts("/Predictor").at(0);
-
-  // Read the /W entry to get the width in bytes of each column in the table
-  // check the widths for any zero values and skip them if present
-  for (auto i : dictionary_.GetInts("/W")) if (i) array_widths_.push_back(i);
-  if(array_widths_.empty()) throw runtime_error("Invalid /W entry in XRefStrm");
-
-  // if no record of column numbers, infer from number of /W entries
-  if (number_of_columns_ == 0) number_of_columns_ = array_widths_.size();
-
-  // Predictors above 10 require an extra column
-  if (predictor_ > 9) ++number_of_columns_;
+  // Read the /W entry to get the width in bytes of each field in the table
+  array_widths_ = dictionary_.GetInts("/W");
+  if (array_widths_.size() > 3) array_widths_.resize(3);
+  for (auto width : array_widths_)
+  {
+    if (width < 0) throw runtime_error("Invalid /W entry in XRefStrm");
+    row_width_ += width;
+  }
+  if (row_width_ == 0) throw runtime_error("Invalid /W entry in XRefStrm");
+  array_widths_.resize(3, 0);
 
-  // Obtain the raw stream data
+  // Decode the stream, reading each row into the table as it arrives
   auto charstream = xref_.GetStreamLocation(object_start_);
-
-  // Applies decompression to stream if needed
-  string&& s = dictionary_["/Filter"].find("/FlateDecode", 0) != string::npos?
-               FlateDecode(charstream) : charstream.AsString();
-
-  byte_stream_ = vector<uint8_t>(s.begin(), s.end());
-}
-
-/*---------------------------------------------------------------------------*/
-// Get the raw data from the stream and arrange it in a table as directed by
-// the /W ("widths") entry in the main dictionary
-
-void XRefStream::ProcessStream_()
-{
-  // Gets number of rows
-  int number_of_rows = byte_stream_.size() / number_of_columns_;
+  DecodeStream(charstream, dictionary_,
+               [&](const char* chunk, size_t length) -> void
+               {
+                 ReadRows_(chunk, length);
+               });
 
   // Ensures rectangular table
-  if ((size_t)(number_of_rows * number_of_columns_) != byte_stream_.size())
+  if (!row_buffer_.empty())
   {
     throw runtime_error("Unmatched row and column numbers");
   }
-
-  if (predictor_ == 12)
-  {
-    for (auto element = byte_stream_.begin() + number_of_columns_;
-              element != byte_stream_.end(); ++element)
-    {
-      *element += *(element - number_of_columns_);
-    }
-  }
-  ToColumns_(number_of_columns_, number_of_rows);
-  ExpandBytes_();
-  MergeColumns_();
-  NumberRows_();
 }
 
-
 /*---------------------------------------------------------------------------*/
-// Changes the byte stream into a group of columns
+// Reads as many complete rows as there are into the table, keeping any
+// incomplete row at the end until the next chunk arrives. Each field is a
+// big-endian number. A field of zero width takes its default value, which is
+// 1 for the type field (an object in use) and 0 for the others.
 
-void XRefStream::ToColumns_(int n_cols, int n_rows)
+void XRefStream::ReadRows_(const char* chunk, size_t length)
 {
-  for (int i = 0; i < n_cols; ++i)
-  {
-    // Create a new column vector
-    vector<int> temp_column{};
-    temp_column.reserve(n_rows);
-    for(int j = 0; j < n_rows; ++j)
-    {
-      temp_column.push_back((int) (uint8_t) byte_stream_[i + j * n_cols]);
-    }
-
-    // the new column is pushed to the final array unless it is the first
-    // column (which is skipped when the predictor is > 9)
-    if (predictor_ < 10 || i > 0) final_array_.push_back(move(temp_column));
-  }
-}
+  row_buffer_.insert(row_buffer_.end(), chunk, chunk + length);
 
-/*---------------------------------------------------------------------------*/
-// Multiplies the entries in the matrix according to the width in bytes of the
-// numbers represented according to the /W entry
+  const uint8_t* row = row_buffer_.data();
+  const uint8_t* end = row + row_buffer_.size();
 
-void XRefStream::ExpandBytes_()
-{
-  // Calculate the byte shift for each column (with 1:1 correspondence);
-  int column_number = 0;
-  for (auto width : array_widths_)
+  for (; row + row_width_ <= end; row += row_width_)
   {
-    while (width)
+    const uint8_t* byte = row;
+    for (int field = 0; field < 3; ++field)
     {
-      int byte_shift = 8 * (width-- - 1);
-      for (auto& element : final_array_.at(column_number))
+      int64_t value = 0;
+      for (int i = 0; i < array_widths_[field]; ++i)
       {
-        element <<= byte_shift;
+        value = (value << 8) | *byte++;
       }
-      ++column_number;
+      if (array_widths_[field] == 0 && field == 0) value = 1;
+      result_[field].push_back(value);
     }
   }
-}
-
-/*---------------------------------------------------------------------------*/
-// Now the matrix has the correct values but the columns representing higher
-// bytes need to be added to those with lower bytes
 
-void XRefStream::MergeColumns_()
-{
-  // For each of the final columns
-  for (size_t column_number = 0, cumsum = 0;
-       column_number < array_widths_.size();
-       ++column_number)
-  {
-    // Take a zero-filled column the size of those in the unmerged array
-    vector<int> new_column(final_array_[0].size(), 0);
-
-    // For each width value
-    for (int width_it = 0; width_it < array_widths_[column_number]; ++width_it)
-    {
-      // Add the column to be merged to the new column
-      transform(new_column.begin(), new_column.end(),
-                final_array_[cumsum + width_it].begin(),
-                new_column.begin(), plus<int>());
-    }
-
-    // This is a final column - push it to result
-    result_.emplace_back(move(new_column));
-
-    // move to the next column in the final result
-    cumsum += array_widths_[column_number];
-  }
+  row_buffer_.erase(row_buffer_.begin(), row_buffer_.begin() +
+                                         (row - row_buffer_.data()));
 }
 
 /*---------------------------------------------------------------------------*/
@@ -488,12 +1014,6 @@ void XRefStream::MergeColumns_()
 
 void XRefStream::NumberRows_()
 {
-  // If there are only two columns append a zero filled column of the same size
-  if (result_.size() == 2)
-  {
-    result_.emplace_back(vector<int>(result_[0].size(), 0));
-  }
-
   // if no index entries, assume start at object 0
   if (object_numbers_.empty())
   {
@@ -503,5 +1023,5 @@ void XRefStream::NumberRows_()
   }
 
   // Append to our result
-  result_.push_back(object_numbers_);
+  result_.emplace_back(object_numbers_.begin(), object_numbers_.end());
 }
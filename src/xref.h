@@ -53,26 +53,61 @@
  * warrant their own class. However, since this class only has to perform a part
  * of XRef implementation, it has no public interface and is therefore not
  * defined in this header file, but rather within xref.cpp
+ *
+ * Files from some scanners and mail gateways are damaged: the startxref
+ * offset may be missing or the XRef offsets may not point at their objects.
+ * If the XRef can't be read, or an object isn't where it says, the table is
+ * rebuilt by scanning the whole file for "n g obj" headers, trailer
+ * dictionaries and object streams. Objects whose original entries were
+ * correct keep them, and the others are marked as recovered.
+ *
+ * A linearized ("fast web view") file is laid out so that its first page can
+ * be shown before the rest of it has arrived. Its first object is a
+ * linearization dictionary giving the file's length, the number of pages and
+ * the object number of the first page. This is followed by a short XRef
+ * section listing the catalog and the objects used by the first page, with
+ * the main XRef for everything else at the end of the file as usual. An XRef
+ * can be made from this first section alone, which lets the first page be
+ * read without reading the main XRef or going near the rest of the file. If
+ * the file has been changed since it was linearized, its length no longer
+ * matches, so the first section can't be trusted and isn't used.
+ *
+ * Once built, the table, trailer and list of recovered objects can be saved
+ * to a sidecar file and read back the next time the same file is opened,
+ * which skips finding, decoding and checking the XRefs altogether.
 */
 #include<string>
 #include<vector>
 #include<memory>
 #include<unordered_map>
+#include<cstdint>
+#include<mutex>
 
 class Dictionary;
 class Crypto;
 class CharString;
+class ByteSource;
+class SidecarReader;
+class SidecarWriter;
 
 /*---------------------------------------------------------------------------*/
-// The main XRef data member is an unordered map with the key being the object
-// number and the value being a struct of named ints as defined here
+// The main XRef data member is a vector indexed by object number, each entry
+// being a struct of named ints as defined here. Object numbers are mostly
+// given out in sequence from 1, so the vector has few gaps; entries for
+// object numbers that are not in the table have a startbyte of -1. Offsets
+// are 64-bit so that files larger than 2GB can be read.
+//
+// Sorting the objects by their start offsets when the XRef is built gives the
+// next object's start as a limit for the search for each "endobj", so no
+// search runs past its own object. The search itself is left until an
+// object's end is asked for, so that building the XRef reads only the XRef.
 
 struct XRefRow
 {
-  int startbyte,  // Its byte offset
-      stopbyte,   // The offset of the corresponding endobj marker
-      in_object;  // If this is a stream object, in which other object is it
-};                // located? Has value of 0 if the object is not in a stream
+  int64_t startbyte,  // Its byte offset
+          limit;      // Where the next object starts, or -1 if none does
+  int in_object;      // If this is a stream object, in which other object is
+};                    // it located? Has value of 0 if not in a stream
 
 /*---------------------------------------------------------------------------*/
 // The main XRef class definition. Since this is the main "skeleton" of the pdf
@@ -85,22 +120,33 @@ struct XRefRow
 class XRef
 {
  public:
-  XRef(std::shared_ptr<const std::string>);
+  XRef(std::shared_ptr<const ByteSource>);
 
   // Empty XRef constructor
-  XRef(){};
+  XRef() : is_repaired_(false), is_first_page_only_(false) {};
+
+  // Reads only the first-page XRef section of a linearized file. Returns
+  // nullptr if the file isn't linearized or the section can't be used.
+  static std::shared_ptr<const XRef>
+    FromFirstPage(std::shared_ptr<const ByteSource>);
+
+  // Reads back a table written to a sidecar (see sidecar.h) by Save
+  XRef(std::shared_ptr<const ByteSource>, SidecarReader&);
+  void Save(SidecarWriter&) const;
 
   // public methods
   Dictionary GetTrailer()                    const; // Gets trailer dictionary
   size_t GetObjectEndByte(int)               const; // Gets object end position
   std::vector<int> GetAllObjectNumbers()     const; // Gets all object numbers
-  CharString GetStreamLocation(int) const; // Gets start/stop of stream
-  std::string Decrypt(std::string&, int, int) const; // Decrypts a stream
+  std::vector<int> GetObjectStreamNumbers()  const; // Gets holding objects
+  CharString GetStreamLocation(size_t) const; // Gets start/stop of stream
+  void Decrypt(std::string&, int, int) const; // Decrypts a stream in place
+  void DecryptString(std::string&, int, int) const; // Decrypts a string
   std::string Decrypt(const CharString&, int, int) const;
+  size_t Decrypt(const CharString&, uint8_t*, int, int) const; // Into buffer
+  bool EncryptsMetadata() const; // False if /EncryptMetadata is false
 
-  std::shared_ptr<const std::string> File() const { return file_string_;}
-
-  CharString GetCharString() const { return CharString(*file_string_);}
+  std::shared_ptr<const ByteSource> File() const { return file_;}
 
   bool IsEncrypted() const { if(encryption_) return true; else return false; }
 
@@ -110,20 +156,45 @@ class XRef
   size_t GetHoldingNumberOf(int object_number) const
    { return GetRow_(object_number).in_object; }
 
+  bool IsRepaired() const { return is_repaired_; } // Was the table rebuilt?
+  bool IsRecovered(int) const;  // Was the object found by rebuilding?
+
+  bool ContainsObject(int object_number) const
+    { return HasRow_(object_number); }
+
+  // Only set for an XRef made from a linearized file's first-page section
+  bool IsFirstPageOnly() const { return is_first_page_only_; }
+  Dictionary GetLinearization() const { return linearization_; }
+
  private:
-  std::shared_ptr<const std::string> file_string_;  // Pointer to file string
-  std::unordered_map<int, XRefRow> xref_table_;     // Main data member
+  std::shared_ptr<const ByteSource> file_;          // The file's contents
+  std::vector<XRefRow> xref_table_;                 // Main data member
   Dictionary trailer_dictionary_;  // Main trailer dictionary
   std::shared_ptr<Crypto> encryption_;              // Used for encrypted files
+  mutable std::unordered_map<int, size_t> stream_lengths_; // Indirect /Lengths
+  mutable std::mutex stream_lengths_mutex_;         // Guards stream_lengths_
+  bool is_repaired_;                      // Set if the table was rebuilt
+  std::vector<int> recovered_objects_;    // Objects found by rebuilding
+  std::vector<int> object_streams_;       // Object streams found by rebuilding
+  bool is_first_page_only_;               // Made from first-page section?
+  Dictionary linearization_;              // Linearization dictionary, if so
 
   // private methods
   XRef& operator=(const XRef&);
-  int GetStreamLength_(const Dictionary&) const;
+  size_t GetStreamLength_(const Dictionary&) const;
   void LocateXRefs_();                    // Finds XRef locations
-  void ReadXRefStrings_(int);             // Gets strings from XRef locations
-  void ReadXRefFromStream_(int);          // Uses xrefstream class to get XRef
+  Dictionary ReadTrailer_(size_t) const;  // Reads dictionary after an XRef
+  void ReadXRefStrings_(size_t);          // Gets strings from XRef locations
+  void ReadXRefFromStream_(size_t);       // Uses xrefstream class to get XRef
   void ReadXRefFromString_(const CharString&); // parses XRef directly
   void CreateCrypto_();                   // Allows decryption of encrypted docs
+  void StoreRow_(int, const XRefRow&);    // Adds a row to the table
+  void FindObjectLimits_();               // Fills in limit for each row
+  bool IsValidTable_() const;             // Do objects start where listed?
+  void Repair_();                         // Rebuilds the table from the file
+  void FindRepairTrailer_(const std::vector<std::pair<size_t, int>>&);
+  void ReadObjectStreams_();              // Adds objects in object streams
+  bool HasRow_(int) const;                // Is the object in the table?
   const XRefRow& GetRow_(int) const;
 };
 